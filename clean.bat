@@ -117,4 +117,9 @@ del ""%samples%\FallingBlocks\FallingBlocks\CompileRan"
 
 rd "%samples%\HelloWorldDisplay\HelloWorldDisplay\Device-Debug" /s /q
 rd "%samples%\HelloWorldDisplay\HelloWorldDisplay\Simulator-Debug" /s /q
-del ""%samples%\HelloWorldDisplay\HelloWorldDisplay\CompileRan"
\ No newline at end of file
+del ""%samples%\HelloWorldDisplay\HelloWorldDisplay\CompileRan"
+
+
+rd "%samples%\TextBenchmark\TextBenchmark\Device-Debug" /s /q
+rd "%samples%\TextBenchmark\TextBenchmark\Simulator-Debug" /s /q
+del "%samples%\TextBenchmark\TextBenchmark\CompileRan"
\ No newline at end of file
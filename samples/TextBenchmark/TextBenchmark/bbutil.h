@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2011-2013 BlackBerry Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BBUTIL_H__
+#define __BBUTIL_H__
+
+#include <EGL/egl.h>
+#include <screen/screen.h>
+#include <sys/platform.h>
+
+extern EGLDisplay egl_disp;
+extern EGLSurface egl_surf;
+
+typedef struct font_t font_t;
+typedef struct text_layout_t text_layout_t;
+
+#define BBUTIL_DEFAULT_FONT "/usr/fonts/font_repository/monotype/arial.ttf"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * Initializes EGL
+ *
+ * @param libscreen context that will be used for EGL setup
+ * @return EXIT_SUCCESS if initialization succeeded otherwise EXIT_FAILURE
+ */
+int bbutil_init_egl(screen_context_t ctx);
+
+/**
+ * Terminates EGL
+ */
+void bbutil_terminate();
+
+/**
+ * Swaps default bbutil window surface to the screen
+ */
+void bbutil_swap();
+
+/**
+ * Loads the font from the specified font file.
+ * Only printable ASCII characters are rasterized upfront, all the other glyphs are rasterized
+ * into the font texture on their first use. When it's full, least recently used glyphs are evicted.
+ * NOTE: should be called after a successful return from bbutil_init() or bbutil_init_egl() call
+ * @param font_file string indicating the absolute path of the font file
+ * @param point_size used for glyph generation
+ * @param dpi used for glyph generation
+ * @return pointer to font_t structure on success or NULL on failure
+ */
+font_t* bbutil_load_font(const char* font_file, int point_size, int dpi);
+
+/**
+ * Loads the font from the specified font file, which glyphs are stored as signed distance fields.
+ * Text of such font stays sharp at any scale, so single font can serve text of all sizes.
+ * With OpenGL ES 1.1 it's drawn using alpha test, so its edges are not anti-aliased.
+ * NOTE: should be called after a successful return from bbutil_init() or bbutil_init_egl() call
+ * @param font_file string indicating the absolute path of the font file
+ * @param point_size of the text drawn at scale 1.0f
+ * @param dpi used for glyph generation
+ * @return pointer to font_t structure on success or NULL on failure
+ */
+font_t* bbutil_load_sdf_font(const char* font_file, int point_size, int dpi);
+
+/**
+ * Enables the font cache. Glyphs and atlas of each loaded font are stored into a file inside the directory,
+ * so next time the font is loaded from the file, without opening FreeType and rasterizing the glyphs.
+ * Cache files are ignored, when the font file, the point size or dpi changes. Glyphs first used later
+ * are added to the file by bbutil_destroy_font().
+ * NOTE: should be called before loading the fonts
+ * @param directory writable directory for the cache files (i.e. "data" inside the application sandbox) or NULL to disable the cache
+ * @return EXIT_SUCCESS if the directory was set, otherwise EXIT_FAILURE
+ */
+int bbutil_set_font_cache(const char* directory);
+
+/**
+ * Destroys the passed font
+ * @param font to be destroyed
+ */
+void bbutil_destroy_font(font_t* font);
+
+/**
+ * Renders the specified message using current font starting from the specified
+ * bottom left coordinates.
+ * NOTE: must be called after a successful return from bbutil_init() or bbutil_init_egl() call
+
+ *
+ * @param font to use for rendering
+ * @param msg the UTF-8 encoded message to display
+ * @param x, y position of the bottom-left corner of text string in world coordinate space
+ * @param rgba color for the text to render with
+ */
+void bbutil_render_text(font_t* font, const char* msg, float x, float y, float r, float g, float b, float a);
+
+/**
+ * Renders the message scaled, i.e. using font loaded by bbutil_load_sdf_font() at any size.
+ * Parameters are the same as of bbutil_render_text().
+ *
+ * @param scale of the text, 1.0f renders it at the size of the font
+ */
+void bbutil_render_text_scaled(font_t* font, const char* msg, float x, float y, float scale, float r, float g, float b, float a);
+
+/**
+ * Starts collecting text, that is drawn at once by bbutil_text_batch_end().
+ * Use it instead of many bbutil_render_text() calls per frame, i.e. for HUD labels.
+ * NOTE: must be called after a successful return from bbutil_init() or bbutil_init_egl() call
+ */
+void bbutil_text_batch_begin();
+
+/**
+ * Adds the message to the text batch. Parameters are the same as of bbutil_render_text(),
+ * each message can have its own color and font.
+ *
+ * @param font to use for rendering
+ * @param msg the message to display
+ * @param x, y position of the bottom-left corner of text string in world coordinate space
+ * @param rgba color for the text to render with
+ */
+void bbutil_text_batch_add(font_t* font, const char* msg, float x, float y, float r, float g, float b, float a);
+
+/**
+ * Adds the scaled message to the text batch. Parameters are the same as of bbutil_text_batch_add().
+ *
+ * @param scale of the text, 1.0f renders it at the size of the font
+ */
+void bbutil_text_batch_add_scaled(font_t* font, const char* msg, float x, float y, float scale, float r, float g, float b, float a);
+
+/**
+ * Draws all the text added since bbutil_text_batch_begin() with single draw call per font texture.
+ * Text of different fonts is drawn font by font, not in the order it was added.
+ */
+void bbutil_text_batch_end();
+
+/**
+ * Lays the message out once into a vertex buffer, so it can be drawn every frame
+ * by bbutil_render_text_layout() without any work on CPU. Use it for text, that rarely changes.
+ * NOTE: must be called after a successful return from bbutil_init() or bbutil_init_egl() call
+ *
+ * @param font to use for rendering, it must not be destroyed before the layout
+ * @param msg the message to display
+ * @return pointer to the text layout on success, NULL on error
+ */
+text_layout_t* bbutil_create_text_layout(font_t* font, const char* msg);
+
+/**
+ * Lays the new message out into the existing text layout, when its text or font has changed.
+ *
+ * @param layout to update
+ * @param font to use for rendering
+ * @param msg the message to display
+ * @return EXIT_SUCCESS if the layout was updated, EXIT_FAILURE otherwise
+ */
+int bbutil_update_text_layout(text_layout_t* layout, font_t* font, const char* msg);
+
+/**
+ * Renders the text layout.
+ *
+ * @param layout to render
+ * @param x, y position of the bottom-left corner of text string in world coordinate space
+ * @param scale of the text, 1.0f renders it at the size of the font
+ * @param rgba color for the text to render with
+ */
+void bbutil_render_text_layout(text_layout_t* layout, float x, float y, float scale, float r, float g, float b, float a);
+
+/**
+ * Destroys the passed text layout
+ * @param layout to be destroyed
+ */
+void bbutil_destroy_text_layout(text_layout_t* layout);
+
+/**
+ * Returns the non-scaled width and height of a string, multiply them by the scale of the scaled text
+ * NOTE: must be called after a successful return from bbutil_init() or bbutil_init_egl() call
+
+ *
+ * @param font to use for measurement of a string size
+ * @param msg the UTF-8 encoded message to get the size of
+ * @param return pointer for width of a string
+ * @param return pointer for height of a string
+ */
+void bbutil_measure_text(font_t* font, const  char* msg, float* width, float* height);
+
+/**
+ * Creates and loads a texture from a png file
+ * NOTE: must be called after a successful return from bbutil_init() or bbutil_init_egl() call
+
+ *
+ * @param filename path to texture png
+ * @param return width of texture
+ * @param return height of texture
+ * @param return gl texture handle
+ * @return EXIT_SUCCESS if texture loading succeeded otherwise EXIT_FAILURE
+ */
+
+int bbutil_load_texture(const char* filename, int* width, int* height, float* tex_x, float* tex_y, unsigned int* tex);
+
+/**
+ * Returns dpi for a given screen
+
+ *
+ * @param ctx path libscreen context that corresponds to display of interest
+ * @return dpi for a given screen
+ */
+
+int bbutil_calculate_dpi(screen_context_t ctx);
+
+/**
+ * Rotates the screen to a given angle
+
+ *
+ * @param angle to rotate screen surface to, must by 0, 90, 180, or 270
+ * @return EXIT_SUCCESS if texture loading succeeded otherwise EXIT_FAILURE
+ */
+
+int bbutil_rotate_screen_surface(int angle);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __BBUTIL_H__ */
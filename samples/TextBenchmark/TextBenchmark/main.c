@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2011-2013 BlackBerry Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bbutil.h"
+
+#include <bps/navigator.h>
+#include <bps/screen.h>
+#include <bps/bps.h>
+#include <bps/event.h>
+
+#include <screen/screen.h>
+
+#include <EGL/egl.h>
+#include <GLES/gl.h>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Number of HUD labels drawn each frame
+#define LABEL_COUNT 50
+
+//Number of frames measured, before switching to the other text rendering mode
+#define FRAMES_PER_MODE 120
+
+//Scale of the title, drawn by the same distance field font as the small text
+#define TITLE_SCALE 4.0f
+
+enum {
+    MODE_PER_CALL = 0,
+    MODE_BATCHED,
+    MODE_LAYOUTS,
+    MODE_COUNT
+};
+
+static const char* mode_names[MODE_COUNT] = { "per-call", "batched", "layouts" };
+
+//Localized names of the labels, their glyphs are rasterized by bbutil on first use
+#define LABEL_NAME_COUNT 5
+static const char* label_names[LABEL_NAME_COUNT] = { "Label", "\xC3\x89tiquette", "Etikett", "\xD0\x9C\xD0\xB5\xD1\x82\xD0\xBA\xD0\xB0", "\xCE\x95\xCF\x84\xCE\xB9\xCE\xBA\xCE\xAD\xCF\x84\xCE\xB1" };
+
+typedef struct {
+    char text[32];
+    float x, y;
+    float r, g, b;
+    text_layout_t* layout;
+} label_t;
+
+static float width, height;
+static screen_context_t screen_cxt;
+static font_t* font;
+static font_t* sdf_font;
+static float title_height;
+static label_t labels[LABEL_COUNT];
+
+static int mode = MODE_PER_CALL;
+static int mode_frames = 0;
+static double mode_time = 0.0;
+static double average_time[MODE_COUNT];
+static char summary[160] = "measuring...";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int init() {
+    EGLint surface_width, surface_height;
+    float text_width = 0.0f, text_height = 0.0f;
+    float label_width, label_height, title_width;
+    double load_start;
+    int i, columns, rows;
+
+    //Query width and height of the window surface created by utility code
+    eglQuerySurface(egl_disp, egl_surf, EGL_WIDTH, &surface_width);
+    eglQuerySurface(egl_disp, egl_surf, EGL_HEIGHT, &surface_height);
+
+    EGLint err = eglGetError();
+    if (err != 0x3000) {
+        fprintf(stderr, "Unable to query EGL surface dimensions\n");
+        return EXIT_FAILURE;
+    }
+
+    width = (float) surface_width;
+    height = (float) surface_height;
+
+    int dpi = bbutil_calculate_dpi(screen_cxt);
+
+    //Keep the rasterized fonts in the application data, so next start doesn't need to rasterize them again
+    bbutil_set_font_cache("data");
+    load_start = now();
+
+    font = bbutil_load_font(BBUTIL_DEFAULT_FONT, 6, dpi);
+
+    if (!font) {
+        return EXIT_FAILURE;
+    }
+
+    //Distance field font is rasterized once and stays sharp at any scale
+    sdf_font = bbutil_load_sdf_font(BBUTIL_DEFAULT_FONT, 6, dpi);
+
+    if (!sdf_font) {
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "Fonts loaded in %.3f ms\n", now() - load_start);
+
+    bbutil_measure_text(sdf_font, "TextBenchmark", &title_width, &title_height);
+    title_height *= TITLE_SCALE;
+
+    //Initialize GL for 2D rendering
+    glViewport(0, 0, (int) width, (int) height);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+
+    glOrthof(0.0f, width / height, 0.0f, 1.0f, -1.0f, 1.0f);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    //Set world coordinates to coincide with screen pixels
+    glScalef(1.0f / height, 1.0f / height, 1.0f);
+
+    //Lay the labels out in a grid, each with its own color, like a busy HUD
+    for (i = 0; i < LABEL_NAME_COUNT; ++i) {
+        snprintf(labels[0].text, sizeof(labels[0].text), "%s 00: 0000", label_names[i]);
+        bbutil_measure_text(font, labels[0].text, &label_width, &label_height);
+
+        if (label_width > text_width) {
+            text_width = label_width;
+        }
+        if (label_height > text_height) {
+            text_height = label_height;
+        }
+    }
+
+    columns = (int) (width / (text_width * 1.2f));
+    if (columns < 1) {
+        columns = 1;
+    }
+    rows = (LABEL_COUNT + columns - 1) / columns;
+
+    for (i = 0; i < LABEL_COUNT; ++i) {
+        labels[i].x = (i % columns) * text_width * 1.2f + 10.0f;
+        labels[i].y = height - title_height - (i / columns + 1) * (height - title_height - 4.0f * text_height) / (rows + 1);
+        labels[i].r = 0.3f + 0.7f * ((i * 37) % 100) / 100.0f;
+        labels[i].g = 0.3f + 0.7f * ((i * 59) % 100) / 100.0f;
+        labels[i].b = 0.3f + 0.7f * ((i * 83) % 100) / 100.0f;
+
+        //Text of the labels never changes, so it is laid out only once for the layouts mode
+        snprintf(labels[i].text, sizeof(labels[i].text), "%s %02d: %04d", label_names[i % LABEL_NAME_COUNT], i, (i * 7919) % 10000);
+        labels[i].layout = bbutil_create_text_layout(font, labels[i].text);
+
+        if (!labels[i].layout) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void cleanup() {
+    int i;
+
+    for (i = 0; i < LABEL_COUNT; ++i) {
+        bbutil_destroy_text_layout(labels[i].layout);
+        labels[i].layout = NULL;
+    }
+}
+
+void render() {
+    int i;
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (mode == MODE_BATCHED) {
+        bbutil_text_batch_begin();
+        for (i = 0; i < LABEL_COUNT; ++i) {
+            bbutil_text_batch_add(font, labels[i].text, labels[i].x, labels[i].y, labels[i].r, labels[i].g, labels[i].b, 1.0f);
+        }
+        bbutil_text_batch_add(font, summary, 10.0f, 10.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_text_batch_add_scaled(sdf_font, "TextBenchmark", 10.0f, height - title_height - 10.0f, TITLE_SCALE, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_text_batch_add(sdf_font, mode_names[mode], 10.0f, height - title_height - 30.0f, 1.0f, 1.0f, 0.0f, 1.0f);
+        bbutil_text_batch_end();
+    } else if (mode == MODE_LAYOUTS) {
+        for (i = 0; i < LABEL_COUNT; ++i) {
+            bbutil_render_text_layout(labels[i].layout, labels[i].x, labels[i].y, 1.0f, labels[i].r, labels[i].g, labels[i].b, 1.0f);
+        }
+        bbutil_render_text(font, summary, 10.0f, 10.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_render_text_scaled(sdf_font, "TextBenchmark", 10.0f, height - title_height - 10.0f, TITLE_SCALE, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_render_text(sdf_font, mode_names[mode], 10.0f, height - title_height - 30.0f, 1.0f, 1.0f, 0.0f, 1.0f);
+    } else {
+        for (i = 0; i < LABEL_COUNT; ++i) {
+            bbutil_render_text(font, labels[i].text, labels[i].x, labels[i].y, labels[i].r, labels[i].g, labels[i].b, 1.0f);
+        }
+        bbutil_render_text(font, summary, 10.0f, 10.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_render_text_scaled(sdf_font, "TextBenchmark", 10.0f, height - title_height - 10.0f, TITLE_SCALE, 1.0f, 1.0f, 1.0f, 1.0f);
+        bbutil_render_text(sdf_font, mode_names[mode], 10.0f, height - title_height - 30.0f, 1.0f, 1.0f, 0.0f, 1.0f);
+    }
+}
+
+void measure(double elapsed) {
+    mode_time += elapsed;
+
+    if (++mode_frames < FRAMES_PER_MODE) {
+        return;
+    }
+
+    //Switch the mode and publish the results, once both of them were measured
+    average_time[mode] = mode_time / mode_frames;
+    mode_time = 0.0;
+    mode_frames = 0;
+    mode = (mode + 1) % MODE_COUNT;
+
+    if (mode == MODE_PER_CALL) {
+        snprintf(summary, sizeof(summary), "%s: %.3f ms/frame, %s: %.3f ms/frame, %s: %.3f ms/frame",
+                mode_names[MODE_PER_CALL], average_time[MODE_PER_CALL],
+                mode_names[MODE_BATCHED], average_time[MODE_BATCHED],
+                mode_names[MODE_LAYOUTS], average_time[MODE_LAYOUTS]);
+        fprintf(stderr, "%s\n", summary);
+    }
+}
+
+int main(int argc, char **argv) {
+    //Create a screen context that will be used to create an EGL surface to to receive libscreen events
+    screen_create_context(&screen_cxt, 0);
+
+    //Initialize BPS library
+    bps_initialize();
+
+    //Use utility code to initialize EGL for rendering with GL ES 1.1
+    if (EXIT_SUCCESS != bbutil_init_egl(screen_cxt)) {
+        fprintf(stderr, "Unable to initialize EGL\n");
+        screen_destroy_context(screen_cxt);
+        return 0;
+    }
+
+    //Initialize app data
+    if (EXIT_SUCCESS != init()) {
+        fprintf(stderr, "Unable to initialize app logic\n");
+        cleanup();
+        bbutil_terminate();
+        screen_destroy_context(screen_cxt);
+        return 0;
+    }
+
+    //Signal BPS library that navigator and screen events will be requested
+    if (BPS_SUCCESS != screen_request_events(screen_cxt)) {
+        fprintf(stderr, "screen_request_events failed\n");
+        bbutil_terminate();
+        screen_destroy_context(screen_cxt);
+        return 0;
+    }
+
+    if (BPS_SUCCESS != navigator_request_events(0)) {
+        fprintf(stderr, "navigator_request_events failed\n");
+        bbutil_terminate();
+        screen_destroy_context(screen_cxt);
+        return 0;
+    }
+
+    for (;;) {
+        //Request and process BPS next available event
+        bps_event_t *event = NULL;
+        if (BPS_SUCCESS != bps_get_event(&event, 0)) {
+            fprintf(stderr, "bps_get_event failed\n");
+            break;
+        }
+
+        if ((event) && (bps_event_get_domain(event) == navigator_get_domain())
+                && (NAVIGATOR_EXIT == bps_event_get_code(event))) {
+            break;
+        }
+
+        //Measure only the text rendering, waiting for GPU to finish it, as swapping is limited by vsync
+        double start = now();
+        render();
+        glFinish();
+        measure(now() - start);
+
+        //Use utility code to update the screen
+        bbutil_swap();
+    }
+
+    //Stop requesting events from libscreen
+    screen_stop_events(screen_cxt);
+
+    //Shut down BPS library for this process
+    bps_shutdown();
+
+    //Destroy the text layouts and the fonts
+    cleanup();
+    bbutil_destroy_font(font);
+    bbutil_destroy_font(sdf_font);
+
+    //Use utility code to terminate EGL setup
+    bbutil_terminate();
+
+    //Destroy libscreen context
+    screen_destroy_context(screen_cxt);
+    return 0;
+}
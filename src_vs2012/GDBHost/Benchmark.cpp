@@ -0,0 +1,1109 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// Benchmark.cpp : micro-benchmarks of the host components, runnable without GDB.
+//
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "CoreIndex.h"
+#include "CoreServer.h"
+#include "FakeGdb.h"
+#include "GDBWrapper.h"
+#include "HostLoop.h"
+#include "LaunchProfile.h"
+#include "LatencyHistogram.h"
+#include "MiParser.h"
+#include "RspProxy.h"
+#include "ShmTransport.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <pthread.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+
+/// <summary>
+/// Loads whole file into memory.
+/// </summary>
+static BOOL LoadFile(LPCTSTR lpszPath, std::string& content)
+{
+    FILE* file = _tfopen(lpszPath, _T("rb"));
+    if (file == NULL)
+        return FALSE;
+
+    char buffer[64 * 1024];
+    size_t count;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        content.append(buffer, count);
+    }
+
+    fclose(file);
+    return TRUE;
+}
+
+/// <summary>
+/// Observer counting records of each type and optionally building frames out of them.
+/// </summary>
+class BenchmarkObserver : public MiRecordObserver
+{
+public:
+    unsigned long long counts[MiRecordLogStream + 1];
+    std::string frames;
+    BOOL buildFrames;
+
+    BenchmarkObserver(BOOL frames)
+        : buildFrames(frames)
+    {
+        memset(counts, 0, sizeof(counts));
+    }
+
+    virtual void OnRecord(const MiRecord& record)
+    {
+        counts[record.type]++;
+        if (buildFrames)
+        {
+            MiParser::AppendFrame(frames, record);
+        }
+    }
+};
+
+/// <summary>
+/// Streams the transcript through the parser in pipe-sized chunks, the same way the relay does.
+/// Returns the time spent in microseconds.
+/// </summary>
+static unsigned long long StreamTranscript(const std::string& transcript, int iterations, BenchmarkObserver& observer)
+{
+    std::string pending;
+    unsigned long long start = HostGetTimestamp();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (size_t offset = 0; offset < transcript.size(); offset += LOOP_READ_BUFFER_SIZE)
+        {
+            size_t length = transcript.size() - offset;
+            if (length > LOOP_READ_BUFFER_SIZE)
+                length = LOOP_READ_BUFFER_SIZE;
+
+            pending.append(transcript.data() + offset, length);
+            size_t consumed = MiParser::Parse(pending.data(), pending.size(), &observer);
+            pending.erase(0, consumed);
+            observer.frames.clear();
+        }
+    }
+
+    return HostGetTimestamp() - start;
+}
+
+int RunParserBenchmark(LPCTSTR lpszTranscriptPath, int iterations)
+{
+    std::string transcript;
+
+    if (!LoadFile(lpszTranscriptPath, transcript) || transcript.empty())
+    {
+        PrintMessage(_T("Error: Unable to load MI transcript (%s)\r\n"), lpszTranscriptPath);
+        return 1;
+    }
+
+    if (iterations <= 0)
+        iterations = 1;
+
+    BenchmarkObserver tokenizer(FALSE);
+    BenchmarkObserver framer(TRUE);
+
+    // warm-up, so the first measurement doesn't include page faults:
+    StreamTranscript(transcript, 1, tokenizer);
+    memset(tokenizer.counts, 0, sizeof(tokenizer.counts));
+
+    unsigned long long tokenizeTime = StreamTranscript(transcript, iterations, tokenizer);
+    unsigned long long frameTime = StreamTranscript(transcript, iterations, framer);
+
+    double megabytes = (double) transcript.size() * iterations / (1024.0 * 1024.0);
+    unsigned long long records = 0;
+    for (int i = 0; i <= MiRecordLogStream; i++)
+    {
+        records += tokenizer.counts[i];
+    }
+
+    PrintMessage(_T("MI parser benchmark: %s\r\n"), lpszTranscriptPath);
+    PrintMessage(_T("  transcript: %u bytes, %d iterations, %llu records\r\n"), (unsigned int) transcript.size(), iterations, records);
+    PrintMessage(_T("  records: result %llu, exec %llu, status %llu, notify %llu, console %llu, target %llu, log %llu, prompt %llu, other %llu\r\n"),
+                 tokenizer.counts[MiRecordResult], tokenizer.counts[MiRecordExecAsync], tokenizer.counts[MiRecordStatusAsync],
+                 tokenizer.counts[MiRecordNotify], tokenizer.counts[MiRecordConsoleStream], tokenizer.counts[MiRecordTargetStream],
+                 tokenizer.counts[MiRecordLogStream], tokenizer.counts[MiRecordPrompt], tokenizer.counts[MiRecordUnknown]);
+    PrintMessage(_T("  tokenize:         %.1f MB/s (%.1f M records/s)\r\n"),
+                 megabytes * 1000000.0 / (tokenizeTime ? tokenizeTime : 1), records / (double) (tokenizeTime ? tokenizeTime : 1));
+    PrintMessage(_T("  tokenize + frame: %.1f MB/s\r\n"), megabytes * 1000000.0 / (frameTime ? frameTime : 1));
+    return 0;
+}
+
+/// <summary>
+/// Logs given number of records in bursts, that fit into the ring buffer, so the writer thread has time
+/// to drain it in between and dropping doesn't distort the results. Returns the time spent in microseconds.
+/// </summary>
+static unsigned long long LogRecords(int count)
+{
+    unsigned long long total = 0;
+    int burst = LOG_RING_CAPACITY / 2;
+
+    for (int i = 0; i < count; i += burst)
+    {
+        int length = count - i < burst ? count - i : burst;
+        unsigned long long start = HostGetTimestamp();
+
+        for (int j = 0; j < length; j++)
+        {
+            LogPrint(_T("HostLoop: benchmark record of average length, like the ones of the wait loop"));
+        }
+
+        total += HostGetTimestamp() - start;
+
+        if (LogIsEnabled())
+        {
+#ifdef _WIN32
+            Sleep(LOG_FLUSH_INTERVAL * 2);
+#else
+            usleep(LOG_FLUSH_INTERVAL * 2000);
+#endif
+        }
+    }
+
+    return total;
+}
+
+int RunLogBenchmark(int count)
+{
+    if (count <= 0)
+        count = 1;
+
+    BOOL wasEnabled = LogIsEnabled();
+    unsigned long long disabledTime = 0;
+
+    if (!wasEnabled)
+    {
+        disabledTime = LogRecords(count);
+        if (!LogEnable(LOG_DEFAULT_MAX_FILE_SIZE))
+        {
+            PrintMessage(_T("Error: Unable to enable logging\r\n"));
+            return 1;
+        }
+    }
+
+    unsigned long long enabledTime = LogRecords(count);
+
+    PrintMessage(_T("Logger benchmark: %d records\r\n"), count);
+    if (!wasEnabled)
+    {
+        PrintMessage(_T("  disabled: %.1f ns/record\r\n"), disabledTime * 1000.0 / count);
+    }
+    PrintMessage(_T("  enabled:  %.1f ns/record, %llu dropped\r\n"), enabledTime * 1000.0 / count, LogGetDroppedCount());
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// commands refreshing the IDE tool windows after each step:
+static const char* const SessionBenchmarkCommands[] =
+{
+    "-stack-list-frames",
+    "-stack-list-variables --all-values",
+    "-thread-info",
+    "-data-list-register-values x",
+    "-var-update --all-values *",
+};
+
+/// <summary>
+/// Gets the full path of the running executable, so it can start itself as the host and the fake GDB.
+/// </summary>
+static BOOL GetExecutablePath(LPTSTR lpszPath, DWORD size)
+{
+#ifdef _WIN32
+    DWORD length = GetModuleFileName(NULL, lpszPath, size);
+    return length > 0 && length < size;
+#else
+    ssize_t length = readlink("/proc/self/exe", lpszPath, size - 1);
+    if (length <= 0)
+        return FALSE;
+
+    lpszPath[length] = '\0';
+    return TRUE;
+#endif
+}
+
+/// <summary>
+/// Drives the host process as the IDE would: keeps given number of commands in flight and matches results by token.
+/// Commands and MI output go either through the console pipes of the host or through the shared memory transport.
+/// </summary>
+class SessionBenchmark : public HostReadHandler, public HostWaitHandler, public MiRecordObserver, public ShmTransportListener
+{
+private:
+    GDBWrapper* m_host;
+    HostLoop* m_loop;
+    ShmTransport* m_transport;      // NULL, when the console pipes are used
+    std::string m_pending;
+    std::vector<unsigned long long> m_sentTimes;   // indexed by token, 0 when not in flight
+
+public:
+    int count;
+    int sent;
+    int completed;
+    unsigned long long bytes;
+    unsigned long long peakMemory;
+    unsigned long long startTime;
+    unsigned long long finishTime;
+    unsigned long long streamRecords;
+    unsigned int streamCost;        // us spent on each target stream record, like the output window of the IDE does
+    LatencyHistogram roundTrip;
+
+    SessionBenchmark(int commands)
+        : m_host(NULL), m_loop(NULL), m_transport(NULL), m_sentTimes(commands + 1, 0), count(commands), sent(0), completed(0),
+          bytes(0), peakMemory(0), startTime(0), finishTime(0), streamRecords(0), streamCost(0)
+    {
+    }
+
+    void Attach(GDBWrapper* host, HostLoop* loop, ShmTransport* transport)
+    {
+        m_host = host;
+        m_loop = loop;
+        m_transport = transport;
+    }
+
+    void Write(const char* data, size_t length)
+    {
+        if (m_transport != NULL)
+        {
+            m_transport->Send(ShmMessageCommand, data, length);
+        }
+        else
+        {
+            m_host->WriteInput(data, length);
+        }
+    }
+
+    void ParseOutput(const char* data, size_t length)
+    {
+        bytes += length;
+        m_pending.append(data, length);
+        m_pending.erase(0, MiParser::Parse(m_pending.data(), m_pending.size(), this));
+    }
+
+    void SendNext()
+    {
+        if (sent >= count)
+            return;
+
+        char command[128];
+        int token = ++sent;
+
+        // step the target regularly, so the pipeline has to respect the barriers:
+        const char* text = token % 16 == 0 ? "-exec-next" : SessionBenchmarkCommands[token % _countof(SessionBenchmarkCommands)];
+        int length = sprintf_s(command, sizeof(command), "%d%s\n", token, text);
+
+        m_sentTimes[token] = HostGetTimestamp();
+        Write(command, length);
+    }
+
+    void SampleMemory()
+    {
+        unsigned long long memory = m_host->GetMemoryUsage();
+        if (memory > peakMemory)
+        {
+            peakMemory = memory;
+        }
+    }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length)
+    {
+        // with the shared memory transport the console carries only the host diagnostics:
+        if (m_transport == NULL)
+        {
+            ParseOutput(data, length);
+        }
+    }
+
+    virtual void OnClosed(HostPipe pipe)
+    {
+        m_loop->Stop();
+    }
+
+    // HostWaitHandler
+    virtual BOOL OnSignaled(HostWaitable waitable)
+    {
+        return m_host->IsRunning();
+    }
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record)
+    {
+        if (record.type == MiRecordTargetStream)
+        {
+            unsigned long long start = HostGetTimestamp();
+
+            streamRecords++;
+            while (HostGetTimestamp() - start < streamCost)
+            {
+            }
+            return;
+        }
+
+        if (record.type != MiRecordResult || record.token == MI_NO_TOKEN || record.token > (unsigned int) count || m_sentTimes[record.token] == 0)
+            return;
+
+        roundTrip.Record(HostGetTimestamp() - m_sentTimes[record.token]);
+        m_sentTimes[record.token] = 0;
+        completed++;
+
+        if (completed % 256 == 0)
+        {
+            SampleMemory();
+        }
+
+        if (completed == count)
+        {
+            finishTime = HostGetTimestamp();
+            SampleMemory();
+            Write("-gdb-exit\n", 10);
+        }
+        else
+        {
+            SendNext();
+        }
+    }
+
+    // ShmTransportListener
+    virtual BOOL OnMessage(ShmMessageType type, const char* data, size_t length)
+    {
+        if (type == ShmMessageOutput)
+        {
+            ParseOutput(data, length);
+        }
+        return type != ShmMessageExited;
+    }
+};
+
+/// <summary>
+/// Runs the host with given options over the fake GDB with given arguments and drives it, till all commands complete.
+/// When the transport is given, it's opened as the IDE side before the host starts and the host option 't' is added.
+/// </summary>
+static int MeasureSession(SessionBenchmark& benchmark, int window, LPCTSTR lpszHostOptions, LPCTSTR lpszFakeArguments, ShmTransport* transport = NULL)
+{
+    TCHAR path[_MAX_PATH];
+    TCHAR command[3 * _MAX_PATH];
+
+    if (!GetExecutablePath(path, _countof(path)))
+    {
+        PrintMessage(_T("Error: Unable to find own executable\r\n"));
+        return 1;
+    }
+
+#ifdef _WIN32
+    DWORD id = GetCurrentProcessId();
+#else
+    DWORD id = (DWORD) getpid();
+#endif
+
+    TCHAR baseName[64];
+
+    _stprintf_s(baseName, _countof(baseName), _T("gdbhost-bench-%u-c"), id);
+    if (transport != NULL && !transport->Open(baseName, &benchmark))
+    {
+        PrintMessage(_T("Error: Unable to create shared memory transport (%s%s)\r\n"), baseName, SHM_NAME_SUFFIX);
+        return 2;
+    }
+
+    // the host runs the fake GDB, which is the same executable:
+    _stprintf_s(command, _countof(command), _T("\"%s\" %s gdbhost-bench-%u-t -sc%s%s \"%s\" --fake-gdb %s"),
+                path, baseName, id, lpszHostOptions, transport != NULL ? _T("t") : _T(""), path, lpszFakeArguments);
+
+    GDBWrapper* host = new GDBWrapper(command);
+    if (!host->StartProcess(GDB_START_OWN_PIPES))
+    {
+        PrintMessage(_T("Error: Unable to start the host (%s)\r\n"), command);
+        delete host;
+        return 2;
+    }
+
+    HostLoop loop;
+
+    benchmark.Attach(host, &loop, transport);
+    loop.AddReader(host->GetOutputPipe(), &benchmark);
+    loop.Add(host->GetProcessHandle(), &benchmark);
+    if (transport != NULL)
+    {
+        loop.Add(transport->GetWaitable(), transport);
+    }
+
+    benchmark.startTime = HostGetTimestamp();
+    for (int i = 0; i < window; i++)
+    {
+        benchmark.SendNext();
+    }
+
+    loop.Run();
+
+    host->Shutdown();
+    delete host;
+
+    if (benchmark.completed < benchmark.count)
+    {
+        PrintMessage(_T("Error: The host exited after %d of %d commands\r\n"), benchmark.completed, benchmark.count);
+        return 3;
+    }
+
+    return 0;
+}
+
+int RunSessionBenchmark(int count, int window, LPCTSTR lpszHostOptions)
+{
+    if (count <= 0)
+        count = 10000;
+    if (window <= 0)
+        window = 1;
+    if (lpszHostOptions == NULL)
+        lpszHostOptions = _T("r");
+
+    SessionBenchmark benchmark(count);
+    int result = MeasureSession(benchmark, window, lpszHostOptions, _T("synth 8 32 24"));
+    if (result != 0)
+        return result;
+
+    unsigned long long elapsed = benchmark.finishTime - benchmark.startTime;
+    std::string latency;
+
+    benchmark.roundTrip.Format(latency, "roundtrip");
+    std::basic_string<TCHAR> message(latency.begin(), latency.end());
+
+    PrintMessage(_T("Session benchmark: %d commands, %d in flight, host options: -sc%s\r\n"), count, window, lpszHostOptions);
+    PrintMessage(_T("  throughput: %.0f commands/s, %.1f MB/s of MI output\r\n"),
+                 count * 1000000.0 / (elapsed ? elapsed : 1), benchmark.bytes / (1024.0 * 1024.0) * 1000000.0 / (elapsed ? elapsed : 1));
+    PrintMessage(_T("  latency (us): %s\r\n"), message.c_str());
+    PrintMessage(_T("  host peak memory: %llu KB\r\n"), benchmark.peakMemory / 1024);
+    return 0;
+}
+
+int RunStreamBenchmark(int count, int lines, int cost)
+{
+    struct StreamScenario
+    {
+        const TCHAR* name;
+        const TCHAR* hostOptions;
+        BOOL flood;
+    };
+
+    static const StreamScenario scenarios[] =
+    {
+        { _T("quiet"),      _T("r"),    FALSE },
+        { _T("flood"),      _T("r"),    TRUE },
+        { _T("throttled"),  _T("ro"),   TRUE },
+    };
+
+    if (count <= 0)
+        count = 2000;
+    if (lines <= 0)
+        lines = 200;
+    if (cost < 0)
+        cost = 2;
+
+    PrintMessage(_T("Target output benchmark: %d commands, 4 in flight, %d '@' records emitted before each reply, %d us to show each\r\n"), count, lines, cost);
+    PrintMessage(_T("  scenario    options   p50 (us)   p99 (us)   max (us)   MI output (MB)   '@' records\r\n"));
+
+    for (size_t i = 0; i < _countof(scenarios); i++)
+    {
+        TCHAR arguments[64];
+
+        _stprintf_s(arguments, _countof(arguments), _T("synth 8 32 24 0 %d"), scenarios[i].flood ? lines : 0);
+
+        SessionBenchmark benchmark(count);
+
+        benchmark.streamCost = (unsigned int) cost;
+        int result = MeasureSession(benchmark, 4, scenarios[i].hostOptions, arguments);
+        if (result != 0)
+            return result;
+
+        PrintMessage(_T("  %-10s  -sc%-5s %9llu  %9llu  %9llu   %14.1f   %11llu\r\n"), scenarios[i].name, scenarios[i].hostOptions,
+                     benchmark.roundTrip.GetPercentile(50.0), benchmark.roundTrip.GetPercentile(99.0), benchmark.roundTrip.GetMax(),
+                     benchmark.bytes / (1024.0 * 1024.0), benchmark.streamRecords);
+    }
+
+    return 0;
+}
+
+int RunShmBenchmark(int count, int window)
+{
+    if (count <= 0)
+        count = 10000;
+    if (window <= 0)
+        window = 1;
+
+    PrintMessage(_T("Transport benchmark: %d commands, %d in flight\r\n"), count, window);
+    PrintMessage(_T("  transport       options   p50 (us)   p99 (us)   max (us)   commands/s   doorbells\r\n"));
+
+    for (int i = 0; i < 2; i++)
+    {
+        SessionBenchmark benchmark(count);
+        ShmTransport transport(ShmSideIde);
+
+        int result = MeasureSession(benchmark, window, _T("r"), _T("synth 8 32 24"), i > 0 ? &transport : NULL);
+        if (result != 0)
+            return result;
+
+        unsigned long long elapsed = benchmark.finishTime - benchmark.startTime;
+
+        PrintMessage(_T("  %-14s  -sc%-5s %9llu  %9llu  %9llu   %10.0f   %9llu\r\n"), i > 0 ? _T("shared-memory") : _T("pipes"), i > 0 ? _T("rt") : _T("r"),
+                     benchmark.roundTrip.GetPercentile(50.0), benchmark.roundTrip.GetPercentile(99.0), benchmark.roundTrip.GetMax(),
+                     count * 1000000.0 / (elapsed ? elapsed : 1), transport.GetDoorbellCount());
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Side of the remote serial protocol benchmark running on its own thread: either the gdbserver stand-in
+/// or the proxy in front of it. Each serves single connection and then exits.
+/// </summary>
+struct RspBenchmarkPeer
+{
+    RspSocket listener;
+    FakeGdbServer* server;
+    RspProxy* proxy;
+    unsigned short targetPort;
+#ifdef _WIN32
+    HANDLE hThread;
+#else
+    pthread_t thread;
+#endif
+
+    RspBenchmarkPeer() : server(NULL), proxy(NULL), targetPort(0) { }
+
+    void Run()
+    {
+        if (server != NULL)
+        {
+            server->Run(listener);
+        }
+        else
+        {
+            proxy->Run(listener, "127.0.0.1", targetPort);
+        }
+    }
+};
+
+#ifdef _WIN32
+static DWORD WINAPI RspBenchmarkThread(LPVOID lpParameter)
+{
+    static_cast<RspBenchmarkPeer*>(lpParameter)->Run();
+    return 0;
+}
+#else
+static void* RspBenchmarkThread(void* parameter)
+{
+    static_cast<RspBenchmarkPeer*>(parameter)->Run();
+    return NULL;
+}
+#endif
+
+static BOOL StartPeer(RspBenchmarkPeer& peer)
+{
+    if (!peer.listener.Listen(0))
+        return FALSE;
+
+#ifdef _WIN32
+    peer.hThread = CreateThread(NULL, 0, RspBenchmarkThread, &peer, 0, NULL);
+    return peer.hThread != NULL;
+#else
+    return pthread_create(&peer.thread, NULL, RspBenchmarkThread, &peer) == 0;
+#endif
+}
+
+static void JoinPeer(RspBenchmarkPeer& peer)
+{
+#ifdef _WIN32
+    WaitForSingleObject(peer.hThread, INFINITE);
+    CloseHandle(peer.hThread);
+#else
+    pthread_join(peer.thread, NULL);
+#endif
+}
+
+static BOOL RspExchange(RspConnection& connection, const std::string& request, std::string& reply)
+{
+    return connection.Send(request) && connection.Read(reply, RSP_REQUEST_TIMEOUT) == RspInputPacket;
+}
+
+/// <summary>
+/// Acts as GDB stepping through the code: after each step it reads the registers and unwinds the stack
+/// with many small memory reads. Returns the average time of single step in microseconds or 0 on failure.
+/// </summary>
+static unsigned long long RunRspSteps(unsigned short port, int steps, LatencyHistogram& latency)
+{
+    RspConnection gdb;
+    std::string reply;
+    char request[64];
+
+    if (!gdb.GetSocket().Connect("127.0.0.1", port)
+        || !RspExchange(gdb, "qSupported:multiprocess+;swbreak+;hwbreak+", reply)
+        || !RspExchange(gdb, "QStartNoAckMode", reply))
+        return 0;
+
+    gdb.SetNoAck(TRUE);
+    if (!RspExchange(gdb, "?", reply))
+        return 0;
+
+    unsigned long long start = HostGetTimestamp();
+
+    for (int step = 0; step < steps; step++)
+    {
+        unsigned long long stepStart = HostGetTimestamp();
+        unsigned long long sp = FAKE_SERVER_SP - (step % 8) * 16;
+        unsigned long long pc = FAKE_SERVER_PC + (step % 32) * 4;
+
+        if (!RspExchange(gdb, "vCont;s:1", reply) || !RspExchange(gdb, "g", reply))
+            return 0;
+
+        for (int frame = 0; frame < 10; frame++)
+        {
+            unsigned long long frameAddress = sp + frame * 96;
+
+            // return address and frame pointer, some locals and the code for the prologue analysis:
+            sprintf_s(request, sizeof(request), "m%llx,8", frameAddress);
+            if (!RspExchange(gdb, request, reply))
+                return 0;
+            sprintf_s(request, sizeof(request), "m%llx,8", frameAddress + 8);
+            if (!RspExchange(gdb, request, reply))
+                return 0;
+            for (int local = 0; local < 3; local++)
+            {
+                sprintf_s(request, sizeof(request), "m%llx,4", frameAddress + 16 + local * 12);
+                if (!RspExchange(gdb, request, reply))
+                    return 0;
+            }
+            sprintf_s(request, sizeof(request), "m%llx,4", pc + frame * 0x40);
+            if (!RspExchange(gdb, request, reply))
+                return 0;
+            sprintf_s(request, sizeof(request), "m%llx,4", pc + frame * 0x40 + 4);
+            if (!RspExchange(gdb, request, reply) || reply.size() != 8)
+                return 0;
+        }
+
+        latency.Record(HostGetTimestamp() - stepStart);
+    }
+
+    unsigned long long elapsed = HostGetTimestamp() - start;
+    gdb.Send("k");
+    return elapsed / steps;
+}
+
+int RunRspBenchmark(int steps, int delay, int blockSize)
+{
+    if (steps <= 0)
+        steps = 100;
+    if (delay < 0)
+        delay = 1000;
+    if (blockSize <= 0)
+        blockSize = RSP_DEFAULT_BLOCK_SIZE;
+
+    if (!RspSocket::Startup())
+        return 1;
+
+    PrintMessage(_T("RSP benchmark: %d steps, %d us per target reply, %d bytes blocks\r\n"), steps, delay, blockSize);
+
+    // GDB connected directly to the target:
+    FakeGdbServer directServer((unsigned long long) delay, TRUE);
+    RspBenchmarkPeer direct;
+    LatencyHistogram directLatency;
+
+    direct.server = &directServer;
+    if (!StartPeer(direct))
+    {
+        PrintMessage(_T("Error: Unable to start the target\r\n"));
+        return 2;
+    }
+
+    unsigned long long directStep = RunRspSteps(direct.listener.GetPort(), steps, directLatency);
+    JoinPeer(direct);
+
+    // and through the proxy:
+    FakeGdbServer proxiedServer((unsigned long long) delay, TRUE);
+    RspProxy proxy((size_t) blockSize);
+    RspBenchmarkPeer target;
+    RspBenchmarkPeer proxied;
+    LatencyHistogram proxiedLatency;
+
+    target.server = &proxiedServer;
+    proxied.proxy = &proxy;
+    if (!StartPeer(target))
+    {
+        PrintMessage(_T("Error: Unable to start the target\r\n"));
+        return 2;
+    }
+
+    proxied.targetPort = target.listener.GetPort();
+    if (!StartPeer(proxied))
+    {
+        PrintMessage(_T("Error: Unable to start the proxy\r\n"));
+        return 2;
+    }
+
+    unsigned long long proxiedStep = RunRspSteps(proxied.listener.GetPort(), steps, proxiedLatency);
+    JoinPeer(proxied);
+    JoinPeer(target);
+
+    if (directStep == 0 || proxiedStep == 0)
+    {
+        PrintMessage(_T("Error: The session failed\r\n"));
+        return 3;
+    }
+
+    std::string text;
+    std::string stats;
+
+    directLatency.Format(text, "step");
+    proxy.Format(stats);
+    std::basic_string<TCHAR> directMessage(text.begin(), text.end());
+    text.clear();
+    proxiedLatency.Format(text, "step");
+    std::basic_string<TCHAR> proxiedMessage(text.begin(), text.end());
+    std::basic_string<TCHAR> statsMessage(stats.begin(), stats.end());
+
+    PrintMessage(_T("  direct: %llu us/step, %llu packets/step, latency (us): %s\r\n"),
+                 directStep, directServer.GetStats().packets / steps, directMessage.c_str());
+    PrintMessage(_T("  proxy:  %llu us/step, %llu packets/step, latency (us): %s\r\n"),
+                 proxiedStep, proxiedServer.GetStats().packets / steps, proxiedMessage.c_str());
+    PrintMessage(_T("  %s\r\n"), statsMessage.c_str());
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Evicts the file from the page cache, so it's read from the disk again (Linux only, elsewhere the cache stays warm).
+/// </summary>
+static void DropFileCache(LPCTSTR lpszPath)
+{
+#ifndef _WIN32
+    int file = open(lpszPath, O_RDONLY);
+    if (file >= 0)
+    {
+        fdatasync(file);
+        posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+        close(file);
+    }
+#endif
+}
+
+/// <summary>
+/// Acts as GDB asked for 'bt' right after 'target remote': selects the crashing thread, reads its registers
+/// and follows the frame pointers. Returns the number of frames or 0 on failure.
+/// </summary>
+static size_t RunCoreBacktrace(unsigned short port, BOOL linuxCore)
+{
+    RspConnection gdb;
+    std::string reply;
+    std::string word;
+    char request[64];
+    size_t wordSize = linuxCore ? 8 : 4;
+    size_t fpOffset = linuxCore ? 6 * 8 : 11 * 4;   // rbp or r11 inside the 'g' packet
+    size_t pcOffset = linuxCore ? 16 * 8 : 15 * 4;
+    unsigned long long fp = 0;
+    unsigned long long pc = 0;
+    size_t frames = 0;
+
+    if (!gdb.GetSocket().Connect("127.0.0.1", port)
+        || !RspExchange(gdb, "qSupported:multiprocess+;swbreak+;hwbreak+", reply)
+        || !RspExchange(gdb, "QStartNoAckMode", reply))
+        return 0;
+
+    gdb.SetNoAck(TRUE);
+    if (!RspExchange(gdb, "?", reply) || !RspExchange(gdb, "Hg0", reply) || !RspExchange(gdb, "g", reply)
+        || !RspCodec::DecodeHex(reply.data() + fpOffset * 2, wordSize * 2, word))
+        return 0;
+    memcpy(&fp, word.data(), wordSize);
+    if (!RspCodec::DecodeHex(reply.data() + pcOffset * 2, wordSize * 2, word))
+        return 0;
+    memcpy(&pc, word.data(), wordSize);
+
+    for (frames = pc != 0 ? 1 : 0; fp != 0 && frames < CORE_MAX_BACKTRACE; frames++)
+    {
+        unsigned long long caller = 0;
+
+        sprintf_s(request, sizeof(request), "m%llx,%x", fp, (unsigned int) wordSize * 2);
+        if (!RspExchange(gdb, request, reply) || !RspCodec::DecodeHex(reply.data(), reply.size(), word) || word.size() != wordSize * 2)
+            break;
+
+        memcpy(&caller, word.data(), wordSize);
+        fp = caller;
+    }
+
+    gdb.Send("k");
+    return frames;
+}
+
+/// <summary>
+/// Measures single core of the corpus. Returns FALSE, if the index doesn't match, what was written.
+/// </summary>
+static BOOL MeasureCore(LPCTSTR lpszPath, int threads, int megabytes, BOOL linuxCore)
+{
+    FakeCoreInfo info;
+    std::string content;
+    std::vector<unsigned long long> frames;
+    std::vector<CoreThread> all;
+
+    if (!WriteFakeCore(lpszPath, threads, megabytes, linuxCore, info))
+    {
+        PrintMessage(_T("Error: Unable to write the core file (%s)\r\n"), lpszPath);
+        return FALSE;
+    }
+
+    // what GDB does: everything goes through buffered reads, before the first backtrace:
+    DropFileCache(lpszPath);
+    unsigned long long start = HostGetTimestamp();
+    LoadFile(lpszPath, content);
+    unsigned long long buffered = HostGetTimestamp() - start;
+    content.clear();
+
+    // mapped and indexed till the crashing thread:
+    CoreIndex index;
+
+    DropFileCache(lpszPath);
+    start = HostGetTimestamp();
+    if (!index.Open(lpszPath))
+    {
+        PrintMessage(_T("Error: Unable to open the core file (%s)\r\n"), lpszPath);
+        return FALSE;
+    }
+    unsigned long long opened = HostGetTimestamp() - start;
+    index.Backtrace(index.GetCrashedThread(), frames, CORE_MAX_BACKTRACE);
+    unsigned long long backtrace = HostGetTimestamp() - start;
+
+    // the same served to GDB:
+    CoreServer server(&index);
+    if (!server.Listen(0) || !server.Start())
+    {
+        PrintMessage(_T("Error: Unable to start the core server\r\n"));
+        return FALSE;
+    }
+    unsigned long long served = HostGetTimestamp();
+    size_t servedFrames = RunCoreBacktrace(server.GetPort(), linuxCore);
+    served = HostGetTimestamp() - served;
+    server.Stop();
+
+    // and the rest of the threads:
+    index.GetThreads(all);
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        std::vector<unsigned long long> threadFrames;
+        index.Backtrace(all[i], threadFrames, CORE_MAX_BACKTRACE);
+    }
+    unsigned long long complete = HostGetTimestamp() - start;
+
+    BOOL valid = index.GetCrashedThread().id == info.crashedId && index.GetCrashedThread().signal == FAKE_CORE_SIGNAL
+                 && frames.size() == info.crashedFrames && frames[0] == info.crashedPc && servedFrames == info.crashedFrames
+                 && all.size() == (size_t) threads;
+
+    PrintMessage(_T("  %-10s %llu MB, buffered read: %llu ms; mapped: open %llu us, crashed thread backtrace %llu us (over RSP %llu us), all threads %llu us%s\r\n"),
+                 linuxCore ? _T("linux-x64:") : _T("qnx-arm:"), info.size / (1024 * 1024), buffered / 1000, opened, backtrace, served, complete,
+                 valid ? _T("") : _T(" - INDEX MISMATCH"));
+    return valid;
+}
+
+int RunCoreBenchmark(int threads, int megabytes)
+{
+    TCHAR path[_MAX_PATH];
+    BOOL valid;
+
+    if (threads <= 0)
+        threads = 64;
+    if (megabytes <= 0)
+        megabytes = 256;
+
+    if (!RspSocket::Startup())
+        return 1;
+
+#ifdef _WIN32
+    TCHAR directory[_MAX_PATH];
+    GetTempPath(_countof(directory), directory);
+    _stprintf_s(path, _countof(path), _T("%sgdbhost-bench-%u.core"), directory, GetCurrentProcessId());
+#else
+    const char* directory = getenv("TMPDIR");
+    _stprintf_s(path, _countof(path), _T("%s/gdbhost-bench-%u.core"), directory != NULL && directory[0] != '\0' ? directory : "/tmp", (unsigned int) getpid());
+#endif
+
+    PrintMessage(_T("Core benchmark: %d threads, %d MB of other memory\r\n"), threads, megabytes);
+    valid = MeasureCore(path, threads, megabytes, FALSE);
+    valid = MeasureCore(path, threads, megabytes, TRUE) && valid;
+
+#ifdef _WIN32
+    DeleteFile(path);
+#else
+    unlink(path);
+#endif
+    return valid ? 0 : 3;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CreateBenchmarkDirectory(const HostString& path)
+{
+#ifdef _WIN32
+    CreateDirectory(path.c_str(), NULL);
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+static void RemoveBenchmarkPath(const HostString& path, BOOL directory)
+{
+#ifdef _WIN32
+    if (directory)
+        RemoveDirectory(path.c_str());
+    else
+        DeleteFile(path.c_str());
+#else
+    if (directory)
+        rmdir(path.c_str());
+    else
+        unlink(path.c_str());
+#endif
+}
+
+/// <summary>
+/// Loads the profile given number of times and returns the average time of single load in microseconds.
+/// </summary>
+static double MeasureProfile(LPCTSTR lpszProfile, LPCTSTR lpszCache, int launches, BOOL cached, LaunchProfileStats& stats)
+{
+    LaunchProfile profile;
+    unsigned long long total = 0;
+
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < launches; i++)
+    {
+        if (!cached)
+        {
+            profile.Invalidate();
+        }
+        if (!profile.Load(lpszProfile, lpszCache) || profile.GetStats().cached != cached)
+            return -1.0;
+
+        total += profile.GetStats().loadTime;
+        stats = profile.GetStats();
+    }
+
+    return (double) total / launches;
+}
+
+int RunProfileBenchmark(int launches, int paths)
+{
+    HostString directory;
+    HostString separator;
+    TCHAR name[64];
+    BOOL valid;
+
+    if (launches <= 0)
+        launches = 100;
+    if (paths <= 0)
+        paths = 64;
+
+#ifdef _WIN32
+    TCHAR temporary[_MAX_PATH];
+    GetTempPath(_countof(temporary), temporary);
+    _stprintf_s(name, _countof(name), _T("gdbhost-profile-%u"), GetCurrentProcessId());
+    directory = HostString(temporary) + name;
+    separator = _T("\\");
+#else
+    const char* temporary = getenv("TMPDIR");
+    _stprintf_s(name, _countof(name), _T("/gdbhost-profile-%u"), (unsigned int) getpid());
+    directory = HostString(temporary != NULL && temporary[0] != '\0' ? temporary : "/tmp") + name;
+    separator = _T("/");
+#endif
+
+    HostString profilePath = directory + separator + _T("launch.profile");
+    HostString gdbDirectory = directory + separator + _T("bin");
+    HostString gdbPath = gdbDirectory + separator + _T("ntoarm-gdb");
+    HostString cachePath = directory + separator + _T("cache");
+    std::string content("gdb bin/ntoarm-gdb\narg --interpreter=mi2\narg --nx\nenv GDBHOST_BENCHMARK=1\n");
+    char line[64];
+
+    // profile resembling the one of the IDE: search path of the target libraries and a few settings:
+    CreateBenchmarkDirectory(directory);
+    CreateBenchmarkDirectory(gdbDirectory);
+    for (int i = 0; i < paths; i++)
+    {
+        sprintf_s(line, sizeof(line), "symbols libs-%d\n", i);
+        content += line;
+        if (i % 2 == 0)
+        {
+            _stprintf_s(name, _countof(name), _T("libs-%d"), i);
+            CreateBenchmarkDirectory(directory + separator + name);
+        }
+    }
+    content += "init set breakpoint pending on\ninit set print elements 0\ninit set auto-solib-add on\n";
+
+    FILE* file = _tfopen(profilePath.c_str(), _T("wb"));
+    if (file != NULL)
+    {
+        fwrite(content.data(), 1, content.size(), file);
+        fclose(file);
+    }
+    file = _tfopen(gdbPath.c_str(), _T("wb"));
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    LaunchProfileStats resolvedStats;
+    LaunchProfileStats cachedStats;
+    double resolved = MeasureProfile(profilePath.c_str(), cachePath.c_str(), launches, FALSE, resolvedStats);
+    double cached = MeasureProfile(profilePath.c_str(), cachePath.c_str(), launches, TRUE, cachedStats);
+
+    valid = resolved >= 0.0 && cached >= 0.0;
+    PrintMessage(_T("Launch profile benchmark: %d launches, %d symbol directories\r\n"), launches, paths);
+    if (valid)
+    {
+        PrintMessage(_T("  resolved: %.1f us/launch (%u paths probed)\r\n"), resolved, resolvedStats.probes);
+        PrintMessage(_T("  cached:   %.1f us/launch (%u paths probed)\r\n"), cached, cachedStats.probes);
+    }
+    else
+    {
+        PrintMessage(_T("Error: Unable to load the launch profile\r\n"));
+    }
+
+    // clean-up:
+    LaunchProfile profile;
+    if (profile.Load(profilePath.c_str(), cachePath.c_str()))
+    {
+        profile.Invalidate();
+    }
+    for (int i = 0; i < paths; i += 2)
+    {
+        _stprintf_s(name, _countof(name), _T("libs-%d"), i);
+        RemoveBenchmarkPath(directory + separator + name, TRUE);
+    }
+    RemoveBenchmarkPath(gdbPath, FALSE);
+    RemoveBenchmarkPath(gdbDirectory, TRUE);
+    RemoveBenchmarkPath(profilePath, FALSE);
+    RemoveBenchmarkPath(cachePath, TRUE);
+    RemoveBenchmarkPath(directory, TRUE);
+    return valid ? 0 : 3;
+}
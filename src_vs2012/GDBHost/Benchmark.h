@@ -0,0 +1,66 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+
+
+/// <summary>
+/// Measures throughput of the MI parser over recorded GDB output and prints results in MB/s.
+/// </summary>
+int RunParserBenchmark(LPCTSTR lpszTranscriptPath, int iterations);
+
+/// <summary>
+/// Measures the cost of single LogPrint() call with logging disabled and enabled and prints results in ns per record.
+/// </summary>
+int RunLogBenchmark(int count);
+
+/// <summary>
+/// Runs the host in relay mode over the fake GDB and measures round-trip latency and throughput of MI commands
+/// sent through the whole host pipeline together with the peak memory of the host process.
+/// </summary>
+int RunSessionBenchmark(int count, int window, LPCTSTR lpszHostOptions);
+
+/// <summary>
+/// Runs the session benchmark over the fake GDB flooding the output with target stream records and compares
+/// latency of the commands without the flood, with the flood and with the target output throttled by the host.
+/// Each '@' record costs the IDE side given number of microseconds, so it can fall behind the debuggee.
+/// </summary>
+int RunStreamBenchmark(int count, int lines, int cost);
+
+/// <summary>
+/// Runs the session benchmark once over the console pipes of the host and once over the shared memory transport,
+/// with the benchmark acting as the IDE side of the rings, and compares the latency and throughput of the commands.
+/// </summary>
+int RunShmBenchmark(int count, int window);
+
+/// <summary>
+/// Emulates GDB stepping over a slow link to the gdbserver stand-in, once directly and once through
+/// the remote serial protocol proxy, and compares the time of single step.
+/// </summary>
+int RunRspBenchmark(int steps, int delay, int blockSize);
+
+/// <summary>
+/// Writes the corpus of synthetic core files (QNX ARM and Linux x86-64) and compares the time till the backtrace
+/// of the crashing thread, when the whole core is read first and when it's mapped by the core index (directly
+/// and served to GDB over the remote serial protocol). Returns non-zero, if the index doesn't match the corpus.
+/// </summary>
+int RunCoreBenchmark(int threads, int megabytes);
+
+/// <summary>
+/// Loads the launch profile with given number of symbol directories (every other one missing) repeatedly,
+/// once resolving it each time and once from the cache, and compares the time of single launch.
+/// </summary>
+int RunProfileBenchmark(int launches, int paths);
@@ -0,0 +1,780 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// CoreIndex.cpp : memory-mapped index of ELF core files for post-mortem sessions.
+//
+
+#include "stdafx.h"
+#include "CoreIndex.h"
+#include "HostLoop.h"
+#include "RspProtocol.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+
+#define ELF_CLASS_64                2
+#define ELF_DATA_LITTLE             1
+#define ELF_TYPE_CORE               4
+#define ELF_MACHINE_386             3
+#define ELF_MACHINE_ARM             40
+#define ELF_MACHINE_X86_64          62
+#define ELF_SEGMENT_LOAD            1
+#define ELF_SEGMENT_NOTE            4
+#define ELF_EXTENDED_COUNT          0xFFFF      // PN_XNUM, real count is in the first section header
+#define CORE_PAGE_SIZE              4096
+
+
+/// <summary>
+/// Register of GDB 'g' packet and the index of the word inside the register block of the core, it comes from (-1, if it's not there).
+/// </summary>
+struct CoreRegister
+{
+    int source;
+    size_t size;
+};
+
+/// <summary>
+/// Describes, how to get registers of a thread out of the notes of given architecture and flavour.
+/// </summary>
+struct CoreRegisterLayout
+{
+    unsigned short machine;
+    CoreFormat format;
+    size_t wordSize;                // of the register block inside the core
+    size_t offset;                  // of the register block inside the thread note
+    int pc;
+    int sp;
+    int fp;
+    size_t count;
+    const CoreRegister* registers;
+};
+
+// r0-r15, f0-f7, fps, cpsr; the core has r0-r15 followed by cpsr (spsr on QNX):
+static const CoreRegister ArmRegisters[] =
+{
+    { 0, 4 }, { 1, 4 }, { 2, 4 }, { 3, 4 }, { 4, 4 }, { 5, 4 }, { 6, 4 }, { 7, 4 },
+    { 8, 4 }, { 9, 4 }, { 10, 4 }, { 11, 4 }, { 12, 4 }, { 13, 4 }, { 14, 4 }, { 15, 4 },
+    { -1, 12 }, { -1, 12 }, { -1, 12 }, { -1, 12 }, { -1, 12 }, { -1, 12 }, { -1, 12 }, { -1, 12 },
+    { -1, 4 }, { 16, 4 }
+};
+
+// eax, ecx, edx, ebx, esp, ebp, esi, edi, eip, eflags, cs, ss, ds, es, fs, gs from Linux user_regs_struct:
+static const CoreRegister X86LinuxRegisters[] =
+{
+    { 6, 4 }, { 1, 4 }, { 2, 4 }, { 0, 4 }, { 15, 4 }, { 5, 4 }, { 3, 4 }, { 4, 4 },
+    { 12, 4 }, { 14, 4 }, { 13, 4 }, { 16, 4 }, { 7, 4 }, { 8, 4 }, { 9, 4 }, { 10, 4 }
+};
+
+// the same from QNX X86_CPU_REGISTERS (edi, esi, ebp, exx, ebx, edx, ecx, eax, eip, cs, efl, esp, ss):
+static const CoreRegister X86QnxRegisters[] =
+{
+    { 7, 4 }, { 6, 4 }, { 5, 4 }, { 4, 4 }, { 11, 4 }, { 2, 4 }, { 1, 4 }, { 0, 4 },
+    { 8, 4 }, { 10, 4 }, { 9, 4 }, { 12, 4 }, { -1, 4 }, { -1, 4 }, { -1, 4 }, { -1, 4 }
+};
+
+// rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp, r8-r15, rip, eflags, cs, ss, ds, es, fs, gs from Linux user_regs_struct:
+static const CoreRegister X64LinuxRegisters[] =
+{
+    { 10, 8 }, { 5, 8 }, { 11, 8 }, { 12, 8 }, { 13, 8 }, { 14, 8 }, { 4, 8 }, { 19, 8 },
+    { 9, 8 }, { 8, 8 }, { 7, 8 }, { 6, 8 }, { 3, 8 }, { 2, 8 }, { 1, 8 }, { 0, 8 },
+    { 16, 8 }, { 18, 4 }, { 17, 4 }, { 20, 4 }, { 23, 4 }, { 24, 4 }, { 25, 4 }, { 26, 4 }
+};
+
+static const CoreRegisterLayout* FindLayout(unsigned short machine, CoreFormat format)
+{
+    static const CoreRegisterLayout Layouts[] =
+    {
+        { ELF_MACHINE_ARM, CoreFormatQnx, 4, 0, 15, 13, 11, _countof(ArmRegisters), ArmRegisters },
+        { ELF_MACHINE_ARM, CoreFormatLinux, 4, 72, 15, 13, 11, _countof(ArmRegisters), ArmRegisters },
+        { ELF_MACHINE_386, CoreFormatQnx, 4, 0, 8, 11, 2, _countof(X86QnxRegisters), X86QnxRegisters },
+        { ELF_MACHINE_386, CoreFormatLinux, 4, 72, 12, 15, 5, _countof(X86LinuxRegisters), X86LinuxRegisters },
+        { ELF_MACHINE_X86_64, CoreFormatLinux, 8, 112, 16, 19, 4, _countof(X64LinuxRegisters), X64LinuxRegisters }
+    };
+
+    for (size_t i = 0; i < _countof(Layouts); i++)
+    {
+        if (Layouts[i].machine == machine && Layouts[i].format == format)
+            return &Layouts[i];
+    }
+
+    return NULL;
+}
+
+static BOOL CompareSegments(const CoreSegment& first, const CoreSegment& second)
+{
+    return first.address < second.address;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+CoreIndex::CoreIndex()
+    : m_data(NULL), m_size(0), m_is64(FALSE), m_machine(0), m_format(CoreFormatLinux), m_layout(NULL),
+      m_noteSegment(0), m_noteOffset(0), m_pendingId(0), m_pendingSignal(0), m_pendingCurrent(FALSE), m_complete(FALSE), m_stopping(FALSE)
+{
+    memset(&m_crashed, 0, sizeof(m_crashed));
+    memset(&m_stats, 0, sizeof(m_stats));
+#ifdef _WIN32
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+    InitializeCriticalSection(&m_lock);
+    m_completeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_thread = NULL;
+#else
+    m_file = -1;
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_completed, NULL);
+    m_threadStarted = FALSE;
+#endif
+}
+
+CoreIndex::~CoreIndex()
+{
+    Close();
+#ifdef _WIN32
+    CloseHandle(m_completeEvent);
+    DeleteCriticalSection(&m_lock);
+#else
+    pthread_cond_destroy(&m_completed);
+    pthread_mutex_destroy(&m_lock);
+#endif
+}
+
+BOOL CoreIndex::Open(LPCTSTR lpszPath)
+{
+    unsigned long long start = HostGetTimestamp();
+
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    m_file = CreateFile(lpszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0 || (unsigned long long) size.QuadPart > (size_t) -1)
+    {
+        Close();
+        return FALSE;
+    }
+
+    m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    m_data = m_mapping != NULL ? static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : NULL;
+    m_size = (size_t) size.QuadPart;
+#else
+    struct stat info;
+
+    m_file = open(lpszPath, O_RDONLY | O_CLOEXEC);
+    if (m_file < 0 || fstat(m_file, &info) != 0 || info.st_size == 0)
+    {
+        Close();
+        return FALSE;
+    }
+
+    void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (data != MAP_FAILED)
+    {
+        // GDB jumps around the stacks, so reading ahead would only waste the I/O:
+        madvise(data, (size_t) info.st_size, MADV_RANDOM);
+        m_data = static_cast<const char*>(data);
+    }
+    m_size = (size_t) info.st_size;
+#endif
+
+    if (m_data == NULL || !ParseHeaders())
+    {
+        LogPrint(_T("CoreIndex: not a supported ELF core file"));
+        Close();
+        return FALSE;
+    }
+
+    m_stats.size = m_size;
+    m_stats.segments = m_segments.size();
+
+    if (!IndexNotes(TRUE) && m_threads.empty())
+    {
+        LogPrint(_T("CoreIndex: no threads found"));
+        Close();
+        return FALSE;
+    }
+
+    // without the explicit flag, the first thread is the one, that caused the dump:
+    if (m_crashed.registers == NULL)
+    {
+        m_crashed = m_threads[0];
+    }
+    m_stats.openTime = HostGetTimestamp() - start;
+
+    // the rest is indexed in background:
+#ifdef _WIN32
+    m_thread = CreateThread(NULL, 0, IndexerThread, this, 0, NULL);
+    if (m_thread == NULL)
+    {
+        RunIndexer();
+    }
+#else
+    m_threadStarted = pthread_create(&m_thread, NULL, IndexerThread, this) == 0;
+    if (!m_threadStarted)
+    {
+        RunIndexer();
+    }
+#endif
+
+    return TRUE;
+}
+
+void CoreIndex::Close()
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+    m_stopping = TRUE;
+    LeaveCriticalSection(&m_lock);
+
+    if (m_thread != NULL)
+    {
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+        m_thread = NULL;
+    }
+    if (m_data != NULL)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != NULL)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    ResetEvent(m_completeEvent);
+#else
+    pthread_mutex_lock(&m_lock);
+    m_stopping = TRUE;
+    pthread_mutex_unlock(&m_lock);
+
+    if (m_threadStarted)
+    {
+        pthread_join(m_thread, NULL);
+        m_threadStarted = FALSE;
+    }
+    if (m_data != NULL)
+    {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+    if (m_file >= 0)
+    {
+        close(m_file);
+        m_file = -1;
+    }
+#endif
+
+    m_data = NULL;
+    m_size = 0;
+    m_layout = NULL;
+    m_segments.clear();
+    m_notes.clear();
+    m_auxv.clear();
+    m_threads.clear();
+    m_noteSegment = 0;
+    m_noteOffset = 0;
+    m_pendingId = 0;
+    m_complete = FALSE;
+    m_stopping = FALSE;
+    memset(&m_crashed, 0, sizeof(m_crashed));
+}
+
+/// <summary>
+/// Reads little-endian number of given size at the offset of the file (0, if it's outside).
+/// </summary>
+unsigned long long CoreIndex::ReadWord(size_t offset, size_t size) const
+{
+    unsigned long long value = 0;
+
+    if (offset > m_size || size > m_size - offset)
+        return 0;
+
+    for (size_t i = size; i > 0; i--)
+    {
+        value = (value << 8) | (unsigned char) m_data[offset + i - 1];
+    }
+
+    return value;
+}
+
+/// <summary>
+/// Validates the ELF header and collects all the segments.
+/// </summary>
+BOOL CoreIndex::ParseHeaders()
+{
+    if (m_size < 64 || memcmp(m_data, "\x7f" "ELF", 4) != 0 || m_data[5] != ELF_DATA_LITTLE || ReadWord(16, 2) != ELF_TYPE_CORE)
+        return FALSE;
+
+    m_is64 = m_data[4] == ELF_CLASS_64;
+    m_machine = (unsigned short) ReadWord(18, 2);
+
+    size_t headersOffset = (size_t) (m_is64 ? ReadWord(32, 8) : ReadWord(28, 4));
+    size_t headerSize = (size_t) ReadWord(m_is64 ? 54 : 42, 2);
+    size_t count = (size_t) ReadWord(m_is64 ? 56 : 44, 2);
+
+    if (count == ELF_EXTENDED_COUNT)
+    {
+        size_t sectionsOffset = (size_t) (m_is64 ? ReadWord(40, 8) : ReadWord(32, 4));
+        count = (size_t) ReadWord(sectionsOffset + (m_is64 ? 44 : 28), 4);
+    }
+
+    if (headerSize < (m_is64 ? 56U : 32U) || headersOffset > m_size || count > (m_size - headersOffset) / headerSize)
+        return FALSE;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t header = headersOffset + i * headerSize;
+        unsigned int type = (unsigned int) ReadWord(header, 4);
+        CoreSegment segment;
+
+        segment.offset = m_is64 ? ReadWord(header + 8, 8) : ReadWord(header + 4, 4);
+        segment.address = m_is64 ? ReadWord(header + 16, 8) : ReadWord(header + 8, 4);
+        segment.fileSize = m_is64 ? ReadWord(header + 32, 8) : ReadWord(header + 16, 4);
+        segment.memorySize = m_is64 ? ReadWord(header + 40, 8) : ReadWord(header + 20, 4);
+
+        // truncated cores are still useful, only their end is missing:
+        if (segment.offset > m_size)
+        {
+            segment.fileSize = 0;
+        }
+        else if (segment.fileSize > m_size - segment.offset)
+        {
+            segment.fileSize = m_size - segment.offset;
+        }
+
+        if (type == ELF_SEGMENT_LOAD && segment.memorySize > 0)
+        {
+            m_segments.push_back(segment);
+        }
+        else if (type == ELF_SEGMENT_NOTE && segment.fileSize > 0)
+        {
+            m_notes.push_back(std::make_pair((size_t) segment.offset, (size_t) segment.fileSize));
+        }
+    }
+
+    std::sort(m_segments.begin(), m_segments.end(), CompareSegments);
+    return TRUE;
+}
+
+/// <summary>
+/// Walks the notes from the position, where the previous call stopped. When asked, it stops right after the crashing thread.
+/// Returns TRUE, if that happened.
+/// </summary>
+BOOL CoreIndex::IndexNotes(BOOL untilCrashed)
+{
+    for (; m_noteSegment < m_notes.size(); m_noteSegment++, m_noteOffset = 0)
+    {
+        size_t start = m_notes[m_noteSegment].first;
+        size_t end = start + m_notes[m_noteSegment].second;
+
+        while (start + m_noteOffset + 12 <= end)
+        {
+            size_t note = start + m_noteOffset;
+            size_t nameSize = (size_t) ReadWord(note, 4);
+            size_t descSize = (size_t) ReadWord(note + 4, 4);
+            unsigned int type = (unsigned int) ReadWord(note + 8, 4);
+            size_t descOffset = note + 12 + ((nameSize + 3) & ~3);
+            CoreThread thread;
+
+            if (descOffset > end || descSize > end - descOffset)
+            {
+                m_noteOffset = end - start;
+                break;
+            }
+
+            m_noteOffset = descOffset + ((descSize + 3) & ~3) - start;
+            if (m_stopping)
+                return FALSE;
+
+            if (AddNote(type, m_data + note + 12, nameSize, descOffset, descSize, thread))
+            {
+                AddThread(thread);
+
+                if (untilCrashed && (m_format == CoreFormatLinux || m_pendingCurrent))
+                {
+                    m_crashed = thread;
+                    return TRUE;
+                }
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+/// <summary>
+/// Processes single note. Returns TRUE, when the note completes a thread.
+/// </summary>
+BOOL CoreIndex::AddNote(unsigned int type, const char* name, size_t nameSize, size_t descOffset, size_t descSize, CoreThread& thread)
+{
+    BOOL linuxNote = nameSize >= 4 && memcmp(name, "CORE", 4) == 0;
+    BOOL qnxNote = nameSize >= 3 && memcmp(name, "QNX", 3) == 0;
+
+    if (linuxNote && type == CORE_NOTE_AUXV)
+    {
+        m_auxv.assign(m_data + descOffset, descSize);
+        return FALSE;
+    }
+
+    if (qnxNote && type == CORE_QNX_NOTE_STATUS && descSize >= 16)
+    {
+        m_pendingId = (unsigned int) ReadWord(descOffset + 4, 4);
+        m_pendingCurrent = (ReadWord(descOffset + 8, 4) & CORE_QNX_FLAG_CURRENT) != 0;
+        m_pendingSignal = (int) ReadWord(descOffset + 14, 2);
+        return FALSE;
+    }
+
+    if (!(linuxNote && type == CORE_NOTE_PRSTATUS) && !(qnxNote && type == CORE_QNX_NOTE_GREG && m_pendingId != 0))
+        return FALSE;
+
+    if (m_layout == NULL)
+    {
+        m_format = qnxNote ? CoreFormatQnx : CoreFormatLinux;
+        m_layout = FindLayout(m_machine, m_format);
+        if (m_layout == NULL)
+            return FALSE;
+    }
+
+    if (descSize <= m_layout->offset)
+        return FALSE;
+
+    thread.registers = m_data + descOffset + m_layout->offset;
+    thread.registersSize = descSize - m_layout->offset;
+    if (qnxNote)
+    {
+        thread.id = m_pendingId;
+        thread.signal = m_pendingSignal;
+        m_pendingId = 0;
+    }
+    else
+    {
+        thread.id = (unsigned int) ReadWord(descOffset + (m_is64 ? 32 : 24), 4);
+        thread.signal = (int) ReadWord(descOffset + 12, 2);
+    }
+
+    return TRUE;
+}
+
+void CoreIndex::AddThread(const CoreThread& thread)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+    m_threads.push_back(thread);
+    m_stats.threads = m_threads.size();
+    LeaveCriticalSection(&m_lock);
+#else
+    pthread_mutex_lock(&m_lock);
+    m_threads.push_back(thread);
+    m_stats.threads = m_threads.size();
+    pthread_mutex_unlock(&m_lock);
+#endif
+}
+
+/// <summary>
+/// Pages in the top of the thread's stack, which is what GDB reads first.
+/// </summary>
+void CoreIndex::Prefetch(const CoreThread& thread)
+{
+    unsigned long long sp = GetSp(thread);
+    volatile char touched = 0;
+
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        const CoreSegment& segment = m_segments[i];
+
+        if (sp >= segment.address && sp < segment.address + segment.fileSize)
+        {
+            size_t start = (size_t) (segment.offset + sp - segment.address);
+            size_t end = (size_t) (segment.offset + segment.fileSize);
+
+            if (end - start > CORE_PREFETCH_STACK)
+            {
+                end = start + CORE_PREFETCH_STACK;
+            }
+            for (size_t offset = start; offset < end && !m_stopping; offset += CORE_PAGE_SIZE)
+            {
+                touched = touched + m_data[offset];
+            }
+            return;
+        }
+    }
+}
+
+void CoreIndex::RunIndexer()
+{
+    unsigned long long start = HostGetTimestamp() - m_stats.openTime;
+    std::vector<CoreThread> threads;
+
+    IndexNotes(FALSE);
+
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+    m_stats.indexTime = HostGetTimestamp() - start;
+    m_complete = TRUE;
+    threads = m_threads;
+    LeaveCriticalSection(&m_lock);
+    SetEvent(m_completeEvent);
+#else
+    pthread_mutex_lock(&m_lock);
+    m_stats.indexTime = HostGetTimestamp() - start;
+    m_complete = TRUE;
+    threads = m_threads;
+    pthread_cond_broadcast(&m_completed);
+    pthread_mutex_unlock(&m_lock);
+#endif
+
+    // the crashing thread is the first to be asked for:
+    Prefetch(m_crashed);
+    for (size_t i = 0; i < threads.size() && !m_stopping; i++)
+    {
+        Prefetch(threads[i]);
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI CoreIndex::IndexerThread(LPVOID lpParameter)
+{
+    static_cast<CoreIndex*>(lpParameter)->RunIndexer();
+    return 0;
+}
+#else
+void* CoreIndex::IndexerThread(void* parameter)
+{
+    static_cast<CoreIndex*>(parameter)->RunIndexer();
+    return NULL;
+}
+#endif
+
+void CoreIndex::WaitComplete()
+{
+#ifdef _WIN32
+    WaitForSingleObject(m_completeEvent, INFINITE);
+#else
+    pthread_mutex_lock(&m_lock);
+    while (!m_complete)
+    {
+        pthread_cond_wait(&m_completed, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+#endif
+}
+
+BOOL CoreIndex::IsComplete()
+{
+    BOOL complete;
+
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+    complete = m_complete;
+    LeaveCriticalSection(&m_lock);
+#else
+    pthread_mutex_lock(&m_lock);
+    complete = m_complete;
+    pthread_mutex_unlock(&m_lock);
+#endif
+
+    return complete;
+}
+
+BOOL CoreIndex::FindThread(unsigned int id, CoreThread& thread)
+{
+    if (id == m_crashed.id)
+    {
+        thread = m_crashed;
+        return TRUE;
+    }
+
+    if (!IsComplete())
+    {
+        m_stats.waits++;
+        WaitComplete();
+    }
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        if (m_threads[i].id == id)
+        {
+            thread = m_threads[i];
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void CoreIndex::GetThreads(std::vector<CoreThread>& threads)
+{
+    if (!IsComplete())
+    {
+        m_stats.waits++;
+        WaitComplete();
+    }
+
+    threads = m_threads;
+}
+
+const std::string& CoreIndex::GetAuxv()
+{
+    WaitComplete();
+    return m_auxv;
+}
+
+size_t CoreIndex::ReadMemory(unsigned long long address, char* buffer, size_t length) const
+{
+    CoreSegment key;
+    size_t copied = 0;
+
+    key.address = address;
+    std::vector<CoreSegment>::const_iterator it = std::upper_bound(m_segments.begin(), m_segments.end(), key, CompareSegments);
+    if (it == m_segments.begin())
+        return 0;
+
+    // the read can continue into the following segment, if they are adjacent:
+    for (--it; it != m_segments.end() && copied < length; ++it)
+    {
+        unsigned long long current = address + copied;
+
+        if (current < it->address || current >= it->address + it->fileSize)
+            break;
+
+        size_t available = (size_t) (it->address + it->fileSize - current);
+        size_t count = length - copied < available ? length - copied : available;
+
+        memcpy(buffer + copied, m_data + it->offset + (current - it->address), count);
+        copied += count;
+    }
+
+    return copied;
+}
+
+BOOL CoreIndex::FormatRegisters(const CoreThread& thread, std::string& output) const
+{
+    if (m_layout == NULL || thread.registers == NULL)
+        return FALSE;
+
+    for (size_t i = 0; i < m_layout->count; i++)
+    {
+        const CoreRegister& reg = m_layout->registers[i];
+
+        if (reg.source >= 0 && (reg.source + 1) * m_layout->wordSize <= thread.registersSize && reg.size <= m_layout->wordSize)
+        {
+            RspCodec::AppendHex(output, thread.registers + reg.source * m_layout->wordSize, reg.size);
+        }
+        else
+        {
+            output.append(reg.size * 2, 'x');
+        }
+    }
+
+    return TRUE;
+}
+
+unsigned long long CoreIndex::GetPc(const CoreThread& thread) const
+{
+    if (m_layout == NULL || thread.registers == NULL || (m_layout->pc + 1) * m_layout->wordSize > thread.registersSize)
+        return 0;
+
+    return ReadWord(thread.registers + m_layout->pc * m_layout->wordSize - m_data, m_layout->wordSize);
+}
+
+unsigned long long CoreIndex::GetSp(const CoreThread& thread) const
+{
+    if (m_layout == NULL || thread.registers == NULL || (m_layout->sp + 1) * m_layout->wordSize > thread.registersSize)
+        return 0;
+
+    return ReadWord(thread.registers + m_layout->sp * m_layout->wordSize - m_data, m_layout->wordSize);
+}
+
+size_t CoreIndex::Backtrace(const CoreThread& thread, std::vector<unsigned long long>& frames, size_t maxFrames) const
+{
+    size_t wordSize = m_is64 ? 8 : 4;
+    unsigned long long fp;
+    char words[16];
+
+    frames.clear();
+    if (m_layout == NULL || thread.registers == NULL || (m_layout->fp + 1) * m_layout->wordSize > thread.registersSize || maxFrames == 0)
+        return 0;
+
+    frames.push_back(GetPc(thread));
+    fp = ReadWord(thread.registers + m_layout->fp * m_layout->wordSize - m_data, m_layout->wordSize);
+
+    while (frames.size() < maxFrames && fp != 0 && ReadMemory(fp, words, wordSize * 2) == wordSize * 2)
+    {
+        unsigned long long caller = 0;
+        unsigned long long returnAddress = 0;
+
+        memcpy(&caller, words, wordSize);
+        memcpy(&returnAddress, words + wordSize, wordSize);
+        if (returnAddress == 0)
+            break;
+
+        frames.push_back(returnAddress);
+
+        // stacks grow down, so anything else means the chain is broken:
+        if (caller <= fp)
+            break;
+        fp = caller;
+    }
+
+    return frames.size();
+}
+
+void CoreIndex::PrintCrashedThread() const
+{
+    std::vector<unsigned long long> frames;
+
+    Backtrace(m_crashed, frames, CORE_MAX_BACKTRACE);
+    PrintMessage(_T("Thread %u received signal %d:\r\n"), m_crashed.id, m_crashed.signal);
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        PrintMessage(_T("  #%-3u 0x%llx\r\n"), (unsigned int) i, frames[i]);
+    }
+}
+
+void CoreIndex::Format(std::string& output) const
+{
+    char text[256];
+
+    sprintf_s(text, sizeof(text), "core={size=\"%llu\",segments=\"%llu\",threads=\"%llu\",crashed=\"%u\",signal=\"%d\",waits=\"%llu\",open=\"%llu\",index=\"%llu\"}",
+              m_stats.size, m_stats.segments, m_stats.threads, m_crashed.id, m_crashed.signal, m_stats.waits, m_stats.openTime, m_stats.indexTime);
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void CoreIndex::Print() const
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
@@ -0,0 +1,213 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#   include <pthread.h>
+#endif
+
+
+#define CORE_NOTE_PRSTATUS          1           // Linux thread status with general registers ("CORE" notes)
+#define CORE_NOTE_AUXV              6
+#define CORE_QNX_NOTE_STATUS        8           // QNX thread status ("QNX" notes), followed by its registers
+#define CORE_QNX_NOTE_GREG          9
+#define CORE_QNX_FLAG_CURRENT       0x80        // _DEBUG_FLAG_CURTID, the thread that caused the dump
+#define CORE_PREFETCH_STACK         (64 * 1024) // bytes of each thread's stack touched in background
+#define CORE_MAX_BACKTRACE          256
+
+
+/// <summary>
+/// Flavour of the thread notes inside the core file.
+/// </summary>
+enum CoreFormat
+{
+    CoreFormatLinux = 0,
+    CoreFormatQnx
+};
+
+/// <summary>
+/// Memory of the process dumped into the core (PT_LOAD). Bytes past the file size (like code of mapped binaries)
+/// are not part of the core.
+/// </summary>
+struct CoreSegment
+{
+    unsigned long long address;
+    unsigned long long memorySize;
+    unsigned long long offset;
+    unsigned long long fileSize;
+};
+
+/// <summary>
+/// Thread found in the notes of the core. Registers point directly into the mapped file.
+/// </summary>
+struct CoreThread
+{
+    unsigned int id;
+    int signal;
+    const char* registers;
+    size_t registersSize;
+};
+
+/// <summary>
+/// Statistics of the core index (times are in microseconds).
+/// </summary>
+struct CoreIndexStats
+{
+    unsigned long long size;        // of the mapped file
+    unsigned long long segments;
+    unsigned long long threads;
+    unsigned long long waits;       // requests for other threads, that had to wait for the background indexing
+    unsigned long long openTime;    // till the crashing thread is known
+    unsigned long long indexTime;   // till all threads are known
+};
+
+/// <summary>
+/// Index of an ELF core file (Linux or QNX, little-endian, ARM or x86), that is memory-mapped instead of read,
+/// so opening it costs the same for a few megabytes and for a gigabyte. Opening indexes only the segments and
+/// the notes up to the thread, that caused the dump, so its registers and stack can be served right away.
+/// The remaining threads are indexed (and the top of their stacks paged in) on a background thread; requests
+/// for them wait, till it gets there. Memory reads go straight to the mapping and are safe from any thread.
+/// </summary>
+struct CoreRegisterLayout;
+
+class CoreIndex
+{
+private:
+    const char* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#else
+    int m_file;
+#endif
+    BOOL m_is64;
+    unsigned short m_machine;
+    CoreFormat m_format;
+    const CoreRegisterLayout* m_layout;
+    std::vector<CoreSegment> m_segments;            // sorted by address
+    std::vector<std::pair<size_t, size_t> > m_notes;  // offset and size of each PT_NOTE
+    std::string m_auxv;
+    size_t m_noteSegment;                           // position, where the background indexing continues
+    size_t m_noteOffset;
+    unsigned int m_pendingId;                       // QNX: thread of the last status note without registers yet
+    int m_pendingSignal;
+    BOOL m_pendingCurrent;
+    CoreThread m_crashed;
+    CoreIndexStats m_stats;
+
+    // shared with the background thread:
+    std::vector<CoreThread> m_threads;
+    BOOL m_complete;
+    BOOL m_stopping;
+#ifdef _WIN32
+    CRITICAL_SECTION m_lock;
+    HANDLE m_completeEvent;
+    HANDLE m_thread;
+#else
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_completed;
+    pthread_t m_thread;
+    BOOL m_threadStarted;
+#endif
+
+    unsigned long long ReadWord(size_t offset, size_t size) const;
+    BOOL ParseHeaders();
+    BOOL IndexNotes(BOOL untilCrashed);
+    BOOL AddNote(unsigned int type, const char* name, size_t nameSize, size_t descOffset, size_t descSize, CoreThread& thread);
+    void AddThread(const CoreThread& thread);
+    void Prefetch(const CoreThread& thread);
+    void RunIndexer();
+#ifdef _WIN32
+    static DWORD WINAPI IndexerThread(LPVOID lpParameter);
+#else
+    static void* IndexerThread(void* parameter);
+#endif
+
+    CoreIndex(const CoreIndex&);
+    CoreIndex& operator=(const CoreIndex&);
+
+public:
+    CoreIndex();
+    ~CoreIndex();
+
+    /// <summary>
+    /// Maps the core file and indexes it till the crashing thread is found. The rest is indexed in background.
+    /// </summary>
+    BOOL Open(LPCTSTR lpszPath);
+    void Close();
+
+    BOOL IsOpen() const { return m_data != NULL; }
+    CoreFormat GetFormat() const { return m_format; }
+    unsigned short GetMachine() const { return m_machine; }
+    const std::vector<CoreSegment>& GetSegments() const { return m_segments; }
+    const CoreThread& GetCrashedThread() const { return m_crashed; }
+
+    /// <summary>
+    /// Auxiliary vector of the process (Linux only), needed by GDB to relocate position independent executables.
+    /// It can follow the crashing thread, so it waits for the background indexing.
+    /// </summary>
+    const std::string& GetAuxv();
+
+    /// <summary>
+    /// Waits, till all threads are indexed.
+    /// </summary>
+    void WaitComplete();
+    BOOL IsComplete();
+
+    /// <summary>
+    /// Finds the thread by its id. Unless it's the crashing one, it waits for the background indexing to reach it.
+    /// </summary>
+    BOOL FindThread(unsigned int id, CoreThread& thread);
+    void GetThreads(std::vector<CoreThread>& threads);
+
+    /// <summary>
+    /// Copies the dumped memory starting at given address. Returns the number of bytes copied, which is less than
+    /// requested, when the read crosses the end of the dumped data.
+    /// </summary>
+    size_t ReadMemory(unsigned long long address, char* buffer, size_t length) const;
+
+    /// <summary>
+    /// Appends hex encoded registers of the thread in the order of GDB 'g' packet of the architecture,
+    /// registers missing from the core are marked as unavailable ('xx').
+    /// </summary>
+    BOOL FormatRegisters(const CoreThread& thread, std::string& output) const;
+
+    unsigned long long GetPc(const CoreThread& thread) const;
+    unsigned long long GetSp(const CoreThread& thread) const;
+
+    /// <summary>
+    /// Walks the frame-pointer chain of the thread ([fp] - caller's fp, [fp + word] - return address), which is
+    /// enough for a quick look before GDB is up; GDB itself unwinds using the debug information.
+    /// </summary>
+    size_t Backtrace(const CoreThread& thread, std::vector<unsigned long long>& frames, size_t maxFrames) const;
+
+    /// <summary>
+    /// Prints the crashing thread with its frames found by Backtrace() to console (and log).
+    /// </summary>
+    void PrintCrashedThread() const;
+
+    const CoreIndexStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: core={size="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print() const;
+};
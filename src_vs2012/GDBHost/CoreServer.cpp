@@ -0,0 +1,396 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// CoreServer.cpp : remote serial protocol server of the memory-mapped core files.
+//
+
+#include "stdafx.h"
+#include "CoreServer.h"
+#include "HostLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+CoreServer::CoreServer(CoreIndex* index)
+    : m_index(index), m_threadsListed(0)
+{
+    memset(&m_selected, 0, sizeof(m_selected));
+    memset(&m_stats, 0, sizeof(m_stats));
+#ifdef _WIN32
+    m_thread = NULL;
+#else
+    m_threadStarted = FALSE;
+#endif
+}
+
+CoreServer::~CoreServer()
+{
+    Stop();
+}
+
+BOOL CoreServer::Listen(unsigned short port)
+{
+    return RspSocket::Startup() && m_listener.Listen(port);
+}
+
+/// <summary>
+/// Reads memory requested by 'm' or 'x' packet. Reads crossing the end of the dumped data are shortened.
+/// </summary>
+std::string CoreServer::ReadMemory(const std::string& payload, BOOL binary)
+{
+    size_t position = 1;
+    unsigned long long address;
+    unsigned long long length;
+
+    if (!RspCodec::ParseNumber(payload, position, address) || position >= payload.size() || payload[position++] != ','
+        || !RspCodec::ParseNumber(payload, position, length))
+        return "E01";
+
+    if (length > CORE_SERVER_PACKET_SIZE / 2 - 8)
+    {
+        length = CORE_SERVER_PACKET_SIZE / 2 - 8;
+    }
+
+    std::string data((size_t) length, '\0');
+    std::string reply(binary ? "b" : "");
+
+    m_stats.memoryReads++;
+    data.resize(length > 0 ? m_index->ReadMemory(address, &data[0], data.size()) : 0);
+    if (data.empty() && length > 0)
+    {
+        m_stats.failedReads++;
+        return "E14";
+    }
+    m_stats.memoryBytes += data.size();
+
+    if (binary)
+    {
+        RspCodec::AppendBinary(reply, data.data(), data.size());
+    }
+    else
+    {
+        RspCodec::AppendHex(reply, data.data(), data.size());
+    }
+
+    return reply;
+}
+
+/// <summary>
+/// Serves 'qXfer:auxv:read::<offset>,<length>'.
+/// </summary>
+std::string CoreServer::ReadAuxv(const std::string& payload)
+{
+    size_t position = payload.find("::");
+    unsigned long long offset;
+    unsigned long long length;
+
+    if (position == std::string::npos)
+        return "E01";
+
+    position += 2;
+    if (!RspCodec::ParseNumber(payload, position, offset) || position >= payload.size() || payload[position++] != ','
+        || !RspCodec::ParseNumber(payload, position, length))
+        return "E01";
+
+    const std::string& auxv = m_index->GetAuxv();
+    if (offset >= auxv.size())
+        return "l";
+
+    if (length > auxv.size() - offset)
+    {
+        length = auxv.size() - offset;
+    }
+    if (length > CORE_SERVER_PACKET_SIZE / 2 - 8)
+    {
+        length = CORE_SERVER_PACKET_SIZE / 2 - 8;
+    }
+
+    std::string reply(offset + length < auxv.size() ? "m" : "l");
+    RspCodec::AppendBinary(reply, auxv.data() + offset, (size_t) length);
+    return reply;
+}
+
+/// <summary>
+/// Serves 'Hg<id>'; 0 and -1 (any or all threads) select the crashing one.
+/// </summary>
+std::string CoreServer::SelectThread(const std::string& payload)
+{
+    size_t position = 2;
+    unsigned long long id;
+
+    if (payload.size() < 2 || payload[1] != 'g')
+        return "OK";
+
+    if (payload.compare(2, std::string::npos, "-1") == 0 || !RspCodec::ParseNumber(payload, position, id) || id == 0)
+    {
+        m_selected = m_index->GetCrashedThread();
+        return "OK";
+    }
+
+    return m_index->FindThread((unsigned int) id, m_selected) ? "OK" : "E01";
+}
+
+/// <summary>
+/// Returns the next chunk of thread ids for 'qfThreadInfo' and 'qsThreadInfo'.
+/// </summary>
+std::string CoreServer::ListThreads()
+{
+    std::string reply;
+    char id[16];
+
+    for (size_t i = 0; i < CORE_SERVER_THREADS_CHUNK && m_threadsListed < m_threads.size(); i++, m_threadsListed++)
+    {
+        sprintf_s(id, sizeof(id), "%x", m_threads[m_threadsListed].id);
+        reply.append(reply.empty() ? "m" : ",").append(id);
+    }
+
+    return reply.empty() ? "l" : reply;
+}
+
+/// <summary>
+/// Processes single packet. Returns FALSE, when the connection should be closed.
+/// </summary>
+BOOL CoreServer::Handle(const std::string& payload)
+{
+    char text[128];
+
+    m_stats.packets++;
+
+    if (payload.compare(0, 10, "qSupported") == 0)
+    {
+        sprintf_s(text, sizeof(text), "PacketSize=%x;QStartNoAckMode+;binary-upload+%s", CORE_SERVER_PACKET_SIZE,
+                  m_index->GetFormat() == CoreFormatLinux ? ";qXfer:auxv:read+" : "");
+        return m_client.Send(text);
+    }
+
+    if (payload == "QStartNoAckMode")
+    {
+        BOOL result = m_client.Send("OK");
+        m_client.SetNoAck(TRUE);
+        return result;
+    }
+
+    if (payload.empty())
+        return m_client.Send("");
+
+    switch (payload[0])
+    {
+        case '?':
+            sprintf_s(text, sizeof(text), "T%02xthread:%x;", m_index->GetCrashedThread().signal & 0xFF, m_index->GetCrashedThread().id);
+            return m_client.Send(text);
+
+        case 'g':
+        {
+            std::string registers;
+
+            m_stats.registerReads++;
+            return m_client.Send(m_index->FormatRegisters(m_selected, registers) ? registers : std::string("E01"));
+        }
+
+        case 'm':
+            return m_client.Send(ReadMemory(payload, FALSE));
+
+        case 'x':
+            return m_client.Send(ReadMemory(payload, TRUE));
+
+        case 'H':
+            return m_client.Send(SelectThread(payload));
+
+        case 'T':
+        {
+            size_t position = 1;
+            unsigned long long id;
+            CoreThread thread;
+
+            return m_client.Send(RspCodec::ParseNumber(payload, position, id) && m_index->FindThread((unsigned int) id, thread) ? "OK" : "E01");
+        }
+
+        // the dumped process can be neither resumed, nor changed:
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+        case 'M':
+        case 'X':
+        case 'P':
+        case 'G':
+            return m_client.Send("E01");
+
+        case 'D':
+            m_client.Send("OK");
+            return FALSE;
+
+        case 'k':
+            return FALSE;
+
+        case 'q':
+            if (payload == "qC")
+            {
+                sprintf_s(text, sizeof(text), "QC%x", m_index->GetCrashedThread().id);
+                return m_client.Send(text);
+            }
+            if (payload == "qAttached")
+                return m_client.Send("1");
+            if (payload == "qfThreadInfo")
+            {
+                m_index->GetThreads(m_threads);
+                m_threadsListed = 0;
+                return m_client.Send(ListThreads());
+            }
+            if (payload == "qsThreadInfo")
+                return m_client.Send(ListThreads());
+            if (payload.compare(0, 17, "qXfer:auxv:read::") == 0)
+                return m_client.Send(ReadAuxv(payload));
+            return m_client.Send("");
+
+        default:
+            return m_client.Send("");
+    }
+}
+
+BOOL CoreServer::Run()
+{
+    std::string payload;
+
+    if (!m_listener.Accept(m_client.GetSocket()))
+        return FALSE;
+
+    LogPrint(_T("CoreServer: GDB connected"));
+    m_selected = m_index->GetCrashedThread();
+
+    for (;;)
+    {
+        RspInputType type = m_client.Read(payload, INFINITE);
+
+        if (type == RspInputClosed)
+            break;
+
+        // there is nothing running to interrupt:
+        if (type == RspInputPacket && !Handle(payload))
+            break;
+    }
+
+    m_client.GetSocket().Close();
+    LogPrint(_T("CoreServer: connection closed"));
+    return TRUE;
+}
+
+#ifdef _WIN32
+DWORD WINAPI CoreServer::ServerThread(LPVOID lpParameter)
+{
+    static_cast<CoreServer*>(lpParameter)->Run();
+    return 0;
+}
+#else
+void* CoreServer::ServerThread(void* parameter)
+{
+    static_cast<CoreServer*>(parameter)->Run();
+    return NULL;
+}
+#endif
+
+BOOL CoreServer::Start()
+{
+#ifdef _WIN32
+    m_thread = CreateThread(NULL, 0, ServerThread, this, 0, NULL);
+    return m_thread != NULL;
+#else
+    m_threadStarted = pthread_create(&m_thread, NULL, ServerThread, this) == 0;
+    return m_threadStarted;
+#endif
+}
+
+/// <summary>
+/// Wakes up the server thread, if it's still waiting for GDB or its packets, and waits for it to finish.
+/// </summary>
+void CoreServer::Stop()
+{
+    m_listener.Shutdown();
+    m_client.GetSocket().Shutdown();
+
+#ifdef _WIN32
+    if (m_thread != NULL)
+    {
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+        m_thread = NULL;
+    }
+#else
+    if (m_threadStarted)
+    {
+        pthread_join(m_thread, NULL);
+        m_threadStarted = FALSE;
+    }
+#endif
+
+    m_listener.Close();
+}
+
+void CoreServer::Format(std::string& output) const
+{
+    char text[192];
+
+    sprintf_s(text, sizeof(text), "core-server={packets=\"%llu\",memory-reads=\"%llu\",memory-bytes=\"%llu\",failed-reads=\"%llu\",register-reads=\"%llu\"}",
+              m_stats.packets, m_stats.memoryReads, m_stats.memoryBytes, m_stats.failedReads, m_stats.registerReads);
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void CoreServer::Print() const
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
+
+int RunCoreServer(int argc, _TCHAR* argv[])
+{
+    CoreIndex index;
+
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: --core-server <core> (<port>)\n");
+        return 1;
+    }
+
+    if (!index.Open(argv[0]))
+    {
+        PrintMessage(_T("Error: Unable to open core file (%s)\r\n"), argv[0]);
+        return 1;
+    }
+
+    CoreServer server(&index);
+    if (!server.Listen(argc >= 2 ? (unsigned short) _ttoi(argv[1]) : 0))
+    {
+        PrintMessage(_T("Error: Unable to listen on port %d\r\n"), argc >= 2 ? _ttoi(argv[1]) : 0);
+        return 1;
+    }
+
+    index.PrintCrashedThread();
+    PrintMessage(_T("Listening on 127.0.0.1:%u, connect GDB with: target remote :%u\r\n"), (unsigned int) server.GetPort(), (unsigned int) server.GetPort());
+
+    server.Run();
+    index.WaitComplete();
+    index.Print();
+    server.Print();
+    return 0;
+}
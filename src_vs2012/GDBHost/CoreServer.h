@@ -0,0 +1,112 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "CoreIndex.h"
+#include "RspProtocol.h"
+
+#include <string>
+#ifndef _WIN32
+#   include <pthread.h>
+#endif
+
+
+#define CORE_SERVER_PACKET_SIZE     0x4000
+#define CORE_SERVER_THREADS_CHUNK   128         // thread ids per 'qfThreadInfo' or 'qsThreadInfo' reply
+
+
+/// <summary>
+/// Statistics of the core server.
+/// </summary>
+struct CoreServerStats
+{
+    unsigned long long packets;
+    unsigned long long memoryReads;
+    unsigned long long memoryBytes;
+    unsigned long long failedReads;     // outside of the dumped memory
+    unsigned long long registerReads;
+};
+
+/// <summary>
+/// Serves the indexed core file to GDB over the remote serial protocol ('target remote :port'), so GDB reads
+/// registers and memory straight from the mapping instead of loading the whole core first. The crashing thread is
+/// selected and can be unwound right away, other threads are served, once the background indexing reaches them.
+/// The target can't be resumed or written. Each instance serves single connection of GDB.
+/// </summary>
+class CoreServer
+{
+private:
+    CoreIndex* m_index;
+    RspSocket m_listener;
+    RspConnection m_client;
+    CoreThread m_selected;
+    std::vector<CoreThread> m_threads;  // listed by the last 'qfThreadInfo'
+    size_t m_threadsListed;
+    CoreServerStats m_stats;
+#ifdef _WIN32
+    HANDLE m_thread;
+#else
+    pthread_t m_thread;
+    BOOL m_threadStarted;
+#endif
+
+    BOOL Handle(const std::string& payload);
+    std::string ReadMemory(const std::string& payload, BOOL binary);
+    std::string ReadAuxv(const std::string& payload);
+    std::string SelectThread(const std::string& payload);
+    std::string ListThreads();
+#ifdef _WIN32
+    static DWORD WINAPI ServerThread(LPVOID lpParameter);
+#else
+    static void* ServerThread(void* parameter);
+#endif
+
+public:
+    CoreServer(CoreIndex* index);
+    ~CoreServer();
+
+    /// <summary>
+    /// Starts listening on given loopback port (0 picks any free one, see GetPort()).
+    /// </summary>
+    BOOL Listen(unsigned short port);
+    unsigned short GetPort() const { return m_listener.GetPort(); }
+
+    /// <summary>
+    /// Accepts the connection of GDB and serves it, till it's closed.
+    /// </summary>
+    BOOL Run();
+
+    /// <summary>
+    /// Runs the server on its own thread, so it doesn't depend on the host loop.
+    /// </summary>
+    BOOL Start();
+    void Stop();
+
+    const CoreServerStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: core-server={packets="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print() const;
+};
+
+/// <summary>
+/// Runs the core server as a tool:
+///   --core-server <core> (<port>)
+/// Arguments start after the '--core-server' switch.
+/// </summary>
+int RunCoreServer(int argc, _TCHAR* argv[]);
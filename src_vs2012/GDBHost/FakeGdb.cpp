@@ -0,0 +1,990 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// FakeGdb.cpp : GDB/MI stand-in replaying recorded sessions or synthesizing replies and gdbserver stand-in.
+//
+
+#include "stdafx.h"
+#include "FakeGdb.h"
+#include "CoreIndex.h"
+#include "HostLoop.h"
+#include "MiRecorder.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#   include <errno.h>
+#   include <signal.h>
+#   include <unistd.h>
+#endif
+
+
+static const char FakeStoppedRecord[] = "*stopped,reason=\"signal-received\",signal-name=\"SIGINT\",signal-meaning=\"Interrupt\",thread-id=\"1\",stopped-threads=\"all\"\n(gdb) \n";
+
+#ifdef _WIN32
+
+static BOOL WINAPI FakeCtrlHandler(DWORD dwCtrlType)
+{
+    if (dwCtrlType != CTRL_C_EVENT && dwCtrlType != CTRL_BREAK_EVENT)
+        return FALSE;
+
+    // CRT streams are locked, so it's safe to write from the handler thread:
+    fputs(FakeStoppedRecord, stdout);
+    fflush(stdout);
+    return TRUE;
+}
+
+#else
+
+static volatile sig_atomic_t gFakeInterrupted = 0;
+
+static void FakeCtrlHandler(int signal)
+{
+    gFakeInterrupted = 1;
+}
+
+#endif
+
+static void FakeSleep(unsigned long long microseconds)
+{
+    if (microseconds == 0)
+        return;
+
+#ifdef _WIN32
+    Sleep((DWORD) ((microseconds + 999) / 1000));
+#else
+    usleep((useconds_t) microseconds);
+#endif
+}
+
+/// <summary>
+/// Prints the '*stopped' record, if the interrupt arrived in the meantime.
+/// </summary>
+static void FakeCheckInterrupt()
+{
+#ifndef _WIN32
+    if (gFakeInterrupted)
+    {
+        gFakeInterrupted = 0;
+        fputs(FakeStoppedRecord, stdout);
+        fflush(stdout);
+    }
+#endif
+}
+
+/// <summary>
+/// Reads single line from standard input without the new-line. Returns FALSE at the end of input.
+/// </summary>
+static BOOL FakeReadLine(std::string& line)
+{
+    char buffer[4096];
+
+    line.clear();
+    for (;;)
+    {
+        if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+        {
+#ifndef _WIN32
+            // interrupted by Ctrl-C, that just stops the target:
+            if (errno == EINTR && !feof(stdin))
+            {
+                clearerr(stdin);
+                FakeCheckInterrupt();
+                continue;
+            }
+#endif
+            return !line.empty();
+        }
+
+        line.append(buffer);
+        if (!line.empty() && line[line.size() - 1] == '\n')
+            break;
+    }
+
+    while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+    {
+        line.erase(line.size() - 1);
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Splits command into the token (empty, if not present) and the rest.
+/// </summary>
+static void FakeSplitToken(const std::string& line, std::string& token, std::string& command)
+{
+    size_t i = 0;
+
+    while (i < line.size() && line[i] >= '0' && line[i] <= '9')
+    {
+        i++;
+    }
+
+    token.assign(line, 0, i);
+    command.assign(line, i, std::string::npos);
+}
+
+static BOOL FakeStartsWith(const std::string& text, const char* prefix)
+{
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static void FakeWrite(const std::string& text)
+{
+    fwrite(text.data(), 1, text.size(), stdout);
+    fflush(stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AppendFrame(std::string& output, int level)
+{
+    char text[200];
+
+    sprintf_s(text, sizeof(text), "{level=\"%d\",addr=\"0x%08x\",func=\"function_%d\",file=\"main.cpp\",fullname=\"/accounts/devuser/src/main.cpp\",line=\"%d\"}",
+              level, 0x10000 + level * 0x40, level, 100 + level);
+    output.append(text);
+}
+
+/// <summary>
+/// Variable objects of the synthesized target. Every odd one changes its value with each step.
+/// </summary>
+struct FakeVariables
+{
+    int step;
+    std::vector<int> updated;   // step, when the variable object was updated the last time
+};
+
+static void UpdateVariables(const std::string& command, FakeVariables& state, std::string& reply)
+{
+    char text[200];
+    std::string::size_type space = command.find_last_of(' ');
+    std::string name = space != std::string::npos ? command.substr(space + 1) : "";
+    BOOL values = command.find("--all-values") != std::string::npos || command.find(" 1 ") != std::string::npos;
+    BOOL first = TRUE;
+
+    reply = "^done,changelist=[";
+    for (size_t i = 0; i < state.updated.size(); i++)
+    {
+        sprintf_s(text, sizeof(text), "var%u", (unsigned int) i + 1);
+        if ((name != "*" && name != text) || state.updated[i] == state.step)
+            continue;
+
+        state.updated[i] = state.step;
+        if (i % 2 == 0)
+            continue;
+
+        if (values)
+        {
+            sprintf_s(text, sizeof(text), "%s{name=\"var%u\",value=\"%d\",in_scope=\"true\",type_changed=\"false\",has_more=\"0\"}",
+                      first ? "" : ",", (unsigned int) i + 1, (int) i * 7 + state.step);
+        }
+        else
+        {
+            sprintf_s(text, sizeof(text), "%s{name=\"var%u\",in_scope=\"true\",type_changed=\"false\",has_more=\"0\"}", first ? "" : ",", (unsigned int) i + 1);
+        }
+        reply.append(text);
+        first = FALSE;
+    }
+    reply.append("]");
+}
+
+/// <summary>
+/// Builds reply of the synthesized target, which has given number of threads, frames of each stack and variables of each frame.
+/// Returns FALSE, when GDB should exit.
+/// </summary>
+static BOOL Synthesize(const std::string& command, int threads, int frames, int variables, FakeVariables& state, std::string& reply)
+{
+    char text[200];
+
+    if (FakeStartsWith(command, "-gdb-exit"))
+    {
+        reply = "^exit\n";
+        return FALSE;
+    }
+
+    if (FakeStartsWith(command, "-exec-interrupt"))
+    {
+        reply = "^done\n(gdb) \n";
+        reply.append(FakeStoppedRecord);
+        return TRUE;
+    }
+
+    if (FakeStartsWith(command, "-exec-"))
+    {
+        state.step++;
+        reply = "^running\n*running,thread-id=\"all\"\n(gdb) \n*stopped,reason=\"end-stepping-range\",frame=";
+        AppendFrame(reply, 0);
+        reply.append(",thread-id=\"1\",stopped-threads=\"all\"\n(gdb) \n");
+        return TRUE;
+    }
+
+    if (FakeStartsWith(command, "-thread-info"))
+    {
+        reply = "^done,threads=[";
+        for (int i = 1; i <= threads; i++)
+        {
+            sprintf_s(text, sizeof(text), "%s{id=\"%d\",target-id=\"Thread %d\",frame=", i > 1 ? "," : "", i, i);
+            reply.append(text);
+            AppendFrame(reply, 0);
+            reply.append(",state=\"stopped\"}");
+        }
+        reply.append("],current-thread-id=\"1\"");
+    }
+    else if (FakeStartsWith(command, "-stack-list-frames"))
+    {
+        reply = "^done,stack=[";
+        for (int i = 0; i < frames; i++)
+        {
+            reply.append(i > 0 ? ",frame=" : "frame=");
+            AppendFrame(reply, i);
+        }
+        reply.append("]");
+    }
+    else if (FakeStartsWith(command, "-stack-info-depth"))
+    {
+        sprintf_s(text, sizeof(text), "^done,depth=\"%d\"", frames);
+        reply = text;
+    }
+    else if (FakeStartsWith(command, "-stack-list-locals") || FakeStartsWith(command, "-stack-list-variables") || FakeStartsWith(command, "-stack-list-arguments"))
+    {
+        reply = FakeStartsWith(command, "-stack-list-locals") ? "^done,locals=[" : "^done,variables=[";
+        for (int i = 0; i < variables; i++)
+        {
+            sprintf_s(text, sizeof(text), "%s{name=\"variable_%d\",type=\"int\",value=\"%d\"}", i > 0 ? "," : "", i, i * 7);
+            reply.append(text);
+        }
+        reply.append("]");
+    }
+    else if (FakeStartsWith(command, "-data-list-register-names"))
+    {
+        reply = "^done,register-names=[";
+        for (int i = 0; i < FAKE_GDB_REGISTERS; i++)
+        {
+            sprintf_s(text, sizeof(text), "%s\"r%d\"", i > 0 ? "," : "", i);
+            reply.append(text);
+        }
+        reply.append("]");
+    }
+    else if (FakeStartsWith(command, "-data-list-register-values"))
+    {
+        reply = "^done,register-values=[";
+        for (int i = 0; i < FAKE_GDB_REGISTERS; i++)
+        {
+            sprintf_s(text, sizeof(text), "%s{number=\"%d\",value=\"0x%08x\"}", i > 0 ? "," : "", i, i * 0x1111);
+            reply.append(text);
+        }
+        reply.append("]");
+    }
+    else if (FakeStartsWith(command, "-var-create"))
+    {
+        state.updated.push_back(state.step);
+        sprintf_s(text, sizeof(text), "^done,name=\"var%u\",numchild=\"0\",value=\"%d\",type=\"int\",thread-id=\"1\",has_more=\"0\"",
+                  (unsigned int) state.updated.size(), (int) (state.updated.size() - 1) * 7 + state.step);
+        reply = text;
+    }
+    else if (FakeStartsWith(command, "-var-update"))
+    {
+        UpdateVariables(command, state, reply);
+    }
+    else
+    {
+        reply = "^done";
+    }
+
+    reply.append("\n(gdb) \n");
+    return TRUE;
+}
+
+static int RunSynthesized(int threads, int frames, int variables, unsigned long long delay, int records)
+{
+    std::string line;
+    std::string token;
+    std::string command;
+    std::string reply;
+    FakeVariables state;
+
+    state.step = 0;
+    FakeWrite("=thread-group-added,id=\"i1\"\n(gdb) \n");
+
+    while (FakeReadLine(line))
+    {
+        FakeSplitToken(line, token, command);
+        if (command.empty())
+            continue;
+
+        FakeSleep(delay);
+        FakeCheckInterrupt();
+
+        BOOL running = Synthesize(command, threads, frames, variables, state, reply);
+        reply.insert(0, token);
+
+        // debuggee printing like crazy:
+        if (records > 0)
+        {
+            std::string output;
+            char text[160];
+
+            for (int i = 0; i < records; i++)
+            {
+                sprintf_s(text, sizeof(text), "@\"[%d] worker %d: processed item %d of the batch, queue depth %d, elapsed 0.%03d s\\n\"\n",
+                          state.step, i % 8, i, records - i, i % 1000);
+                output.append(text);
+            }
+            reply.insert(0, output);
+        }
+        FakeWrite(reply);
+
+        if (!running)
+            break;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Writes the recorded output line, waiting as long as GDB did (scaled by the speed).
+/// Tokens of results are replaced by the ones of the commands received instead of the recorded ones.
+/// </summary>
+static void ReplayOutput(const MiTranscriptEntry& entry, unsigned long long previousTime, int speed, const std::map<std::string, std::string>& tokens)
+{
+    if (speed > 0 && entry.time > previousTime)
+    {
+        FakeSleep((entry.time - previousTime) * 100 / speed);
+    }
+
+    std::string token;
+    std::string rest;
+    std::string line;
+
+    FakeSplitToken(entry.text, token, rest);
+
+    std::map<std::string, std::string>::const_iterator it = tokens.find(token);
+    if (!token.empty() && !rest.empty() && rest[0] == '^' && it != tokens.end())
+    {
+        line = it->second + rest;
+    }
+    else
+    {
+        line = entry.text;
+    }
+
+    line.append("\n");
+    FakeWrite(line);
+}
+
+static int RunReplay(LPCTSTR lpszPath, int speed)
+{
+    std::vector<MiTranscriptEntry> entries;
+
+    if (!MiRecorder::Load(lpszPath, entries))
+    {
+        fprintf(stderr, "Error: Unable to load recorded session\n");
+        return 1;
+    }
+
+    std::map<std::string, std::string> tokens;  // recorded -> received
+    std::string line;
+    std::string token;
+    std::string command;
+    std::string recordedToken;
+    std::string recordedCommand;
+    unsigned long long previousTime = 0;
+    size_t i = 0;
+
+    // output printed at startup:
+    for (; i < entries.size() && entries[i].direction != MiDirectionCommand; i++)
+    {
+        ReplayOutput(entries[i], previousTime, speed, tokens);
+        previousTime = entries[i].time;
+    }
+
+    while (FakeReadLine(line))
+    {
+        FakeSplitToken(line, token, command);
+        if (command.empty())
+            continue;
+
+        if (i >= entries.size())
+        {
+            // recording is over, keep GDB alive till it's asked to exit:
+            BOOL exiting = FakeStartsWith(command, "-gdb-exit");
+            FakeWrite(token + (exiting ? "^exit\n" : "^done\n(gdb) \n"));
+            if (exiting)
+                break;
+            continue;
+        }
+
+        FakeSplitToken(entries[i].text, recordedToken, recordedCommand);
+        if (!recordedToken.empty())
+        {
+            tokens[recordedToken] = token;
+        }
+        previousTime = entries[i].time;
+        i++;
+
+        FakeCheckInterrupt();
+        for (; i < entries.size() && entries[i].direction != MiDirectionCommand; i++)
+        {
+            ReplayOutput(entries[i], previousTime, speed, tokens);
+            previousTime = entries[i].time;
+        }
+    }
+
+    return 0;
+}
+
+int RunFakeGdb(int argc, _TCHAR* argv[])
+{
+#ifdef _WIN32
+    SetConsoleCtrlHandler(FakeCtrlHandler, TRUE);
+#else
+    // no SA_RESTART, so the blocked read returns and the '*stopped' record can be printed:
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = FakeCtrlHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+#endif
+
+    if (argc >= 2 && _tcscmp(argv[0], _T("replay")) == 0)
+    {
+        return RunReplay(argv[1], argc >= 3 ? _ttoi(argv[2]) : 0);
+    }
+
+    if (argc >= 4 && _tcscmp(argv[0], _T("synth")) == 0)
+    {
+        return RunSynthesized(_ttoi(argv[1]), _ttoi(argv[2]), _ttoi(argv[3]), argc >= 5 ? (unsigned long long) _ttoi(argv[4]) : 0, argc >= 6 ? _ttoi(argv[5]) : 0);
+    }
+
+    fprintf(stderr, "Usage: --fake-gdb replay <recording> (<speed-percent>) | synth <threads> <frames> <variables> (<delay-us>) (<records>)\n");
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="delay">Time in microseconds each reply is delayed.</param>
+/// <param name="binary">Supports binary memory reads ('x' packets).</param>
+FakeGdbServer::FakeGdbServer(unsigned long long delay, BOOL binary)
+    : m_delay(delay), m_binary(binary)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+char FakeGdbServer::ReadByte(unsigned long long address) const
+{
+    std::map<unsigned long long, char>::const_iterator it = m_written.find(address);
+    if (it != m_written.end())
+        return it->second;
+
+    return (char) ((address * 31) ^ (address >> 8));
+}
+
+BOOL FakeGdbServer::Reply(const std::string& payload)
+{
+    FakeSleep(m_delay);
+    return m_client.Send(payload);
+}
+
+/// <summary>
+/// Reads memory requested by 'm' or 'x' packet. Reads starting outside of the mapped region fail,
+/// the ones crossing its end are shortened.
+/// </summary>
+std::string FakeGdbServer::ReadMemory(const std::string& payload, BOOL binary)
+{
+    size_t position = 1;
+    unsigned long long address;
+    unsigned long long length;
+
+    if (!RspCodec::ParseNumber(payload, position, address) || position >= payload.size() || payload[position++] != ','
+        || !RspCodec::ParseNumber(payload, position, length))
+        return "E01";
+
+    if (address < FAKE_SERVER_MEMORY_START || address >= FAKE_SERVER_MEMORY_START + FAKE_SERVER_MEMORY_SIZE)
+        return "E14";
+
+    if (address + length > FAKE_SERVER_MEMORY_START + FAKE_SERVER_MEMORY_SIZE)
+    {
+        length = FAKE_SERVER_MEMORY_START + FAKE_SERVER_MEMORY_SIZE - address;
+    }
+    if (length > FAKE_SERVER_PACKET_SIZE / 2 - 8)
+    {
+        length = FAKE_SERVER_PACKET_SIZE / 2 - 8;
+    }
+
+    std::string data((size_t) length, '\0');
+    std::string reply(binary ? "b" : "");
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = ReadByte(address + i);
+    }
+
+    m_stats.memoryReads++;
+    m_stats.memoryBytes += data.size();
+
+    if (binary)
+    {
+        RspCodec::AppendBinary(reply, data.data(), data.size());
+    }
+    else
+    {
+        RspCodec::AppendHex(reply, data.data(), data.size());
+    }
+
+    return reply;
+}
+
+std::string FakeGdbServer::WriteMemory(const std::string& payload, BOOL binary)
+{
+    size_t position = 1;
+    unsigned long long address;
+    unsigned long long length;
+    size_t colon = payload.find(':');
+    std::string data;
+
+    if (colon == std::string::npos || !RspCodec::ParseNumber(payload, position, address) || position >= payload.size() || payload[position++] != ','
+        || !RspCodec::ParseNumber(payload, position, length))
+        return "E01";
+
+    if (binary)
+    {
+        RspCodec::Decode(payload.data() + colon + 1, payload.size() - colon - 1, data);
+    }
+    else if (!RspCodec::DecodeHex(payload.data() + colon + 1, payload.size() - colon - 1, data))
+    {
+        return "E01";
+    }
+
+    if (data.size() != length || address < FAKE_SERVER_MEMORY_START || address + length > FAKE_SERVER_MEMORY_START + FAKE_SERVER_MEMORY_SIZE)
+        return "E14";
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        m_written[address + i] = data[i];
+    }
+
+    return "OK";
+}
+
+/// <summary>
+/// Processes single packet. Returns FALSE, when the connection should be closed.
+/// </summary>
+BOOL FakeGdbServer::Handle(const std::string& payload)
+{
+    m_stats.packets++;
+
+    if (payload.compare(0, 10, "qSupported") == 0)
+    {
+        char features[128];
+
+        sprintf_s(features, sizeof(features), "PacketSize=%x;QStartNoAckMode+%s", FAKE_SERVER_PACKET_SIZE, m_binary ? ";binary-upload+" : "");
+        return Reply(features);
+    }
+
+    if (payload == "QStartNoAckMode")
+    {
+        BOOL result = Reply("OK");
+        m_client.SetNoAck(TRUE);
+        return result;
+    }
+
+    if (payload.empty())
+        return Reply("");
+
+    switch (payload[0])
+    {
+        case '?':
+            return Reply("S05");
+
+        case 'g':
+        {
+            std::string registers;
+            for (int i = 0; i < FAKE_GDB_REGISTERS; i++)
+            {
+                unsigned long long value = i == 13 ? FAKE_SERVER_SP : i == 15 ? FAKE_SERVER_PC : (unsigned long long) i;
+                RspCodec::AppendHex(registers, reinterpret_cast<const char*>(&value), sizeof(value));
+            }
+            return Reply(registers);
+        }
+
+        case 'p':
+        {
+            std::string value;
+            unsigned long long zero = 0;
+            RspCodec::AppendHex(value, reinterpret_cast<const char*>(&zero), sizeof(zero));
+            return Reply(value);
+        }
+
+        case 'm':
+            return Reply(ReadMemory(payload, FALSE));
+
+        case 'x':
+            return Reply(m_binary ? ReadMemory(payload, TRUE) : std::string());
+
+        case 'M':
+            return Reply(WriteMemory(payload, FALSE));
+
+        case 'X':
+            return Reply(WriteMemory(payload, TRUE));
+
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+            return Reply("T05thread:01;");
+
+        case 'H':
+        case 'T':
+        case 'Z':
+        case 'z':
+            return Reply("OK");
+
+        case 'D':
+            Reply("OK");
+            return FALSE;
+
+        case 'k':
+            return FALSE;
+
+        case 'v':
+            if (payload == "vCont?")
+                return Reply("vCont;c;C;s;S");
+            if (payload.compare(0, 6, "vCont;") == 0)
+                return Reply("T05thread:01;");
+            return Reply("");
+
+        case 'q':
+            if (payload == "qC")
+                return Reply("QC01");
+            if (payload == "qAttached")
+                return Reply("1");
+            if (payload == "qfThreadInfo")
+                return Reply("m01");
+            if (payload == "qsThreadInfo")
+                return Reply("l");
+            if (payload == "qOffsets")
+                return Reply("Text=0;Data=0;Bss=0");
+            return Reply("");
+
+        default:
+            return Reply("");
+    }
+}
+
+BOOL FakeGdbServer::Run(RspSocket& listener)
+{
+    std::string payload;
+
+    if (!listener.Accept(m_client.GetSocket()))
+        return FALSE;
+
+    for (;;)
+    {
+        RspInputType type = m_client.Read(payload, INFINITE);
+
+        if (type == RspInputClosed)
+            break;
+
+        // the target stops immediately after each resume, so there is nothing to interrupt:
+        if (type == RspInputPacket && !Handle(payload))
+            break;
+    }
+
+    m_client.GetSocket().Close();
+    return TRUE;
+}
+
+int RunFakeGdbServer(int argc, _TCHAR* argv[])
+{
+    RspSocket listener;
+
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: --fake-gdbserver <port> (<delay-us>) (<binary: 0|1>)\n");
+        return 1;
+    }
+
+    if (!RspSocket::Startup() || !listener.Listen((unsigned short) _ttoi(argv[0])))
+    {
+        fprintf(stderr, "Unable to listen on port %d\n", _ttoi(argv[0]));
+        return 1;
+    }
+
+    FakeGdbServer server(argc >= 2 ? (unsigned long long) _ttoi(argv[1]) : 0, argc >= 3 ? _ttoi(argv[2]) != 0 : TRUE);
+    server.Run(listener);
+
+    const FakeGdbServerStats& stats = server.GetStats();
+    fprintf(stderr, "Packets: %llu, memory reads: %llu (%llu bytes)\n", stats.packets, stats.memoryReads, stats.memoryBytes);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AppendWord(std::string& output, unsigned long long value, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        output.push_back((char) (value >> (i * 8)));
+    }
+}
+
+static void AppendNote(std::string& output, const char* name, unsigned int type, const std::string& desc)
+{
+    size_t nameSize = strlen(name) + 1;
+
+    AppendWord(output, nameSize, 4);
+    AppendWord(output, desc.size(), 4);
+    AppendWord(output, type, 4);
+    output.append(name, nameSize);
+    output.append(((nameSize + 3) & ~3) - nameSize, '\0');
+    output.append(desc);
+    output.append(((desc.size() + 3) & ~3) - desc.size(), '\0');
+}
+
+/// <summary>
+/// Builds the stack of the thread with the chain of frames ([fp] - caller's fp, [fp + word] - return address)
+/// and returns its registers.
+/// </summary>
+static void BuildFakeStack(int index, size_t wordSize, std::string& stack, unsigned long long& pc, unsigned long long& sp, unsigned long long& fp)
+{
+    unsigned long long base = FAKE_CORE_STACK_START + index * FAKE_CORE_STACK_STRIDE;
+    unsigned long long code = FAKE_CORE_CODE_START + index * 0x1000;
+    int frames = FAKE_CORE_FRAMES(index);
+
+    stack.assign(FAKE_CORE_STACK_SIZE, '\0');
+    pc = code;
+    sp = base + FAKE_CORE_STACK_SIZE - 0x800;
+    fp = sp + 64;
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        unsigned long long current = fp + frame * 32;
+        unsigned long long caller = frame + 1 < frames ? current + 32 : 0;
+        std::string words;
+
+        AppendWord(words, caller, wordSize);
+        AppendWord(words, code + (frame + 1) * 0x10, wordSize);
+        stack.replace((size_t) (current - base), words.size(), words);
+    }
+}
+
+BOOL WriteFakeCore(LPCTSTR lpszPath, int threads, int megabytes, BOOL linuxCore, FakeCoreInfo& info)
+{
+    size_t wordSize = linuxCore ? 8 : 4;
+    size_t headerSize = linuxCore ? 64 : 52;
+    size_t programHeaderSize = linuxCore ? 56 : 32;
+    int crashed = threads / 2;
+    std::string notes;
+    std::vector<std::string> stacks(threads);
+
+    if (threads <= 0 || megabytes < 0)
+        return FALSE;
+
+    // notes with threads (the crashing one goes first on Linux):
+    if (!linuxCore)
+    {
+        AppendNote(notes, "QNX", 7, std::string(64, '\0'));
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        int index = linuxCore ? (i == 0 ? crashed : i <= crashed ? i - 1 : i) : i;
+        unsigned int id = linuxCore ? 1000 + index : index + 1;
+        int signal = index == crashed ? FAKE_CORE_SIGNAL : 0;
+        unsigned long long pc, sp, fp;
+        std::string status;
+        std::string registers;
+
+        BuildFakeStack(index, wordSize, stacks[index], pc, sp, fp);
+        if (index == crashed)
+        {
+            info.crashedId = id;
+            info.crashedPc = pc;
+            info.crashedFrames = FAKE_CORE_FRAMES(index) + 1;
+        }
+
+        if (linuxCore)
+        {
+            // elf_prstatus of x86-64 with user_regs_struct at 112:
+            status.assign(336, '\0');
+            status[0] = (char) signal;
+            status[12] = (char) signal;
+            AppendWord(registers, id, 4);
+            status.replace(32, 4, registers);
+            for (int reg = 0; reg < 27; reg++)
+            {
+                unsigned long long value = reg == 4 ? fp : reg == 16 ? pc : reg == 19 ? sp : reg == 17 ? 0x33 : reg == 18 ? 0x246 : reg == 20 ? 0x2b : (unsigned long long) reg;
+                registers.clear();
+                AppendWord(registers, value, 8);
+                status.replace(112 + reg * 8, 8, registers);
+            }
+            AppendNote(notes, "CORE", 1, status);
+
+            if (i == 0)
+            {
+                std::string auxv;
+                AppendWord(auxv, 6, 8);     // AT_PAGESZ
+                AppendWord(auxv, 4096, 8);
+                AppendWord(auxv, 9, 8);     // AT_ENTRY
+                AppendWord(auxv, FAKE_CORE_CODE_START, 8);
+                AppendWord(auxv, 0, 16);    // AT_NULL
+                AppendNote(notes, "CORE", 6, auxv);
+            }
+        }
+        else
+        {
+            // procfs_status: pid, tid, flags and the signal in 'what':
+            status.assign(64, '\0');
+            AppendWord(registers, 4242, 4);
+            AppendWord(registers, id, 4);
+            AppendWord(registers, index == crashed ? 0x80 : 0, 4);
+            AppendWord(registers, 0, 2);
+            AppendWord(registers, signal, 2);
+            status.replace(0, registers.size(), registers);
+            AppendNote(notes, "QNX", 8, status);
+
+            // ARM_CPU_REGISTERS: r0-r15 and spsr:
+            registers.clear();
+            for (int reg = 0; reg < 17; reg++)
+            {
+                AppendWord(registers, reg == 11 ? fp : reg == 13 ? sp : reg == 14 ? pc + 0x10 : reg == 15 ? pc : reg == 16 ? 0x10 : (unsigned long long) reg, 4);
+            }
+            AppendNote(notes, "QNX", 9, registers);
+        }
+    }
+
+    // segments: code of the binaries (not dumped), other memory and the stacks:
+    std::vector<CoreSegment> segments;
+    CoreSegment segment;
+    size_t count = 1 + megabytes + threads;
+    unsigned long long offset = (headerSize + (count + 1) * programHeaderSize + notes.size() + 0xFFF) & ~0xFFFULL;
+
+    segment.address = FAKE_CORE_CODE_START;
+    segment.memorySize = FAKE_CORE_STACK_STRIDE;
+    segment.offset = offset;
+    segment.fileSize = 0;
+    segments.push_back(segment);
+    for (int i = 0; i < megabytes + threads; i++)
+    {
+        segment.address = i < megabytes ? FAKE_CORE_DATA_START + i * (unsigned long long) FAKE_CORE_DATA_SEGMENT : FAKE_CORE_STACK_START + (i - megabytes) * FAKE_CORE_STACK_STRIDE;
+        segment.memorySize = i < megabytes ? FAKE_CORE_DATA_SEGMENT : FAKE_CORE_STACK_SIZE;
+        segment.offset = offset;
+        segment.fileSize = segment.memorySize;
+        segments.push_back(segment);
+        offset += segment.fileSize;
+    }
+
+    // ELF header:
+    std::string headers("\x7f" "ELF", 4);
+    headers.push_back(linuxCore ? 2 : 1);
+    headers.push_back(1);
+    headers.push_back(1);
+    headers.append(9, '\0');
+    AppendWord(headers, 4, 2);                      // ET_CORE
+    AppendWord(headers, linuxCore ? 62 : 40, 2);    // EM_X86_64 or EM_ARM
+    AppendWord(headers, 1, 4);
+    AppendWord(headers, 0, wordSize);
+    AppendWord(headers, headerSize, wordSize);
+    AppendWord(headers, 0, wordSize);
+    AppendWord(headers, linuxCore ? 0 : 0x05000000, 4);
+    AppendWord(headers, headerSize, 2);
+    AppendWord(headers, programHeaderSize, 2);
+    AppendWord(headers, count + 1, 2);
+    AppendWord(headers, 0, 6);
+
+    // program headers, the notes come first:
+    for (size_t i = 0; i <= count; i++)
+    {
+        unsigned int type = i == 0 ? 4 : 1;
+        unsigned long long segmentOffset = i == 0 ? headerSize + (count + 1) * programHeaderSize : segments[i - 1].offset;
+        unsigned long long address = i == 0 ? 0 : segments[i - 1].address;
+        unsigned long long fileSize = i == 0 ? notes.size() : segments[i - 1].fileSize;
+        unsigned long long memorySize = i == 0 ? 0 : segments[i - 1].memorySize;
+
+        AppendWord(headers, type, 4);
+        if (linuxCore)
+        {
+            AppendWord(headers, 6, 4);
+        }
+        AppendWord(headers, segmentOffset, wordSize);
+        AppendWord(headers, address, wordSize);
+        AppendWord(headers, 0, wordSize);
+        AppendWord(headers, fileSize, wordSize);
+        AppendWord(headers, memorySize, wordSize);
+        if (!linuxCore)
+        {
+            AppendWord(headers, 6, 4);
+        }
+        AppendWord(headers, i == 0 ? 4 : 0x1000, wordSize);
+    }
+    headers.append(notes);
+    headers.append((size_t) (segments[0].offset - headers.size()), '\0');
+
+    FILE* file = _tfopen(lpszPath, _T("wb"));
+    if (file == NULL)
+        return FALSE;
+
+    BOOL result = fwrite(headers.data(), 1, headers.size(), file) == headers.size();
+    std::string block;
+
+    for (int i = 0; i < megabytes && result; i++)
+    {
+        block.clear();
+        for (unsigned long long address = segments[i + 1].address; address < segments[i + 1].address + FAKE_CORE_DATA_SEGMENT; address += 4)
+        {
+            AppendWord(block, address, 4);
+        }
+        result = fwrite(block.data(), 1, block.size(), file) == block.size();
+    }
+    for (int i = 0; i < threads && result; i++)
+    {
+        result = fwrite(stacks[i].data(), 1, stacks[i].size(), file) == stacks[i].size();
+    }
+
+    result = fclose(file) == 0 && result;
+    info.size = offset;
+    return result;
+}
+
+int RunFakeCore(int argc, _TCHAR* argv[])
+{
+    FakeCoreInfo info;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: --fake-core <path> <threads> (<megabytes>) (<format: qnx|linux>)\n");
+        return 1;
+    }
+
+    BOOL linuxCore = argc >= 4 && _tcscmp(argv[3], _T("linux")) == 0;
+    if (!WriteFakeCore(argv[0], _ttoi(argv[1]), argc >= 3 ? _ttoi(argv[2]) : 0, linuxCore, info))
+    {
+        fprintf(stderr, "Unable to write the core file\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Core: %llu bytes, thread %u crashed at 0x%llx with %u frames\n", info.size, info.crashedId, info.crashedPc, (unsigned int) info.crashedFrames);
+    return 0;
+}
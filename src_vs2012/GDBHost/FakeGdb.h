@@ -0,0 +1,118 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "RspProtocol.h"
+
+#include <map>
+
+
+#define FAKE_GDB_REGISTERS          16
+#define FAKE_SERVER_PACKET_SIZE     0x4000
+#define FAKE_SERVER_MEMORY_START    0x10000ULL
+#define FAKE_SERVER_MEMORY_SIZE     (16 * 1024 * 1024ULL)
+#define FAKE_SERVER_PC              (FAKE_SERVER_MEMORY_START + 0x100)
+#define FAKE_SERVER_SP              (FAKE_SERVER_MEMORY_START + FAKE_SERVER_MEMORY_SIZE - 0x1000)
+#define FAKE_CORE_CODE_START        0x400000ULL
+#define FAKE_CORE_DATA_START        0x10000000ULL
+#define FAKE_CORE_DATA_SEGMENT      (1024 * 1024)
+#define FAKE_CORE_STACK_START       0x70000000ULL
+#define FAKE_CORE_STACK_SIZE        0x10000
+#define FAKE_CORE_STACK_STRIDE      0x100000
+#define FAKE_CORE_SIGNAL            11          // SIGSEGV
+#define FAKE_CORE_FRAMES(index)     (8 + (index) % 8)
+
+
+/// <summary>
+/// Stand-in for GDB, used to measure the host and the IDE without any device. It reads MI commands from
+/// standard input and either replays the replies from a session recorded by the host (MiRecorder):
+///   --fake-gdb replay <recording> (<speed-percent>)
+/// rewriting the tokens of results to the ones of received commands and keeping the recorded delays scaled by
+/// <speed-percent> (0 - no delays, default), or synthesizes replies of a target with given size:
+///   --fake-gdb synth <threads> <frames> <variables> (<delay-us>)
+/// Arguments start after the '--fake-gdb' switch.
+/// </summary>
+int RunFakeGdb(int argc, _TCHAR* argv[]);
+
+/// <summary>
+/// Statistics of the gdbserver stand-in.
+/// </summary>
+struct FakeGdbServerStats
+{
+    unsigned long long packets;
+    unsigned long long memoryReads;
+    unsigned long long memoryBytes;
+};
+
+/// <summary>
+/// Stand-in for gdbserver, used to measure the remote serial protocol proxy without any device.
+/// It serves single connection of single-threaded target with one mapped memory region, which content
+/// is derived from the address (unless written). Each reply is delayed to simulate slow link.
+/// </summary>
+class FakeGdbServer
+{
+private:
+    RspConnection m_client;
+    unsigned long long m_delay;
+    BOOL m_binary;
+    std::map<unsigned long long, char> m_written;
+    FakeGdbServerStats m_stats;
+
+    char ReadByte(unsigned long long address) const;
+    BOOL Reply(const std::string& payload);
+    BOOL Handle(const std::string& payload);
+    std::string ReadMemory(const std::string& payload, BOOL binary);
+    std::string WriteMemory(const std::string& payload, BOOL binary);
+
+public:
+    FakeGdbServer(unsigned long long delay, BOOL binary);
+
+    BOOL Run(RspSocket& listener);
+    const FakeGdbServerStats& GetStats() const { return m_stats; }
+};
+
+/// <summary>
+/// Describes the crash inside a synthesized core file, so readers of the core can be checked.
+/// </summary>
+struct FakeCoreInfo
+{
+    unsigned long long size;
+    unsigned int crashedId;
+    unsigned long long crashedPc;
+    size_t crashedFrames;           // including the one of the PC
+};
+
+/// <summary>
+/// Writes synthetic ELF core file of a QNX ARM process (or of a Linux x86-64 one) with given number of threads,
+/// each with its own stack holding a frame-pointer chain, and given amount of other memory. The thread in the
+/// middle is the one, that crashed. Together they form the corpus used to test and measure the core index.
+/// </summary>
+BOOL WriteFakeCore(LPCTSTR lpszPath, int threads, int megabytes, BOOL linuxCore, FakeCoreInfo& info);
+
+/// <summary>
+/// Runs the core writer as a tool:
+///   --fake-core <path> <threads> (<megabytes>) (<format: qnx|linux>)
+/// Arguments start after the '--fake-core' switch.
+/// </summary>
+int RunFakeCore(int argc, _TCHAR* argv[]);
+
+/// <summary>
+/// Runs the gdbserver stand-in as a tool:
+///   --fake-gdbserver <port> (<delay-us>) (<binary: 0|1>)
+/// Arguments start after the '--fake-gdbserver' switch.
+/// </summary>
+int RunFakeGdbServer(int argc, _TCHAR* argv[]);
@@ -0,0 +1,470 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// GDBPool.cpp : pool of pre-started GDB instances of the multi-session host.
+//
+
+#include "stdafx.h"
+#include "GDBPool.h"
+#include "MiParser.h"
+#include "Log.h"
+
+#include <string.h>
+
+
+/// <summary>
+/// Finds out, whether GDB has already printed its first prompt.
+/// </summary>
+class PromptDetector : public MiRecordObserver
+{
+public:
+    BOOL found;
+
+    PromptDetector() : found(FALSE) { }
+
+    virtual void OnRecord(const MiRecord& record)
+    {
+        if (record.type == MiRecordPrompt)
+        {
+            found = TRUE;
+        }
+    }
+};
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="loop">Loop, all idle instances are registered in.</param>
+/// <param name="idleTimeout">Time in seconds since the last request, after which the idle instances are closed.</param>
+/// <param name="memoryLimit">Max memory in MB of all idle instances together (0 means no limit).</param>
+GDBPool::GDBPool(HostLoop* loop, DWORD idleTimeout, DWORD memoryLimit)
+    : m_loop(loop), m_idleTimeout(idleTimeout * 1000000ULL), m_memoryLimit(memoryLimit * 1024ULL * 1024ULL), m_lastCheck(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+GDBPool::~GDBPool()
+{
+    Clear();
+}
+
+/// <summary>
+/// Closes all idle instances and forgets about all pools.
+/// </summary>
+void GDBPool::Clear()
+{
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        while (!m_pools[i]->idle.empty())
+        {
+            Discard(m_pools[i], m_pools[i]->idle.size() - 1, FALSE);
+        }
+        delete m_pools[i];
+    }
+    m_pools.clear();
+}
+
+GDBPool::Pool* GDBPool::Find(LPCTSTR lpszGdbCommand)
+{
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        if (m_pools[i]->command == lpszGdbCommand)
+            return m_pools[i];
+    }
+
+    return NULL;
+}
+
+BOOL GDBPool::FindEntry(HostWaitable handle, Pool** pool, size_t* index)
+{
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        for (size_t j = 0; j < m_pools[i]->idle.size(); j++)
+        {
+            GDBWrapper* gdb = m_pools[i]->idle[j]->gdb;
+            if (gdb->GetProcessHandle() == handle || gdb->GetOutputPipe() == handle || gdb->GetErrorPipe() == handle)
+            {
+                *pool = m_pools[i];
+                *index = j;
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+size_t GDBPool::GetIdleCount() const
+{
+    size_t result = 0;
+
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        result += m_pools[i]->idle.size();
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Sets the number of idle instances, that should be kept ready for given GDB command. Size 0 closes the pool.
+/// </summary>
+void GDBPool::Configure(LPCTSTR lpszGdbCommand, size_t size)
+{
+    Pool* pool = Find(lpszGdbCommand);
+
+    if (pool == NULL)
+    {
+        if (size == 0)
+            return;
+
+        pool = new Pool;
+        pool->command = lpszGdbCommand;
+        pool->nextStart = 0;
+        m_pools.push_back(pool);
+    }
+
+    pool->size = size;
+    pool->lastUsed = HostGetTimestamp();
+
+    while (pool->idle.size() > size)
+    {
+        Discard(pool, pool->idle.size() - 1, FALSE);
+    }
+}
+
+/// <summary>
+/// Hands out an idle instance started with given command. Returns NULL, if there is none.
+/// Caller becomes owner of the entry and must take over all its handles from the pool using
+/// HostLoop::SetHandler() and HostLoop::SetReadHandler() before returning to the loop.
+/// </summary>
+GDBPoolEntry* GDBPool::Acquire(LPCTSTR lpszGdbCommand)
+{
+    Pool* pool = Find(lpszGdbCommand);
+
+    if (pool != NULL)
+    {
+        pool->lastUsed = HostGetTimestamp();
+
+        // the most recently recycled instance most likely has the symbols of the next session already loaded:
+        for (size_t i = pool->idle.size(); i > 0; i--)
+        {
+            if (!pool->idle[i - 1]->symbolFile.empty())
+            {
+                GDBPoolEntry* entry = pool->idle[i - 1];
+
+                pool->idle.erase(pool->idle.begin() + i - 1);
+                m_stats.hits++;
+                m_stats.warmHits++;
+                return entry;
+            }
+        }
+
+        // prefer instances, that are already fully initialized:
+        for (size_t i = 0; i < pool->idle.size(); i++)
+        {
+            if (pool->idle[i]->promptTime != 0 || i == pool->idle.size() - 1)
+            {
+                GDBPoolEntry* entry = pool->idle[i];
+
+                pool->idle.erase(pool->idle.begin() + i);
+                m_stats.hits++;
+                return entry;
+            }
+        }
+    }
+
+    m_stats.misses++;
+    return NULL;
+}
+
+/// <summary>
+/// Takes back an instance, that was reset by a finished session, and keeps it for the next session
+/// started with the same command. Pool becomes owner of the entry and handles all its notifications again.
+/// </summary>
+void GDBPool::Release(GDBPoolEntry* entry)
+{
+    Pool* pool = Find(entry->command.c_str());
+
+    if (pool == NULL)
+    {
+        // recycled instances don't make the pool start any new ones:
+        pool = new Pool;
+        pool->command = entry->command;
+        pool->size = 0;
+        pool->nextStart = 0;
+        m_pools.push_back(pool);
+    }
+
+    pool->lastUsed = HostGetTimestamp();
+    pool->idle.push_back(entry);
+    m_stats.recycled++;
+
+    m_loop->SetHandler(entry->gdb->GetProcessHandle(), this);
+    m_loop->SetReadHandler(entry->gdb->GetOutputPipe(), this);
+    m_loop->SetReadHandler(entry->gdb->GetErrorPipe(), this);
+
+    // keep only the newest ones, the older have the least chance to be asked for:
+    while (pool->idle.size() > pool->size + POOL_MAX_RECYCLED)
+    {
+        Discard(pool, 0, FALSE);
+    }
+
+    // it might have exited meanwhile and its notification was already consumed by the session:
+    if (!entry->gdb->IsRunning())
+    {
+        Discard(pool, pool->idle.size() - 1, TRUE);
+    }
+}
+
+/// <summary>
+/// Records the time, the IDE had to wait for the first prompt of a new session.
+/// </summary>
+void GDBPool::AddPromptTime(BOOL hit, unsigned long long elapsed)
+{
+    GDBPromptStats& stats = hit ? m_stats.hitPrompt : m_stats.missPrompt;
+
+    stats.count++;
+    stats.total += elapsed;
+    if (elapsed > stats.max)
+    {
+        stats.max = elapsed;
+    }
+}
+
+/// <summary>
+/// Checks, if another instance should be started now for given pool.
+/// </summary>
+BOOL GDBPool::NeedsStart(Pool* pool, unsigned long long now)
+{
+    if (pool->idle.size() >= pool->size || now < pool->nextStart)
+        return FALSE;
+
+    // pool is not used anymore:
+    if (now - pool->lastUsed > m_idleTimeout)
+        return FALSE;
+
+    // assume, the new instance will need as much memory as the already running ones:
+    size_t count = GetIdleCount();
+    if (m_memoryLimit > 0 && count > 0 && m_stats.memoryUsage + m_stats.memoryUsage / count > m_memoryLimit)
+        return FALSE;
+
+    return TRUE;
+}
+
+/// <summary>
+/// Starts new idle instance and registers all its handles in the loop.
+/// </summary>
+BOOL GDBPool::Start(Pool* pool)
+{
+    GDBWrapper* gdb = new GDBWrapper(pool->command.c_str());
+
+    if (!gdb->StartProcess(GDB_START_OWN_PIPES | GDB_START_OWN_CONSOLE))
+    {
+        delete gdb;
+        pool->nextStart = HostGetTimestamp() + POOL_RETRY_DELAY * 1000ULL;
+        return FALSE;
+    }
+
+    GDBPoolEntry* entry = new GDBPoolEntry;
+    entry->gdb = gdb;
+    entry->command = pool->command;
+    entry->symbolSize = 0;
+    entry->symbolTime = 0;
+    entry->startTime = HostGetTimestamp();
+    entry->promptTime = 0;
+
+    pool->idle.push_back(entry);
+    m_stats.started++;
+
+    m_loop->Add(gdb->GetProcessHandle(), this);
+    m_loop->AddReader(gdb->GetOutputPipe(), this);
+    m_loop->AddReader(gdb->GetErrorPipe(), this);
+    return TRUE;
+}
+
+/// <summary>
+/// Closes the idle instance. Failed instance delays starting of its replacement.
+/// </summary>
+void GDBPool::Discard(Pool* pool, size_t index, BOOL failed)
+{
+    GDBPoolEntry* entry = pool->idle[index];
+    GDBWrapper* gdb = entry->gdb;
+
+    pool->idle.erase(pool->idle.begin() + index);
+    m_stats.discarded++;
+
+    if (failed)
+    {
+        LogPrint(_T("Pooled GDB failed"));
+        pool->nextStart = HostGetTimestamp() + POOL_RETRY_DELAY * 1000ULL;
+    }
+
+    m_loop->Remove(gdb->GetProcessHandle());
+    m_loop->RemoveReader(gdb->GetOutputPipe());
+    m_loop->RemoveReader(gdb->GetErrorPipe());
+    gdb->Shutdown();
+    delete gdb;
+    delete entry;
+}
+
+/// <summary>
+/// Closes instances of pools, that were not used for long time, and the ones over the memory limit.
+/// </summary>
+void GDBPool::Check()
+{
+    unsigned long long now = HostGetTimestamp();
+    Pool* largest = NULL;
+
+    m_lastCheck = now;
+    m_stats.memoryUsage = 0;
+
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        Pool* pool = m_pools[i];
+
+        if (now - pool->lastUsed > m_idleTimeout)
+        {
+            while (!pool->idle.empty())
+            {
+                Discard(pool, pool->idle.size() - 1, FALSE);
+            }
+        }
+
+        for (size_t j = 0; j < pool->idle.size(); j++)
+        {
+            m_stats.memoryUsage += pool->idle[j]->gdb->GetMemoryUsage();
+        }
+
+        if (largest == NULL || pool->idle.size() > largest->idle.size())
+        {
+            largest = pool;
+        }
+    }
+
+    if (m_memoryLimit > 0 && m_stats.memoryUsage > m_memoryLimit && largest != NULL && !largest->idle.empty())
+    {
+        LogPrint(_T("GDB pool over memory limit"));
+        Discard(largest, largest->idle.size() - 1, FALSE);
+    }
+}
+
+BOOL GDBPool::OnSignaled(HostWaitable waitable)
+{
+    Pool* pool;
+    size_t index;
+
+    if (FindEntry(waitable, &pool, &index) && !pool->idle[index]->gdb->IsRunning())
+    {
+        Discard(pool, index, TRUE);
+    }
+
+    return TRUE;
+}
+
+void GDBPool::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    Pool* pool;
+    size_t index;
+
+    if (!FindEntry(pipe, &pool, &index))
+        return;
+
+    GDBPoolEntry* entry = pool->idle[index];
+    if (pipe == entry->gdb->GetErrorPipe())
+    {
+        entry->errors.append(data, length);
+    }
+    else
+    {
+        entry->output.append(data, length);
+
+        if (entry->promptTime == 0)
+        {
+            PromptDetector detector;
+
+            MiParser::Parse(entry->output.data(), entry->output.size(), &detector);
+            if (detector.found)
+            {
+                entry->promptTime = HostGetTimestamp();
+            }
+        }
+    }
+
+    // nobody is going to use instance, that talks that much:
+    if (entry->output.size() + entry->errors.size() > POOL_MAX_BUFFERED_OUTPUT)
+    {
+        Discard(pool, index, TRUE);
+    }
+}
+
+void GDBPool::OnClosed(HostPipe pipe)
+{
+    Pool* pool;
+    size_t index;
+
+    if (FindEntry(pipe, &pool, &index))
+    {
+        Discard(pool, index, TRUE);
+    }
+}
+
+/// <summary>
+/// Gets the time till another instance should be started or the next periodic check.
+/// </summary>
+DWORD GDBPool::GetTimeout()
+{
+    if (m_pools.empty())
+        return INFINITE;
+
+    unsigned long long now = HostGetTimestamp();
+    unsigned long long next = m_lastCheck + POOL_CHECK_INTERVAL * 1000ULL;
+
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        if (NeedsStart(m_pools[i], now))
+            return 0;
+
+        if (m_pools[i]->idle.size() < m_pools[i]->size && m_pools[i]->nextStart > now && m_pools[i]->nextStart < next)
+        {
+            next = m_pools[i]->nextStart;
+        }
+    }
+
+    return next <= now ? 0 : (DWORD) ((next - now + 999) / 1000);
+}
+
+/// <summary>
+/// Refills the pools, one instance per pool at a time, so the loop is never blocked for long.
+/// </summary>
+BOOL GDBPool::OnTimeout()
+{
+    unsigned long long now = HostGetTimestamp();
+
+    if (now >= m_lastCheck + POOL_CHECK_INTERVAL * 1000ULL)
+    {
+        Check();
+    }
+
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        if (NeedsStart(m_pools[i], now))
+        {
+            Start(m_pools[i]);
+        }
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,128 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "GDBWrapper.h"
+#include "HostLoop.h"
+
+#include <string>
+#include <vector>
+
+
+#define POOL_DEFAULT_IDLE_TIMEOUT   600         // s, after the last request, when the idle GDB instances are closed
+#define POOL_DEFAULT_MEMORY_LIMIT   512         // MB, max memory of all idle GDB instances together (0 - no limit)
+#define POOL_CHECK_INTERVAL         1000        // ms
+#define POOL_RETRY_DELAY            5000        // ms, before starting another instance, when the previous one failed
+#define POOL_MAX_BUFFERED_OUTPUT    (256 * 1024)
+#define POOL_MAX_RECYCLED           4           // per GDB command, recycled instances kept over the configured pool size
+
+
+/// <summary>
+/// Already started GDB waiting inside the pool. Output it produced so far is buffered,
+/// so it can be passed to the IDE, once the instance is handed out.
+/// </summary>
+struct GDBPoolEntry
+{
+    GDBWrapper* gdb;
+    HostString command;
+    std::string output;
+    std::string errors;
+    std::string symbolFile;         // argument of -file-exec-and-symbols already loaded by recycled instance
+    unsigned long long symbolSize;  // and the stamp of the binary, when it was loaded
+    unsigned long long symbolTime;
+    unsigned long long startTime;
+    unsigned long long promptTime;  // 0, until the first prompt arrives
+};
+
+/// <summary>
+/// Time from receiving the request till the first prompt reached the IDE (in microseconds).
+/// </summary>
+struct GDBPromptStats
+{
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+};
+
+struct GDBPoolStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long started;
+    unsigned long long discarded;   // instances closed without being used (failed, expired or over memory limit)
+    unsigned long long recycled;    // instances returned by finished sessions
+    unsigned long long warmHits;    // hits served by recycled instances
+    unsigned long long memoryUsage; // bytes used by idle instances at the last check
+    GDBPromptStats hitPrompt;
+    GDBPromptStats missPrompt;
+};
+
+/// <summary>
+/// Pool of pre-started, idle GDB instances. Each pool is identified by the exact GDB command line
+/// (so by the NDK, architecture and arguments), and is refilled in the background after an instance is handed out.
+/// Until then, the pool itself handles all notifications of its instances.
+/// </summary>
+class GDBPool : public HostWaitHandler, public HostReadHandler, public HostTimerHandler
+{
+private:
+    struct Pool
+    {
+        HostString command;
+        size_t size;
+        std::vector<GDBPoolEntry*> idle;
+        unsigned long long lastUsed;
+        unsigned long long nextStart;
+    };
+
+    HostLoop* m_loop;
+    unsigned long long m_idleTimeout;   // us
+    unsigned long long m_memoryLimit;   // bytes
+    std::vector<Pool*> m_pools;
+    unsigned long long m_lastCheck;
+    GDBPoolStats m_stats;
+
+    Pool* Find(LPCTSTR lpszGdbCommand);
+    BOOL FindEntry(HostWaitable handle, Pool** pool, size_t* index);
+    BOOL NeedsStart(Pool* pool, unsigned long long now);
+    BOOL Start(Pool* pool);
+    void Discard(Pool* pool, size_t index, BOOL failed);
+    void Check();
+
+public:
+    GDBPool(HostLoop* loop, DWORD idleTimeout, DWORD memoryLimit);
+    virtual ~GDBPool();
+
+    void Configure(LPCTSTR lpszGdbCommand, size_t size);
+    GDBPoolEntry* Acquire(LPCTSTR lpszGdbCommand);
+    void Release(GDBPoolEntry* entry);
+    void AddPromptTime(BOOL hit, unsigned long long elapsed);
+    void Clear();
+
+    size_t GetIdleCount() const;
+    const GDBPoolStats& GetStats() const { return m_stats; }
+
+    // HostWaitHandler
+    virtual BOOL OnSignaled(HostWaitable waitable);
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+};
@@ -0,0 +1,660 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// GDBSession.cpp : single GDB instance of the multi-session host.
+//
+
+#include "stdafx.h"
+#include "GDBSession.h"
+#include "Log.h"
+#include "SymbolIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+struct GDBSessionSetting
+{
+    const char* command;            // followed by a space or the end of the line
+    const char* reset;              // restores the default, empty when nothing persists, NULL when it can't be restored
+};
+
+// commands changing the state GDB keeps for the next session (the first match wins):
+static const GDBSessionSetting SessionSettings[] =
+{
+    { "set var",                        "" },
+    { "set variable",                   "" },
+    { "-gdb-set breakpoint pending",    "-gdb-set breakpoint pending auto" },
+    { "set breakpoint pending",         "-gdb-set breakpoint pending auto" },
+    { "-gdb-set solib-search-path",     "-gdb-set solib-search-path" },
+    { "set solib-search-path",          "-gdb-set solib-search-path" },
+    { "-gdb-set sysroot",               "-gdb-set sysroot" },
+    { "set sysroot",                    "-gdb-set sysroot" },
+    { "-gdb-set solib-absolute-prefix", "-gdb-set sysroot" },
+    { "set solib-absolute-prefix",      "-gdb-set sysroot" },
+    { "-gdb-set auto-solib-add",        "-gdb-set auto-solib-add on" },
+    { "set auto-solib-add",             "-gdb-set auto-solib-add on" },
+    { "-gdb-set args",                  "-exec-arguments" },
+    { "set args",                       "-exec-arguments" },
+    { "-exec-arguments",                "-exec-arguments" },
+    { "-environment-directory",         "-environment-directory -r" },
+    { "directory",                      "-environment-directory -r" },
+    { "dir",                            "-environment-directory -r" },
+    { "-environment-path",              "-environment-path -r" },
+    { "path",                           "-environment-path -r" },
+    { "-gdb-set",                       NULL },
+    { "set",                            NULL },
+    { "-environment-cd",                NULL },
+    { "cd",                             NULL },
+    { "-interpreter-exec",              NULL },
+};
+
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="id">Unique identifier of the session, also used as channel number of its output.</param>
+/// <param name="loop">Loop, the session registers all its handles in.</param>
+/// <param name="listener">Owner notified, when the session finishes.</param>
+/// <param name="latency">Max time in ms, GDB output can wait inside the relay for the prompt.</param>
+/// <param name="framed">Sends the GDB output as frames with parsed MI records.</param>
+/// <param name="streamChunk">Max bytes of target output forwarded per interval (0 - unlimited).</param>
+/// <param name="interruptStats">Latency statistics of interrupts shared by all sessions.</param>
+GDBSession::GDBSession(int id, HostLoop* loop, GDBSessionListener* listener, DWORD latency, BOOL framed, size_t streamChunk, InterruptStats* interruptStats)
+    : m_id(id), m_loop(loop), m_listener(listener), m_gdb(NULL),
+      m_outputRelay(HostGetStdPipe(HOST_STDOUT), latency), m_errorRelay(HostGetStdPipe(HOST_STDERR), latency),
+      m_interruptTracker(interruptStats),
+      m_exited(FALSE), m_finished(FALSE), m_pooled(FALSE), m_ready(FALSE), m_targetRunning(FALSE), m_startTime(HostGetTimestamp()),
+      m_settingsLost(FALSE), m_symbolSize(0), m_symbolTime(0), m_pendingSymbolToken(MI_NO_TOKEN), m_symbolPending(FALSE), m_symbolReuses(0),
+      m_recycleState(GDBRecycleNone), m_recycleToken(MI_NO_TOKEN), m_recycleStart(0), m_recycled(NULL)
+{
+    m_outputRelay.SetChannel(id);
+    m_outputRelay.SetFramed(framed);
+    m_outputRelay.SetStreamChunk(streamChunk);
+    m_errorRelay.SetChannel(id);
+    m_outputRelay.AddObserver(this);
+    m_outputRelay.AddObserver(&m_interruptTracker);
+}
+
+GDBSession::~GDBSession()
+{
+    if (!m_finished)
+    {
+        Terminate();
+    }
+
+    // recycled instance, that nobody took over:
+    if (m_recycled != NULL)
+    {
+        m_loop->Remove(m_recycled->gdb->GetProcessHandle());
+        m_loop->RemoveReader(m_recycled->gdb->GetOutputPipe());
+        m_loop->RemoveReader(m_recycled->gdb->GetErrorPipe());
+        m_recycled->gdb->Shutdown();
+        delete m_recycled->gdb;
+        delete m_recycled;
+    }
+
+    delete m_gdb;
+}
+
+/// <summary>
+/// Opens event with given name or creates a new one, if it doesn't exist. Name '-' means no event.
+/// </summary>
+BOOL GDBSession::OpenEvent(HostEvent& event, LPCTSTR lpszName)
+{
+    if (lpszName == NULL || _tcscmp(lpszName, _T("-")) == 0)
+        return TRUE;
+
+    if (!event.Open(lpszName) && !event.Create(lpszName))
+        return FALSE;
+
+    return m_loop->Add(event.GetWaitable(), this);
+}
+
+/// <summary>
+/// Starts GDB and registers all its handles inside the loop.
+/// </summary>
+BOOL GDBSession::Start(LPCTSTR lpszGdbCommand, LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName)
+{
+    if (m_gdb != NULL)
+        return FALSE;
+
+    m_command = lpszGdbCommand;
+    m_gdb = new GDBWrapper(lpszGdbCommand);
+    if (!m_gdb->StartProcess(GDB_START_OWN_PIPES | GDB_START_OWN_CONSOLE))
+    {
+        m_finished = TRUE;
+        return FALSE;
+    }
+
+    return Attach(lpszCtrlCName, lpszTerminateName, NULL);
+}
+
+/// <summary>
+/// Takes over already running GDB from the pool and forwards everything it has printed so far.
+/// The entry itself remains owned by the caller.
+/// </summary>
+BOOL GDBSession::Adopt(GDBPoolEntry* entry, LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName)
+{
+    if (m_gdb != NULL || entry == NULL || entry->gdb == NULL)
+        return FALSE;
+
+    m_gdb = entry->gdb;
+    m_pooled = TRUE;
+    m_command = entry->command;
+    m_symbolFile = entry->symbolFile;
+    m_symbolSize = entry->symbolSize;
+    m_symbolTime = entry->symbolTime;
+    entry->gdb = NULL;
+
+    return Attach(lpszCtrlCName, lpszTerminateName, entry);
+}
+
+/// <summary>
+/// Registers all handles of the session inside the loop. Handles of GDB coming from the pool are already
+/// registered, so only their handler is changed.
+/// </summary>
+BOOL GDBSession::Attach(LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName, GDBPoolEntry* entry)
+{
+    if (!OpenEvent(m_ctrlC, lpszCtrlCName) || !OpenEvent(m_terminate, lpszTerminateName))
+    {
+        Terminate();
+        return FALSE;
+    }
+
+    if (entry != NULL)
+    {
+        m_loop->SetHandler(m_gdb->GetProcessHandle(), this);
+        m_loop->SetReadHandler(m_gdb->GetOutputPipe(), this);
+        m_loop->SetReadHandler(m_gdb->GetErrorPipe(), this);
+    }
+    else
+    {
+        m_loop->Add(m_gdb->GetProcessHandle(), this);
+        m_loop->AddReader(m_gdb->GetOutputPipe(), this);
+        m_loop->AddReader(m_gdb->GetErrorPipe(), this);
+    }
+
+    m_loop->AddTimer(&m_outputRelay);
+    m_loop->AddTimer(&m_errorRelay);
+
+    if (entry != NULL)
+    {
+        m_outputRelay.Feed(entry->output.data(), entry->output.size());
+        m_errorRelay.Feed(entry->errors.data(), entry->errors.size());
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Watches for the first prompt passing through the output relay and tracks the state, that has to be reset,
+/// when the session is recycled.
+/// </summary>
+void GDBSession::OnRecord(const MiRecord& record)
+{
+    if (m_recycleState != GDBRecycleNone)
+    {
+        OnRecycleRecord(record);
+        return;
+    }
+
+    if (!m_ready && record.type == MiRecordPrompt)
+    {
+        m_ready = TRUE;
+        if (m_listener != NULL)
+        {
+            m_listener->OnSessionReady(this, HostGetTimestamp() - m_startTime);
+        }
+    }
+
+    if (record.type == MiRecordExecAsync)
+    {
+        if (record.IsClass("running"))
+        {
+            m_targetRunning = TRUE;
+        }
+        else if (record.IsClass("stopped"))
+        {
+            m_targetRunning = FALSE;
+        }
+        return;
+    }
+
+    if (record.type != MiRecordResult)
+        return;
+
+    if (m_symbolPending && record.token == m_pendingSymbolToken)
+    {
+        m_symbolPending = FALSE;
+        if (record.IsClass("done") && SymbolIndexCache::GetArgumentStamp(m_pendingSymbolFile, m_symbolSize, m_symbolTime))
+        {
+            m_symbolFile = m_pendingSymbolFile;
+        }
+        return;
+    }
+
+    // only -var-create replies start with the name of the variable object (children are deleted with their parent):
+    if (record.IsClass("done") && record.resultsLength > 6 && memcmp(record.results, "name=\"", 6) == 0)
+    {
+        const char* end = static_cast<const char*>(memchr(record.results + 6, '"', record.resultsLength - 6));
+        if (end != NULL)
+        {
+            m_variables.insert(std::string(record.results + 6, end));
+        }
+    }
+}
+
+/// <summary>
+/// Remembers, which binary GDB is going to load. Returns TRUE, when the command was answered by the host,
+/// because the same unchanged binary is already loaded by the recycled GDB.
+/// </summary>
+BOOL GDBSession::TrackSymbols(const char* data, size_t length)
+{
+    static const char LoadCommand[] = "-file-exec-and-symbols";
+    unsigned int token = MI_NO_TOKEN;
+    size_t position = 0;
+
+    if (position < length && data[position] >= '0' && data[position] <= '9')
+    {
+        const char* p = data;
+
+        token = MiParser::ParseToken(p, data + length);
+        position = p - data;
+    }
+
+    std::string command(data + position, length - position);
+    while (!command.empty() && (command[command.size() - 1] == '\n' || command[command.size() - 1] == '\r' || command[command.size() - 1] == ' '))
+    {
+        command.erase(command.size() - 1);
+    }
+
+    if (command.compare(0, sizeof(LoadCommand) - 1, LoadCommand) != 0 || (command.size() >= sizeof(LoadCommand) && command[sizeof(LoadCommand) - 1] != ' '))
+    {
+        // anything else, that changes the loaded binaries:
+        if (command.compare(0, 11, "-file-exec-") == 0 || command.compare(0, 17, "-file-symbol-file") == 0)
+        {
+            m_symbolFile.clear();
+            m_symbolPending = FALSE;
+        }
+        return FALSE;
+    }
+
+    size_t argumentStart = command.find_first_not_of(' ', sizeof(LoadCommand) - 1);
+    std::string argument = argumentStart != std::string::npos ? command.substr(argumentStart) : std::string();
+    unsigned long long size;
+    unsigned long long time;
+
+    if (!argument.empty() && argument == m_symbolFile && SymbolIndexCache::GetArgumentStamp(argument, size, time)
+        && size == m_symbolSize && time == m_symbolTime)
+    {
+        char reply[64];
+
+        if (token != MI_NO_TOKEN)
+        {
+            sprintf_s(reply, sizeof(reply), "%u^done\n(gdb) \n", token);
+        }
+        else
+        {
+            sprintf_s(reply, sizeof(reply), "^done\n(gdb) \n");
+        }
+
+        m_symbolReuses++;
+        LogPrint(_T("Session reused loaded symbols"));
+        m_outputRelay.Inject(reply, strlen(reply));
+        return TRUE;
+    }
+
+    m_symbolFile.clear();
+    m_pendingSymbolFile = argument;
+    m_pendingSymbolToken = token;
+    m_symbolPending = TRUE;
+    return FALSE;
+}
+
+/// <summary>
+/// Remembers the commands, that restore the settings changed by the IDE to their defaults, before GDB is recycled.
+/// Settings without a known default prevent the session from being recycled at all.
+/// </summary>
+void GDBSession::TrackSettings(const char* data, size_t length)
+{
+    const char* end = data + length;
+    const char* p = data;
+
+    MiParser::ParseToken(p, end);
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+
+    for (size_t i = 0; i < _countof(SessionSettings); i++)
+    {
+        size_t commandLength = strlen(SessionSettings[i].command);
+
+        if ((size_t) (end - p) >= commandLength && memcmp(p, SessionSettings[i].command, commandLength) == 0
+            && (p + commandLength == end || p[commandLength] == ' ' || p[commandLength] == '\t' || p[commandLength] == '\r' || p[commandLength] == '\n'))
+        {
+            if (SessionSettings[i].reset == NULL)
+            {
+                m_settingsLost = TRUE;
+            }
+            else if (SessionSettings[i].reset[0] != '\0')
+            {
+                m_settingResets.insert(SessionSettings[i].reset);
+            }
+            return;
+        }
+    }
+}
+
+/// <summary>
+/// Passes the command to GDB standard input.
+/// </summary>
+BOOL GDBSession::Send(const char* data, size_t length)
+{
+    if (m_finished || m_recycleState != GDBRecycleNone)
+        return FALSE;
+
+    TrackSettings(data, length);
+    if (TrackSymbols(data, length))
+        return TRUE;
+
+    return m_gdb->WriteInput(data, length);
+}
+
+BOOL GDBSession::Interrupt()
+{
+    if (m_finished)
+        return FALSE;
+
+    m_interruptTracker.OnRequested();
+    BOOL result = m_gdb->Interrupt();
+    m_interruptTracker.OnDelivered(result);
+    return result;
+}
+
+/// <summary>
+/// Starts resetting GDB to the state right after loading the symbols: it detaches from the inferior and drops the
+/// connection, all breakpoints, variable objects and settings changed by the IDE. Output of the reset is not passed
+/// to the IDE. Once done, the session finishes and GDB can be taken over using TakeRecycled().
+/// Sessions, that changed settings which defaults are unknown, can't be recycled.
+/// </summary>
+BOOL GDBSession::Recycle()
+{
+    if (m_finished || m_exited || !m_ready || m_recycleState != GDBRecycleNone)
+        return FALSE;
+
+    if (m_settingsLost)
+    {
+        LogPrint(_T("Session changed GDB settings, that can't be restored, so it can't be recycled"));
+        return FALSE;
+    }
+
+    std::string script;
+    char line[256];
+    unsigned int token = SESSION_RECYCLE_TOKEN;
+
+    m_outputRelay.FlushAll();
+    m_errorRelay.FlushAll();
+
+    // GDB reads the commands only after the inferior stops:
+    if (m_targetRunning)
+    {
+        Interrupt();
+    }
+
+    for (std::set<std::string>::const_iterator it = m_variables.begin(); it != m_variables.end(); ++it)
+    {
+        if (it->size() < sizeof(line) - 32)
+        {
+            sprintf_s(line, sizeof(line), "%u-var-delete %s\n", token++, it->c_str());
+            script.append(line);
+        }
+    }
+
+    for (std::set<std::string>::const_iterator it = m_settingResets.begin(); it != m_settingResets.end(); ++it)
+    {
+        sprintf_s(line, sizeof(line), "%u%s\n", token++, it->c_str());
+        script.append(line);
+    }
+
+    sprintf_s(line, sizeof(line), "%u-break-delete\n%u-target-detach\n%u-target-disconnect\n", token, token + 1, token + 2);
+    script.append(line);
+
+    m_variables.clear();
+    m_settingResets.clear();
+    m_symbolPending = FALSE;
+    m_recycleToken = token + 2;
+    m_recycleState = GDBRecycleWaitResult;
+    m_recycleStart = HostGetTimestamp();
+    m_loop->AddTimer(this);
+
+    if (!m_gdb->WriteInput(script.data(), script.size()))
+    {
+        Terminate();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Follows the output of the reset commands, till GDB is ready for another session.
+/// </summary>
+void GDBSession::OnRecycleRecord(const MiRecord& record)
+{
+    if (m_recycleState == GDBRecycleWaitResult && record.type == MiRecordResult && record.token == m_recycleToken)
+    {
+        m_recycleState = GDBRecycleWaitPrompt;
+    }
+    else if (m_recycleState == GDBRecycleWaitPrompt && record.type == MiRecordPrompt)
+    {
+        m_recycleState = GDBRecycleDone;
+    }
+}
+
+/// <summary>
+/// Detaches GDB from the session and finishes it. The next session gets only the prompt, as if GDB was just started.
+/// </summary>
+void GDBSession::CompleteRecycle()
+{
+    unsigned long long now = HostGetTimestamp();
+    TCHAR text[64];
+
+    _stprintf_s(text, _countof(text), _T("Session recycled in %llu us"), now - m_recycleStart);
+    LogPrint(text);
+
+    m_recycled = new GDBPoolEntry;
+    m_recycled->gdb = m_gdb;
+    m_recycled->command = m_command;
+    m_recycled->output = "(gdb) \n";
+    m_recycled->symbolFile = m_symbolFile;
+    m_recycled->symbolSize = m_symbolSize;
+    m_recycled->symbolTime = m_symbolTime;
+    m_recycled->startTime = now;
+    m_recycled->promptTime = now;
+
+    // handles stay registered, so the new owner can take them over:
+    m_gdb = NULL;
+    Finish();
+}
+
+/// <summary>
+/// Hands over the GDB instance of finished recycled session. Caller becomes owner of the entry
+/// and must take over all its handles before returning to the loop. Returns NULL, if the session was not recycled.
+/// </summary>
+GDBPoolEntry* GDBSession::TakeRecycled()
+{
+    GDBPoolEntry* entry = m_recycled;
+
+    m_recycled = NULL;
+    return entry;
+}
+
+/// <summary>
+/// Kills GDB immediately, without waiting for its remaining output.
+/// </summary>
+void GDBSession::Terminate()
+{
+    if (m_finished)
+        return;
+
+    m_outputRelay.FlushAll();
+    m_errorRelay.FlushAll();
+    Finish();
+}
+
+/// <summary>
+/// Finishes the session, once GDB has exited and both its output streams are closed.
+/// </summary>
+void GDBSession::CheckFinished()
+{
+    if (m_exited && m_outputRelay.IsClosed() && m_errorRelay.IsClosed())
+    {
+        Finish();
+    }
+}
+
+void GDBSession::Finish()
+{
+    if (m_finished)
+        return;
+
+    m_finished = TRUE;
+
+    if (m_gdb != NULL)
+    {
+        m_loop->Remove(m_gdb->GetProcessHandle());
+        m_loop->RemoveReader(m_gdb->GetOutputPipe());
+        m_loop->RemoveReader(m_gdb->GetErrorPipe());
+        m_gdb->Shutdown();
+    }
+
+    if (m_ctrlC.GetWaitable() != INVALID_WAITABLE)
+    {
+        m_loop->Remove(m_ctrlC.GetWaitable());
+        m_ctrlC.Close();
+    }
+    if (m_terminate.GetWaitable() != INVALID_WAITABLE)
+    {
+        m_loop->Remove(m_terminate.GetWaitable());
+        m_terminate.Close();
+    }
+
+    m_loop->RemoveTimer(&m_outputRelay);
+    m_loop->RemoveTimer(&m_errorRelay);
+    m_loop->RemoveTimer(this);
+
+    if (m_listener != NULL)
+    {
+        m_listener->OnSessionFinished(this);
+    }
+}
+
+BOOL GDBSession::OnSignaled(HostWaitable waitable)
+{
+    if (waitable == m_ctrlC.GetWaitable())
+    {
+        LogPrint(_T("Session Ctrl-C"));
+        m_ctrlC.Consume();
+        Interrupt();
+        return TRUE;
+    }
+
+    if (waitable == m_terminate.GetWaitable())
+    {
+        LogPrint(_T("Session terminate"));
+        m_terminate.Consume();
+        Terminate();
+        return TRUE;
+    }
+
+    if (m_gdb != NULL && waitable == m_gdb->GetProcessHandle())
+    {
+        if (m_gdb->IsRunning())
+            return TRUE;
+
+        LogPrint(_T("Session GDB terminated"));
+        m_exited = TRUE;
+
+        // exit notification doesn't have to be delivered after the pipes get closed:
+        m_loop->Remove(waitable);
+        CheckFinished();
+        return TRUE;
+    }
+
+    return TRUE;
+}
+
+void GDBSession::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    if (m_recycleState != GDBRecycleNone)
+    {
+        if (m_gdb == NULL || pipe != m_gdb->GetOutputPipe())
+            return;
+
+        m_recycleOutput.append(data, length);
+        m_recycleOutput.erase(0, MiParser::Parse(m_recycleOutput.data(), m_recycleOutput.size(), this));
+
+        if (m_recycleState == GDBRecycleDone && !m_finished)
+        {
+            CompleteRecycle();
+        }
+        return;
+    }
+
+    if (pipe == m_gdb->GetOutputPipe())
+    {
+        m_outputRelay.Feed(data, length);
+    }
+    else
+    {
+        m_errorRelay.Feed(data, length);
+    }
+}
+
+void GDBSession::OnClosed(HostPipe pipe)
+{
+    if (pipe == m_gdb->GetOutputPipe())
+    {
+        m_outputRelay.OnClosed(pipe);
+    }
+    else
+    {
+        m_errorRelay.OnClosed(pipe);
+    }
+
+    m_loop->RemoveReader(pipe);
+    CheckFinished();
+}
+
+/// <summary>
+/// Gets the time left for GDB to finish resetting itself.
+/// </summary>
+DWORD GDBSession::GetTimeout()
+{
+    if (m_recycleState == GDBRecycleNone || m_finished)
+        return INFINITE;
+
+    unsigned long long elapsed = (HostGetTimestamp() - m_recycleStart) / 1000;
+    return elapsed >= SESSION_RECYCLE_TIMEOUT ? 0 : (DWORD) (SESSION_RECYCLE_TIMEOUT - elapsed);
+}
+
+BOOL GDBSession::OnTimeout()
+{
+    LogPrint(_T("Session recycling timed out"));
+    Terminate();
+    return TRUE;
+}
@@ -0,0 +1,148 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "GDBPool.h"
+#include "GDBWrapper.h"
+#include "HostLoop.h"
+#include "InterruptStats.h"
+#include "MiRelay.h"
+
+#include <set>
+#include <string>
+
+
+#define SESSION_RECYCLE_TOKEN       4000000000U // first token of commands resetting GDB, outside the range used by the IDE
+#define SESSION_RECYCLE_TIMEOUT     5000        // ms, GDB can spend resetting itself, before it's killed instead
+
+class GDBSession;
+
+/// <summary>
+/// Interface of the owner of sessions, notified when the session finishes.
+/// </summary>
+class GDBSessionListener
+{
+public:
+    virtual ~GDBSessionListener() { }
+
+    /// <summary>
+    /// Called once, when GDB has exited (and all its output was forwarded) or the session was terminated.
+    /// The session is already detached from the loop, but it must not be deleted from inside this notification.
+    /// </summary>
+    virtual void OnSessionFinished(GDBSession* session) = 0;
+
+    /// <summary>
+    /// Called once, when the first prompt of GDB was forwarded to the IDE.
+    /// </summary>
+    /// <param name="elapsed">Time in microseconds since the session was created.</param>
+    virtual void OnSessionReady(GDBSession* session, unsigned long long elapsed) = 0;
+};
+
+/// <summary>
+/// Progress of returning the session's GDB to a clean state.
+/// </summary>
+enum GDBRecycleState
+{
+    GDBRecycleNone = 0,
+    GDBRecycleWaitResult,           // reset commands were sent, waiting for the result of the last one
+    GDBRecycleWaitPrompt,           // waiting for the prompt following that result
+    GDBRecycleDone
+};
+
+/// <summary>
+/// Single GDB instance managed by the multi-session host. It owns the GDB process, its optional
+/// Ctrl-C and termination events and relays of GDB output, that are sent to the shared host output
+/// on the channel equal to the session ID.
+/// Instead of being killed, the session can be recycled: GDB detaches from the inferior, drops breakpoints,
+/// variable objects and changed settings, but keeps the symbols loaded, so it can be handed over to the next session
+/// started with the same command. Loading the same, unchanged binary again is then answered by the host.
+/// </summary>
+class GDBSession : public HostWaitHandler, public HostReadHandler, public HostTimerHandler, private MiRecordObserver
+{
+private:
+    int m_id;
+    HostLoop* m_loop;
+    GDBSessionListener* m_listener;
+    GDBWrapper* m_gdb;
+    HostEvent m_ctrlC;
+    HostEvent m_terminate;
+    MiRelay m_outputRelay;
+    MiRelay m_errorRelay;
+    InterruptTracker m_interruptTracker;
+    BOOL m_exited;
+    BOOL m_finished;
+    BOOL m_pooled;
+    BOOL m_ready;
+    BOOL m_targetRunning;
+    unsigned long long m_startTime;
+    HostString m_command;
+    std::set<std::string> m_variables;      // variable objects created by the IDE
+    std::set<std::string> m_settingResets;  // commands restoring defaults of the settings changed by the IDE
+    BOOL m_settingsLost;                    // some setting was changed and its default is unknown
+    std::string m_symbolFile;               // argument of the last successful -file-exec-and-symbols
+    unsigned long long m_symbolSize;        // and the stamp of that binary at that time
+    unsigned long long m_symbolTime;
+    std::string m_pendingSymbolFile;
+    unsigned int m_pendingSymbolToken;
+    BOOL m_symbolPending;
+    unsigned int m_symbolReuses;
+    GDBRecycleState m_recycleState;
+    unsigned int m_recycleToken;
+    unsigned long long m_recycleStart;
+    std::string m_recycleOutput;
+    GDBPoolEntry* m_recycled;
+
+    BOOL OpenEvent(HostEvent& event, LPCTSTR lpszName);
+    BOOL Attach(LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName, GDBPoolEntry* entry);
+    virtual void OnRecord(const MiRecord& record);
+    void OnRecycleRecord(const MiRecord& record);
+    void TrackSettings(const char* data, size_t length);
+    BOOL TrackSymbols(const char* data, size_t length);
+    void CompleteRecycle();
+    void CheckFinished();
+    void Finish();
+
+public:
+    GDBSession(int id, HostLoop* loop, GDBSessionListener* listener, DWORD latency, BOOL framed, size_t streamChunk, InterruptStats* interruptStats);
+    virtual ~GDBSession();
+
+    int GetId() const { return m_id; }
+    BOOL IsFinished() const { return m_finished; }
+    BOOL IsRunning() const { return !m_exited && !m_finished; }
+    BOOL IsPooled() const { return m_pooled; }
+    BOOL IsRecycling() const { return m_recycleState != GDBRecycleNone; }
+    unsigned int GetSymbolReuses() const { return m_symbolReuses; }
+
+    BOOL Start(LPCTSTR lpszGdbCommand, LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName);
+    BOOL Adopt(GDBPoolEntry* entry, LPCTSTR lpszCtrlCName, LPCTSTR lpszTerminateName);
+    BOOL Send(const char* data, size_t length);
+    BOOL Interrupt();
+    void Terminate();
+    BOOL Recycle();
+    GDBPoolEntry* TakeRecycled();
+
+    // HostWaitHandler
+    virtual BOOL OnSignaled(HostWaitable waitable);
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+};
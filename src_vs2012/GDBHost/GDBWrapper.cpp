@@ -20,11 +20,17 @@
 
 #include <strsafe.h>
 #include <process.h>
+#include <psapi.h>
 
 #include "GDBWrapper.h"
 #include "Log.h"
 
 
+#define GDB_PIPE_BUFFER_SIZE    (64 * 1024)
+
+#pragma comment(lib, "psapi.lib")
+
+
 /// <summary> 
 /// CTRL-C handler. 
 /// </summary>
@@ -47,10 +53,8 @@ static BOOL WINAPI GDBWrapperCtrlHandler(DWORD dwCtrlType)
 /// Constructor. 
 /// </summary>
 /// <param name="pcGDBCmd">String with full path and command to initialize GDB/MI.</param>
-/// <param name="eventCtrlC">Ctrl-C event handle</param>
-/// <param name="eventTerminate">Terminate event handle</param>
-GDBWrapper::GDBWrapper(LPCTSTR lpszGdbCommandpcGDBCmd, HANDLE hEventCtrlC, HANDLE hEventTerminate)
-    : m_lpszGdbCommand(NULL), m_eventCtrlC(hEventCtrlC), m_eventTerminate(hEventCtrlC), m_isClosed(FALSE), m_hProcess(NULL)
+GDBWrapper::GDBWrapper(LPCTSTR lpszGdbCommandpcGDBCmd)
+    : m_lpszGdbCommand(NULL), m_isClosed(FALSE), m_hProcess(NULL), m_processId(0), m_ownConsole(FALSE), m_inputPipe(NULL), m_outputPipe(NULL), m_errorPipe(NULL)
 {
     // Copy path to GDB
     if (lpszGdbCommandpcGDBCmd != NULL)
@@ -84,11 +88,80 @@ GDBWrapper::~GDBWrapper()
     LogPrint(_T("-~GDBWrapper"));
 }
 
-HANDLE GDBWrapper::GetProcessHandle()
+HostWaitable GDBWrapper::GetProcessHandle()
 {
     return m_hProcess;
 }
 
+/// <summary> 
+/// Sends Ctrl+C to all processes sharing the console, so also to GDB. Host itself ignores it. 
+/// When GDB runs inside own console, host temporarily attaches to it, as Ctrl+C can't be sent to other consoles.
+/// </summary>
+BOOL GDBWrapper::Interrupt()
+{
+    if (m_ownConsole)
+    {
+        FreeConsole();
+        if (!AttachConsole(m_processId))
+        {
+            PrintError(_T("AttachConsole"), GetLastError());
+            return FALSE;
+        }
+
+        // newly attached console resets the handler list, so ignore the signal again:
+        SetConsoleCtrlHandler(NULL, TRUE);
+    }
+
+    BOOL result = GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0);
+    if (!result)
+    {
+        PrintError(_T("GenerateConsoleCtrlEvent"), GetLastError());
+    }
+
+    if (m_ownConsole)
+    {
+        FreeConsole();
+    }
+
+    return result;
+}
+
+/// <summary> 
+/// Checks, if the GDB process is still alive. 
+/// </summary>
+BOOL GDBWrapper::IsRunning()
+{
+    return m_hProcess != NULL && WaitForSingleObject(m_hProcess, 0) == WAIT_TIMEOUT;
+}
+
+/// <summary> 
+/// Gets the size of the working set of GDB process in bytes. 
+/// </summary>
+unsigned long long GDBWrapper::GetMemoryUsage()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if (m_hProcess == NULL || !GetProcessMemoryInfo(m_hProcess, &counters, sizeof(counters)))
+        return 0;
+
+    return counters.WorkingSetSize;
+}
+
+/// <summary> 
+/// Gets the processor time (user and kernel) consumed by GDB process in microseconds. 
+/// </summary>
+unsigned long long GDBWrapper::GetCpuTime()
+{
+    FILETIME creation, exit, kernel, user;
+
+    if (m_hProcess == NULL || !GetProcessTimes(m_hProcess, &creation, &exit, &kernel, &user))
+        return 0;
+
+    // both are in 100ns units:
+    return ((((unsigned long long) kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime)
+            + (((unsigned long long) user.dwHighDateTime) << 32 | user.dwLowDateTime)) / 10;
+}
+
 /// <summary> 
 /// Shut down GDB Wrapper: Update variables and terminate GDBWrapper process. 
 /// </summary>
@@ -112,13 +185,66 @@ void GDBWrapper::Shutdown()
         m_hProcess = NULL;
     }
 
+    ClosePipes();
     LogPrint(_T("-shutdown"));
 }
 
+void GDBWrapper::ClosePipes()
+{
+    CloseInput();
+    HostClosePipe(m_outputPipe);
+    HostClosePipe(m_errorPipe);
+    m_outputPipe = NULL;
+    m_errorPipe = NULL;
+}
+
+/// <summary> 
+/// Passes data to GDB standard input. Available only, when the host owns GDB streams. 
+/// </summary>
+BOOL GDBWrapper::WriteInput(const char* data, size_t length)
+{
+    if (m_inputPipe == NULL)
+        return FALSE;
+
+    return HostWritePipe(m_inputPipe, data, length);
+}
+
+/// <summary> 
+/// Closes GDB standard input, so it will get EOF. 
+/// </summary>
+void GDBWrapper::CloseInput()
+{
+    HostClosePipe(m_inputPipe);
+    m_inputPipe = NULL;
+}
+
+/// <summary> 
+/// Creates pipe, where only the child's end is inheritable. 
+/// </summary>
+static BOOL CreateChildPipe(HANDLE* hRead, HANDLE* hWrite, BOOL childReads)
+{
+    SECURITY_ATTRIBUTES sa;
+
+    sa.nLength = sizeof(sa);
+    sa.lpSecurityDescriptor = NULL;
+    sa.bInheritHandle = TRUE;
+
+    if (!CreatePipe(hRead, hWrite, &sa, GDB_PIPE_BUFFER_SIZE))
+    {
+        PrintError(_T("CreatePipe"), GetLastError());
+        return FALSE;
+    }
+
+    SetHandleInformation(childReads ? *hWrite : *hRead, HANDLE_FLAG_INHERIT, 0);
+    return TRUE;
+}
+
 /// <summary> 
 /// Sets up STARTUPINFO structure and launches redirected child. 
 /// </summary>
-BOOL GDBWrapper::StartProcess()
+/// <param name="flags">GDB_START_OWN_PIPES - GDB std streams are connected to pipes owned by host, otherwise GDB uses host's own std handles;
+/// GDB_START_OWN_CONSOLE - GDB runs inside own hidden console.</param>
+BOOL GDBWrapper::StartProcess(DWORD flags)
 {
     if (m_hProcess != NULL)
     {
@@ -128,7 +254,7 @@ BOOL GDBWrapper::StartProcess()
     LPCTSTR lpApplicationName = NULL;
     PROCESS_INFORMATION pi;
     STARTUPINFO si;
-    DWORD flags = 0;
+    DWORD creationFlags = 0;
 
     // Set up the start up info struct.
     ZeroMemory(&pi, sizeof(pi));
@@ -141,19 +267,55 @@ BOOL GDBWrapper::StartProcess()
     si.hStdInput  = GetStdHandle(STD_INPUT_HANDLE);
     si.hStdError  = GetStdHandle(STD_ERROR_HANDLE);
 
-    // Use this if you want to hide the child:
-    //     si.wShowWindow = SW_HIDE;
-    // Note that dwFlags must include STARTF_USESHOWWINDOW if you want to
-    // use the wShowWindow flags.
+    HANDLE hChildInput = NULL;
+    HANDLE hChildOutput = NULL;
+    HANDLE hChildError = NULL;
+
+    if (flags & GDB_START_OWN_PIPES)
+    {
+        if (!CreateChildPipe(&hChildInput, &m_inputPipe, TRUE)
+            || !CreateChildPipe(&m_outputPipe, &hChildOutput, FALSE)
+            || !CreateChildPipe(&m_errorPipe, &hChildError, FALSE))
+        {
+            HostClosePipe(hChildInput);
+            HostClosePipe(hChildOutput);
+            HostClosePipe(hChildError);
+            ClosePipes();
+            return FALSE;
+        }
+
+        si.hStdInput  = hChildInput;
+        si.hStdOutput = hChildOutput;
+        si.hStdError  = hChildError;
+    }
+
+    // Hide the console of the child, if it gets own one:
+    if (flags & GDB_START_OWN_CONSOLE)
+    {
+        creationFlags |= CREATE_NEW_CONSOLE;
+        si.dwFlags |= STARTF_USESHOWWINDOW;
+        si.wShowWindow = SW_HIDE;
+    }
 
     // Launch the process
-    if (!CreateProcess(NULL, m_lpszGdbCommand, NULL, NULL, TRUE, flags, NULL, NULL, &si, &pi))
+    BOOL created = CreateProcess(NULL, m_lpszGdbCommand, NULL, NULL, TRUE, creationFlags, NULL, NULL, &si, &pi);
+    DWORD lastError = GetLastError();
+
+    // child's ends are not needed anymore, GDB has own copies:
+    HostClosePipe(hChildInput);
+    HostClosePipe(hChildOutput);
+    HostClosePipe(hChildError);
+
+    if (!created)
     {
-        ShowMessage(_T("CreateProcess"), GetLastError(), m_lpszGdbCommand);
+        ClosePipes();
+        ShowMessage(_T("CreateProcess"), lastError, m_lpszGdbCommand);
         return FALSE;
     }
 
     m_hProcess = pi.hProcess;
+    m_processId = pi.dwProcessId;
+    m_ownConsole = (flags & GDB_START_OWN_CONSOLE) != 0;
 
     if (!CloseHandle(pi.hThread))
     {
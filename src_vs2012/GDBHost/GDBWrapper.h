@@ -15,21 +15,51 @@
 #pragma once
 
 #include "stdafx.h"
+#include "HostLoop.h"
+
+#ifndef _WIN32
+#   include <sys/types.h>
+#endif
+
+// flags of GDBWrapper::StartProcess()
+#define GDB_START_OWN_PIPES         0x01    // GDB std streams are connected to pipes owned by the host
+#define GDB_START_OWN_CONSOLE       0x02    // GDB gets own hidden console (own session on POSIX), so it can be interrupted separately from other instances
 
 class GDBWrapper
 {
 private:
     BOOL   m_isClosed;
+#ifdef _WIN32
     HANDLE m_hProcess;
-    HANDLE m_eventCtrlC;
-    HANDLE m_eventTerminate;
+    DWORD  m_processId;
+    BOOL   m_ownConsole;
+#else
+    pid_t  m_pid;
+    int    m_exitFd;        // pidfd of the GDB process or signalfd for SIGCHLD, if pidfd is not supported by kernel
+    BOOL   m_exited;
+#endif
     TCHAR* m_lpszGdbCommand;
+    HostPipe m_inputPipe;   // host ends of GDB std streams, valid only when they are owned by host (relay mode)
+    HostPipe m_outputPipe;
+    HostPipe m_errorPipe;
+
+    void ClosePipes();
 
 public:
-    GDBWrapper(LPCTSTR lpszGdbCommand, HANDLE hEventCtrlC, HANDLE hEventTerminate);
+    GDBWrapper(LPCTSTR lpszGdbCommand);
     ~GDBWrapper();
 
-    HANDLE GetProcessHandle();
+    HostWaitable GetProcessHandle();
+    HostPipe GetOutputPipe() const { return m_outputPipe; }
+    HostPipe GetErrorPipe() const { return m_errorPipe; }
+
+    BOOL Interrupt();
+    BOOL IsRunning();
+    unsigned long long GetMemoryUsage();
+    unsigned long long GetCpuTime();
     void Shutdown();
-    BOOL StartProcess();
+    BOOL StartProcess(DWORD flags = 0);
+
+    BOOL WriteInput(const char* data, size_t length);
+    void CloseInput();
 };
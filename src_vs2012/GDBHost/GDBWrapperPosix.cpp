@@ -0,0 +1,444 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// GDBWrapperPosix.cpp : Linux implementation of running GDB as a child process (fork/exec),
+// that is interrupted by SIGINT and monitored via pidfd (or signalfd on older kernels).
+//
+
+#include "stdafx.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+
+#include "GDBWrapper.h"
+#include "Log.h"
+
+
+#define GDB_PIPE_BUFFER_SIZE    (1024 * 1024)
+
+
+/// <summary>
+/// SIGINT handler. The host must survive Ctrl+C, that is meant only for GDB.
+/// Not using SIG_IGN as it would be inherited by GDB.
+/// </summary>
+static void GDBWrapperCtrlHandler(int signal)
+{
+    (void) signal;
+}
+
+/// <summary>
+/// Splits the command line built by ConcatGdbCommand() back into arguments.
+/// Follows the Windows convention: double-quotes group, backslash escapes the quote.
+/// </summary>
+static void SplitCommandLine(LPCTSTR lpszCommand, std::vector<std::string>& args)
+{
+    std::string current;
+    BOOL inQuotes = FALSE;
+    BOOL hasArg = FALSE;
+
+    for (LPCTSTR p = lpszCommand; *p != '\0'; p++)
+    {
+        if (*p == '\\' && p[1] == '"')
+        {
+            current += '"';
+            hasArg = TRUE;
+            p++;
+        }
+        else if (*p == '"')
+        {
+            inQuotes = !inQuotes;
+            hasArg = TRUE;
+        }
+        else if ((*p == ' ' || *p == '\t') && !inQuotes)
+        {
+            if (hasArg)
+            {
+                args.push_back(current);
+                current.clear();
+                hasArg = FALSE;
+            }
+        }
+        else
+        {
+            current += *p;
+            hasArg = TRUE;
+        }
+    }
+
+    if (hasArg)
+    {
+        args.push_back(current);
+    }
+}
+
+/// <summary>
+/// Opens descriptor, which becomes readable, when the process exits.
+/// </summary>
+static int OpenProcessExitDescriptor(pid_t pid, const sigset_t* childMask)
+{
+#ifdef SYS_pidfd_open
+    int fd = (int) syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0)
+    {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+    }
+#else
+    (void) pid;
+#endif
+
+    // fallback for kernels older than 5.3; SIGCHLD is already blocked:
+    return signalfd(-1, childMask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="pcGDBCmd">String with full path and command to initialize GDB/MI.</param>
+GDBWrapper::GDBWrapper(LPCTSTR lpszGdbCommandpcGDBCmd)
+    : m_isClosed(FALSE), m_pid(-1), m_exitFd(-1), m_exited(FALSE), m_lpszGdbCommand(NULL),
+      m_inputPipe(-1), m_outputPipe(-1), m_errorPipe(-1)
+{
+    // Copy path to GDB
+    if (lpszGdbCommandpcGDBCmd != NULL)
+    {
+        m_lpszGdbCommand = strdup(lpszGdbCommandpcGDBCmd);
+    }
+
+    // Register own CTRL-C handler
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = GDBWrapperCtrlHandler;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGINT, &action, NULL) != 0)
+    {
+        PrintError(_T("sigaction"), errno);
+    }
+
+    // writing to GDB, that has just died, should fail instead of killing the host:
+    signal(SIGPIPE, SIG_IGN);
+}
+
+/// <summary>
+/// Destructor.
+/// </summary>
+GDBWrapper::~GDBWrapper()
+{
+    LogPrint(_T("+~GDBWrapper"));
+    if (!m_isClosed)
+    {
+        Shutdown();
+    }
+    LogPrint(_T("-~GDBWrapper"));
+}
+
+HostWaitable GDBWrapper::GetProcessHandle()
+{
+    return m_exitFd;
+}
+
+/// <summary>
+/// Delivers SIGINT directly to GDB.
+/// </summary>
+BOOL GDBWrapper::Interrupt()
+{
+    if (m_pid <= 0 || kill(m_pid, SIGINT) != 0)
+    {
+        PrintError(_T("kill"), errno);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Checks, if the GDB process is still alive. It also reaps the process, if it has just finished,
+/// as the signalfd-based exit descriptor is signaled by any child, not only by GDB.
+/// </summary>
+BOOL GDBWrapper::IsRunning()
+{
+    if (m_pid <= 0 || m_exited)
+        return FALSE;
+
+    struct signalfd_siginfo info;
+    while (read(m_exitFd, &info, sizeof(info)) == (ssize_t) sizeof(info))
+    {
+        // just drain, when it's a signalfd; pidfd doesn't support reading and fails immediately
+    }
+
+    int status;
+    if (waitpid(m_pid, &status, WNOHANG) == m_pid)
+    {
+        m_exited = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Gets the resident set size of GDB process in bytes.
+/// </summary>
+unsigned long long GDBWrapper::GetMemoryUsage()
+{
+    char path[64];
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+
+    if (m_pid <= 0 || m_exited)
+        return 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int) m_pid);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    if (fscanf(file, "%llu %llu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// <summary>
+/// Gets the processor time (user and system) consumed by GDB process in microseconds.
+/// </summary>
+unsigned long long GDBWrapper::GetCpuTime()
+{
+    char path[64];
+    char line[1024];
+    unsigned long long user = 0;
+    unsigned long long system = 0;
+
+    if (m_pid <= 0 || m_exited)
+        return 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) m_pid);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    size_t length = fread(line, 1, sizeof(line) - 1, file);
+    fclose(file);
+    line[length] = '\0';
+
+    // the executable name can contain spaces, so the fields are counted from its closing parenthesis:
+    const char* fields = strrchr(line, ')');
+    if (fields == NULL || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &user, &system) != 2)
+        return 0;
+
+    return (user + system) * 1000000ULL / sysconf(_SC_CLK_TCK);
+}
+
+/// <summary>
+/// Shut down GDB Wrapper: Update variables and terminate GDBWrapper process.
+/// </summary>
+void GDBWrapper::Shutdown()
+{
+    LogPrint(_T("+shutdown"));
+    m_isClosed = TRUE;
+
+    free(m_lpszGdbCommand);
+    m_lpszGdbCommand = NULL;
+
+    // Kill GDB process
+    if (m_pid > 0)
+    {
+        if (!m_exited)
+        {
+            int status;
+
+            kill(m_pid, SIGKILL);
+            waitpid(m_pid, &status, 0);
+            m_exited = TRUE;
+        }
+        m_pid = -1;
+    }
+
+    if (m_exitFd >= 0)
+    {
+        close(m_exitFd);
+        m_exitFd = -1;
+    }
+
+    ClosePipes();
+    LogPrint(_T("-shutdown"));
+}
+
+void GDBWrapper::ClosePipes()
+{
+    CloseInput();
+    HostClosePipe(m_outputPipe);
+    HostClosePipe(m_errorPipe);
+    m_outputPipe = -1;
+    m_errorPipe = -1;
+}
+
+/// <summary>
+/// Passes data to GDB standard input. Available only, when the host owns GDB streams.
+/// </summary>
+BOOL GDBWrapper::WriteInput(const char* data, size_t length)
+{
+    if (m_inputPipe < 0)
+        return FALSE;
+
+    return HostWritePipe(m_inputPipe, data, length);
+}
+
+/// <summary>
+/// Closes GDB standard input, so it will get EOF.
+/// </summary>
+void GDBWrapper::CloseInput()
+{
+    HostClosePipe(m_inputPipe);
+    m_inputPipe = -1;
+}
+
+/// <summary>
+/// Creates pipe with both ends closed on exec (dup2 of the child's end clears it in the child).
+/// </summary>
+static BOOL CreateChildPipe(int* readFd, int* writeFd)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        PrintError(_T("pipe2"), errno);
+        return FALSE;
+    }
+
+#ifdef F_SETPIPE_SZ
+    // bigger kernel buffer lets GDB dump large replies without waiting for the host:
+    fcntl(fds[1], F_SETPIPE_SZ, GDB_PIPE_BUFFER_SIZE);
+#endif
+
+    *readFd = fds[0];
+    *writeFd = fds[1];
+    return TRUE;
+}
+
+/// <summary>
+/// Forks and executes GDB, that inherits std handles of the host.
+/// </summary>
+/// <param name="flags">GDB_START_OWN_PIPES - GDB std streams are connected to pipes owned by host, otherwise GDB uses host's own std handles;
+/// GDB_START_OWN_CONSOLE - GDB runs in a new session, so it doesn't get signals from the host's terminal.</param>
+BOOL GDBWrapper::StartProcess(DWORD flags)
+{
+    if (m_pid > 0 || m_lpszGdbCommand == NULL)
+    {
+        return FALSE;
+    }
+
+    std::vector<std::string> args;
+    SplitCommandLine(m_lpszGdbCommand, args);
+    if (args.empty())
+    {
+        return FALSE;
+    }
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    }
+    argv.push_back(NULL);
+
+    int childInput = -1;
+    int childOutput = -1;
+    int childError = -1;
+
+    if (flags & GDB_START_OWN_PIPES)
+    {
+        if (!CreateChildPipe(&childInput, &m_inputPipe)
+            || !CreateChildPipe(&m_outputPipe, &childOutput)
+            || !CreateChildPipe(&m_errorPipe, &childError))
+        {
+            HostClosePipe(childInput);
+            HostClosePipe(childOutput);
+            HostClosePipe(childError);
+            ClosePipes();
+            return FALSE;
+        }
+    }
+
+    // block SIGCHLD, in case signalfd is the only way of getting the exit notification:
+    sigset_t childMask;
+    sigset_t previousMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &previousMask);
+
+    // Launch the process
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        int lastError = errno;
+
+        sigprocmask(SIG_SETMASK, &previousMask, NULL);
+        HostClosePipe(childInput);
+        HostClosePipe(childOutput);
+        HostClosePipe(childError);
+        ClosePipes();
+        ShowMessage(_T("fork"), lastError, m_lpszGdbCommand);
+        return FALSE;
+    }
+
+    if (pid == 0)
+    {
+        if (flags & GDB_START_OWN_CONSOLE)
+        {
+            setsid();
+        }
+
+        if (flags & GDB_START_OWN_PIPES)
+        {
+            dup2(childInput, STDIN_FILENO);
+            dup2(childOutput, STDOUT_FILENO);
+            dup2(childError, STDERR_FILENO);
+        }
+
+        signal(SIGPIPE, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &previousMask, NULL);
+        execvp(argv[0], &argv[0]);
+        _exit(127);
+    }
+
+    // child's ends are not needed anymore, GDB has own copies:
+    HostClosePipe(childInput);
+    HostClosePipe(childOutput);
+    HostClosePipe(childError);
+
+    m_pid = pid;
+    m_exited = FALSE;
+    m_exitFd = OpenProcessExitDescriptor(pid, &childMask);
+
+    if (m_exitFd < 0)
+    {
+        PrintError(_T("OpenProcessExitDescriptor"), errno);
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,79 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+
+
+// Minimal set of 32-bit atomic operations used by the lock-free structures of the host.
+// Visual Studio 2010 has no <atomic>, so they are mapped to Interlocked API on Windows and to GCC built-ins elsewhere.
+// All of them are full barriers, except the load, which has acquire semantics.
+
+#ifdef _WIN32
+typedef volatile LONG HostAtomic;
+
+inline LONG HostAtomicLoad(HostAtomic* value)
+{
+    return *value;  // volatile read has acquire semantics in MSVC
+}
+
+inline void HostAtomicStore(HostAtomic* value, LONG data)
+{
+    InterlockedExchange(value, data);
+}
+
+inline LONG HostAtomicExchange(HostAtomic* value, LONG data)
+{
+    return InterlockedExchange(value, data);
+}
+
+inline BOOL HostAtomicCompareExchange(HostAtomic* value, LONG expected, LONG data)
+{
+    return InterlockedCompareExchange(value, data, expected) == expected;
+}
+
+inline void HostAtomicIncrement(HostAtomic* value)
+{
+    InterlockedIncrement(value);
+}
+#else
+typedef volatile int HostAtomic;
+
+inline int HostAtomicLoad(HostAtomic* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+inline void HostAtomicStore(HostAtomic* value, int data)
+{
+    __atomic_store_n(value, data, __ATOMIC_SEQ_CST);
+}
+
+inline int HostAtomicExchange(HostAtomic* value, int data)
+{
+    return __atomic_exchange_n(value, data, __ATOMIC_SEQ_CST);
+}
+
+inline BOOL HostAtomicCompareExchange(HostAtomic* value, int expected, int data)
+{
+    return __atomic_compare_exchange_n(value, &expected, data, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+inline void HostAtomicIncrement(HostAtomic* value)
+{
+    __atomic_fetch_add(value, 1, __ATOMIC_SEQ_CST);
+}
+#endif
@@ -0,0 +1,153 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// HostLoop.cpp : platform independent part of the host wait-loop.
+//
+
+#include "stdafx.h"
+#include "HostLoop.h"
+
+
+int HostLoop::IndexOf(HostWaitable waitable) const
+{
+    for (size_t i = 0; i < m_waits.size(); i++)
+    {
+        if (m_waits[i]->waitable == waitable)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+int HostLoop::IndexOfReader(HostPipe pipe) const
+{
+    for (size_t i = 0; i < m_readers.size(); i++)
+    {
+        if (m_readers[i]->pipe == pipe)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+/// <summary>
+/// Changes the handler of already registered waitable, without touching the wait itself.
+/// </summary>
+BOOL HostLoop::SetHandler(HostWaitable waitable, HostWaitHandler* handler)
+{
+    int index = IndexOf(waitable);
+    if (index < 0 || handler == NULL)
+        return FALSE;
+
+    m_waits[index]->handler = handler;
+    return TRUE;
+}
+
+/// <summary>
+/// Changes the handler of already registered pipe. Unlike removing and adding the pipe again,
+/// it keeps the current reader, so no data can be lost or read twice.
+/// </summary>
+BOOL HostLoop::SetReadHandler(HostPipe pipe, HostReadHandler* handler)
+{
+    int index = IndexOfReader(pipe);
+    if (index < 0 || handler == NULL)
+        return FALSE;
+
+    m_readers[index]->handler = handler;
+    return TRUE;
+}
+
+/// <summary>
+/// Registers a handler, that wants to be called after some time.
+/// </summary>
+BOOL HostLoop::AddTimer(HostTimerHandler* handler)
+{
+    if (handler == NULL)
+        return FALSE;
+
+    for (size_t i = 0; i < m_timers.size(); i++)
+    {
+        if (m_timers[i] == handler)
+            return FALSE;
+    }
+
+    m_timers.push_back(handler);
+    return TRUE;
+}
+
+void HostLoop::RemoveTimer(HostTimerHandler* handler)
+{
+    for (size_t i = 0; i < m_timers.size(); i++)
+    {
+        if (m_timers[i] == handler)
+        {
+            m_timers.erase(m_timers.begin() + i);
+            return;
+        }
+    }
+}
+
+/// <summary>
+/// Gets the shortest time, the loop can wait, without delaying any of the timers.
+/// </summary>
+DWORD HostLoop::GetNextTimeout()
+{
+    DWORD result = INFINITE;
+
+    for (size_t i = 0; i < m_timers.size(); i++)
+    {
+        DWORD timeout = m_timers[i]->GetTimeout();
+        if (timeout < result)
+        {
+            result = timeout;
+        }
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Notifies all timers, which time has elapsed. Returns FALSE, when any of them wants the loop to stop.
+/// Timers can add or remove other timers, while being notified.
+/// </summary>
+BOOL HostLoop::DispatchTimers()
+{
+    std::vector<HostTimerHandler*> expired;
+    BOOL result = TRUE;
+
+    for (size_t i = 0; i < m_timers.size(); i++)
+    {
+        if (m_timers[i]->GetTimeout() == 0)
+        {
+            expired.push_back(m_timers[i]);
+        }
+    }
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        // skip the ones removed by previously notified timers:
+        BOOL registered = FALSE;
+        for (size_t j = 0; j < m_timers.size() && !registered; j++)
+        {
+            registered = m_timers[j] == expired[i];
+        }
+
+        if (registered && !expired[i]->OnTimeout())
+        {
+            result = FALSE;
+        }
+    }
+
+    return result;
+}
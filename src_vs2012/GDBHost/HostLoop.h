@@ -0,0 +1,218 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    typedef HANDLE HostWaitable;
+    typedef HANDLE HostPipe;
+#   define INVALID_WAITABLE         NULL
+#   define INVALID_PIPE             NULL
+#   define WAITABLE_FORMAT          _T("0x%p")
+#else
+    typedef int HostWaitable;
+    typedef int HostPipe;
+#   define INVALID_WAITABLE         (-1)
+#   define INVALID_PIPE             (-1)
+#   define WAITABLE_FORMAT          _T("fd %d")
+#   define INFINITE                 0xFFFFFFFF
+#endif
+
+#define LOOP_EVENTS_BATCH           64
+#define LOOP_READ_BUFFER_SIZE       (64 * 1024)
+
+#define HOST_STDIN                  0
+#define HOST_STDOUT                 1
+#define HOST_STDERR                 2
+
+typedef std::basic_string<TCHAR> HostString;
+
+/// <summary>
+/// Returns value of a monotonic, high-resolution clock in microseconds.
+/// </summary>
+unsigned long long HostGetTimestamp();
+
+/// <summary>
+/// Returns one of the standard handles of the host process (HOST_STDIN, HOST_STDOUT or HOST_STDERR).
+/// </summary>
+HostPipe HostGetStdPipe(int index);
+
+/// <summary>
+/// Writes whole buffer into the pipe, retrying on partial writes.
+/// </summary>
+BOOL HostWritePipe(HostPipe pipe, const void* data, size_t length);
+
+/// <summary>
+/// Closes the pipe.
+/// </summary>
+void HostClosePipe(HostPipe pipe);
+
+
+/// <summary>
+/// Interface notified by the HostLoop, when any of the registered waitables gets signaled.
+/// </summary>
+class HostWaitHandler
+{
+public:
+    virtual ~HostWaitHandler() { }
+
+    /// <summary>
+    /// Called from inside HostLoop::Run(), when given waitable is signaled.
+    /// Returning FALSE stops the loop.
+    /// </summary>
+    virtual BOOL OnSignaled(HostWaitable waitable) = 0;
+};
+
+/// <summary>
+/// Interface notified by the HostLoop, when data arrives on a registered pipe.
+/// All notifications are serialized with the ones of HostWaitHandler and HostTimerHandler,
+/// even if the platform reads the pipe on a separate thread.
+/// </summary>
+class HostReadHandler
+{
+public:
+    virtual ~HostReadHandler() { }
+
+    /// <summary>
+    /// Called, when new data is read from the pipe.
+    /// </summary>
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length) = 0;
+
+    /// <summary>
+    /// Called once, when the other side has closed the pipe or reading failed.
+    /// </summary>
+    virtual void OnClosed(HostPipe pipe) = 0;
+};
+
+/// <summary>
+/// Interface of the HostLoop clients, that need to be called after some time.
+/// </summary>
+class HostTimerHandler
+{
+public:
+    virtual ~HostTimerHandler() { }
+
+    /// <summary>
+    /// Returns the number of milliseconds, after which OnTimeout() should be called or INFINITE.
+    /// It's queried each time, before the loop starts waiting.
+    /// </summary>
+    virtual DWORD GetTimeout() = 0;
+
+    /// <summary>
+    /// Called, when the requested time elapsed. Returning FALSE stops the loop.
+    /// </summary>
+    virtual BOOL OnTimeout() = 0;
+};
+
+/// <summary>
+/// Named, auto-reset event used to trigger actions inside the host from outside world.
+/// On Windows it is a global kernel event. On POSIX systems it is either a FIFO
+/// (name is a path or a file inside $TMPDIR) or an inherited eventfd (name is a number).
+/// </summary>
+class HostEvent
+{
+private:
+    HostWaitable m_waitable;
+#ifndef _WIN32
+    TCHAR* m_lpszFifoPath;  // not NULL only, when the FIFO was created by this instance
+#endif
+
+public:
+    HostEvent();
+    ~HostEvent();
+
+    BOOL Open(LPCTSTR lpszName);
+    BOOL Create(LPCTSTR lpszName);
+    void Close();
+
+    void Signal();
+    void Consume();
+    HostWaitable GetWaitable() const { return m_waitable; }
+};
+
+/// <summary>
+/// Platform specific wait-loop, that dispatches signaled waitables, incoming pipe data and timers to their handlers.
+/// On Windows waitables are monitored by thread-pool waits and pipes by a reader thread each, all reporting back
+/// to the loop thread, so there is no 64 handles limit of WaitForMultipleObjects(). On Linux it's an epoll loop.
+/// </summary>
+class HostLoop
+{
+private:
+    struct Wait
+    {
+        HostLoop* loop;
+        HostWaitable waitable;
+        HostWaitHandler* handler;
+#ifdef _WIN32
+        HANDLE hWait;
+#endif
+    };
+
+    struct Reader
+    {
+        HostLoop* loop;
+        HostPipe pipe;
+        HostReadHandler* handler;
+#ifdef _WIN32
+        HANDLE hThread;
+#endif
+    };
+
+    std::vector<Wait*> m_waits;
+    std::vector<Reader*> m_readers;
+    std::vector<HostTimerHandler*> m_timers;
+    BOOL m_stopped;
+#ifdef _WIN32
+    CRITICAL_SECTION m_lock;        // serializes all notifications
+    CRITICAL_SECTION m_queueLock;   // guards the list of signaled waits
+    std::vector<Wait*> m_signaled;
+    HANDLE m_wakeEvent;
+    BOOL m_closing;
+
+    BOOL ArmWait(Wait* wait);
+    static VOID CALLBACK WaitCallback(PVOID lpParameter, BOOLEAN timerOrWaitFired);
+    static DWORD WINAPI ReaderThread(LPVOID lpParameter);
+#else
+    int m_epoll;
+    char* m_buffer;
+
+    void DispatchRead(Reader* reader);
+#endif
+
+    int IndexOf(HostWaitable waitable) const;
+    int IndexOfReader(HostPipe pipe) const;
+    DWORD GetNextTimeout();
+    BOOL DispatchTimers();
+
+public:
+    HostLoop();
+    ~HostLoop();
+
+    BOOL Add(HostWaitable waitable, HostWaitHandler* handler);
+    void Remove(HostWaitable waitable);
+    BOOL AddReader(HostPipe pipe, HostReadHandler* handler);
+    void RemoveReader(HostPipe pipe);
+    BOOL SetHandler(HostWaitable waitable, HostWaitHandler* handler);
+    BOOL SetReadHandler(HostPipe pipe, HostReadHandler* handler);
+    BOOL AddTimer(HostTimerHandler* handler);
+    void RemoveTimer(HostTimerHandler* handler);
+
+    BOOL Run();
+    void Stop();
+};
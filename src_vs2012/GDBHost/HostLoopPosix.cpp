@@ -0,0 +1,426 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// HostLoopPosix.cpp : Linux implementation of the host events (FIFO/eventfd) and epoll wait-loop.
+//
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+
+unsigned long long HostGetTimestamp()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+HostPipe HostGetStdPipe(int index)
+{
+    return index;
+}
+
+BOOL HostWritePipe(HostPipe pipe, const void* data, size_t length)
+{
+    const char* buffer = static_cast<const char*>(data);
+
+    while (length > 0)
+    {
+        ssize_t written = write(pipe, buffer, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+
+    return TRUE;
+}
+
+void HostClosePipe(HostPipe pipe)
+{
+    if (pipe >= 0)
+    {
+        close(pipe);
+    }
+}
+
+/// <summary>
+/// Checks, if the event name is a number, so it's an inherited file descriptor.
+/// </summary>
+static BOOL IsDescriptorName(LPCTSTR lpszName)
+{
+    if (lpszName == NULL || lpszName[0] == '\0')
+        return FALSE;
+
+    for (LPCTSTR p = lpszName; *p != '\0'; p++)
+    {
+        if (*p < '0' || *p > '9')
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Builds the FIFO path for given event name. Names without any slash are placed inside the $TMPDIR.
+/// </summary>
+static void GetFifoPath(LPCTSTR lpszName, TCHAR* path, size_t length)
+{
+    if (strchr(lpszName, '/') != NULL)
+    {
+        snprintf(path, length, "%s", lpszName);
+    }
+    else
+    {
+        const char* tmpDir = getenv("TMPDIR");
+        snprintf(path, length, "%s/%s", tmpDir != NULL && tmpDir[0] != '\0' ? tmpDir : "/tmp", lpszName);
+    }
+}
+
+HostEvent::HostEvent()
+    : m_waitable(INVALID_WAITABLE), m_lpszFifoPath(NULL)
+{
+}
+
+HostEvent::~HostEvent()
+{
+    Close();
+}
+
+/// <summary>
+/// Opens existing FIFO or takes over an inherited eventfd descriptor.
+/// </summary>
+BOOL HostEvent::Open(LPCTSTR lpszName)
+{
+    Close();
+
+    if (IsDescriptorName(lpszName))
+    {
+        int fd = atoi(lpszName);
+        if (fcntl(fd, F_GETFD) < 0)
+            return FALSE;
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        m_waitable = fd;
+        return TRUE;
+    }
+
+    TCHAR path[_MAX_PATH];
+    struct stat info;
+
+    GetFifoPath(lpszName, path, _countof(path));
+    if (stat(path, &info) != 0 || !S_ISFIFO(info.st_mode))
+        return FALSE;
+
+    // open for both reading and writing, so the FIFO never reports EOF, when the last writer goes away:
+    m_waitable = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    return m_waitable >= 0;
+}
+
+/// <summary>
+/// Creates new FIFO with specified name (or anonymous eventfd, if name is empty).
+/// </summary>
+BOOL HostEvent::Create(LPCTSTR lpszName)
+{
+    Close();
+
+    if (lpszName == NULL || lpszName[0] == '\0')
+    {
+        m_waitable = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return m_waitable >= 0;
+    }
+
+    if (IsDescriptorName(lpszName))
+        return FALSE;
+
+    TCHAR path[_MAX_PATH];
+    GetFifoPath(lpszName, path, _countof(path));
+
+    if (mkfifo(path, 0600) != 0 && errno != EEXIST)
+        return FALSE;
+
+    m_waitable = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (m_waitable < 0)
+    {
+        unlink(path);
+        return FALSE;
+    }
+
+    m_lpszFifoPath = strdup(path);
+    return TRUE;
+}
+
+void HostEvent::Close()
+{
+    if (m_waitable >= 0)
+    {
+        close(m_waitable);
+        m_waitable = INVALID_WAITABLE;
+    }
+
+    if (m_lpszFifoPath != NULL)
+    {
+        unlink(m_lpszFifoPath);
+        free(m_lpszFifoPath);
+        m_lpszFifoPath = NULL;
+    }
+}
+
+void HostEvent::Signal()
+{
+    if (m_waitable < 0)
+        return;
+
+    // eventfd requires 8-byte counter value, while for FIFO any data is good enough:
+    unsigned long long value = 1;
+    ssize_t written = write(m_waitable, &value, sizeof(value));
+    (void) written;
+}
+
+/// <summary>
+/// Drains all pending signals, so the event gets back into non-signaled state.
+/// </summary>
+void HostEvent::Consume()
+{
+    char buffer[64];
+
+    if (m_waitable < 0)
+        return;
+
+    while (read(m_waitable, buffer, sizeof(buffer)) > 0)
+    {
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+HostLoop::HostLoop()
+    : m_stopped(FALSE)
+{
+    m_buffer = new char[LOOP_READ_BUFFER_SIZE];
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0)
+    {
+        PrintError(_T("epoll_create1"), errno);
+    }
+}
+
+HostLoop::~HostLoop()
+{
+    for (size_t i = 0; i < m_waits.size(); i++)
+    {
+        delete m_waits[i];
+    }
+
+    for (size_t i = 0; i < m_readers.size(); i++)
+    {
+        delete m_readers[i];
+    }
+
+    if (m_epoll >= 0)
+    {
+        close(m_epoll);
+    }
+
+    delete[] m_buffer;
+}
+
+/// <summary>
+/// Adds the descriptor into the epoll set.
+/// </summary>
+static BOOL WatchDescriptor(int epoll, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        PrintError(_T("epoll_ctl"), errno);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Registers new file descriptor to be monitored by the loop for readability.
+/// </summary>
+BOOL HostLoop::Add(HostWaitable waitable, HostWaitHandler* handler)
+{
+    if (m_epoll < 0 || waitable < 0 || handler == NULL || IndexOf(waitable) >= 0 || IndexOfReader(waitable) >= 0)
+        return FALSE;
+
+    if (!WatchDescriptor(m_epoll, waitable))
+        return FALSE;
+
+    Wait* wait = new Wait;
+    wait->loop = this;
+    wait->waitable = waitable;
+    wait->handler = handler;
+    m_waits.push_back(wait);
+    return TRUE;
+}
+
+void HostLoop::Remove(HostWaitable waitable)
+{
+    int index = IndexOf(waitable);
+    if (index < 0)
+        return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, waitable, NULL);
+    delete m_waits[index];
+    m_waits.erase(m_waits.begin() + index);
+}
+
+/// <summary>
+/// Registers a pipe, which incoming data should be passed to the handler.
+/// </summary>
+BOOL HostLoop::AddReader(HostPipe pipe, HostReadHandler* handler)
+{
+    if (m_epoll < 0 || pipe < 0 || handler == NULL || IndexOfReader(pipe) >= 0 || IndexOf(pipe) >= 0)
+        return FALSE;
+
+    if (!WatchDescriptor(m_epoll, pipe))
+        return FALSE;
+
+    Reader* reader = new Reader;
+    reader->loop = this;
+    reader->pipe = pipe;
+    reader->handler = handler;
+    m_readers.push_back(reader);
+    return TRUE;
+}
+
+void HostLoop::RemoveReader(HostPipe pipe)
+{
+    int index = IndexOfReader(pipe);
+    if (index < 0)
+        return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, pipe, NULL);
+    delete m_readers[index];
+    m_readers.erase(m_readers.begin() + index);
+}
+
+/// <summary>
+/// Reads available data from the pipe (single read never blocks, as epoll reported it readable)
+/// and passes it to the handler.
+/// </summary>
+void HostLoop::DispatchRead(Reader* reader)
+{
+    ssize_t count;
+
+    do
+    {
+        count = read(reader->pipe, m_buffer, LOOP_READ_BUFFER_SIZE);
+    }
+    while (count < 0 && errno == EINTR);
+
+    if (count > 0)
+    {
+        reader->handler->OnRead(reader->pipe, m_buffer, count);
+        return;
+    }
+
+    if (count < 0 && errno == EAGAIN)
+        return;
+
+    HostPipe pipe = reader->pipe;
+    HostReadHandler* handler = reader->handler;
+
+    RemoveReader(pipe);
+    handler->OnClosed(pipe);
+}
+
+/// <summary>
+/// Waits for any of the registered descriptors and notifies its handler,
+/// until Stop() is called or any handler returns FALSE.
+/// </summary>
+BOOL HostLoop::Run()
+{
+    struct epoll_event events[LOOP_EVENTS_BATCH];
+
+    if (m_epoll < 0)
+        return FALSE;
+
+    m_stopped = FALSE;
+
+    while (!m_stopped)
+    {
+        DWORD timeout = GetNextTimeout();
+
+        LogPrint(_T("epoll_wait"));
+        int count = epoll_wait(m_epoll, events, _countof(events), timeout == INFINITE ? -1 : (int) timeout);
+
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            PrintError(_T("epoll_wait"), errno);
+            return FALSE;
+        }
+
+        for (int i = 0; i < count && !m_stopped; i++)
+        {
+            // handler could be already removed by previously dispatched one:
+            int index = IndexOfReader(events[i].data.fd);
+            if (index >= 0)
+            {
+                DispatchRead(m_readers[index]);
+                continue;
+            }
+
+            index = IndexOf(events[i].data.fd);
+            if (index < 0)
+                continue;
+
+            if (!m_waits[index]->handler->OnSignaled(m_waits[index]->waitable))
+            {
+                m_stopped = TRUE;
+            }
+        }
+
+        if (!m_stopped && !DispatchTimers())
+        {
+            m_stopped = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+void HostLoop::Stop()
+{
+    m_stopped = TRUE;
+}
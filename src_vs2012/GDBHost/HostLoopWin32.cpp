@@ -0,0 +1,444 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// HostLoopWin32.cpp : Win32 implementation of the host events and wait-loop.
+//
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "Log.h"
+
+
+unsigned long long HostGetTimestamp()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    QueryPerformanceCounter(&now);
+    return (unsigned long long) (now.QuadPart / frequency.QuadPart) * 1000000ULL
+         + (unsigned long long) (now.QuadPart % frequency.QuadPart) * 1000000ULL / frequency.QuadPart;
+}
+
+HostPipe HostGetStdPipe(int index)
+{
+    switch (index)
+    {
+        case HOST_STDIN:
+            return GetStdHandle(STD_INPUT_HANDLE);
+        case HOST_STDOUT:
+            return GetStdHandle(STD_OUTPUT_HANDLE);
+        case HOST_STDERR:
+            return GetStdHandle(STD_ERROR_HANDLE);
+        default:
+            return NULL;
+    }
+}
+
+BOOL HostWritePipe(HostPipe pipe, const void* data, size_t length)
+{
+    const char* buffer = static_cast<const char*>(data);
+
+    while (length > 0)
+    {
+        DWORD written = 0;
+        if (!WriteFile(pipe, buffer, (DWORD) length, &written, NULL))
+            return FALSE;
+
+        buffer += written;
+        length -= written;
+    }
+
+    return TRUE;
+}
+
+void HostClosePipe(HostPipe pipe)
+{
+    if (pipe != NULL && pipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(pipe);
+    }
+}
+
+HostEvent::HostEvent()
+    : m_waitable(INVALID_WAITABLE)
+{
+}
+
+HostEvent::~HostEvent()
+{
+    Close();
+}
+
+/// <summary>
+/// Opens existing global event with specified name.
+/// </summary>
+BOOL HostEvent::Open(LPCTSTR lpszName)
+{
+    Close();
+    m_waitable = OpenEventW(EVENT_ALL_ACCESS, TRUE, lpszName);
+    return m_waitable != NULL;
+}
+
+/// <summary>
+/// Creates new auto-reset event with specified name.
+/// </summary>
+BOOL HostEvent::Create(LPCTSTR lpszName)
+{
+    Close();
+    m_waitable = CreateEvent(NULL, FALSE, FALSE, lpszName);
+    return m_waitable != NULL;
+}
+
+void HostEvent::Close()
+{
+    if (m_waitable != NULL)
+    {
+        CloseHandle(m_waitable);
+        m_waitable = NULL;
+    }
+}
+
+void HostEvent::Signal()
+{
+    if (m_waitable != NULL)
+    {
+        SetEvent(m_waitable);
+    }
+}
+
+void HostEvent::Consume()
+{
+    // do nothing, events are auto-reset
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+HostLoop::HostLoop()
+    : m_stopped(FALSE), m_closing(FALSE)
+{
+    InitializeCriticalSection(&m_lock);
+    InitializeCriticalSection(&m_queueLock);
+    m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/// <summary>
+/// Destructor. It cancels all pending waits, blocking reads of all reader threads and waits for them to finish.
+/// </summary>
+HostLoop::~HostLoop()
+{
+    BOOL allFinished = TRUE;
+
+    EnterCriticalSection(&m_lock);
+    m_closing = TRUE;
+    LeaveCriticalSection(&m_lock);
+
+    while (!m_waits.empty())
+    {
+        Remove(m_waits.back()->waitable);
+    }
+
+    for (size_t i = 0; i < m_readers.size(); i++)
+    {
+        CancelSynchronousIo(m_readers[i]->hThread);
+        if (WaitForSingleObject(m_readers[i]->hThread, 1000) == WAIT_OBJECT_0)
+        {
+            CloseHandle(m_readers[i]->hThread);
+            delete m_readers[i];
+        }
+        else
+        {
+            // the thread is still blocked somewhere, leak its data, it will be killed at process exit
+            allFinished = FALSE;
+        }
+    }
+
+    CloseHandle(m_wakeEvent);
+    DeleteCriticalSection(&m_queueLock);
+    if (allFinished)
+    {
+        DeleteCriticalSection(&m_lock);
+    }
+}
+
+/// <summary>
+/// Thread-pool callback, executed when the waitable gets signaled. It only queues the wait for the loop thread.
+/// </summary>
+VOID CALLBACK HostLoop::WaitCallback(PVOID lpParameter, BOOLEAN timerOrWaitFired)
+{
+    Wait* wait = static_cast<Wait*>(lpParameter);
+    HostLoop* loop = wait->loop;
+
+    EnterCriticalSection(&loop->m_queueLock);
+    loop->m_signaled.push_back(wait);
+    LeaveCriticalSection(&loop->m_queueLock);
+
+    SetEvent(loop->m_wakeEvent);
+}
+
+/// <summary>
+/// Starts single-shot thread-pool wait for the waitable. It's re-armed each time after its handler is notified.
+/// </summary>
+BOOL HostLoop::ArmWait(Wait* wait)
+{
+    if (!RegisterWaitForSingleObject(&wait->hWait, wait->waitable, WaitCallback, wait, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+    {
+        PrintError(_T("RegisterWaitForSingleObject"), GetLastError());
+        wait->hWait = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Registers new waitable handle to be monitored by the loop.
+/// </summary>
+BOOL HostLoop::Add(HostWaitable waitable, HostWaitHandler* handler)
+{
+    if (waitable == NULL || handler == NULL || IndexOf(waitable) >= 0)
+        return FALSE;
+
+    Wait* wait = new Wait;
+    wait->loop = this;
+    wait->waitable = waitable;
+    wait->handler = handler;
+    wait->hWait = NULL;
+
+    if (!ArmWait(wait))
+    {
+        delete wait;
+        return FALSE;
+    }
+
+    m_waits.push_back(wait);
+    return TRUE;
+}
+
+void HostLoop::Remove(HostWaitable waitable)
+{
+    int index = IndexOf(waitable);
+    if (index < 0)
+        return;
+
+    Wait* wait = m_waits[index];
+    m_waits.erase(m_waits.begin() + index);
+
+    // wait for the callback to finish, if it's running right now, then forget about this wait:
+    if (wait->hWait != NULL)
+    {
+        UnregisterWaitEx(wait->hWait, INVALID_HANDLE_VALUE);
+    }
+
+    EnterCriticalSection(&m_queueLock);
+    for (size_t i = 0; i < m_signaled.size(); )
+    {
+        if (m_signaled[i] == wait)
+        {
+            m_signaled.erase(m_signaled.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    LeaveCriticalSection(&m_queueLock);
+
+    delete wait;
+}
+
+/// <summary>
+/// Thread reading the pipe in a blocking way. Each chunk of data is passed to the handler
+/// while holding the loop lock, so it's serialized with any other notification.
+/// </summary>
+DWORD WINAPI HostLoop::ReaderThread(LPVOID lpParameter)
+{
+    Reader* reader = static_cast<Reader*>(lpParameter);
+    HostLoop* loop = reader->loop;
+    char* buffer = new char[LOOP_READ_BUFFER_SIZE];
+    DWORD count;
+
+    while (ReadFile(reader->pipe, buffer, LOOP_READ_BUFFER_SIZE, &count, NULL) && count > 0)
+    {
+        EnterCriticalSection(&loop->m_lock);
+        if (!loop->m_closing)
+        {
+            reader->handler->OnRead(reader->pipe, buffer, count);
+            SetEvent(loop->m_wakeEvent);
+        }
+        LeaveCriticalSection(&loop->m_lock);
+    }
+
+    LogPrint(_T("ReaderThread finished"));
+    EnterCriticalSection(&loop->m_lock);
+    if (!loop->m_closing)
+    {
+        reader->handler->OnClosed(reader->pipe);
+        SetEvent(loop->m_wakeEvent);
+    }
+    LeaveCriticalSection(&loop->m_lock);
+
+    delete[] buffer;
+    return 0;
+}
+
+/// <summary>
+/// Registers a pipe, which incoming data should be passed to the handler.
+/// The pipe is read by a dedicated thread, as anonymous pipes can't be waited on.
+/// </summary>
+BOOL HostLoop::AddReader(HostPipe pipe, HostReadHandler* handler)
+{
+    if (pipe == NULL || pipe == INVALID_HANDLE_VALUE || handler == NULL || IndexOfReader(pipe) >= 0)
+        return FALSE;
+
+    Reader* reader = new Reader;
+    reader->loop = this;
+    reader->pipe = pipe;
+    reader->handler = handler;
+    reader->hThread = CreateThread(NULL, 0, ReaderThread, reader, 0, NULL);
+
+    if (reader->hThread == NULL)
+    {
+        PrintError(_T("CreateThread"), GetLastError());
+        delete reader;
+        return FALSE;
+    }
+
+    m_readers.push_back(reader);
+    return TRUE;
+}
+
+/// <summary>
+/// Stops passing data from the pipe. The reader thread itself finishes, once the pipe is closed.
+/// </summary>
+void HostLoop::RemoveReader(HostPipe pipe)
+{
+    int index = IndexOfReader(pipe);
+    if (index < 0)
+        return;
+
+    // the thread is not stopped here, as this can be called from inside its own notification;
+    // instead make it passing data to nowhere:
+    static class NullReadHandler : public HostReadHandler
+    {
+    public:
+        virtual void OnRead(HostPipe pipe, const char* data, size_t length) { }
+        virtual void OnClosed(HostPipe pipe) { }
+    } nullHandler;
+
+    m_readers[index]->handler = &nullHandler;
+    m_readers[index]->pipe = INVALID_PIPE;
+
+    // release threads of previously removed readers, which have already finished:
+    for (size_t i = 0; i < m_readers.size(); )
+    {
+        Reader* reader = m_readers[i];
+        if (reader->pipe == INVALID_PIPE && WaitForSingleObject(reader->hThread, 0) == WAIT_OBJECT_0)
+        {
+            CloseHandle(reader->hThread);
+            delete reader;
+            m_readers.erase(m_readers.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/// <summary>
+/// Waits for any of the registered handles and notifies its handler,
+/// until Stop() is called or any handler returns FALSE.
+/// </summary>
+BOOL HostLoop::Run()
+{
+    std::vector<Wait*> signaled;
+
+    EnterCriticalSection(&m_lock);
+    m_stopped = FALSE;
+
+    while (!m_stopped)
+    {
+        DWORD timeout = GetNextTimeout();
+
+        LeaveCriticalSection(&m_lock);
+        LogPrint(_T("WaitForSingleObject"));
+        DWORD event = WaitForSingleObject(m_wakeEvent, timeout);
+        EnterCriticalSection(&m_lock);
+
+        if (event == WAIT_FAILED)
+        {
+            PrintError(_T("WaitForSingleObject WAIT_FAILED"), GetLastError());
+            LeaveCriticalSection(&m_lock);
+            return FALSE;
+        }
+
+        EnterCriticalSection(&m_queueLock);
+        signaled.swap(m_signaled);
+        LeaveCriticalSection(&m_queueLock);
+
+        for (size_t i = 0; i < signaled.size() && !m_stopped; i++)
+        {
+            Wait* wait = signaled[i];
+            HostWaitable waitable = wait->waitable;
+
+            // handler could be already removed by previously dispatched one:
+            if (IndexOf(waitable) < 0 || m_waits[IndexOf(waitable)] != wait)
+                continue;
+
+            // single-shot wait has already finished, release it:
+            UnregisterWait(wait->hWait);
+            wait->hWait = NULL;
+
+            if (!wait->handler->OnSignaled(waitable))
+            {
+                m_stopped = TRUE;
+            }
+
+            // re-arm, if it is still registered:
+            int index = IndexOf(waitable);
+            if (index >= 0 && m_waits[index] == wait && wait->hWait == NULL)
+            {
+                ArmWait(wait);
+            }
+        }
+
+        // not dispatched ones must be still delivered after restart:
+        if (m_stopped)
+        {
+            EnterCriticalSection(&m_queueLock);
+            m_signaled.insert(m_signaled.begin(), signaled.begin(), signaled.end());
+            LeaveCriticalSection(&m_queueLock);
+        }
+        signaled.clear();
+
+        if (!m_stopped && !DispatchTimers())
+        {
+            m_stopped = TRUE;
+        }
+    }
+
+    LeaveCriticalSection(&m_lock);
+    return TRUE;
+}
+
+void HostLoop::Stop()
+{
+    m_stopped = TRUE;
+    SetEvent(m_wakeEvent);
+}
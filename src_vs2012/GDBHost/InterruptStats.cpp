@@ -0,0 +1,156 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// InterruptStats.cpp : latency instrumentation of the Ctrl-C path.
+//
+
+#include "stdafx.h"
+#include "InterruptStats.h"
+#include "Log.h"
+
+#include <stdio.h>
+
+
+InterruptStats::InterruptStats()
+    : m_dumpInterval(0), m_lastDump(HostGetTimestamp()), requests(0), repeated(0), failed(0), lost(0)
+{
+}
+
+void InterruptStats::Format(std::string& output) const
+{
+    char text[160];
+
+    sprintf_s(text, sizeof(text), "interrupts={requests=\"%llu\",repeated=\"%llu\",failed=\"%llu\",lost=\"%llu\",", requests, repeated, failed, lost);
+    output.append(text);
+    delivery.Format(output, "delivery");
+    output.append(",");
+    stop.Format(output, "stop");
+    output.append(",");
+    total.Format(output, "total");
+    output.append("}");
+}
+
+/// <summary>
+/// Writes the statistics into the log.
+/// </summary>
+void InterruptStats::Dump()
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    LogPrint(message.c_str());
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void InterruptStats::Print()
+{
+    std::string text;
+
+    Format(text);
+
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
+
+DWORD InterruptStats::GetTimeout()
+{
+    if (m_dumpInterval == 0)
+        return INFINITE;
+
+    unsigned long long elapsed = (HostGetTimestamp() - m_lastDump) / 1000;
+    return elapsed >= m_dumpInterval ? 0 : (DWORD) (m_dumpInterval - elapsed);
+}
+
+BOOL InterruptStats::OnTimeout()
+{
+    m_lastDump = HostGetTimestamp();
+    Dump();
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+InterruptTracker::InterruptTracker(InterruptStats* stats)
+    : m_stats(stats), m_requested(0), m_delivered(0)
+{
+}
+
+/// <summary>
+/// Called as soon as the interrupt event is noticed by the host.
+/// </summary>
+void InterruptTracker::OnRequested()
+{
+    unsigned long long now = HostGetTimestamp();
+
+    m_stats->requests++;
+
+    // the previous one is still pending, measure from the first request, as that's what the user waits for:
+    if (m_requested != 0)
+    {
+        if (now - m_requested < INTERRUPT_STOP_TIMEOUT)
+        {
+            m_stats->repeated++;
+            return;
+        }
+
+        m_stats->lost++;
+    }
+
+    m_requested = now;
+    m_delivered = 0;
+}
+
+/// <summary>
+/// Called right after the control event was generated (or the signal sent).
+/// </summary>
+void InterruptTracker::OnDelivered(BOOL succeeded)
+{
+    if (m_requested == 0)
+        return;
+
+    if (!succeeded)
+    {
+        m_stats->failed++;
+        m_requested = 0;
+        return;
+    }
+
+    if (m_delivered == 0)
+    {
+        m_delivered = HostGetTimestamp();
+        m_stats->delivery.Record(m_delivered - m_requested);
+    }
+}
+
+void InterruptTracker::OnRecord(const MiRecord& record)
+{
+    if (m_requested == 0 || record.type != MiRecordExecAsync || !record.IsClass("stopped"))
+        return;
+
+    unsigned long long now = HostGetTimestamp();
+
+    if (m_delivered != 0)
+    {
+        m_stats->stop.Record(now - m_delivered);
+    }
+    m_stats->total.Record(now - m_requested);
+    m_requested = 0;
+    m_delivered = 0;
+}
@@ -0,0 +1,85 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "LatencyHistogram.h"
+#include "MiParser.h"
+
+#include <string>
+
+
+#define INTERRUPT_STOP_TIMEOUT      (60 * 1000000ULL)   // us, after which pending interrupt without '*stopped' is counted as lost
+
+
+/// <summary>
+/// Latency histograms of the Ctrl-C path shared by all GDB instances of the host:
+///   delivery - from the interrupt event firing till the console control event (or signal) is delivered to GDB,
+///   stop     - from the delivery till GDB's first '*stopped' record arrives,
+///   total    - from the interrupt event firing till the '*stopped' record.
+/// Optionally they are periodically dumped into the log.
+/// </summary>
+class InterruptStats : public HostTimerHandler
+{
+private:
+    DWORD m_dumpInterval;               // ms, 0 when disabled
+    unsigned long long m_lastDump;
+
+public:
+    LatencyHistogram delivery;
+    LatencyHistogram stop;
+    LatencyHistogram total;
+    unsigned long long requests;
+    unsigned long long repeated;        // requests received, while the previous one was still pending
+    unsigned long long failed;
+    unsigned long long lost;
+
+    InterruptStats();
+
+    void SetDumpInterval(DWORD interval) { m_dumpInterval = interval; }
+
+    /// <summary>
+    /// Appends MI-like tuple with all the statistics: interrupts={requests="",...,delivery={...},stop={...},total={...}}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Dump();
+    void Print();
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+};
+
+/// <summary>
+/// Timestamps interrupt requests of single GDB instance and matches them with '*stopped' records passing through its relay.
+/// </summary>
+class InterruptTracker : public MiRecordObserver
+{
+private:
+    InterruptStats* m_stats;
+    unsigned long long m_requested;     // 0, when there is no pending interrupt
+    unsigned long long m_delivered;
+
+public:
+    InterruptTracker(InterruptStats* stats);
+
+    void OnRequested();
+    void OnDelivered(BOOL succeeded);
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
@@ -0,0 +1,129 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// LatencyHistogram.cpp : log-linear histogram of latencies.
+//
+
+#include "stdafx.h"
+#include "LatencyHistogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_total = 0;
+    m_min = 0;
+    m_max = 0;
+}
+
+/// <summary>
+/// Values below HISTOGRAM_SUB_BUCKETS have own buckets, all bigger ones are split by their highest bit
+/// and the following HISTOGRAM_SUB_BUCKET_BITS bits.
+/// </summary>
+int LatencyHistogram::GetBucket(unsigned long long value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (int) value;
+
+    int exponent = HISTOGRAM_SUB_BUCKET_BITS;
+    while (exponent < HISTOGRAM_MAX_EXPONENT && (value >> (exponent + 1)) != 0)
+    {
+        exponent++;
+    }
+
+    // too big values are clamped into the last bucket:
+    if ((value >> (exponent + 1)) != 0)
+        return HISTOGRAM_BUCKETS - 1;
+
+    int mantissa = (int) (value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + mantissa;
+}
+
+/// <summary>
+/// Gets the highest value falling into the bucket.
+/// </summary>
+unsigned long long LatencyHistogram::GetBucketMax(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+    unsigned long long mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+    int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(unsigned long long value)
+{
+    m_counts[GetBucket(value)]++;
+
+    if (m_count == 0 || value < m_min)
+    {
+        m_min = value;
+    }
+    if (value > m_max)
+    {
+        m_max = value;
+    }
+
+    m_count++;
+    m_total += value;
+}
+
+/// <summary>
+/// Gets the value, that given percentage (0-100) of all recorded values doesn't exceed.
+/// </summary>
+unsigned long long LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (m_count == 0)
+        return 0;
+
+    unsigned long long limit = (unsigned long long) (m_count * percentile / 100.0 + 0.5);
+    unsigned long long count = 0;
+
+    if (limit == 0)
+        limit = 1;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        count += m_counts[i];
+        if (count >= limit)
+        {
+            unsigned long long value = GetBucketMax(i);
+            return value < m_max ? value : m_max;
+        }
+    }
+
+    return m_max;
+}
+
+void LatencyHistogram::Format(std::string& output, const char* name) const
+{
+    char text[256];
+
+    sprintf_s(text, sizeof(text), "%s={count=\"%llu\",min=\"%llu\",p50=\"%llu\",p90=\"%llu\",p99=\"%llu\",max=\"%llu\",mean=\"%llu\"}",
+              name, m_count, GetMin(), GetPercentile(50), GetPercentile(90), GetPercentile(99), GetMax(), GetMean());
+    output.append(text);
+}
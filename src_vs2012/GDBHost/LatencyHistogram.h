@@ -0,0 +1,62 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <string>
+
+
+#define HISTOGRAM_SUB_BUCKETS       16          // per power of 2, so the precision is ~6%
+#define HISTOGRAM_SUB_BUCKET_BITS   4
+#define HISTOGRAM_MAX_EXPONENT      31
+#define HISTOGRAM_BUCKETS           ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKETS)
+
+
+/// <summary>
+/// HDR-style histogram of latencies in microseconds with log-linear buckets. It has constant size
+/// and constant recording time, while keeping relative precision of all values below 2^32 us (~71 minutes); bigger ones are clamped into the last bucket.
+/// </summary>
+class LatencyHistogram
+{
+private:
+    unsigned long long m_counts[HISTOGRAM_BUCKETS];
+    unsigned long long m_count;
+    unsigned long long m_total;
+    unsigned long long m_min;
+    unsigned long long m_max;
+
+    static int GetBucket(unsigned long long value);
+    static unsigned long long GetBucketMax(int bucket);
+
+public:
+    LatencyHistogram();
+
+    void Record(unsigned long long value);
+    void Reset();
+
+    unsigned long long GetCount() const { return m_count; }
+    unsigned long long GetMin() const { return m_count > 0 ? m_min : 0; }
+    unsigned long long GetMax() const { return m_max; }
+    unsigned long long GetTotal() const { return m_total; }
+    unsigned long long GetMean() const { return m_count > 0 ? m_total / m_count : 0; }
+    unsigned long long GetPercentile(double percentile) const;
+
+    /// <summary>
+    /// Appends MI-like tuple with the summary: name={count="",min="",p50="",p90="",p99="",max="",mean=""}.
+    /// </summary>
+    void Format(std::string& output, const char* name) const;
+};
@@ -0,0 +1,658 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// LaunchProfile.cpp : launch profiles of GDB with cache of their resolved paths.
+//
+
+#include "stdafx.h"
+#include "LaunchProfile.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#   include <limits.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+
+#ifdef _WIN32
+static const TCHAR PathSeparator = '\\';
+static const char SearchPathSeparator = ';';
+#else
+static const TCHAR PathSeparator = '/';
+static const char SearchPathSeparator = ':';
+#endif
+
+#define FNV_OFFSET_BASIS            0xCBF29CE484222325ULL
+#define FNV_PRIME                   0x100000001B3ULL
+
+
+#ifdef _WIN32
+static HostString ToHostPath(const std::string& text)
+{
+    if (text.empty())
+        return HostString();
+
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), NULL, 0);
+    HostString result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), &result[0], length);
+    return result;
+}
+
+static std::string FromHostPath(const HostString& path)
+{
+    if (path.empty())
+        return std::string();
+
+    int length = WideCharToMultiByte(CP_UTF8, 0, path.data(), (int) path.size(), NULL, 0, NULL, NULL);
+    std::string result(length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, path.data(), (int) path.size(), &result[0], length, NULL, NULL);
+    return result;
+}
+
+static BOOL IsAbsolutePath(const HostString& path)
+{
+    return !path.empty() && (path[0] == '\\' || path[0] == '/' || (path.size() > 1 && path[1] == ':'));
+}
+
+static BOOL HasDirectory(const HostString& path)
+{
+    return path.find_first_of(_T("\\/")) != HostString::npos;
+}
+
+static HostString GetFullPath(LPCTSTR lpszPath)
+{
+    TCHAR path[_MAX_PATH];
+
+    if (GetFullPathName(lpszPath, _countof(path), path, NULL) == 0)
+        return HostString(lpszPath);
+    return HostString(path);
+}
+
+static BOOL PathExists(const HostString& path, BOOL directory)
+{
+    DWORD attributes = GetFileAttributes(path.c_str());
+
+    return attributes != INVALID_FILE_ATTRIBUTES && ((attributes & FILE_ATTRIBUTE_DIRECTORY) ? directory : !directory);
+}
+
+static void CreateDirectoryPath(const HostString& path)
+{
+    for (size_t i = 3; i <= path.size(); i++)
+    {
+        if (i == path.size() || path[i] == PathSeparator)
+        {
+            CreateDirectory(path.substr(0, i).c_str(), NULL);
+        }
+    }
+}
+
+static void DeleteHostFile(const HostString& path)
+{
+    DeleteFile(path.c_str());
+}
+
+static BOOL RenameHostFile(const HostString& source, const HostString& target)
+{
+    return MoveFileEx(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+static void SetHostVariable(const std::string& name, const std::string& value)
+{
+    SetEnvironmentVariable(ToHostPath(name).c_str(), ToHostPath(value).c_str());
+}
+#else
+static const std::string& ToHostPath(const std::string& text)
+{
+    return text;
+}
+
+static const HostString& FromHostPath(const HostString& path)
+{
+    return path;
+}
+
+static BOOL IsAbsolutePath(const HostString& path)
+{
+    return !path.empty() && path[0] == '/';
+}
+
+static BOOL HasDirectory(const HostString& path)
+{
+    return path.find('/') != HostString::npos;
+}
+
+static HostString GetFullPath(LPCTSTR lpszPath)
+{
+    char path[PATH_MAX];
+
+    if (lpszPath[0] == '/' || getcwd(path, sizeof(path)) == NULL)
+        return HostString(lpszPath);
+    return HostString(path) + PathSeparator + lpszPath;
+}
+
+static BOOL PathExists(const HostString& path, BOOL directory)
+{
+    struct stat info;
+
+    return stat(path.c_str(), &info) == 0 && (directory ? S_ISDIR(info.st_mode) : S_ISREG(info.st_mode));
+}
+
+static void CreateDirectoryPath(const HostString& path)
+{
+    for (size_t i = 1; i <= path.size(); i++)
+    {
+        if (i == path.size() || path[i] == PathSeparator)
+        {
+            mkdir(path.substr(0, i).c_str(), 0755);
+        }
+    }
+}
+
+static void DeleteHostFile(const HostString& path)
+{
+    unlink(path.c_str());
+}
+
+static BOOL RenameHostFile(const HostString& source, const HostString& target)
+{
+    return rename(source.c_str(), target.c_str()) == 0;
+}
+
+static void SetHostVariable(const std::string& name, const std::string& value)
+{
+    setenv(name.c_str(), value.c_str(), 1);
+}
+#endif
+
+static BOOL ReadWholeFile(const HostString& path, std::string& content)
+{
+    FILE* file = _tfopen(path.c_str(), _T("rb"));
+    if (file == NULL)
+        return FALSE;
+
+    char buffer[4096];
+    size_t count;
+
+    content.clear();
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        content.append(buffer, count);
+    }
+
+    fclose(file);
+    return TRUE;
+}
+
+/// <summary>
+/// Writes the file next to its final location and renames it, so other hosts never see it half-written.
+/// </summary>
+static BOOL WriteWholeFile(const HostString& path, const std::string& content)
+{
+    HostString temporaryPath = path + _T(".tmp");
+    FILE* file = _tfopen(temporaryPath.c_str(), _T("wb"));
+    if (file == NULL)
+        return FALSE;
+
+    BOOL written = fwrite(content.data(), 1, content.size(), file) == content.size();
+    written = fclose(file) == 0 && written;
+
+    if (!written || !RenameHostFile(temporaryPath, path))
+    {
+        DeleteHostFile(temporaryPath);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Gets next line of the text (without the new-line characters) starting at given position and moves the position after it.
+/// </summary>
+static BOOL NextLine(const std::string& text, size_t& position, std::string& line)
+{
+    if (position >= text.size())
+        return FALSE;
+
+    size_t end = text.find('\n', position);
+    if (end == std::string::npos)
+    {
+        end = text.size();
+    }
+
+    line.assign(text, position, end - position);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+    {
+        line.erase(line.size() - 1);
+    }
+
+    position = end + 1;
+    return TRUE;
+}
+
+/// <summary>
+/// Splits the line into the keyword and the rest of it.
+/// </summary>
+static BOOL SplitEntry(const std::string& line, std::string& key, std::string& value)
+{
+    size_t keyStart = line.find_first_not_of(" \t");
+    if (keyStart == std::string::npos || line[keyStart] == '#')
+        return FALSE;
+
+    size_t keyEnd = line.find_first_of(" \t", keyStart);
+    size_t valueStart = keyEnd != std::string::npos ? line.find_first_not_of(" \t", keyEnd) : std::string::npos;
+
+    key.assign(line, keyStart, keyEnd != std::string::npos ? keyEnd - keyStart : std::string::npos);
+    value = valueStart != std::string::npos ? line.substr(valueStart) : std::string();
+    return TRUE;
+}
+
+static void AppendQuoted(HostString& commandLine, const HostString& argument)
+{
+    if (!commandLine.empty())
+    {
+        commandLine += _T(' ');
+    }
+
+    commandLine += _T('"');
+    commandLine += argument;
+    commandLine += _T('"');
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+LaunchProfile::LaunchProfile()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+BOOL LaunchProfile::Load(LPCTSTR lpszPath, LPCTSTR lpszDirectory)
+{
+    unsigned long long start = HostGetTimestamp();
+
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_environment.clear();
+    m_entryPath.clear();
+
+    if (lpszPath == NULL || lpszPath[0] == '\0')
+        return FALSE;
+
+    if (lpszDirectory != NULL)
+    {
+        m_directory = lpszDirectory;
+    }
+    else
+    {
+#ifdef _WIN32
+        TCHAR path[_MAX_PATH];
+
+        if (GetEnvironmentVariable(_T(PROFILE_ENVIRONMENT_VARIABLE), path, _countof(path)) > 0)
+        {
+            m_directory = path;
+        }
+        else if (GetEnvironmentVariable(_T("LocalAppData"), path, _countof(path)) > 0)
+        {
+            m_directory = path;
+            m_directory += _T("\\BlackBerry\\gdb-profiles");
+        }
+#else
+        const char* path = getenv(PROFILE_ENVIRONMENT_VARIABLE);
+        const char* home = getenv("HOME");
+
+        if (path != NULL && path[0] != '\0')
+        {
+            m_directory = path;
+        }
+        else
+        {
+            m_directory = home != NULL ? home : "/tmp";
+            m_directory += "/.blackberry-gdb-profiles";
+        }
+#endif
+    }
+
+    HostString profilePath = GetFullPath(lpszPath);
+    std::string content;
+
+    if (!ReadWholeFile(profilePath, content))
+        return FALSE;
+
+    // relative paths depend on the location of the profile, so it's hashed together with its content:
+    std::string key(PROFILE_CACHE_VERSION "\n");
+    unsigned long long hash = FNV_OFFSET_BASIS;
+
+    key += FromHostPath(profilePath);
+    key += '\n';
+    key += content;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        hash = (hash ^ (unsigned char) key[i]) * FNV_PRIME;
+    }
+
+    if (!m_directory.empty())
+    {
+        char name[32];
+
+        sprintf_s(name, sizeof(name), "%016llx", hash);
+        m_entryPath = m_directory + PathSeparator + ToHostPath(name);
+    }
+
+    if (!m_entryPath.empty() && ReadEntry())
+    {
+        m_stats.cached = TRUE;
+    }
+    else if (!Resolve(profilePath, content))
+    {
+        return FALSE;
+    }
+
+    m_stats.loadTime = HostGetTimestamp() - start;
+    return TRUE;
+}
+
+BOOL LaunchProfile::Probe(const HostString& path, BOOL directory)
+{
+    m_stats.probes++;
+    return PathExists(path, directory);
+}
+
+/// <summary>
+/// Finds GDB executable given by the profile. Plain names are searched on the PATH, the same way, as the shell would do.
+/// </summary>
+HostString LaunchProfile::ResolveGdb(const HostString& path, const HostString& base)
+{
+    if (HasDirectory(path))
+    {
+        HostString result = IsAbsolutePath(path) ? path : base + path;
+        return Probe(result, FALSE) ? result : HostString();
+    }
+
+    const char* searchPath = getenv("PATH");
+    if (searchPath == NULL)
+        return HostString();
+
+    std::string directories(searchPath);
+    size_t start = 0;
+
+    while (start <= directories.size())
+    {
+        size_t end = directories.find(SearchPathSeparator, start);
+        if (end == std::string::npos)
+        {
+            end = directories.size();
+        }
+
+        if (end > start)
+        {
+            HostString result = ToHostPath(directories.substr(start, end - start));
+
+            if (result[result.size() - 1] != PathSeparator)
+            {
+                result += PathSeparator;
+            }
+            result += path;
+
+            if (Probe(result, FALSE))
+                return result;
+#ifdef _WIN32
+            if (path.find('.') == HostString::npos && Probe(result + _T(".exe"), FALSE))
+                return result + _T(".exe");
+#endif
+        }
+
+        start = end + 1;
+    }
+
+    return HostString();
+}
+
+/// <summary>
+/// Parses the profile, probes all its paths and stores the results into the cache.
+/// </summary>
+BOOL LaunchProfile::Resolve(const HostString& profilePath, const std::string& content)
+{
+    HostString base = profilePath.substr(0, profilePath.find_last_of(_T("\\/")) + 1);
+    HostString gdb;
+    std::vector<HostString> arguments;
+    std::vector<std::string> commands;
+    std::string symbols;
+    std::string line;
+    std::string key;
+    std::string value;
+    size_t position = 0;
+    int lineNumber = 0;
+
+    while (NextLine(content, position, line))
+    {
+        lineNumber++;
+        if (!SplitEntry(line, key, value))
+            continue;
+
+        if (key == "gdb")
+        {
+            gdb = ToHostPath(value);
+        }
+        else if (key == "arg")
+        {
+            arguments.push_back(ToHostPath(value));
+        }
+        else if (key == "env" && value.find('=') != std::string::npos && value[0] != '=')
+        {
+            m_environment.push_back(value);
+        }
+        else if (key == "init")
+        {
+            commands.push_back(value);
+        }
+        else if (key == "symbols")
+        {
+            HostString directory = ToHostPath(value);
+
+            if (!IsAbsolutePath(directory))
+            {
+                directory = base + directory;
+            }
+
+            if (Probe(directory, TRUE))
+            {
+                if (!symbols.empty())
+                {
+                    symbols += SearchPathSeparator;
+                }
+                symbols += FromHostPath(directory);
+            }
+            else
+            {
+                m_stats.skipped++;
+            }
+        }
+        else
+        {
+            PrintMessage(_T("Error: Invalid entry in launch profile (%s, line %d)\r\n"), profilePath.c_str(), lineNumber);
+            return FALSE;
+        }
+    }
+
+    if (gdb.empty())
+    {
+        PrintMessage(_T("Error: Launch profile doesn't specify GDB (%s)\r\n"), profilePath.c_str());
+        return FALSE;
+    }
+
+    m_gdbPath = ResolveGdb(gdb, base);
+    if (m_gdbPath.empty())
+    {
+        PrintMessage(_T("Error: Unable to find GDB executable (%s)\r\n"), gdb.c_str());
+        return FALSE;
+    }
+
+    // the search path goes first, so the libraries are found by the commands of the profile already:
+    if (!symbols.empty())
+    {
+        commands.insert(commands.begin(), "set solib-search-path " + symbols);
+    }
+
+    m_commandLine.clear();
+    AppendQuoted(m_commandLine, m_gdbPath);
+    for (size_t i = 0; i < arguments.size(); i++)
+    {
+        AppendQuoted(m_commandLine, arguments[i]);
+    }
+
+    HostString argumentsOnly = m_commandLine;
+    std::string script;
+
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        script += commands[i];
+        script += '\n';
+    }
+
+    if (!script.empty() && !m_entryPath.empty())
+    {
+        AppendQuoted(m_commandLine, _T("-x"));
+        AppendQuoted(m_commandLine, m_entryPath + _T(".gdbinit"));
+    }
+
+    if (!WriteEntry(script) && !script.empty())
+    {
+        // without the cache, the commands are passed the old way:
+        m_commandLine = argumentsOnly;
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            AppendQuoted(m_commandLine, _T("-ex"));
+            AppendQuoted(m_commandLine, ToHostPath(commands[i]));
+        }
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Loads the resolved values from the cache entry. Only the init script is probed, as the entry can't be used without it.
+/// </summary>
+BOOL LaunchProfile::ReadEntry()
+{
+    std::string content;
+    std::string line;
+    std::string key;
+    std::string value;
+    HostString scriptPath;
+    size_t position = 0;
+
+    if (!ReadWholeFile(m_entryPath + _T(".launch"), content))
+        return FALSE;
+    if (!NextLine(content, position, line) || line != PROFILE_CACHE_VERSION)
+        return FALSE;
+
+    m_gdbPath.clear();
+    m_commandLine.clear();
+    while (NextLine(content, position, line))
+    {
+        if (!SplitEntry(line, key, value))
+            continue;
+
+        if (key == "gdb")
+        {
+            m_gdbPath = ToHostPath(value);
+        }
+        else if (key == "env")
+        {
+            m_environment.push_back(value);
+        }
+        else if (key == "script")
+        {
+            scriptPath = ToHostPath(value);
+        }
+        else if (key == "command")
+        {
+            m_commandLine = ToHostPath(value);
+        }
+        else if (key == "skipped")
+        {
+            m_stats.skipped = (unsigned int) strtoul(value.c_str(), NULL, 10);
+        }
+    }
+
+    if (m_gdbPath.empty() || m_commandLine.empty() || (!scriptPath.empty() && !Probe(scriptPath, FALSE)))
+    {
+        m_environment.clear();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL LaunchProfile::WriteEntry(const std::string& script)
+{
+    if (m_entryPath.empty())
+        return FALSE;
+
+    std::string entry(PROFILE_CACHE_VERSION "\n");
+    char skipped[32];
+
+    entry += "gdb " + FromHostPath(m_gdbPath) + "\n";
+    for (size_t i = 0; i < m_environment.size(); i++)
+    {
+        entry += "env " + m_environment[i] + "\n";
+    }
+    if (!script.empty())
+    {
+        entry += "script " + FromHostPath(m_entryPath + _T(".gdbinit")) + "\n";
+    }
+    sprintf_s(skipped, sizeof(skipped), "skipped %u\n", m_stats.skipped);
+    entry += skipped;
+    entry += "command " + FromHostPath(m_commandLine) + "\n";
+
+    CreateDirectoryPath(m_directory);
+
+    // the script must be in place, before the entry referencing it appears:
+    if (!script.empty() && !WriteWholeFile(m_entryPath + _T(".gdbinit"), script))
+    {
+        LogPrint(_T("Unable to write init script of the launch profile"));
+        return FALSE;
+    }
+    if (!WriteWholeFile(m_entryPath + _T(".launch"), entry))
+    {
+        LogPrint(_T("Unable to write launch profile cache entry"));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void LaunchProfile::Invalidate()
+{
+    if (!m_entryPath.empty())
+    {
+        DeleteHostFile(m_entryPath + _T(".launch"));
+        DeleteHostFile(m_entryPath + _T(".gdbinit"));
+    }
+}
+
+void LaunchProfile::ApplyEnvironment() const
+{
+    for (size_t i = 0; i < m_environment.size(); i++)
+    {
+        size_t separator = m_environment[i].find('=');
+
+        if (separator != std::string::npos && separator > 0)
+        {
+            SetHostVariable(m_environment[i].substr(0, separator), m_environment[i].substr(separator + 1));
+        }
+    }
+}
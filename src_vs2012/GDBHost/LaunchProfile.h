@@ -0,0 +1,94 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+
+#include <string>
+#include <vector>
+
+
+#define PROFILE_ENVIRONMENT_VARIABLE    "BLACKBERRY_GDBHOST_PROFILE_CACHE"
+#define PROFILE_CACHE_VERSION           "gdbhost-launch 1"
+#define PROFILE_PREFIX                  '@'
+
+
+/// <summary>
+/// Statistics of loading the launch profile.
+/// </summary>
+struct LaunchProfileStats
+{
+    BOOL cached;                    // resolved values were taken from the cache
+    unsigned int probes;            // file system lookups done to resolve the paths
+    unsigned int skipped;           // missing symbol directories left out of the search path
+    unsigned long long loadTime;    // us spent on reading, hashing and resolving the profile
+};
+
+/// <summary>
+/// Description of GDB launch read from a text file passed instead of the GDB path ('@<profile>').
+/// Each line holds single entry, empty lines and lines starting with '#' are ignored:
+///   gdb <path>            - GDB executable; relative to the profile or searched on the PATH, if it's just a name
+///   arg <argument>        - argument passed to GDB as-is
+///   env <name>=<value>    - environment variable set for GDB
+///   init <command>        - GDB command executed on startup
+///   symbols <directory>   - directory searched for shared libraries; relative to the profile, missing ones are skipped
+/// Resolved paths, the quoted command line and the init script precompiled from 'init' and 'symbols' entries are
+/// stored in the cache under the hash of the profile, so identical launches skip the parsing and all the probing.
+/// </summary>
+class LaunchProfile
+{
+private:
+    HostString m_directory;
+    HostString m_entryPath;             // cache entry without an extension
+    HostString m_gdbPath;
+    HostString m_commandLine;
+    std::vector<std::string> m_environment;
+    LaunchProfileStats m_stats;
+
+    BOOL Resolve(const HostString& profilePath, const std::string& content);
+    BOOL ReadEntry();
+    BOOL WriteEntry(const std::string& script);
+    BOOL Probe(const HostString& path, BOOL directory);
+    HostString ResolveGdb(const HostString& path, const HostString& base);
+
+public:
+    LaunchProfile();
+
+    /// <summary>
+    /// Loads the profile, from the cache if possible. Directory of the cache can be NULL to use the default one.
+    /// </summary>
+    BOOL Load(LPCTSTR lpszPath, LPCTSTR lpszDirectory);
+
+    /// <summary>
+    /// Removes the cache entry, when its resolved values turned out to be wrong (i.e. GDB failed to start),
+    /// so the next launch resolves the profile again.
+    /// </summary>
+    void Invalidate();
+
+    /// <summary>
+    /// Sets the variables of the profile in the host process, so GDB inherits them.
+    /// </summary>
+    void ApplyEnvironment() const;
+
+    LPCTSTR GetGdbPath() const { return m_gdbPath.c_str(); }
+
+    /// <summary>
+    /// Gets quoted GDB path followed by the arguments of the profile and the init script.
+    /// </summary>
+    const HostString& GetCommandLine() const { return m_commandLine; }
+
+    const LaunchProfileStats& GetStats() const { return m_stats; }
+};
@@ -1,50 +1,338 @@
 #include "stdafx.h"
 #include "Log.h"
+#include "HostAtomic.h"
+#include "HostLoop.h"
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <strsafe.h>
-#include <wtypes.h>
+#include <string.h>
+#include <string>
+#ifdef _WIN32
+#   include <strsafe.h>
+#   include <wtypes.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#endif
 
 
 static bool gPrintConsole = true;
 
-#if LOGS_ENABLED
 
-static char gLogFilePath[_MAX_PATH]; // contains the path to the output log (needed in LogPrint())
+#ifdef _WIN32
+static inline unsigned int LogGetThreadId()
+{
+    return GetCurrentThreadId();
+}
+#else
+static inline unsigned int LogGetThreadId()
+{
+    static __thread unsigned int threadId = 0;
+
+    // gettid is a syscall, so ask only once per thread:
+    if (threadId == 0)
+    {
+        threadId = (unsigned int) syscall(SYS_gettid);
+    }
+    return threadId;
+}
+#endif
+
+#define LOG_MESSAGE_LENGTH  ((LOG_RECORD_SIZE - 16) / sizeof(TCHAR))
+
+/// <summary>
+/// Single slot of the ring buffer. The sequence number tells, whether the slot is free for the producer
+/// or contains a record for the consumer (bounded MPMC queue by D. Vyukov, used here with single consumer).
+/// </summary>
+struct LogRecord
+{
+    HostAtomic sequence;
+    unsigned int threadId;
+    unsigned long long timestamp;
+    TCHAR message[LOG_MESSAGE_LENGTH];
+};
+
+static volatile bool gLogEnabled = false;
+static char gLogFilePath[_MAX_PATH]; // contains the path to the output log
+static LogRecord* gLogRing = NULL;
+static HostAtomic gLogEnqueuePosition = 0;
+static unsigned int gLogDequeuePosition = 0;    // used only by the writer thread
+static HostAtomic gLogDropped = 0;
+static volatile bool gLogStopping = false;
+static FILE* gLogFile = NULL;
+static unsigned int gLogFileSize = 0;
+static unsigned int gLogMaxFileSize = LOG_DEFAULT_MAX_FILE_SIZE;
+#ifdef _WIN32
+static HANDLE gLogThread = NULL;
+static HANDLE gLogWakeEvent = NULL;
+#else
+static pthread_t gLogThread;
+#endif
 
 void LogInitialize()
 {
+#ifdef _WIN32
     GetEnvironmentVariableA("LocalAppData", gLogFilePath, _countof(gLogFilePath));
     strcat_s(gLogFilePath, _countof(gLogFilePath), "\\BlackBerry\\wrapper.log");
+#else
+    const char* home = getenv("HOME");
+    snprintf(gLogFilePath, _countof(gLogFilePath), "%s/.blackberry-wrapper.log", home != NULL ? home : "/tmp");
+#endif
 
-    FILE* file = NULL;
-    errno_t retCode;
-    retCode = fopen_s(&file, gLogFilePath, "w"); // just to delete a possible existing file
-    if (file != NULL && retCode == 0)
+    const char* setting = getenv(LOG_ENVIRONMENT_VARIABLE);
+    if (setting != NULL && setting[0] != '\0' && setting[0] != '0')
     {
-        fclose(file);
+        unsigned int maxFileSize = (unsigned int) atoi(setting);
+        LogEnable(maxFileSize > 1 ? maxFileSize * 1024 : LOG_DEFAULT_MAX_FILE_SIZE);
     }
 }
 
-/// <summary> 
-/// Generic function to print to a log file. 
+/// <summary>
+/// Moves the current log file aside and starts a new one.
+/// </summary>
+static void LogRotate()
+{
+    char source[_MAX_PATH + 8];
+    char target[_MAX_PATH + 8];
+
+    if (gLogFile != NULL)
+    {
+        fclose(gLogFile);
+    }
+
+    for (int i = LOG_ROTATED_FILES; i > 0; i--)
+    {
+        if (i > 1)
+        {
+            sprintf_s(source, sizeof(source), "%s.%d", gLogFilePath, i - 1);
+        }
+        else
+        {
+            sprintf_s(source, sizeof(source), "%s", gLogFilePath);
+        }
+        sprintf_s(target, sizeof(target), "%s.%d", gLogFilePath, i);
+
+        remove(target);
+        rename(source, target);
+    }
+
+    gLogFile = fopen(gLogFilePath, "wb");
+    gLogFileSize = 0;
+}
+
+/// <summary>
+/// Moves all records from the ring buffer into the file using single write.
+/// </summary>
+static void LogWriteBatch(std::string& batch)
+{
+    TCHAR line[LOG_MESSAGE_LENGTH + 64];
+    unsigned int mask = LOG_RING_CAPACITY - 1;
+
+    batch.clear();
+
+    while (true)
+    {
+        LogRecord* record = &gLogRing[gLogDequeuePosition & mask];
+        int difference = (int) ((unsigned int) HostAtomicLoad(&record->sequence) - (gLogDequeuePosition + 1));
+        if (difference < 0)
+            break;
+
+        int length = _stprintf_s(line, _countof(line), _T("[%6llu.%06llu] [%5u] %s\r\n"),
+                                 record->timestamp / 1000000, record->timestamp % 1000000, record->threadId, record->message);
+
+#if defined(_WIN32) && defined(_UNICODE)
+        char text[_countof(line) * 3];
+        length = WideCharToMultiByte(CP_UTF8, 0, line, length, text, sizeof(text), NULL, NULL);
+        batch.append(text, length > 0 ? length : 0);
+#else
+        batch.append(line, length > 0 ? length : 0);
+#endif
+
+        // release the slot for producers:
+        HostAtomicStore(&record->sequence, (int) (gLogDequeuePosition + LOG_RING_CAPACITY));
+        gLogDequeuePosition++;
+    }
+
+    if (batch.empty())
+        return;
+
+    if (gLogFile == NULL || gLogFileSize + batch.size() > gLogMaxFileSize)
+    {
+        LogRotate();
+        if (gLogFile == NULL)
+            return;
+    }
+
+    fwrite(batch.data(), 1, batch.size(), gLogFile);
+    fflush(gLogFile);
+    gLogFileSize += (unsigned int) batch.size();
+}
+
+/// <summary>
+/// Background thread writing the records into the file.
 /// </summary>
-/// <param name="buffer"> Message to be printed to a log file. </param>
-void LogPrint(TCHAR* message)
+#ifdef _WIN32
+static DWORD WINAPI LogWriterThread(LPVOID lpParameter)
+#else
+static void* LogWriterThread(void* lpParameter)
+#endif
 {
-    FILE* file = NULL;
-    errno_t retCode;
+    std::string batch;
+    batch.reserve(LOG_RING_CAPACITY * 64);
 
-    retCode = fopen_s(&file, gLogFilePath, "a");
-    if (file != NULL && retCode == 0)
+    while (!gLogStopping)
     {
-        _ftprintf(file, _T("%s\r\n"), message);
-        fclose(file);
+#ifdef _WIN32
+        WaitForSingleObject(gLogWakeEvent, LOG_FLUSH_INTERVAL);
+#else
+        usleep(LOG_FLUSH_INTERVAL * 1000);
+#endif
+        LogWriteBatch(batch);
     }
+
+    LogWriteBatch(batch);
+    return 0;
 }
 
-#endif /* LOGS_ENABLED */
+/// <summary>
+/// Turns the logging on. The previous log file is rotated away.
+/// </summary>
+/// <param name="maxFileSize">Size in bytes, after which the file is rotated.</param>
+BOOL LogEnable(unsigned int maxFileSize)
+{
+    if (gLogEnabled)
+        return TRUE;
+
+    gLogMaxFileSize = maxFileSize > 0 ? maxFileSize : LOG_DEFAULT_MAX_FILE_SIZE;
+    gLogRing = new LogRecord[LOG_RING_CAPACITY];
+    for (unsigned int i = 0; i < LOG_RING_CAPACITY; i++)
+    {
+        gLogRing[i].sequence = (int) i;
+    }
+
+    LogRotate();
+    if (gLogFile == NULL)
+        return FALSE;
+
+    gLogStopping = false;
+#ifdef _WIN32
+    gLogWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    gLogThread = CreateThread(NULL, 0, LogWriterThread, NULL, 0, NULL);
+    if (gLogThread == NULL)
+        return FALSE;
+#else
+    if (pthread_create(&gLogThread, NULL, LogWriterThread, NULL) != 0)
+        return FALSE;
+#endif
+
+    gLogEnabled = true;
+    atexit(LogShutdown);
+    return TRUE;
+}
+
+BOOL LogIsEnabled()
+{
+    return gLogEnabled;
+}
+
+/// <summary>
+/// Writes all pending records and stops the writer thread.
+/// </summary>
+void LogShutdown()
+{
+    if (!gLogEnabled)
+        return;
+
+    if (gLogDropped > 0)
+    {
+        TCHAR message[64];
+        _stprintf_s(message, _countof(message), _T("Log: %d records dropped"), (int) gLogDropped);
+        LogPrint(message);
+    }
+
+    gLogEnabled = false;
+    gLogStopping = true;
+#ifdef _WIN32
+    SetEvent(gLogWakeEvent);
+    WaitForSingleObject(gLogThread, INFINITE);
+    CloseHandle(gLogThread);
+    CloseHandle(gLogWakeEvent);
+#else
+    pthread_join(gLogThread, NULL);
+#endif
+
+    if (gLogFile != NULL)
+    {
+        fclose(gLogFile);
+        gLogFile = NULL;
+    }
+}
+
+unsigned long long LogGetDroppedCount()
+{
+    return (unsigned int) HostAtomicLoad(&gLogDropped);
+}
+
+/// <summary> 
+/// Puts the message into the ring buffer. It never blocks; when the buffer is full, the message is dropped.
+/// </summary>
+/// <param name="message"> Message to be printed to a log file. </param>
+void LogPrint(LPCTSTR message)
+{
+    if (!gLogEnabled)
+        return;
+
+    unsigned int mask = LOG_RING_CAPACITY - 1;
+    unsigned int position = (unsigned int) HostAtomicLoad(&gLogEnqueuePosition);
+    LogRecord* record;
+
+    while (true)
+    {
+        record = &gLogRing[position & mask];
+        int difference = (int) ((unsigned int) HostAtomicLoad(&record->sequence) - position);
+
+        if (difference == 0)
+        {
+            if (HostAtomicCompareExchange(&gLogEnqueuePosition, (int) position, (int) (position + 1)))
+                break;
+        }
+        else if (difference < 0)
+        {
+            // buffer is full:
+            HostAtomicIncrement(&gLogDropped);
+            return;
+        }
+
+        position = (unsigned int) HostAtomicLoad(&gLogEnqueuePosition);
+    }
+
+    size_t length = _tcslen(message);
+    while (length > 0 && (message[length - 1] == '\r' || message[length - 1] == '\n'))
+    {
+        length--;
+    }
+    if (length >= _countof(record->message))
+    {
+        length = _countof(record->message) - 1;
+    }
+
+    memcpy(record->message, message, length * sizeof(TCHAR));
+    record->message[length] = '\0';
+    record->timestamp = HostGetTimestamp();
+    record->threadId = LogGetThreadId();
+
+    // publish the record for the writer thread:
+    HostAtomicStore(&record->sequence, (int) (position + 1));
+
+    // wake the writer earlier, when the buffer gets half full:
+#ifdef _WIN32
+    if ((position & (mask >> 1)) == 0)
+    {
+        SetEvent(gLogWakeEvent);
+    }
+#endif
+}
 
 void DisableConsolePrinting()
 {
@@ -59,7 +347,7 @@ static void VsPrintMessage(LPCTSTR format, va_list args)
 
     if (gPrintConsole)
     {
-        _tprintf(buffer);
+        _tprintf(_T("%s"), buffer);
         fflush(stdout);
     }
 
@@ -82,12 +370,16 @@ void PrintMessage(LPCTSTR format, ...)
 /// <param name="lpszFunctionName">Name of the API function, that failed</param>
 void PrintError(LPCTSTR lpszFunctionName, DWORD lastError)
 {
+#ifdef _WIN32
     HLOCAL lpvMessageBuffer = NULL;
 
     FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
         NULL, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR) &lpvMessageBuffer, 0, NULL);
     PrintMessage(_T("Error: API    = %s.\n   error code = %d.\n   message    = %s.\n"), lpszFunctionName, lastError, (LPTSTR)lpvMessageBuffer);
     LocalFree(lpvMessageBuffer);
+#else
+    PrintMessage(_T("Error: API    = %s.\n   error code = %d.\n   message    = %s.\n"), lpszFunctionName, lastError, strerror(lastError));
+#endif
 }
 
 /// <summary> 
@@ -96,12 +388,13 @@ void PrintError(LPCTSTR lpszFunctionName, DWORD lastError)
 /// <param name="lpszFunctionName">Name of the API function, that failed</param>
 void ShowMessage(LPCTSTR lpszFunctionName, DWORD lastError, LPCTSTR arguments)
 { 
-    HLOCAL lpMsgBuf;
-    HLOCAL lpDisplayBuf;
-
     if (arguments == NULL)
         arguments = _T("");
 
+#ifdef _WIN32
+    HLOCAL lpMsgBuf;
+    HLOCAL lpDisplayBuf;
+
     FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
         NULL, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR) &lpMsgBuf, 0, NULL);
 
@@ -115,4 +408,8 @@ void ShowMessage(LPCTSTR lpszFunctionName, DWORD lastError, LPCTSTR arguments)
 
     LocalFree(lpMsgBuf);
     LocalFree(lpDisplayBuf);
+#else
+    // no message boxes, just print the error to console
+    PrintMessage(_T("%s failed with error %d: %s\r\n%s"), lpszFunctionName, lastError, strerror(lastError), arguments);
+#endif
 }
@@ -3,16 +3,23 @@
 #include "stdafx.h"
 
 
-#define LOGS_ENABLED        0
+#define LOG_RING_CAPACITY           8192                // records, must be power of 2
+#define LOG_RECORD_SIZE             256                 // bytes of single record including its header
+#define LOG_FLUSH_INTERVAL          50                  // ms
+#define LOG_DEFAULT_MAX_FILE_SIZE   (4 * 1024 * 1024)   // bytes, before the file is rotated
+#define LOG_ROTATED_FILES           2
+#define LOG_ENVIRONMENT_VARIABLE    "BLACKBERRY_GDBHOST_LOG"
 
-
-#if LOGS_ENABLED
-    void LogInitialize();
-    void LogPrint(TCHAR *message);
-#else
-#   define LogInitialize()                  // do nothing
-#   define LogPrint(message)                // do nothing
-#endif
+// Logging is disabled by default and costs only a single check per call then.
+// Once enabled (via LogEnable() or by setting the environment variable to the max file size in KB or '1'),
+// each call copies the message into a lock-free ring buffer and a background thread writes them in batches
+// into a size-capped, rotated file.
+void LogInitialize();
+BOOL LogEnable(unsigned int maxFileSize);
+BOOL LogIsEnabled();
+void LogShutdown();
+void LogPrint(LPCTSTR message);
+unsigned long long LogGetDroppedCount();
 
 void DisableConsolePrinting();
 
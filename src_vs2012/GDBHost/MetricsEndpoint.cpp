@@ -0,0 +1,385 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// MetricsEndpoint.cpp : live metrics of the host served over a loopback socket.
+//
+
+#include "stdafx.h"
+#include "MetricsEndpoint.h"
+#include "GDBWrapper.h"
+#include "InterruptStats.h"
+#include "MiPipeline.h"
+#include "MiRelay.h"
+#include "Log.h"
+
+#include <stdio.h>
+#ifndef _WIN32
+#   include <fcntl.h>
+#endif
+
+
+MetricsEndpoint::MetricsEndpoint()
+    : m_started(HostGetTimestamp()), m_scrapes(0), m_gdb(NULL), m_output(NULL), m_error(NULL), m_input(NULL), m_pipeline(NULL), m_interrupts(NULL),
+      m_sampleTime(0), m_sampleRecords(0), m_sampleCpu(0), m_recordRate(0), m_cpuUsage(0)
+{
+#ifdef _WIN32
+    m_event = NULL;
+#endif
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+    Close();
+}
+
+BOOL MetricsEndpoint::Open(unsigned short port)
+{
+    Close();
+    if (!RspSocket::Startup() || !m_listener.Listen(port))
+        return FALSE;
+
+    // the loop must never block in accept(), if the scraper gave up before it got there:
+#ifdef _WIN32
+    m_event = WSACreateEvent();
+    if (m_event == WSA_INVALID_EVENT || WSAEventSelect(m_listener.GetHandle(), m_event, FD_ACCEPT) != 0)
+    {
+        Close();
+        return FALSE;
+    }
+#else
+    int flags = fcntl(m_listener.GetHandle(), F_GETFL);
+    if (flags < 0 || fcntl(m_listener.GetHandle(), F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        Close();
+        return FALSE;
+    }
+#endif
+
+    m_sampleTime = HostGetTimestamp();
+    m_sampleRecords = GetRecordCount();
+    m_sampleCpu = m_gdb != NULL ? m_gdb->GetCpuTime() : 0;
+    return TRUE;
+}
+
+void MetricsEndpoint::Close()
+{
+    m_listener.Close();
+#ifdef _WIN32
+    if (m_event != NULL && m_event != WSA_INVALID_EVENT)
+    {
+        WSACloseEvent(m_event);
+    }
+    m_event = NULL;
+#endif
+}
+
+HostWaitable MetricsEndpoint::GetWaitable() const
+{
+#ifdef _WIN32
+    return m_event;
+#else
+    return m_listener.GetHandle();
+#endif
+}
+
+unsigned long long MetricsEndpoint::GetRecordCount() const
+{
+    unsigned long long records = 0;
+
+    if (m_output != NULL)
+    {
+        records += m_output->GetStats().records;
+    }
+    if (m_error != NULL)
+    {
+        records += m_error->GetStats().records;
+    }
+
+    return records;
+}
+
+void MetricsEndpoint::AppendHeader(std::string& output, const char* name, const char* type, const char* help)
+{
+    output.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    output.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void MetricsEndpoint::AppendValue(std::string& output, const char* name, const char* labels, unsigned long long value)
+{
+    char text[32];
+
+    sprintf_s(text, sizeof(text), " %llu\n", value);
+    output.append(name);
+    if (labels != NULL)
+    {
+        output.append("{").append(labels).append("}");
+    }
+    output.append(text);
+}
+
+void MetricsEndpoint::AppendValue(std::string& output, const char* name, const char* labels, double value)
+{
+    char text[48];
+
+    sprintf_s(text, sizeof(text), " %.6f\n", value);
+    output.append(name);
+    if (labels != NULL)
+    {
+        output.append("{").append(labels).append("}");
+    }
+    output.append(text);
+}
+
+void MetricsEndpoint::AppendLatency(std::string& output, const char* phase, const LatencyHistogram& histogram)
+{
+    static const double Quantiles[] = { 0.5, 0.9, 0.99 };
+    static const char* QuantileNames[] = { "0.5", "0.9", "0.99" };
+    char labels[64];
+
+    for (size_t i = 0; i < _countof(Quantiles); i++)
+    {
+        sprintf_s(labels, sizeof(labels), "phase=\"%s\",quantile=\"%s\"", phase, QuantileNames[i]);
+        AppendValue(output, "gdbhost_interrupt_latency_microseconds", labels, histogram.GetPercentile(Quantiles[i] * 100));
+    }
+
+    sprintf_s(labels, sizeof(labels), "phase=\"%s\"", phase);
+    AppendValue(output, "gdbhost_interrupt_latency_microseconds_sum", labels, histogram.GetTotal());
+    AppendValue(output, "gdbhost_interrupt_latency_microseconds_count", labels, histogram.GetCount());
+}
+
+void MetricsEndpoint::Format(std::string& output)
+{
+    unsigned long long now = HostGetTimestamp();
+
+    AppendHeader(output, "gdbhost_uptime_seconds", "gauge", "Time since the host started.");
+    AppendValue(output, "gdbhost_uptime_seconds", NULL, (now - m_started) / 1000000.0);
+    AppendHeader(output, "gdbhost_scrapes_total", "counter", "Snapshots served by this endpoint, including the current one.");
+    AppendValue(output, "gdbhost_scrapes_total", NULL, m_scrapes);
+
+    if (m_output != NULL && m_error != NULL && m_input != NULL)
+    {
+        const MiRelayStats& outputStats = m_output->GetStats();
+        const MiRelayStats& errorStats = m_error->GetStats();
+        const MiStreamStats& stream = m_output->GetStreamStats();
+
+        AppendHeader(output, "gdbhost_stream_bytes_total", "counter", "Bytes received from GDB (stdout, stderr) or sent to it (stdin).");
+        AppendValue(output, "gdbhost_stream_bytes_total", "stream=\"stdout\"", outputStats.bytes);
+        AppendValue(output, "gdbhost_stream_bytes_total", "stream=\"stderr\"", errorStats.bytes);
+        AppendValue(output, "gdbhost_stream_bytes_total", "stream=\"stdin\"", m_input->bytes);
+        AppendHeader(output, "gdbhost_stream_reads_total", "counter", "Reads of GDB output streams.");
+        AppendValue(output, "gdbhost_stream_reads_total", "stream=\"stdout\"", outputStats.reads);
+        AppendValue(output, "gdbhost_stream_reads_total", "stream=\"stderr\"", errorStats.reads);
+        AppendHeader(output, "gdbhost_stream_writes_total", "counter", "Writes of GDB output to the IDE (stdout, stderr) or of commands to GDB (stdin).");
+        AppendValue(output, "gdbhost_stream_writes_total", "stream=\"stdout\"", outputStats.writes);
+        AppendValue(output, "gdbhost_stream_writes_total", "stream=\"stderr\"", errorStats.writes);
+        AppendValue(output, "gdbhost_stream_writes_total", "stream=\"stdin\"", m_input->writes);
+        AppendHeader(output, "gdbhost_mi_records_total", "counter", "MI records received from GDB.");
+        AppendValue(output, "gdbhost_mi_records_total", "stream=\"stdout\"", outputStats.records);
+        AppendValue(output, "gdbhost_mi_records_total", "stream=\"stderr\"", errorStats.records);
+        AppendHeader(output, "gdbhost_mi_records_per_second", "gauge", "MI records received from GDB during the last second.");
+        AppendValue(output, "gdbhost_mi_records_per_second", NULL, m_recordRate);
+        AppendHeader(output, "gdbhost_queue_bytes", "gauge", "Data waiting inside the host to be forwarded to the IDE.");
+        AppendValue(output, "gdbhost_queue_bytes", "queue=\"stdout\"", (unsigned long long) m_output->GetPendingBytes());
+        AppendValue(output, "gdbhost_queue_bytes", "queue=\"stderr\"", (unsigned long long) m_error->GetPendingBytes());
+        AppendValue(output, "gdbhost_queue_bytes", "queue=\"target-output\"", (unsigned long long) m_output->GetStreamBacklog());
+        AppendHeader(output, "gdbhost_target_output_bytes_total", "counter", "Target output of the debuggee forwarded in throttled chunks or dropped.");
+        AppendValue(output, "gdbhost_target_output_bytes_total", "result=\"forwarded\"", stream.bytes);
+        AppendValue(output, "gdbhost_target_output_bytes_total", "result=\"dropped\"", stream.dropped);
+    }
+
+    if (m_pipeline != NULL)
+    {
+        unsigned long long oldest = m_pipeline->GetOldestSentTime();
+
+        AppendHeader(output, "gdbhost_commands_total", "counter", "Commands received from the IDE.");
+        AppendValue(output, "gdbhost_commands_total", NULL, m_pipeline->GetPipelineStats().commands);
+        AppendHeader(output, "gdbhost_commands_in_flight", "gauge", "Commands sent to GDB and waiting for their results.");
+        AppendValue(output, "gdbhost_commands_in_flight", NULL, (unsigned long long) m_pipeline->GetInFlightCount());
+        AppendHeader(output, "gdbhost_commands_queued", "gauge", "Commands held inside the host by a full window or a barrier.");
+        AppendValue(output, "gdbhost_commands_queued", NULL, (unsigned long long) m_pipeline->GetQueuedCount());
+        AppendHeader(output, "gdbhost_command_oldest_age_seconds", "gauge", "Time the oldest command in flight waits for its result (0, when none).");
+        AppendValue(output, "gdbhost_command_oldest_age_seconds", NULL, oldest != 0 && now > oldest ? (now - oldest) / 1000000.0 : 0.0);
+    }
+
+    if (m_interrupts != NULL)
+    {
+        AppendHeader(output, "gdbhost_interrupts_total", "counter", "Interrupt requests and their failures.");
+        AppendValue(output, "gdbhost_interrupts_total", "result=\"requested\"", m_interrupts->requests);
+        AppendValue(output, "gdbhost_interrupts_total", "result=\"repeated\"", m_interrupts->repeated);
+        AppendValue(output, "gdbhost_interrupts_total", "result=\"failed\"", m_interrupts->failed);
+        AppendValue(output, "gdbhost_interrupts_total", "result=\"lost\"", m_interrupts->lost);
+        AppendHeader(output, "gdbhost_interrupt_latency_microseconds", "summary", "Latency of the Ctrl-C path (delivery to GDB, till '*stopped' and total).");
+        AppendLatency(output, "delivery", m_interrupts->delivery);
+        AppendLatency(output, "stop", m_interrupts->stop);
+        AppendLatency(output, "total", m_interrupts->total);
+    }
+
+    if (m_gdb != NULL)
+    {
+        AppendHeader(output, "gdbhost_gdb_resident_bytes", "gauge", "Resident memory (working set) of the GDB process.");
+        AppendValue(output, "gdbhost_gdb_resident_bytes", NULL, m_gdb->GetMemoryUsage());
+        AppendHeader(output, "gdbhost_gdb_cpu_seconds_total", "counter", "Processor time consumed by the GDB process.");
+        AppendValue(output, "gdbhost_gdb_cpu_seconds_total", NULL, m_gdb->GetCpuTime() / 1000000.0);
+        AppendHeader(output, "gdbhost_gdb_cpu_usage", "gauge", "Share of a single processor used by the GDB process during the last second.");
+        AppendValue(output, "gdbhost_gdb_cpu_usage", NULL, m_cpuUsage);
+    }
+}
+
+/// <summary>
+/// Reads the request head (till the empty line) and returns its first line. Returns FALSE, when the scraper closed
+/// the connection, didn't send the whole head within the timeout or sent too much.
+/// </summary>
+BOOL MetricsEndpoint::ReadRequest(RspSocket& client, std::string& requestLine)
+{
+    std::string head;
+    char buffer[1024];
+    unsigned long long start = HostGetTimestamp();
+
+    while (head.find("\r\n\r\n") == std::string::npos && head.find("\n\n") == std::string::npos)
+    {
+        unsigned long long elapsed = (HostGetTimestamp() - start) / 1000;
+        BOOL ready = FALSE;
+        BOOL unused = FALSE;
+
+        if (elapsed >= METRICS_REQUEST_TIMEOUT || head.size() >= METRICS_REQUEST_MAX_SIZE
+            || !RspSocket::Wait(&client, NULL, (DWORD) (METRICS_REQUEST_TIMEOUT - elapsed), ready, unused) || !ready)
+            return FALSE;
+
+        size_t count = client.Receive(buffer, sizeof(buffer));
+        if (count == 0)
+            return FALSE;
+
+        head.append(buffer, count);
+    }
+
+    requestLine = head.substr(0, head.find_first_of("\r\n"));
+    return TRUE;
+}
+
+/// <summary>
+/// Answers single HTTP request: the snapshot for GET and HEAD of '/metrics' or '/', an error status otherwise.
+/// </summary>
+void MetricsEndpoint::Reply(RspSocket& client, const std::string& requestLine)
+{
+    size_t methodEnd = requestLine.find(' ');
+    std::string method = requestLine.substr(0, methodEnd);
+    std::string path;
+    std::string body;
+    const char* status = "200 OK";
+    char header[256];
+
+    if (methodEnd != std::string::npos)
+    {
+        size_t pathEnd = requestLine.find(' ', methodEnd + 1);
+        path = requestLine.substr(methodEnd + 1, pathEnd != std::string::npos ? pathEnd - methodEnd - 1 : std::string::npos);
+        path = path.substr(0, path.find('?'));
+    }
+
+    if (method != "GET" && method != "HEAD")
+    {
+        status = "405 Method Not Allowed";
+        body = "Only GET is supported.\n";
+    }
+    else if (path != "/metrics" && path != "/")
+    {
+        status = "404 Not Found";
+        body = "Metrics are served at /metrics.\n";
+    }
+    else
+    {
+        m_scrapes++;
+        Format(body);
+    }
+
+    sprintf_s(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+              status, (unsigned int) body.size());
+
+    std::string response(header);
+    if (method != "HEAD")
+    {
+        response.append(body);
+    }
+
+    if (!client.Send(response.data(), response.size()))
+    {
+        LogPrint(_T("MetricsEndpoint: unable to send snapshot"));
+    }
+}
+
+/// <summary>
+/// Accepts all pending connections and answers the request of each with the current snapshot. Local scrapers send
+/// the request right after connecting, so the loop waits for it only briefly (the request of a silent client is dropped
+/// after METRICS_REQUEST_TIMEOUT). The snapshot is only a few kilobytes, which fit into the socket buffer, so sending
+/// doesn't stall the loop, even if the scraper is slow to read it.
+/// </summary>
+BOOL MetricsEndpoint::OnSignaled(HostWaitable waitable)
+{
+    RspSocket client;
+
+#ifdef _WIN32
+    WSANETWORKEVENTS events;
+
+    // also resets the event:
+    WSAEnumNetworkEvents(m_listener.GetHandle(), m_event, &events);
+#endif
+
+    while (m_listener.Accept(client))
+    {
+#ifdef _WIN32
+        // accepted socket inherits the event selection and non-blocking mode of the listener:
+        u_long blocking = 0;
+        WSAEventSelect(client.GetHandle(), NULL, 0);
+        ioctlsocket(client.GetHandle(), FIONBIO, &blocking);
+#endif
+        std::string requestLine;
+
+        // the request must be read whole, closing the socket with unread data would reset the connection:
+        if (ReadRequest(client, requestLine))
+        {
+            Reply(client, requestLine);
+        }
+        else
+        {
+            LogPrint(_T("MetricsEndpoint: no valid request received"));
+        }
+        client.Close();
+    }
+
+    return TRUE;
+}
+
+DWORD MetricsEndpoint::GetTimeout()
+{
+    unsigned long long elapsed = (HostGetTimestamp() - m_sampleTime) / 1000;
+    return elapsed >= METRICS_SAMPLE_INTERVAL ? 0 : (DWORD) (METRICS_SAMPLE_INTERVAL - elapsed);
+}
+
+BOOL MetricsEndpoint::OnTimeout()
+{
+    unsigned long long now = HostGetTimestamp();
+    unsigned long long records = GetRecordCount();
+    unsigned long long cpu = m_gdb != NULL ? m_gdb->GetCpuTime() : 0;
+    double elapsed = (double) (now - m_sampleTime);
+
+    if (elapsed > 0)
+    {
+        m_recordRate = (records - m_sampleRecords) * 1000000.0 / elapsed;
+        m_cpuUsage = cpu >= m_sampleCpu ? (cpu - m_sampleCpu) / elapsed : 0;
+    }
+
+    m_sampleTime = now;
+    m_sampleRecords = records;
+    m_sampleCpu = cpu;
+    return TRUE;
+}
@@ -0,0 +1,107 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "RspProtocol.h"
+
+#include <string>
+
+
+#define METRICS_SAMPLE_INTERVAL     1000        // ms, over which the rates are measured
+#define METRICS_REQUEST_TIMEOUT     200         // ms, the loop waits for the request of an accepted scraper
+#define METRICS_REQUEST_MAX_SIZE    4096        // bytes of the request line and headers, longer requests are refused
+
+class GDBWrapper;
+class InterruptStats;
+class LatencyHistogram;
+class MiCommandPipeline;
+class MiRelay;
+struct MiRelayStats;
+
+/// <summary>
+/// Serves live metrics of the running host to local scrapers. Each connection accepted on the loopback port
+/// is a single HTTP/1.0 exchange: 'GET /metrics' (or '/') is answered with a snapshot in the Prometheus text
+/// exposition format and the connection is closed, so it can be read by Prometheus, 'curl' or a charting agent.
+/// Metrics are only ever added, their names and labels never change:
+///   gdbhost_stream_bytes_total{stream}, gdbhost_stream_reads_total{stream}, gdbhost_stream_writes_total{stream},
+///   gdbhost_mi_records_total{stream}, gdbhost_mi_records_per_second, gdbhost_queue_bytes{queue},
+///   gdbhost_commands_total, gdbhost_commands_in_flight, gdbhost_commands_queued, gdbhost_command_oldest_age_seconds,
+///   gdbhost_target_output_bytes_total{result}, gdbhost_interrupts_total{result}, gdbhost_interrupt_latency_microseconds{phase,quantile},
+///   gdbhost_gdb_resident_bytes, gdbhost_gdb_cpu_seconds_total, gdbhost_gdb_cpu_usage, gdbhost_uptime_seconds, gdbhost_scrapes_total.
+/// All sources are read on the loop thread, so the snapshot is consistent and nothing needs locking.
+/// </summary>
+class MetricsEndpoint : public HostWaitHandler, public HostTimerHandler
+{
+private:
+    RspSocket m_listener;
+#ifdef _WIN32
+    HANDLE m_event;                     // signaled by the sockets library, when a connection is pending
+#endif
+    unsigned long long m_started;
+    unsigned long long m_scrapes;
+    GDBWrapper* m_gdb;
+    MiRelay* m_output;
+    MiRelay* m_error;
+    const MiRelayStats* m_input;
+    MiCommandPipeline* m_pipeline;
+    InterruptStats* m_interrupts;
+
+    // rates measured over the last sample interval:
+    unsigned long long m_sampleTime;
+    unsigned long long m_sampleRecords;
+    unsigned long long m_sampleCpu;
+    double m_recordRate;
+    double m_cpuUsage;
+
+    unsigned long long GetRecordCount() const;
+    static BOOL ReadRequest(RspSocket& client, std::string& requestLine);
+    void Reply(RspSocket& client, const std::string& requestLine);
+    static void AppendHeader(std::string& output, const char* name, const char* type, const char* help);
+    static void AppendValue(std::string& output, const char* name, const char* labels, unsigned long long value);
+    static void AppendValue(std::string& output, const char* name, const char* labels, double value);
+    static void AppendLatency(std::string& output, const char* phase, const LatencyHistogram& histogram);
+
+public:
+    MetricsEndpoint();
+    ~MetricsEndpoint();
+
+    /// <summary>
+    /// Starts listening on given loopback port (0 picks any free one, see GetPort()).
+    /// </summary>
+    BOOL Open(unsigned short port);
+    void Close();
+
+    unsigned short GetPort() const { return m_listener.GetPort(); }
+    HostWaitable GetWaitable() const;
+
+    void SetGdb(GDBWrapper* gdb) { m_gdb = gdb; }
+    void SetRelays(MiRelay* output, MiRelay* error, const MiRelayStats* input) { m_output = output; m_error = error; m_input = input; }
+    void SetPipeline(MiCommandPipeline* pipeline) { m_pipeline = pipeline; }
+    void SetInterrupts(InterruptStats* interrupts) { m_interrupts = interrupts; }
+
+    /// <summary>
+    /// Appends the snapshot of all metrics in the text exposition format.
+    /// </summary>
+    void Format(std::string& output);
+
+    // HostWaitHandler
+    virtual BOOL OnSignaled(HostWaitable waitable);
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+};
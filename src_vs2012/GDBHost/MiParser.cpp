@@ -0,0 +1,169 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// MiParser.cpp : streaming tokenizer of GDB/MI output records.
+//
+
+#include "stdafx.h"
+#include "MiParser.h"
+
+#include <string.h>
+
+
+static const char MiPrompt[] = "(gdb)";
+
+
+BOOL MiRecord::IsClass(const char* name) const
+{
+    size_t nameLength = strlen(name);
+    return classLength == nameLength && memcmp(className, name, nameLength) == 0;
+}
+
+void MiParser::ParseRecord(const char* line, size_t length, MiRecord& record)
+{
+    const char* end = line + length;
+    const char* p = line;
+
+    record.type = MiRecordUnknown;
+    record.token = MI_NO_TOKEN;
+    record.line = line;
+    record.length = length;
+    record.className = line;
+    record.classLength = 0;
+    record.results = line;
+    record.resultsLength = length;
+
+    if (length >= sizeof(MiPrompt) - 1 && memcmp(line, MiPrompt, sizeof(MiPrompt) - 1) == 0)
+    {
+        record.type = MiRecordPrompt;
+        record.results = end;
+        record.resultsLength = 0;
+        return;
+    }
+
+    // optional token:
+    if (p < end && *p >= '0' && *p <= '9')
+    {
+        record.token = ParseToken(p, end);
+    }
+
+    if (p >= end)
+    {
+        record.token = MI_NO_TOKEN;
+        return;
+    }
+
+    switch (*p)
+    {
+        case '^':
+            record.type = MiRecordResult;
+            break;
+        case '*':
+            record.type = MiRecordExecAsync;
+            break;
+        case '+':
+            record.type = MiRecordStatusAsync;
+            break;
+        case '=':
+            record.type = MiRecordNotify;
+            break;
+        case '~':
+            record.type = MiRecordConsoleStream;
+            break;
+        case '@':
+            record.type = MiRecordTargetStream;
+            break;
+        case '&':
+            record.type = MiRecordLogStream;
+            break;
+        default:
+            record.token = MI_NO_TOKEN;
+            return;
+    }
+
+    p++;
+
+    // streams have only the c-string:
+    if (record.type >= MiRecordConsoleStream)
+    {
+        record.className = p;
+        record.results = p;
+        record.resultsLength = end - p;
+        return;
+    }
+
+    const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+    const char* classEnd = comma != NULL ? comma : end;
+
+    record.className = p;
+    record.classLength = classEnd - p;
+    record.results = comma != NULL ? comma + 1 : end;
+    record.resultsLength = end - record.results;
+}
+
+unsigned int MiParser::ParseToken(const char*& p, const char* end)
+{
+    unsigned int token = 0;
+
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        unsigned int digit = *p - '0';
+
+        token = token > (MI_LARGE_TOKEN - digit) / 10 ? MI_LARGE_TOKEN : token * 10 + digit;
+        p++;
+    }
+    return token;
+}
+
+size_t MiParser::Parse(const char* data, size_t length, MiRecordObserver* observer)
+{
+    const char* end = data + length;
+    const char* start = data;
+    const char* eol = static_cast<const char*>(memchr(start, '\n', length));
+    MiRecord record;
+
+    while (eol != NULL)
+    {
+        size_t lineLength = eol - start;
+        if (lineLength > 0 && start[lineLength - 1] == '\r')
+        {
+            lineLength--;
+        }
+
+        ParseRecord(start, lineLength, record);
+        if (observer != NULL)
+        {
+            observer->OnRecord(record);
+        }
+
+        start = eol + 1;
+        eol = static_cast<const char*>(memchr(start, '\n', end - start));
+    }
+
+    return start - data;
+}
+
+void MiParser::AppendFrame(std::string& output, const MiRecord& record)
+{
+    MiFrameHeader header;
+
+    header.length = (unsigned int) (sizeof(header) + record.length);
+    header.type = (unsigned char) record.type;
+    header.classOffset = (unsigned char) (record.className - record.line);
+    header.classLength = (unsigned short) record.classLength;
+    header.token = record.token;
+
+    output.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.append(record.line, record.length);
+}
@@ -0,0 +1,113 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <string>
+
+
+#define MI_NO_TOKEN                 0xFFFFFFFF
+#define MI_LARGE_TOKEN              0xFFFFFFFE  // any token too big to be matched exactly
+
+
+/// <summary>
+/// Types of GDB/MI output records.
+/// </summary>
+enum MiRecordType
+{
+    MiRecordUnknown = 0,        // any text, that doesn't match MI syntax
+    MiRecordPrompt,             // (gdb)
+    MiRecordResult,             // ^done, ^running, ^connected, ^error, ^exit
+    MiRecordExecAsync,          // *stopped, *running
+    MiRecordStatusAsync,        // +download
+    MiRecordNotify,             // =thread-created, =library-loaded, ...
+    MiRecordConsoleStream,      // ~"text"
+    MiRecordTargetStream,       // @"text"
+    MiRecordLogStream           // &"text"
+};
+
+/// <summary>
+/// Single record of GDB/MI output. It doesn't own any memory, all pointers refer to the parsed buffer.
+/// </summary>
+struct MiRecord
+{
+    MiRecordType type;
+    unsigned int token;         // MI_NO_TOKEN, if not specified
+    const char* line;           // whole line without the new-line characters
+    size_t length;
+    const char* className;      // 'done', 'stopped', 'library-loaded', ... (empty for streams and prompt)
+    size_t classLength;
+    const char* results;        // everything after the class name and the comma or the stream c-string
+    size_t resultsLength;
+
+    BOOL IsClass(const char* name) const;
+};
+
+/// <summary>
+/// Header of a frame, that carries single MI record to the IDE, when the relay runs in framed mode.
+/// All numbers are little-endian. The header is followed by the record line (without the new-line),
+/// so the class name and results can be accessed directly at specified offsets.
+/// </summary>
+#pragma pack(push, 1)
+struct MiFrameHeader
+{
+    unsigned int length;        // total size of the frame including this header
+    unsigned char type;         // MiRecordType
+    unsigned char classOffset;  // offset of the class name inside the record line
+    unsigned short classLength;
+    unsigned int token;         // MI_NO_TOKEN, if not specified
+};
+#pragma pack(pop)
+
+/// <summary>
+/// Interface of components interested in all records passing through the relay.
+/// </summary>
+class MiRecordObserver
+{
+public:
+    virtual ~MiRecordObserver() { }
+
+    virtual void OnRecord(const MiRecord& record) = 0;
+};
+
+/// <summary>
+/// Streaming tokenizer of GDB/MI output. It works directly over the raw buffer and doesn't copy any data.
+/// </summary>
+class MiParser
+{
+public:
+    /// <summary>
+    /// Classifies single line (without new-line characters) and extracts its token and class.
+    /// </summary>
+    static void ParseRecord(const char* line, size_t length, MiRecord& record);
+
+    /// <summary>
+    /// Parses decimal token starting at 'p' and moves 'p' behind it. Values, that don't fit below MI_LARGE_TOKEN,
+    /// saturate to MI_LARGE_TOKEN, so they never wrap around nor collide with MI_NO_TOKEN.
+    /// </summary>
+    static unsigned int ParseToken(const char*& p, const char* end);
+
+    /// <summary>
+    /// Parses all complete lines inside the buffer and passes them to the observer.
+    /// Returns the number of consumed bytes; the remaining incomplete line should be passed again, once more data arrives.
+    /// </summary>
+    static size_t Parse(const char* data, size_t length, MiRecordObserver* observer);
+
+    /// <summary>
+    /// Appends the frame representing given record to the output buffer.
+    /// </summary>
+    static void AppendFrame(std::string& output, const MiRecord& record);
+};
@@ -0,0 +1,391 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// MiPipeline.cpp : forwarding of token-tagged commands to GDB without waiting for the previous replies.
+//
+
+#include "stdafx.h"
+#include "MiPipeline.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+struct MiCommandPrefix
+{
+    const char* name;
+    MiCommandClass commandClass;
+};
+
+// first matching prefix wins, everything else starting with '-' is a query:
+static const MiCommandPrefix MiCommandPrefixes[] =
+{
+    { "-exec-interrupt",    MiCommandControl },
+    { "-gdb-exit",          MiCommandBarrier },
+    { "-exec-",             MiCommandBarrier },
+    { "-target-",           MiCommandBarrier },
+    { "-file-exec-",        MiCommandBarrier },
+    { "-interpreter-exec",  MiCommandBarrier },
+    { "-gdb-set",           MiCommandBarrier },
+    { "-environment-",      MiCommandBarrier },
+};
+
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="gdb">GDB receiving the commands.</param>
+/// <param name="window">Max number of commands waiting for their results inside GDB.</param>
+MiCommandPipeline::MiCommandPipeline(GDBWrapper* gdb, size_t window)
+    : m_gdb(gdb), m_window(window > 0 ? window : 1), m_closing(FALSE), m_cache(NULL), m_output(NULL), m_symbols(NULL), m_variables(NULL)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(&m_pipelineStats, 0, sizeof(m_pipelineStats));
+}
+
+MiCommandClass MiCommandPipeline::Classify(const char* line, size_t length, unsigned int& token, size_t& commandOffset)
+{
+    const char* end = line + length;
+    const char* p = line;
+
+    token = MI_NO_TOKEN;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+
+    if (p < end && *p >= '0' && *p <= '9')
+    {
+        token = MiParser::ParseToken(p, end);
+    }
+
+    commandOffset = p - line;
+
+    // CLI commands can do anything:
+    if (p >= end || *p != '-')
+        return MiCommandBarrier;
+
+    // saturated tokens aren't unique, so such commands are sent alone to match their results unambiguously:
+    if (token == MI_LARGE_TOKEN)
+        return MiCommandBarrier;
+
+    for (size_t i = 0; i < sizeof(MiCommandPrefixes) / sizeof(MiCommandPrefixes[0]); i++)
+    {
+        size_t prefixLength = strlen(MiCommandPrefixes[i].name);
+        if ((size_t) (end - p) >= prefixLength && memcmp(p, MiCommandPrefixes[i].name, prefixLength) == 0)
+            return MiCommandPrefixes[i].commandClass;
+    }
+
+    return MiCommandQuery;
+}
+
+void MiCommandPipeline::Submit(const char* data, size_t length)
+{
+    m_stats.reads++;
+    m_input.append(data, length);
+
+    size_t start = 0;
+    size_t eol;
+
+    while ((eol = m_input.find('\n', start)) != std::string::npos)
+    {
+        size_t lineLength = eol - start;
+        if (lineLength > 0 && m_input[start + lineLength - 1] == '\r')
+        {
+            lineLength--;
+        }
+
+        // empty lines don't produce any result and would only break matching of the ones without tokens:
+        if (lineLength > 0)
+        {
+            Command command;
+            size_t offset;
+
+            command.commandClass = Classify(m_input.data() + start, lineLength, command.token, offset);
+            command.text.assign(m_input, start, eol - start + 1);
+            if (m_symbols != NULL && command.commandClass == MiCommandBarrier)
+            {
+                m_symbols->Rewrite(command.text);
+            }
+            command.sentTime = 0;
+            command.cacheGeneration = 0;
+            if (m_cache != NULL && command.commandClass == MiCommandQuery)
+            {
+                m_cache->IsCacheable(m_input.data() + start + offset, lineLength - offset, command.cacheKey);
+            }
+            command.invalidates = m_cache != NULL && command.cacheKey.empty()
+                                  && (command.commandClass != MiCommandQuery || !MiResponseCache::IsReadOnly(m_input.data() + start + offset, lineLength - offset));
+            command.varUpdate = m_variables != NULL && command.commandClass == MiCommandQuery && MiVarTracker::IsUpdate(m_input.data() + start + offset, lineLength - offset);
+            m_pipelineStats.commands++;
+
+            if (command.commandClass == MiCommandControl)
+            {
+                // lines read before it go first, as far as the window and barriers allow:
+                Pump();
+                Send(command);
+            }
+            else
+            {
+                if (!m_queue.empty() || !CanSend(command))
+                {
+                    m_pipelineStats.held++;
+                }
+                m_queue.push_back(command);
+            }
+        }
+
+        start = eol + 1;
+    }
+
+    m_input.erase(0, start);
+    Pump();
+}
+
+/// <summary>
+/// Checks, if the command can be sent to GDB right now.
+/// </summary>
+BOOL MiCommandPipeline::CanSend(const Command& command) const
+{
+    if (m_inFlight.empty())
+        return TRUE;
+    if (command.commandClass == MiCommandBarrier)
+        return FALSE;
+
+    // all -var-update requests are answered from one refresh and the ones without token can't be matched with it out of order:
+    if (command.varUpdate && (m_variables->IsFetching() || command.token == MI_NO_TOKEN))
+        return FALSE;
+
+    size_t count = 0;
+    for (size_t i = 0; i < m_inFlight.size(); i++)
+    {
+        // barriers are sent alone, so nothing can follow them:
+        if (m_inFlight[i].commandClass == MiCommandBarrier)
+            return FALSE;
+        if (m_inFlight[i].commandClass != MiCommandControl)
+        {
+            count++;
+        }
+    }
+
+    return count < m_window;
+}
+
+void MiCommandPipeline::Send(Command& command)
+{
+    if (command.varUpdate)
+    {
+        std::string reply;
+
+        if (m_variables->Update(command.text, command.token, reply))
+        {
+            Answer(command, reply);
+            return;
+        }
+    }
+    else if (m_variables != NULL)
+    {
+        m_variables->OnCommand(command.text.data(), command.text.size());
+    }
+
+    if (!command.cacheKey.empty())
+    {
+        std::string reply;
+
+        // replies without token are matched in order, so they can't wait behind other commands:
+        if ((m_inFlight.empty() || command.token != MI_NO_TOKEN) && m_cache->Lookup(command.cacheKey, reply))
+        {
+            Answer(command, reply);
+            return;
+        }
+
+        if (!m_inFlight.empty() && command.token == MI_NO_TOKEN)
+        {
+            m_cache->CountMiss();
+        }
+        command.cacheGeneration = m_cache->GetGeneration();
+    }
+    else if (command.invalidates)
+    {
+        m_cache->Invalidate();
+    }
+
+    if (!m_inFlight.empty())
+    {
+        m_pipelineStats.pipelined++;
+    }
+
+    if (!m_gdb->WriteInput(command.text.data(), command.text.size()))
+    {
+        LogPrint(_T("MiCommandPipeline: write failed"));
+    }
+
+    m_stats.writes++;
+    m_stats.bytes += command.text.size();
+
+    command.sentTime = HostGetTimestamp();
+    m_inFlight.push_back(command);
+    if (m_inFlight.size() > m_pipelineStats.maxDepth)
+    {
+        m_pipelineStats.maxDepth = (unsigned int) m_inFlight.size();
+    }
+}
+
+/// <summary>
+/// Sends as many queued commands, as the window and barriers allow.
+/// </summary>
+void MiCommandPipeline::Pump()
+{
+    while (!m_queue.empty() && CanSend(m_queue.front()))
+    {
+        // sending a cached reply dispatches results recursively, so the command must be dequeued first:
+        Command command = m_queue.front();
+
+        m_queue.pop_front();
+        Send(command);
+    }
+
+    // IDE is gone, pass the EOF, once everything is delivered:
+    if (m_closing && m_queue.empty())
+    {
+        m_gdb->CloseInput();
+        m_closing = FALSE;
+    }
+}
+
+/// <summary>
+/// Completes the command with the reply (without token) produced by the host instead of GDB.
+/// </summary>
+void MiCommandPipeline::Answer(Command& command, std::string& reply)
+{
+    char token[16];
+
+    if (command.token != MI_NO_TOKEN)
+    {
+        sprintf_s(token, sizeof(token), "%u", command.token);
+        reply.insert(0, token);
+    }
+    reply.append("\n(gdb) \n");
+
+    // the reply is matched with the command the same way, as if it came from GDB:
+    command.cacheKey.clear();
+    command.reply.swap(reply);
+    command.sentTime = HostGetTimestamp();
+    m_inFlight.push_back(command);
+    InjectReplies();
+}
+
+/// <summary>
+/// Passes cached replies to the output, once all commands sent before them got their results.
+/// </summary>
+void MiCommandPipeline::InjectReplies()
+{
+    while (!m_inFlight.empty() && !m_inFlight.front().reply.empty())
+    {
+        std::string reply;
+
+        // injecting can dispatch the reply immediately and modify the in-flight list:
+        reply.swap(m_inFlight.front().reply);
+        m_output->Inject(reply.data(), reply.size());
+    }
+}
+
+void MiCommandPipeline::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    Submit(data, length);
+}
+
+void MiCommandPipeline::OnClosed(HostPipe pipe)
+{
+    m_closing = TRUE;
+    Pump();
+}
+
+/// <summary>
+/// Called by the output relay for each record received from GDB. Each command produces exactly one result record.
+/// </summary>
+void MiCommandPipeline::OnRecord(const MiRecord& record)
+{
+    if (record.type != MiRecordResult)
+        return;
+
+    for (size_t i = 0; i < m_inFlight.size(); i++)
+    {
+        // replies produced by the host, that still wait for injection, aren't expected from GDB:
+        if (m_inFlight[i].token == record.token && m_inFlight[i].reply.empty())
+        {
+            m_roundTrip.Record(HostGetTimestamp() - m_inFlight[i].sentTime);
+            if (!m_inFlight[i].cacheKey.empty() && record.IsClass("done"))
+            {
+                const char* reply = record.className - 1;
+                m_cache->Store(m_inFlight[i].cacheKey, m_inFlight[i].cacheGeneration, reply, record.line + record.length - reply);
+            }
+            m_inFlight.erase(m_inFlight.begin() + i);
+
+            // GDB answers in order, so results of the commands sent before are lost and they would hold barriers forever:
+            if (i > 0)
+            {
+                unsigned int retired = 0;
+
+                for (size_t j = i; j-- > 0; )
+                {
+                    if (m_inFlight[j].reply.empty())
+                    {
+                        m_inFlight.erase(m_inFlight.begin() + j);
+                        retired++;
+                    }
+                }
+
+                if (retired > 0)
+                {
+                    TCHAR message[128];
+                    _stprintf_s(message, _countof(message), _T("MiCommandPipeline: result of token %u retired %u earlier commands"), record.token, retired);
+                    LogPrint(message);
+                    m_pipelineStats.retired += retired;
+                }
+            }
+            InjectReplies();
+            Pump();
+            return;
+        }
+    }
+
+    m_pipelineStats.unmatched++;
+}
+
+void MiCommandPipeline::Format(std::string& output) const
+{
+    char text[256];
+
+    sprintf_s(text, sizeof(text), "pipeline={commands=\"%llu\",pipelined=\"%llu\",held=\"%llu\",unmatched=\"%llu\",retired=\"%llu\",max-depth=\"%u\",window=\"%u\",",
+              m_pipelineStats.commands, m_pipelineStats.pipelined, m_pipelineStats.held, m_pipelineStats.unmatched, m_pipelineStats.retired, m_pipelineStats.maxDepth, (unsigned int) m_window);
+    output.append(text);
+    m_roundTrip.Format(output, "roundtrip");
+    output.append("}");
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void MiCommandPipeline::Print()
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
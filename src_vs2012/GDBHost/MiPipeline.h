@@ -0,0 +1,154 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "GDBWrapper.h"
+#include "LatencyHistogram.h"
+#include "MiParser.h"
+#include "MiRelay.h"
+#include "MiResponseCache.h"
+#include "MiVariables.h"
+#include "SymbolIndex.h"
+
+#include <deque>
+#include <string>
+
+
+#define PIPELINE_DEFAULT_WINDOW     16
+
+
+/// <summary>
+/// Ordering classes of commands sent by the IDE.
+/// </summary>
+enum MiCommandClass
+{
+    MiCommandQuery = 0,         // -data-*, -stack-*, -var-*, ... they can be sent back-to-back
+    MiCommandBarrier,           // -exec-*, -target-*, CLI commands, ... they never overlap with any other command
+    MiCommandControl            // -exec-interrupt; sent right after the lines read before it, even if the window is full
+};
+
+/// <summary>
+/// Statistics of the command pipeline.
+/// </summary>
+struct MiPipelineStats
+{
+    unsigned long long commands;
+    unsigned long long pipelined;   // commands sent, while others were still waiting for their results
+    unsigned long long held;        // commands, that had to wait inside the host (full window or a barrier)
+    unsigned long long unmatched;   // result records, that don't belong to any command in flight
+    unsigned long long retired;     // commands sent to GDB, which result never came, as a later one got answered first
+    unsigned int maxDepth;
+};
+
+/// <summary>
+/// Replaces the MiInputForwarder, when the IDE sends commands without waiting for replies of the previous ones.
+/// Commands are split into lines and forwarded to GDB back-to-back, as long as there are less than 'window' of them
+/// in flight. Result records passing through the output relay are matched with the commands by token (or in order
+/// for the ones without token), which frees the window again. Since GDB executes the commands in order, the only
+/// additional guarantee is, that the barrier commands changing the state of the target are sent alone, so refreshing
+/// the locals, registers and the stack is one burst, while stepping never mixes with anything else.
+/// </summary>
+class MiCommandPipeline : public HostReadHandler, public MiRecordObserver
+{
+private:
+    struct Command
+    {
+        std::string text;           // whole line including the new-line
+        unsigned int token;
+        MiCommandClass commandClass;
+        unsigned long long sentTime;
+        std::string cacheKey;       // empty, if the reply can't be cached
+        unsigned int cacheGeneration;
+        BOOL invalidates;           // command might change replies stored in the cache
+        std::string reply;          // cached reply, till it can be injected into the output
+        BOOL varUpdate;             // -var-update handled by the variable tracker
+    };
+
+    GDBWrapper* m_gdb;
+    size_t m_window;
+    std::string m_input;            // incomplete line
+    std::deque<Command> m_queue;
+    std::deque<Command> m_inFlight;
+    BOOL m_closing;
+    MiRelayStats m_stats;
+    MiPipelineStats m_pipelineStats;
+    LatencyHistogram m_roundTrip;
+    MiResponseCache* m_cache;
+    MiRelay* m_output;              // relay, where cached replies are injected
+    SymbolIndexCache* m_symbols;
+    MiVarTracker* m_variables;
+
+    BOOL CanSend(const Command& command) const;
+    void Send(Command& command);
+    void Pump();
+    void Answer(Command& command, std::string& reply);
+    void InjectReplies();
+
+public:
+    MiCommandPipeline(GDBWrapper* gdb, size_t window);
+
+    /// <summary>
+    /// Classifies single command line (without the new-line) and extracts its token and the offset of the command after it.
+    /// </summary>
+    static MiCommandClass Classify(const char* line, size_t length, unsigned int& token, size_t& commandOffset);
+
+    /// <summary>
+    /// Enables answering cacheable queries directly by the host. Replies are injected into the output relay in order,
+    /// after the results of all commands sent earlier (or immediately for commands without token, if nothing is in flight).
+    /// </summary>
+    void SetCache(MiResponseCache* cache, MiRelay* output) { m_cache = cache; m_output = output; }
+
+    /// <summary>
+    /// Enables redirecting commands loading symbols to the binaries with pre-built index.
+    /// </summary>
+    void SetSymbolIndex(SymbolIndexCache* symbols) { m_symbols = symbols; }
+
+    /// <summary>
+    /// Enables answering '-var-update' requests from the state of variables shared by all of them.
+    /// Requests wait, while the tracker refreshes the variables, and then they are answered in order the same way as cached replies.
+    /// </summary>
+    void SetVariables(MiVarTracker* variables, MiRelay* output) { m_variables = variables; m_output = output; }
+
+    /// <summary>
+    /// Accepts another chunk of commands, received from the IDE.
+    /// </summary>
+    void Submit(const char* data, size_t length);
+
+    size_t GetInFlightCount() const { return m_inFlight.size(); }
+    size_t GetQueuedCount() const { return m_queue.size(); }
+
+    /// <summary>
+    /// Returns the timestamp of sending the oldest command still waiting for its result or 0, if there is none.
+    /// </summary>
+    unsigned long long GetOldestSentTime() const { return m_inFlight.empty() ? 0 : m_inFlight.front().sentTime; }
+    const MiRelayStats& GetStats() const { return m_stats; }
+    const MiPipelineStats& GetPipelineStats() const { return m_pipelineStats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: pipeline={commands="",...,roundtrip={...}}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print();
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
@@ -0,0 +1,220 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// MiRecorder.cpp : recording of GDB/MI sessions for later replay.
+//
+
+#include "stdafx.h"
+#include "MiRecorder.h"
+#include "Log.h"
+
+#include <string.h>
+
+
+/// <summary>
+/// Appends unsigned LEB128 encoded value into the buffer and returns number of used bytes.
+/// </summary>
+static size_t EncodeVarint(unsigned char* buffer, unsigned long long value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80)
+    {
+        buffer[length++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (unsigned char) value;
+    return length;
+}
+
+static BOOL DecodeVarint(const std::string& data, size_t& offset, unsigned long long& value)
+{
+    int shift = 0;
+
+    value = 0;
+    while (offset < data.size() && shift < 64)
+    {
+        unsigned char byte = (unsigned char) data[offset++];
+        value |= (unsigned long long) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return TRUE;
+        shift += 7;
+    }
+
+    return FALSE;
+}
+
+static void EncodeUInt32(unsigned char* buffer, unsigned int value)
+{
+    buffer[0] = (unsigned char) value;
+    buffer[1] = (unsigned char) (value >> 8);
+    buffer[2] = (unsigned char) (value >> 16);
+    buffer[3] = (unsigned char) (value >> 24);
+}
+
+static unsigned int DecodeUInt32(const char* buffer)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+
+MiRecorder::MiRecorder()
+    : m_file(NULL), m_lastTime(0), m_lines(0), m_bytes(0)
+{
+}
+
+MiRecorder::~MiRecorder()
+{
+    Close();
+}
+
+BOOL MiRecorder::Open(const char* path)
+{
+    unsigned char header[8];
+
+    Close();
+
+    m_file = fopen(path, "wb");
+    if (m_file == NULL)
+        return FALSE;
+
+    setvbuf(m_file, NULL, _IOFBF, RECORDER_BUFFER_SIZE);
+
+    EncodeUInt32(header, RECORDER_MAGIC);
+    EncodeUInt32(header + 4, RECORDER_VERSION);
+    fwrite(header, 1, sizeof(header), m_file);
+
+    m_lastTime = HostGetTimestamp();
+    m_lines = 0;
+    m_bytes = sizeof(header);
+    return TRUE;
+}
+
+void MiRecorder::Close()
+{
+    if (m_file != NULL)
+    {
+        // pass also the last incomplete command:
+        if (!m_input.empty())
+        {
+            Record(MiDirectionCommand, m_input.data(), m_input.size());
+            m_input.clear();
+        }
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+void MiRecorder::Record(MiRecordDirection direction, const char* line, size_t length)
+{
+    if (m_file == NULL)
+        return;
+
+    unsigned char header[24];
+    unsigned long long now = HostGetTimestamp();
+    size_t headerLength = EncodeVarint(header, now - m_lastTime);
+
+    header[headerLength++] = (unsigned char) direction;
+    headerLength += EncodeVarint(header + headerLength, length);
+    m_lastTime = now;
+
+    if (fwrite(header, 1, headerLength, m_file) != headerLength || fwrite(line, 1, length, m_file) != length)
+    {
+        LogPrint(_T("MiRecorder: write failed, recording stopped"));
+        fclose(m_file);
+        m_file = NULL;
+        return;
+    }
+
+    m_lines++;
+    m_bytes += headerLength + length;
+}
+
+void MiRecorder::RecordCommands(const char* data, size_t length)
+{
+    if (m_file == NULL)
+        return;
+
+    m_input.append(data, length);
+
+    size_t start = 0;
+    size_t eol;
+
+    while ((eol = m_input.find('\n', start)) != std::string::npos)
+    {
+        size_t lineLength = eol - start;
+        if (lineLength > 0 && m_input[start + lineLength - 1] == '\r')
+        {
+            lineLength--;
+        }
+
+        Record(MiDirectionCommand, m_input.data() + start, lineLength);
+        start = eol + 1;
+    }
+
+    m_input.erase(0, start);
+}
+
+void MiRecorder::OnRecord(const MiRecord& record)
+{
+    Record(MiDirectionOutput, record.line, record.length);
+}
+
+BOOL MiRecorder::Load(LPCTSTR lpszPath, std::vector<MiTranscriptEntry>& entries)
+{
+    FILE* file = _tfopen(lpszPath, _T("rb"));
+    if (file == NULL)
+        return FALSE;
+
+    std::string data;
+    char buffer[64 * 1024];
+    size_t count;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.append(buffer, count);
+    }
+    fclose(file);
+
+    if (data.size() < 8 || DecodeUInt32(data.data()) != RECORDER_MAGIC || DecodeUInt32(data.data() + 4) != RECORDER_VERSION)
+        return FALSE;
+
+    size_t offset = 8;
+    unsigned long long time = 0;
+
+    while (offset < data.size())
+    {
+        MiTranscriptEntry entry;
+        unsigned long long delta;
+        unsigned long long length;
+
+        if (!DecodeVarint(data, offset, delta) || offset >= data.size())
+            return FALSE;
+
+        entry.direction = (MiRecordDirection) (unsigned char) data[offset++];
+        if (!DecodeVarint(data, offset, length) || length > data.size() - offset)
+            return FALSE;
+
+        time += delta;
+        entry.time = time;
+        entry.text.assign(data, offset, (size_t) length);
+        offset += (size_t) length;
+        entries.push_back(entry);
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,120 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "MiParser.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+
+#define RECORDER_ENVIRONMENT_VARIABLE   "BLACKBERRY_GDBHOST_RECORD"
+#define RECORDER_MAGIC                  0x52484247      // 'GBHR'
+#define RECORDER_VERSION                1
+#define RECORDER_BUFFER_SIZE            (64 * 1024)
+
+
+/// <summary>
+/// Direction of a single recorded line.
+/// </summary>
+enum MiRecordDirection
+{
+    MiDirectionCommand = 0,     // sent by the IDE to GDB
+    MiDirectionOutput = 1       // sent by GDB (or the host itself) to the IDE
+};
+
+/// <summary>
+/// Single line of a recorded session.
+/// </summary>
+struct MiTranscriptEntry
+{
+    unsigned long long time;    // us since the start of the recording
+    MiRecordDirection direction;
+    std::string text;           // line without the new-line
+};
+
+/// <summary>
+/// Captures both directions of a session into a compact file: magic and version (32-bit little-endian each)
+/// followed by the entries. Each entry is the time delta in us since the previous one and the text length
+/// (both as LEB128 varints) with the direction byte in between, followed by the text itself.
+/// File writes are buffered, so the cost per line is an encoding and a memcpy.
+/// </summary>
+class MiRecorder : public MiRecordObserver
+{
+private:
+    FILE* m_file;
+    unsigned long long m_lastTime;
+    std::string m_input;            // incomplete command line
+    unsigned long long m_lines;
+    unsigned long long m_bytes;
+
+public:
+    MiRecorder();
+    ~MiRecorder();
+
+    BOOL Open(const char* path);
+    void Close();
+    BOOL IsOpen() const { return m_file != NULL; }
+
+    void Record(MiRecordDirection direction, const char* line, size_t length);
+
+    /// <summary>
+    /// Records the commands sent by the IDE, split into lines.
+    /// </summary>
+    void RecordCommands(const char* data, size_t length);
+
+    unsigned long long GetLineCount() const { return m_lines; }
+    unsigned long long GetByteCount() const { return m_bytes; }
+
+    /// <summary>
+    /// Reads whole recording created by the MiRecorder.
+    /// </summary>
+    static BOOL Load(LPCTSTR lpszPath, std::vector<MiTranscriptEntry>& entries);
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
+
+/// <summary>
+/// Passes data read from the IDE to the recorder, before forwarding it to the real handler.
+/// </summary>
+class MiRecordingReader : public HostReadHandler
+{
+private:
+    MiRecorder* m_recorder;
+    HostReadHandler* m_next;
+
+public:
+    MiRecordingReader(MiRecorder* recorder, HostReadHandler* next)
+        : m_recorder(recorder), m_next(next)
+    {
+    }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length)
+    {
+        m_recorder->RecordCommands(data, length);
+        m_next->OnRead(pipe, data, length);
+    }
+
+    virtual void OnClosed(HostPipe pipe)
+    {
+        m_next->OnClosed(pipe);
+    }
+};
@@ -0,0 +1,545 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// MiRelay.cpp : buffered forwarding of GDB/MI streams between GDB and the IDE.
+//
+
+#include "stdafx.h"
+#include "MiRelay.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="target">Pipe, where all the data should be forwarded.</param>
+/// <param name="latency">Max time in ms, the data can wait inside the relay for the prompt.</param>
+MiRelay::MiRelay(HostPipe target, DWORD latency)
+    : m_target(target), m_lineStart(0), m_flushTo(0), m_firstPendingTime(0), m_latency(latency), m_framed(FALSE), m_closed(FALSE), m_feeding(FALSE), m_channel(-1), m_sink(NULL), m_replaced(FALSE),
+      m_streamChunk(0), m_streamTime(0), m_streamDropped(0), m_midLine(FALSE)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(&m_streamStats, 0, sizeof(m_streamStats));
+    m_buffer.reserve(LOOP_READ_BUFFER_SIZE);
+}
+
+MiRelay::~MiRelay()
+{
+}
+
+/// <summary>
+/// Registers component, that will be notified about each record received from GDB.
+/// </summary>
+void MiRelay::AddObserver(MiRecordObserver* observer)
+{
+    if (observer != NULL)
+    {
+        m_observers.push_back(observer);
+    }
+}
+
+/// <summary>
+/// Appends new chunk of data from GDB and forwards everything up to the last prompt, if any arrived.
+/// </summary>
+void MiRelay::Feed(const char* data, size_t length)
+{
+    if (length == 0)
+        return;
+
+    if (m_buffer.empty() && m_frames.empty())
+    {
+        m_firstPendingTime = HostGetTimestamp();
+    }
+
+    m_buffer.append(data, length);
+    m_stats.reads++;
+
+    // tokenize all new complete lines:
+    m_feeding = TRUE;
+    m_flushTo = 0;
+    m_lineStart += MiParser::Parse(m_buffer.data() + m_lineStart, m_buffer.size() - m_lineStart, this);
+    ApplyEdits();
+
+    // don't keep too much data, if there is no prompt for a long time:
+    if (m_flushTo == 0 && m_lineStart >= RELAY_FLUSH_THRESHOLD)
+    {
+        m_flushTo = m_lineStart;
+    }
+
+    if (m_flushTo > 0)
+    {
+        Flush(m_flushTo);
+    }
+
+    m_feeding = FALSE;
+    FeedInjected();
+}
+
+/// <summary>
+/// Adds complete records produced by the host itself (like cached replies), as if they came from GDB.
+/// They are processed only between lines of GDB output, so they never split a record GDB is just sending.
+/// </summary>
+void MiRelay::Inject(const char* data, size_t length)
+{
+    m_injected.append(data, length);
+    FeedInjected();
+}
+
+/// <summary>
+/// Forwards given line (without the new-line) instead of the record, the observers are currently notified about.
+/// It can be called only from inside MiRecordObserver::OnRecord().
+/// </summary>
+void MiRelay::Replace(const char* data, size_t length)
+{
+    m_replacement.assign(data, length);
+    m_replaced = TRUE;
+}
+
+/// <summary>
+/// Replaces lines inside the raw buffer, once the parser doesn't point into it anymore.
+/// </summary>
+void MiRelay::ApplyEdits()
+{
+    if (m_edits.empty())
+        return;
+
+    // rebuild the buffer in single pass, as there can be an edit for each line (throttled target output):
+    std::string buffer;
+    size_t position = 0;
+    size_t flushTo = m_flushTo;
+
+    buffer.reserve(m_buffer.capacity());
+    for (size_t i = 0; i < m_edits.size(); i++)
+    {
+        const Edit& edit = m_edits[i];
+
+        buffer.append(m_buffer, position, edit.offset - position);
+        buffer.append(edit.text);
+        position = edit.offset + edit.length;
+
+        m_lineStart = m_lineStart + edit.text.size() - edit.length;
+        if (m_flushTo > edit.offset)
+        {
+            flushTo = flushTo + edit.text.size() - edit.length;
+        }
+    }
+    buffer.append(m_buffer, position, std::string::npos);
+
+    m_buffer.swap(buffer);
+    m_flushTo = flushTo;
+    m_edits.clear();
+}
+
+void MiRelay::FeedInjected()
+{
+    if (m_feeding || m_injected.empty() || m_lineStart < m_buffer.size())
+        return;
+
+    std::string data;
+
+    data.swap(m_injected);
+    Feed(data.data(), data.size());
+}
+
+/// <summary>
+/// Called by the parser for each complete line received from GDB.
+/// </summary>
+void MiRelay::OnRecord(const MiRecord& record)
+{
+    m_stats.records++;
+    m_replaced = FALSE;
+
+    for (size_t i = 0; i < m_observers.size(); i++)
+    {
+        m_observers[i]->OnRecord(record);
+    }
+
+    if (m_replaced)
+    {
+        m_replaced = FALSE;
+        ReplaceRecord(record, record.length, m_replacement);
+    }
+    else if (m_streamChunk > 0 && record.type == MiRecordTargetStream && QueueStream(record))
+    {
+        std::string lines;
+        size_t length = record.length;
+
+        // the record is removed together with its new-line, as there might be nothing to forward instead:
+        const char* end = m_buffer.data() + m_buffer.size();
+        if (!m_framed && record.line + length < end && record.line[length] == '\r')
+        {
+            length++;
+        }
+        if (!m_framed && record.line + length < end && record.line[length] == '\n')
+        {
+            length++;
+        }
+
+        if (IsStreamDue())
+        {
+            TakeStream(lines);
+        }
+        ReplaceRecord(record, length, lines);
+    }
+    else if (m_framed)
+    {
+        MiParser::AppendFrame(m_frames, record);
+    }
+
+    if (record.type == MiRecordPrompt)
+    {
+        const char* eol = static_cast<const char*>(memchr(record.line + record.length, '\n', m_buffer.data() + m_buffer.size() - record.line - record.length));
+        if (eol != NULL)
+        {
+            m_flushTo = eol - m_buffer.data() + 1;
+        }
+    }
+}
+
+/// <summary>
+/// Forwards given lines instead of the record (and given number of bytes of the buffer it occupies).
+/// </summary>
+void MiRelay::ReplaceRecord(const MiRecord& record, size_t length, std::string& lines)
+{
+    if (m_framed)
+    {
+        AppendFrames(lines);
+    }
+    else
+    {
+        Edit edit;
+
+        edit.offset = record.line - m_buffer.data();
+        edit.length = length;
+        edit.text.swap(lines);
+        m_edits.push_back(edit);
+    }
+}
+
+/// <summary>
+/// Appends frames of all records (separated by new-lines) produced by the relay itself.
+/// </summary>
+void MiRelay::AppendFrames(const std::string& lines)
+{
+    size_t start = 0;
+
+    while (start < lines.size())
+    {
+        size_t eol = lines.find('\n', start);
+        if (eol == std::string::npos)
+        {
+            eol = lines.size();
+        }
+
+        MiRecord record;
+
+        MiParser::ParseRecord(lines.data() + start, eol - start, record);
+        MiParser::AppendFrame(m_frames, record);
+        start = eol + 1;
+    }
+}
+
+/// <summary>
+/// Takes the c-string of the target stream record into the queue or drops it, when the queue is full.
+/// Returns FALSE, when the record isn't well-formed and should be forwarded unchanged.
+/// </summary>
+BOOL MiRelay::QueueStream(const MiRecord& record)
+{
+    if (record.resultsLength < 2 || record.results[0] != '"' || record.results[record.resultsLength - 1] != '"')
+        return FALSE;
+
+    size_t length = record.resultsLength - 2;
+
+    m_streamStats.records++;
+    if (m_stream.size() + length > m_streamChunk * RELAY_STREAM_BACKLOG)
+    {
+        m_streamDropped += length;
+        m_streamStats.dropped += length;
+    }
+    else
+    {
+        m_stream.append(record.results + 1, length);
+    }
+
+    return TRUE;
+}
+
+BOOL MiRelay::IsStreamDue() const
+{
+    return (!m_stream.empty() || m_streamDropped > 0) && HostGetTimestamp() - m_streamTime >= RELAY_STREAM_INTERVAL * 1000ULL;
+}
+
+/// <summary>
+/// Builds the next chunk of target output as a single '@' record, followed by the summary of dropped data,
+/// once all the rest was forwarded.
+/// </summary>
+void MiRelay::TakeStream(std::string& lines)
+{
+    size_t length = m_stream.size();
+
+    // prefer cutting after an escaped new-line and never inside of an escape sequence:
+    if (length > m_streamChunk)
+    {
+        size_t newLine = 0;
+        size_t i = 0;
+
+        while (i < m_streamChunk)
+        {
+            if (m_stream[i] != '\\')
+            {
+                i++;
+                continue;
+            }
+
+            size_t escape = i + 1 < length && m_stream[i + 1] >= '0' && m_stream[i + 1] <= '7' ? 4 : 2;
+            if (i + escape > m_streamChunk)
+                break;
+            if (m_stream[i + 1] == 'n')
+            {
+                newLine = i + 2;
+            }
+            i += escape;
+        }
+
+        length = newLine > 0 ? newLine : i;
+    }
+
+    if (length > 0)
+    {
+        lines.append("@\"");
+        lines.append(m_stream, 0, length);
+        lines.append("\"\n");
+        m_stream.erase(0, length);
+
+        m_streamStats.chunks++;
+        m_streamStats.bytes += length;
+    }
+
+    if (m_stream.empty() && m_streamDropped > 0)
+    {
+        char summary[128];
+
+        sprintf_s(summary, sizeof(summary), "@\"\\n[%llu bytes of target output dropped]\\n\"\n", m_streamDropped);
+        lines.append(summary);
+        m_streamDropped = 0;
+    }
+
+    m_streamTime = HostGetTimestamp();
+}
+
+/// <summary>
+/// Forwards the next chunk of target output, when no other record arrives to carry it.
+/// </summary>
+void MiRelay::EmitStream()
+{
+    // the rest of the already sent line (only possible after FlushAll) must come first, so try again one interval later:
+    if (m_midLine)
+    {
+        m_streamTime = HostGetTimestamp();
+        return;
+    }
+
+    std::string lines;
+
+    TakeStream(lines);
+    if (m_framed)
+    {
+        AppendFrames(lines);
+    }
+    else
+    {
+        m_buffer.insert(m_lineStart, lines);
+        m_lineStart += lines.size();
+    }
+
+    Flush(m_lineStart);
+}
+
+/// <summary>
+/// Sends given number of bytes from the beginning of the buffer (or all prepared frames in framed mode).
+/// </summary>
+void MiRelay::Flush(size_t length)
+{
+    if (length == 0 && (!m_framed || m_frames.empty()))
+        return;
+
+    if (m_framed)
+    {
+        if (!m_frames.empty())
+        {
+            Write(m_frames.data(), m_frames.size());
+
+            m_stats.bytes += m_frames.size();
+            m_stats.writes++;
+            m_frames.clear();
+        }
+
+        // frames are built only from complete lines, so the incomplete one must stay:
+        length = m_lineStart;
+    }
+    else
+    {
+        Write(m_buffer.data(), length);
+
+        m_stats.bytes += length;
+        m_stats.writes++;
+        m_midLine = length > m_lineStart;
+    }
+
+    m_buffer.erase(0, length);
+    m_lineStart = m_lineStart > length ? m_lineStart - length : 0;
+    m_firstPendingTime = HostGetTimestamp();
+}
+
+/// <summary>
+/// Sends the data to the target (or the sink) in single write, prefixed with the channel header, if set.
+/// </summary>
+BOOL MiRelay::Write(const char* data, size_t length)
+{
+    BOOL result;
+
+    if (m_channel < 0)
+    {
+        result = m_sink != NULL ? m_sink->Write(data, length) : HostWritePipe(m_target, data, length);
+    }
+    else
+    {
+        char header[32];
+
+        sprintf_s(header, sizeof(header), "#%d %u\r\n", m_channel, (unsigned int) length);
+        m_packet.assign(header);
+        m_packet.append(data, length);
+        result = m_sink != NULL ? m_sink->Write(m_packet.data(), m_packet.size()) : HostWritePipe(m_target, m_packet.data(), m_packet.size());
+        m_packet.clear();
+    }
+
+    if (!result)
+    {
+        LogPrint(_T("MiRelay: write failed"));
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Sends everything, including not finished lines (except in framed mode, where they wait to be completed).
+/// </summary>
+void MiRelay::FlushAll()
+{
+    Flush(m_buffer.size());
+}
+
+void MiRelay::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    Feed(data, length);
+}
+
+void MiRelay::OnClosed(HostPipe pipe)
+{
+    // pass also the last incomplete line:
+    if (m_framed && m_lineStart < m_buffer.size())
+    {
+        MiRecord record;
+
+        MiParser::ParseRecord(m_buffer.data() + m_lineStart, m_buffer.size() - m_lineStart, record);
+        OnRecord(record);
+        m_lineStart = m_buffer.size();
+    }
+
+    // the last output of the debuggee is still limited by the backlog:
+    while (!m_stream.empty() || m_streamDropped > 0)
+    {
+        std::string lines;
+
+        TakeStream(lines);
+        if (m_framed)
+        {
+            AppendFrames(lines);
+        }
+        else
+        {
+            m_buffer.append(lines);
+        }
+    }
+
+    FlushAll();
+    m_closed = TRUE;
+}
+
+/// <summary>
+/// Gets the time left till the latency budget of the oldest pending data elapses.
+/// </summary>
+DWORD MiRelay::GetTimeout()
+{
+    DWORD timeout = INFINITE;
+
+    if (!m_stream.empty() || m_streamDropped > 0)
+    {
+        unsigned long long elapsed = (HostGetTimestamp() - m_streamTime) / 1000;
+        timeout = elapsed >= RELAY_STREAM_INTERVAL ? 0 : (DWORD) (RELAY_STREAM_INTERVAL - elapsed);
+    }
+
+    if (!HasPendingRecords())
+        return timeout;
+
+    unsigned long long elapsed = (HostGetTimestamp() - m_firstPendingTime) / 1000;
+    DWORD latency = elapsed >= m_latency ? 0 : (DWORD) (m_latency - elapsed);
+    return latency < timeout ? latency : timeout;
+}
+
+BOOL MiRelay::OnTimeout()
+{
+    if (IsStreamDue())
+    {
+        EmitStream();
+    }
+
+    // the incomplete line stays, till its end arrives, so it's still parsed and notified as a single record:
+    if (HasPendingRecords() && (HostGetTimestamp() - m_firstPendingTime) / 1000 >= m_latency)
+    {
+        Flush(m_lineStart);
+    }
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+MiInputForwarder::MiInputForwarder(GDBWrapper* gdb)
+    : m_gdb(gdb)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void MiInputForwarder::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    m_stats.reads++;
+    m_stats.writes++;
+    m_stats.bytes += length;
+
+    if (!m_gdb->WriteInput(data, length))
+    {
+        LogPrint(_T("MiInputForwarder: write failed"));
+    }
+}
+
+/// <summary>
+/// IDE closed the input, pass the EOF to GDB.
+/// </summary>
+void MiInputForwarder::OnClosed(HostPipe pipe)
+{
+    m_gdb->CloseInput();
+}
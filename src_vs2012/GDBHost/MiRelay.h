@@ -0,0 +1,182 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "GDBWrapper.h"
+#include "MiParser.h"
+
+#include <string>
+#include <vector>
+
+
+#define RELAY_DEFAULT_LATENCY       5               // ms
+#define RELAY_FLUSH_THRESHOLD       (256 * 1024)    // bytes of complete records, that are sent without waiting for the prompt
+#define RELAY_STREAM_INTERVAL       50              // ms between two chunks of coalesced target output
+#define RELAY_STREAM_DEFAULT_CHUNK  16              // KB of target output forwarded in a single chunk
+#define RELAY_STREAM_BACKLOG        16              // chunks of target output waiting inside the relay, before the rest is dropped
+
+
+/// <summary>
+/// Statistics of the data passing through a relay.
+/// </summary>
+struct MiRelayStats
+{
+    unsigned long long bytes;
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned long long records;
+};
+
+/// <summary>
+/// Statistics of the target output ('@' stream records) passing through a relay with throttling enabled.
+/// </summary>
+struct MiStreamStats
+{
+    unsigned long long records;
+    unsigned long long chunks;      // coalesced records forwarded to the IDE
+    unsigned long long bytes;       // escaped text forwarded
+    unsigned long long dropped;     // escaped text dropped, because the IDE couldn't keep up
+};
+
+/// <summary>
+/// Alternative destination of the relayed data, used instead of the target pipe.
+/// </summary>
+class MiRelaySink
+{
+public:
+    virtual ~MiRelaySink() { }
+
+    virtual BOOL Write(const char* data, size_t length) = 0;
+};
+
+/// <summary>
+/// Forwards GDB output stream to the IDE. Data is accumulated and sent in large writes,
+/// containing complete MI records only. Buffer is flushed, when the '(gdb) ' prompt is received
+/// (so the IDE gets whole reply at once), it grows too much or the latency budget elapses.
+/// An incomplete line is never forwarded before its new-line arrives (except when GDB exits).
+/// In framed mode each record is sent as MiFrameHeader followed by the record line.
+/// When the target is shared by several relays (multi-session host), each write is prefixed
+/// with '#<channel> <length>' line, so the IDE can demultiplex the stream.
+/// Observers can replace the record they are just notified about with another line (like a rewritten reply).
+/// With throttling enabled, the target output of the debuggee is taken out of the stream, coalesced and forwarded
+/// in bounded chunks at most once per interval, so results never wait behind it. When the debuggee produces more,
+/// than the chunks can carry, the excess is dropped and replaced with a short summary.
+/// </summary>
+class MiRelay : public HostReadHandler, public HostTimerHandler, private MiRecordObserver
+{
+private:
+    struct Edit
+    {
+        size_t offset;                      // position of the replaced line inside the buffer
+        size_t length;
+        std::string text;
+    };
+
+    HostPipe m_target;
+    std::string m_buffer;                   // data received from GDB and not forwarded yet
+    std::string m_frames;                   // frames ready to send (framed mode only)
+    size_t m_lineStart;                     // offset of the beginning of the last incomplete line
+    size_t m_flushTo;                       // offset just after the last received prompt
+    unsigned long long m_firstPendingTime;  // timestamp of the oldest not forwarded data
+    DWORD m_latency;
+    BOOL m_framed;
+    BOOL m_closed;
+    BOOL m_feeding;                         // inside Feed(), so injected records must wait
+    int m_channel;                          // -1, when the target is not shared
+    MiRelaySink* m_sink;                    // NULL, when writing directly to the target pipe
+    std::string m_packet;                   // scratch buffer used to send channel header together with data
+    std::string m_injected;                 // records produced by the host, waiting for a line boundary
+    std::string m_replacement;              // line set by an observer for the current record
+    BOOL m_replaced;
+    std::vector<Edit> m_edits;              // replacements, that can be applied only after parsing the buffer
+    size_t m_streamChunk;                   // 0, when the target output is forwarded unchanged
+    std::string m_stream;                   // escaped target output waiting for the next chunk
+    unsigned long long m_streamTime;        // timestamp of the last forwarded chunk
+    unsigned long long m_streamDropped;     // bytes dropped since the last summary
+    BOOL m_midLine;                         // the last write ended inside a line, so nothing can be inserted
+    MiStreamStats m_streamStats;
+    MiRelayStats m_stats;
+    std::vector<MiRecordObserver*> m_observers;
+
+    void Flush(size_t length);
+    void FeedInjected();
+    void ApplyEdits();
+    void ReplaceRecord(const MiRecord& record, size_t length, std::string& lines);
+    void AppendFrames(const std::string& lines);
+    BOOL QueueStream(const MiRecord& record);
+    BOOL IsStreamDue() const;
+    void TakeStream(std::string& lines);
+    void EmitStream();
+    BOOL Write(const char* data, size_t length);
+    BOOL HasPendingRecords() const { return m_framed ? !m_frames.empty() : m_lineStart > 0; }
+    virtual void OnRecord(const MiRecord& record);
+
+public:
+    MiRelay(HostPipe target, DWORD latency);
+    virtual ~MiRelay();
+
+    void SetFramed(BOOL framed) { m_framed = framed; }
+    void SetChannel(int channel) { m_channel = channel; }
+    void SetSink(MiRelaySink* sink) { m_sink = sink; }
+    void SetStreamChunk(size_t chunk) { m_streamChunk = chunk; }
+    void AddObserver(MiRecordObserver* observer);
+
+    void Feed(const char* data, size_t length);
+    void Inject(const char* data, size_t length);
+    void Replace(const char* data, size_t length);
+    void FlushAll();
+    BOOL IsClosed() const { return m_closed; }
+    const MiRelayStats& GetStats() const { return m_stats; }
+    const MiStreamStats& GetStreamStats() const { return m_streamStats; }
+
+    /// <summary>
+    /// Returns the number of bytes received from GDB (or produced by the host), that wait to be forwarded.
+    /// </summary>
+    size_t GetPendingBytes() const { return m_buffer.size() + m_frames.size() + m_injected.size(); }
+
+    /// <summary>
+    /// Returns the number of bytes of escaped target output waiting for the next chunk.
+    /// </summary>
+    size_t GetStreamBacklog() const { return m_stream.size(); }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+};
+
+/// <summary>
+/// Forwards commands sent by the IDE to GDB standard input.
+/// </summary>
+class MiInputForwarder : public HostReadHandler
+{
+private:
+    GDBWrapper* m_gdb;
+    MiRelayStats m_stats;
+
+public:
+    MiInputForwarder(GDBWrapper* gdb);
+
+    const MiRelayStats& GetStats() const { return m_stats; }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+};
@@ -0,0 +1,202 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// MiResponseCache.cpp : cache of replies to idempotent MI queries.
+//
+
+#include "stdafx.h"
+#include "MiResponseCache.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const char MiDefaultCachedCommands[] = "-data-list-register-names,-file-list-exec-source-files,-break-list,-thread-info";
+
+// queries, that never change anything visible through the cached replies; all other commands invalidate the cache,
+// as GDB doesn't emit notifications about changes made by MI commands (like '-break-insert' or '-thread-select'):
+static const char* MiReadOnlyPrefixes[] =
+{
+    "-stack-list-",
+    "-stack-info-",
+    "-data-list-",
+    "-data-read-memory",
+    "-data-disassemble",
+    "-var-update",
+    "-var-evaluate-expression",
+    "-var-list-children",
+    "-var-info-",
+    "-var-show-",
+    "-symbol-",
+    "-file-list-",
+    "-break-list",
+    "-thread-info",
+    "-thread-list-ids",
+    "-list-",
+};
+
+
+MiResponseCache::MiResponseCache()
+    : m_generation(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    SetCommands(MiDefaultCachedCommands);
+}
+
+void MiResponseCache::SetCommands(const char* list)
+{
+    m_commands.clear();
+    Invalidate();
+
+    if (list == NULL)
+        return;
+
+    const char* p = list;
+    while (*p != '\0')
+    {
+        const char* end = p;
+        while (*end != '\0' && *end != ',' && *end != ';')
+        {
+            end++;
+        }
+
+        // skip surrounding spaces:
+        const char* start = p;
+        while (start < end && *start == ' ')
+        {
+            start++;
+        }
+        const char* last = end;
+        while (last > start && last[-1] == ' ')
+        {
+            last--;
+        }
+
+        if (last > start)
+        {
+            m_commands.push_back(std::string(start, last - start));
+        }
+
+        p = *end != '\0' ? end + 1 : end;
+    }
+}
+
+BOOL MiResponseCache::IsCacheable(const char* command, size_t length, std::string& key) const
+{
+    // trailing spaces don't make another command:
+    while (length > 0 && (command[length - 1] == ' ' || command[length - 1] == '\t'))
+    {
+        length--;
+    }
+
+    const char* nameEnd = static_cast<const char*>(memchr(command, ' ', length));
+    size_t nameLength = nameEnd != NULL ? nameEnd - command : length;
+
+    for (size_t i = 0; i < m_commands.size(); i++)
+    {
+        if (m_commands[i].size() == nameLength && memcmp(m_commands[i].data(), command, nameLength) == 0)
+        {
+            key.assign(command, length);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL MiResponseCache::IsReadOnly(const char* command, size_t length)
+{
+    for (size_t i = 0; i < sizeof(MiReadOnlyPrefixes) / sizeof(MiReadOnlyPrefixes[0]); i++)
+    {
+        size_t prefixLength = strlen(MiReadOnlyPrefixes[i]);
+        if (length >= prefixLength && memcmp(command, MiReadOnlyPrefixes[i], prefixLength) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/// <summary>
+/// Gets the cached reply for given key.
+/// </summary>
+BOOL MiResponseCache::Lookup(const std::string& key, std::string& reply)
+{
+    std::map<std::string, std::string>::const_iterator it = m_replies.find(key);
+
+    if (it == m_replies.end())
+    {
+        m_stats.misses++;
+        return FALSE;
+    }
+
+    m_stats.hits++;
+    reply = it->second;
+    return TRUE;
+}
+
+/// <summary>
+/// Remembers the reply, unless the cache was invalidated since the command was sent (generation doesn't match).
+/// </summary>
+void MiResponseCache::Store(const std::string& key, unsigned int generation, const char* reply, size_t length)
+{
+    if (generation != m_generation || length > CACHE_MAX_REPLY_SIZE)
+        return;
+
+    m_replies[key].assign(reply, length);
+    m_stats.stores++;
+}
+
+void MiResponseCache::Invalidate()
+{
+    m_generation++;
+
+    if (!m_replies.empty())
+    {
+        m_replies.clear();
+        m_stats.invalidations++;
+    }
+}
+
+void MiResponseCache::OnRecord(const MiRecord& record)
+{
+    if (record.type == MiRecordExecAsync || record.type == MiRecordNotify)
+    {
+        Invalidate();
+    }
+}
+
+void MiResponseCache::Format(std::string& output) const
+{
+    char text[160];
+
+    sprintf_s(text, sizeof(text), "cache={hits=\"%llu\",misses=\"%llu\",stores=\"%llu\",invalidations=\"%llu\",entries=\"%u\"}",
+              m_stats.hits, m_stats.misses, m_stats.stores, m_stats.invalidations, (unsigned int) m_replies.size());
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void MiResponseCache::Print()
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
@@ -0,0 +1,90 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "MiParser.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+#define CACHE_ENVIRONMENT_VARIABLE  "BLACKBERRY_GDBHOST_CACHED_COMMANDS"
+#define CACHE_MAX_REPLY_SIZE        (256 * 1024)    // bytes, bigger replies are always requested from GDB
+
+
+/// <summary>
+/// Statistics of the response cache.
+/// </summary>
+struct MiResponseCacheStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+    unsigned long long invalidations;
+};
+
+/// <summary>
+/// Replies to idempotent MI queries, which are asked many times by different tool windows, while the target is stopped.
+/// Entries are keyed by the command text without token and all of them are dropped, whenever the state of GDB
+/// might have changed: on any '*running' or '*stopped' record, any '=' notification (libraries, breakpoints, threads)
+/// and any command sent by the IDE, that isn't a known read-only query. Replies are filled and served by the MiCommandPipeline.
+/// </summary>
+class MiResponseCache : public MiRecordObserver
+{
+private:
+    std::vector<std::string> m_commands;            // names of the cacheable commands
+    std::map<std::string, std::string> m_replies;   // command -> result record without token
+    unsigned int m_generation;                      // incremented by each invalidation
+    MiResponseCacheStats m_stats;
+
+public:
+    MiResponseCache();
+
+    /// <summary>
+    /// Replaces the list of cacheable commands with comma or semicolon separated names.
+    /// </summary>
+    void SetCommands(const char* list);
+
+    /// <summary>
+    /// Checks, if the command line (without token and new-line) should be cached and returns its key.
+    /// </summary>
+    BOOL IsCacheable(const char* command, size_t length, std::string& key) const;
+
+    /// <summary>
+    /// Checks, if the command line (without token) surely doesn't change anything, so it can be sent without invalidating the cache.
+    /// </summary>
+    static BOOL IsReadOnly(const char* command, size_t length);
+
+    BOOL Lookup(const std::string& key, std::string& reply);
+    void CountMiss() { m_stats.misses++; }
+    void Store(const std::string& key, unsigned int generation, const char* reply, size_t length);
+    void Invalidate();
+
+    unsigned int GetGeneration() const { return m_generation; }
+    size_t GetCount() const { return m_replies.size(); }
+    const MiResponseCacheStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: cache={hits="",misses="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print();
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
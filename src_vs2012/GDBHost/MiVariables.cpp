@@ -0,0 +1,501 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// MiVariables.cpp : incremental answering of -var-update requests from single refresh of all variable objects.
+//
+
+#include "stdafx.h"
+#include "MiVariables.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const char MiVarUpdate[] = "-var-update";
+static const char MiVarDelete[] = "-var-delete";
+static const char MiVarFetch[] = "-var-update --all-values *\n";
+static const char MiChangeList[] = "changelist=[";
+
+// commands, that never change values of the variables, everything else forces another fetch:
+static const char* const MiVarPureCommands[] =
+{
+    "-var-create",
+    "-var-list-children",
+    "-var-info-",
+    "-var-show-",
+    "-var-evaluate-expression",
+    "-stack-list-",
+    "-stack-info-",
+    "-thread-info",
+    "-thread-list-",
+    "-data-list-register-",
+    "-data-read-memory",
+    "-data-disassemble",
+    "-break-list",
+    "-file-list-",
+    "-gdb-show",
+    "-gdb-version",
+    "-symbol-",
+    "-list-features"
+};
+
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="output">Relay, where replies of GDB to the fetches are replaced.</param>
+MiVarTracker::MiVarTracker(MiRelay* output)
+    : m_state(StateStale), m_changed(FALSE), m_fetchToken(MI_NO_TOKEN), m_fetchValues(TRUE), m_output(output)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/// <summary>
+/// Skips the token and spaces at the beginning and the new-line at the end of the command line.
+/// </summary>
+static const char* TrimCommand(const char* command, size_t& length)
+{
+    const char* end = command + length;
+
+    while (command < end && ((*command >= '0' && *command <= '9') || *command == ' ' || *command == '\t'))
+    {
+        command++;
+    }
+    while (end > command && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+    {
+        end--;
+    }
+
+    length = end - command;
+    return command;
+}
+
+static BOOL StartsWith(const char* text, size_t length, const char* prefix)
+{
+    size_t prefixLength = strlen(prefix);
+    return length >= prefixLength && memcmp(text, prefix, prefixLength) == 0;
+}
+
+BOOL MiVarTracker::IsUpdate(const char* command, size_t length)
+{
+    command = TrimCommand(command, length);
+    return StartsWith(command, length, MiVarUpdate) && (length == sizeof(MiVarUpdate) - 1 || command[sizeof(MiVarUpdate) - 1] == ' ');
+}
+
+/// <summary>
+/// Extracts the name of the variable and the print-values option from: -var-update [print-values] {name | "*"}.
+/// </summary>
+BOOL MiVarTracker::ParseRequest(const char* command, size_t length, std::string& name, BOOL& values)
+{
+    command = TrimCommand(command, length);
+    if (!StartsWith(command, length, MiVarUpdate))
+        return FALSE;
+
+    const char* end = command + length;
+    const char* p = command + sizeof(MiVarUpdate) - 1;
+    int arguments = 0;
+
+    values = FALSE;
+    name.clear();
+    while (p < end)
+    {
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+
+        const char* argument = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+        if (p == argument)
+            break;
+
+        std::string text(argument, p - argument);
+        if (arguments == 0 && (text == "0" || text == "--no-values"))
+        {
+            values = FALSE;
+        }
+        else if (arguments == 0 && (text == "1" || text == "--all-values" || text == "2" || text == "--simple-values"))
+        {
+            values = TRUE;
+        }
+        else if (name.empty())
+        {
+            name = text;
+        }
+        else
+        {
+            return FALSE;
+        }
+
+        arguments++;
+    }
+
+    // quoted names and the '@' floating variables are left to GDB:
+    return !name.empty() && name[0] != '"' && name[0] != '@';
+}
+
+/// <summary>
+/// Finds value of the c-string field inside the list of results (without any escape sequences decoding).
+/// </summary>
+BOOL MiVarTracker::ParseString(const char* data, size_t length, const char* field, std::string& value)
+{
+    size_t fieldLength = strlen(field);
+    const char* end = data + length;
+
+    if (length < fieldLength + 2 || memcmp(data, field, fieldLength) != 0 || data[fieldLength] != '=' || data[fieldLength + 1] != '"')
+        return FALSE;
+
+    const char* start = data + fieldLength + 2;
+    const char* p = start;
+    while (p < end && *p != '"')
+    {
+        p += *p == '\\' ? 2 : 1;
+    }
+    if (p >= end)
+        return FALSE;
+
+    value.assign(start, p - start);
+    return TRUE;
+}
+
+/// <summary>
+/// Checks, if the variable was created by the IDE or is a child of such.
+/// </summary>
+BOOL MiVarTracker::IsKnown(const std::string& name) const
+{
+    std::string::size_type dot = name.find('.');
+    return m_roots.find(dot == std::string::npos ? name : name.substr(0, dot)) != m_roots.end();
+}
+
+/// <summary>
+/// Updates the state with the changelist=[{name="",...},...] reported by GDB.
+/// </summary>
+void MiVarTracker::Merge(const char* data, size_t length)
+{
+    if (!StartsWith(data, length, MiChangeList))
+        return;
+
+    const char* end = data + length;
+    const char* p = data + sizeof(MiChangeList) - 1;
+
+    while (p < end && *p == '{')
+    {
+        const char* start = p;
+        BOOL quoted = FALSE;
+        int depth = 0;
+
+        // find the end of the tuple, values can contain any brackets:
+        for (; p < end; p++)
+        {
+            if (quoted)
+            {
+                if (*p == '\\')
+                    p++;
+                else if (*p == '"')
+                    quoted = FALSE;
+            }
+            else if (*p == '"')
+                quoted = TRUE;
+            else if (*p == '{' || *p == '[')
+                depth++;
+            else if ((*p == '}' || *p == ']') && --depth == 0)
+                break;
+        }
+        if (p >= end)
+            return;
+
+        p++;
+
+        std::string name;
+        if (ParseString(start + 1, p - start - 2, "name", name))
+        {
+            Variable& variable = m_variables[name];
+
+            variable.current.assign(start, p - start);
+            if (variable.current == variable.delivered)
+            {
+                m_stats.unchanged++;
+            }
+        }
+
+        if (p < end && *p == ',')
+        {
+            p++;
+        }
+    }
+}
+
+/// <summary>
+/// Builds the reply (without token) with the changes of the variable and its children, the IDE hasn't seen yet.
+/// </summary>
+void MiVarTracker::Answer(const std::string& request, BOOL values, std::string& reply)
+{
+    BOOL all = request == "*";
+    BOOL first = TRUE;
+
+    reply.assign("^done,");
+    reply.append(MiChangeList);
+
+    std::map<std::string, Variable>::iterator it = all ? m_variables.begin() : m_variables.lower_bound(request);
+    for (; it != m_variables.end(); ++it)
+    {
+        const std::string& name = it->first;
+
+        if (!all)
+        {
+            if (name.compare(0, request.size(), request) != 0)
+                break;
+            // skip 'var10', when asked for 'var1':
+            if (name.size() > request.size() && name[request.size()] != '.')
+                continue;
+        }
+
+        Variable& variable = it->second;
+        if (variable.current == variable.delivered)
+            continue;
+
+        if (!first)
+        {
+            reply.append(",");
+        }
+        first = FALSE;
+
+        if (values)
+        {
+            reply.append(variable.current);
+        }
+        else
+        {
+            std::string::size_type value = variable.current.find(",value=\"");
+            std::string::size_type valueEnd = value;
+
+            if (value != std::string::npos)
+            {
+                valueEnd += 8;
+                while (valueEnd < variable.current.size() && variable.current[valueEnd] != '"')
+                {
+                    valueEnd += variable.current[valueEnd] == '\\' ? 2 : 1;
+                }
+                reply.append(variable.current, 0, value);
+                reply.append(variable.current, valueEnd + 1, std::string::npos);
+            }
+            else
+            {
+                reply.append(variable.current);
+            }
+        }
+
+        variable.delivered = variable.current;
+        m_stats.changes++;
+    }
+
+    reply.append("]");
+}
+
+/// <summary>
+/// Removes the variable and all its children from the state.
+/// </summary>
+void MiVarTracker::Forget(const std::string& name, BOOL childrenOnly)
+{
+    std::map<std::string, Variable>::iterator it = m_variables.lower_bound(name);
+
+    while (it != m_variables.end() && it->first.compare(0, name.size(), name) == 0)
+    {
+        const std::string& key = it->first;
+
+        if ((key.size() == name.size() && !childrenOnly) || (key.size() > name.size() && key[name.size()] == '.'))
+        {
+            m_variables.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!childrenOnly)
+    {
+        m_roots.erase(name);
+    }
+}
+
+BOOL MiVarTracker::Update(std::string& text, unsigned int token, std::string& reply)
+{
+    std::string name;
+    BOOL values;
+
+    m_stats.requests++;
+    if (!ParseRequest(text.data(), text.size(), name, values) || (name != "*" && !IsKnown(name)))
+    {
+        m_stats.forwarded++;
+        return FALSE;
+    }
+
+    if (m_state == StateReady)
+    {
+        Answer(name, values, reply);
+        m_stats.local++;
+        return TRUE;
+    }
+
+    // keep the token and send the request for everything instead:
+    size_t length = text.size();
+    const char* command = TrimCommand(text.data(), length);
+
+    text.erase(command - text.data());
+    text.append(MiVarFetch);
+
+    m_state = StateFetching;
+    m_changed = FALSE;
+    m_fetchToken = token;
+    m_fetchName = name;
+    m_fetchValues = values;
+    m_stats.fetches++;
+    return FALSE;
+}
+
+void MiVarTracker::OnCommand(const char* command, size_t length)
+{
+    command = TrimCommand(command, length);
+
+    if (StartsWith(command, length, MiVarDelete))
+    {
+        std::string name;
+        BOOL childrenOnly = FALSE;
+        const char* end = command + length;
+        const char* p = command + sizeof(MiVarDelete) - 1;
+
+        while (p < end)
+        {
+            while (p < end && *p == ' ')
+            {
+                p++;
+            }
+
+            const char* argument = p;
+            while (p < end && *p != ' ')
+            {
+                p++;
+            }
+
+            if (p - argument == 2 && memcmp(argument, "-c", 2) == 0)
+            {
+                childrenOnly = TRUE;
+            }
+            else if (p > argument)
+            {
+                name.assign(argument, p - argument);
+            }
+        }
+
+        if (!name.empty())
+        {
+            Forget(name, childrenOnly);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(MiVarPureCommands) / sizeof(MiVarPureCommands[0]); i++)
+    {
+        if (StartsWith(command, length, MiVarPureCommands[i]))
+            return;
+    }
+
+    Invalidate();
+}
+
+/// <summary>
+/// Forces the next request to fetch the values from GDB.
+/// </summary>
+void MiVarTracker::Invalidate()
+{
+    if (m_state == StateFetching)
+    {
+        m_changed = TRUE;
+    }
+    else
+    {
+        m_state = StateStale;
+    }
+}
+
+void MiVarTracker::OnRecord(const MiRecord& record)
+{
+    if (record.type == MiRecordExecAsync || record.type == MiRecordNotify)
+    {
+        Invalidate();
+        return;
+    }
+
+    if (record.type != MiRecordResult)
+        return;
+
+    if (m_state == StateFetching && record.token == m_fetchToken)
+    {
+        if (!record.IsClass("done"))
+        {
+            m_state = StateStale;
+            return;
+        }
+
+        Merge(record.results, record.resultsLength);
+        m_state = m_changed ? StateStale : StateReady;
+
+        std::string reply;
+        char token[16];
+
+        Answer(m_fetchName, m_fetchValues, reply);
+        if (record.token != MI_NO_TOKEN)
+        {
+            sprintf_s(token, sizeof(token), "%u", record.token);
+            reply.insert(0, token);
+        }
+        m_output->Replace(reply.data(), reply.size());
+        return;
+    }
+
+    // only reply of -var-create starts with the name:
+    std::string name;
+    if (record.IsClass("done") && ParseString(record.results, record.resultsLength, "name", name))
+    {
+        m_roots.insert(name);
+    }
+}
+
+void MiVarTracker::Format(std::string& output) const
+{
+    char text[200];
+
+    sprintf_s(text, sizeof(text), "variables={requests=\"%llu\",fetches=\"%llu\",local=\"%llu\",changes=\"%llu\",unchanged=\"%llu\",forwarded=\"%llu\",tracked=\"%u\"}",
+              m_stats.requests, m_stats.fetches, m_stats.local, m_stats.changes, m_stats.unchanged, m_stats.forwarded, (unsigned int) m_variables.size());
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void MiVarTracker::Print()
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
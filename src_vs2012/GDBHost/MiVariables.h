@@ -0,0 +1,112 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "MiParser.h"
+#include "MiRelay.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+
+/// <summary>
+/// Statistics of the variable object tracker.
+/// </summary>
+struct MiVarTrackerStats
+{
+    unsigned long long requests;    // -var-update commands sent by the IDE
+    unsigned long long fetches;     // '-var-update *' sent to GDB on their behalf
+    unsigned long long local;       // requests answered without asking GDB
+    unsigned long long changes;     // changes delivered to the IDE
+    unsigned long long unchanged;   // changes reported by GDB, that the IDE has already seen
+    unsigned long long forwarded;   // requests for unknown variables passed to GDB as they are
+};
+
+/// <summary>
+/// Answers '-var-update' requests of watch, locals and autos windows from a single refresh of all variable objects.
+/// The first request after the target stopped (or anything else changed) is rewritten to '-var-update --all-values *',
+/// GDB's changelist is merged into the last known state of each variable and the reply is replaced with only
+/// the changes of requested variable (and its children), the IDE hasn't seen yet. Following requests are answered
+/// directly from this state, till the target runs again, so refreshing many expanded watches costs one round-trip.
+/// Variables are tracked from the '-var-create' replies and forgotten by '-var-delete'.
+/// </summary>
+class MiVarTracker : public MiRecordObserver
+{
+private:
+    enum State
+    {
+        StateStale = 0,             // values have to be fetched from GDB
+        StateFetching,              // '-var-update *' is in flight
+        StateReady                  // state matches GDB
+    };
+
+    struct Variable
+    {
+        std::string delivered;      // last change tuple passed to the IDE
+        std::string current;        // last change tuple reported by GDB
+    };
+
+    std::map<std::string, Variable> m_variables;
+    std::set<std::string> m_roots;  // names of the variables created by the IDE
+    State m_state;
+    BOOL m_changed;                 // target changed, while the fetch was in flight
+    unsigned int m_fetchToken;
+    std::string m_fetchName;        // variable requested by the IDE, that caused the fetch
+    BOOL m_fetchValues;
+    MiRelay* m_output;
+    MiVarTrackerStats m_stats;
+
+    BOOL IsKnown(const std::string& name) const;
+    void Merge(const char* data, size_t length);
+    void Answer(const std::string& request, BOOL values, std::string& reply);
+    void Forget(const std::string& name, BOOL childrenOnly);
+    void Invalidate();
+
+    static BOOL ParseRequest(const char* command, size_t length, std::string& name, BOOL& values);
+    static BOOL ParseString(const char* data, size_t length, const char* field, std::string& value);
+
+public:
+    MiVarTracker(MiRelay* output);
+
+    /// <summary>
+    /// Checks, if the command line (without token and new-line) is a '-var-update' request.
+    /// </summary>
+    static BOOL IsUpdate(const char* command, size_t length);
+
+    /// <summary>
+    /// Answers the request (whole line including token and new-line) from the current state with the reply without token.
+    /// Returns FALSE, when it has to be sent to GDB; the text is then rewritten to refresh all the variables at once.
+    /// </summary>
+    BOOL Update(std::string& text, unsigned int token, std::string& reply);
+
+    /// <summary>
+    /// Called for each command sent to GDB, other than '-var-update'.
+    /// </summary>
+    void OnCommand(const char* command, size_t length);
+
+    BOOL IsFetching() const { return m_state == StateFetching; }
+    const MiVarTrackerStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: variables={requests="",fetches="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print();
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
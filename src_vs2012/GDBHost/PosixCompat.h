@@ -0,0 +1,102 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// PosixCompat.h : minimal subset of Win32 types and TCHAR routines,
+// that lets the host code compile on POSIX systems (Linux) unchanged.
+//
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+typedef int             BOOL;
+typedef unsigned int    DWORD;
+typedef char            TCHAR;
+typedef char            _TCHAR;
+typedef char*           LPTSTR;
+typedef const char*     LPCTSTR;
+
+#ifndef TRUE
+#   define TRUE         1
+#endif
+#ifndef FALSE
+#   define FALSE        0
+#endif
+
+#define _T(x)           x
+#define _tmain          main
+#define _countof(a)     (sizeof(a) / sizeof((a)[0]))
+#define _MAX_PATH       4096
+
+#define _tcslen         strlen
+#define _tcscmp         strcmp
+#define _tcsncmp        strncmp
+#define _tprintf        printf
+#define _ftprintf       fprintf
+#define _ttoi           atoi
+#define _tfopen         fopen
+#define sscanf_s        sscanf
+
+inline int _tcscpy_s(TCHAR* dest, size_t length, LPCTSTR source)
+{
+    snprintf(dest, length, "%s", source);
+    return 0;
+}
+
+inline int _tcscat_s(TCHAR* dest, size_t length, LPCTSTR source)
+{
+    size_t used = strlen(dest);
+    if (used < length)
+        snprintf(dest + used, length - used, "%s", source);
+    return 0;
+}
+
+inline int _vstprintf_s(TCHAR* buffer, size_t length, LPCTSTR format, va_list args)
+{
+    return vsnprintf(buffer, length, format, args);
+}
+
+inline int _stprintf_s(TCHAR* buffer, size_t length, LPCTSTR format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = vsnprintf(buffer, length, format, args);
+    va_end(args);
+    return result;
+}
+
+inline int vsprintf_s(char* buffer, size_t length, const char* format, va_list args)
+{
+    return vsnprintf(buffer, length, format, args);
+}
+
+inline int sprintf_s(char* buffer, size_t length, const char* format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = vsnprintf(buffer, length, format, args);
+    va_end(args);
+    return result;
+}
+
+#endif /* !_WIN32 */
@@ -0,0 +1,503 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// RspProtocol.cpp : sockets and packet layer of the GDB remote serial protocol.
+//
+
+#include "stdafx.h"
+#include "RspProtocol.h"
+#include "HostLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#   include <ws2tcpip.h>
+#   pragma comment(lib, "ws2_32.lib")
+#else
+#   include <errno.h>
+#   include <netdb.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <sys/select.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+#   define RspCloseSocket           closesocket
+    typedef int RspSocketLength;
+#else
+#   define RspCloseSocket           close
+    typedef socklen_t RspSocketLength;
+#endif
+
+static const char HexDigits[] = "0123456789abcdef";
+
+
+RspSocket::RspSocket()
+    : m_socket(RSP_INVALID_SOCKET)
+{
+}
+
+RspSocket::~RspSocket()
+{
+    Close();
+}
+
+BOOL RspSocket::Startup()
+{
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return TRUE;
+#endif
+}
+
+void RspSocket::Close()
+{
+    if (m_socket != RSP_INVALID_SOCKET)
+    {
+        RspCloseSocket(m_socket);
+        m_socket = RSP_INVALID_SOCKET;
+    }
+}
+
+void RspSocket::Shutdown()
+{
+    if (m_socket != RSP_INVALID_SOCKET)
+    {
+#ifdef _WIN32
+        // listening sockets can't be shut down there, only closing wakes up the accept():
+        if (shutdown(m_socket, SD_BOTH) != 0)
+        {
+            Close();
+        }
+#else
+        shutdown(m_socket, SHUT_RDWR);
+#endif
+    }
+}
+
+/// <summary>
+/// Starts listening on given loopback port (0 picks any free one, see GetPort()).
+/// </summary>
+BOOL RspSocket::Listen(unsigned short port)
+{
+    struct sockaddr_in address;
+    int reuse = 1;
+
+    Close();
+    m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_socket == RSP_INVALID_SOCKET)
+        return FALSE;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    if (bind(m_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(m_socket, 1) != 0)
+    {
+        Close();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL RspSocket::Accept(RspSocket& client)
+{
+    int noDelay = 1;
+
+    client.Close();
+    client.m_socket = accept(m_socket, NULL, NULL);
+    if (client.m_socket == RSP_INVALID_SOCKET)
+        return FALSE;
+
+    // packets are small and each one waits for the reply:
+    setsockopt(client.m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return TRUE;
+}
+
+BOOL RspSocket::Connect(const char* host, unsigned short port)
+{
+    struct addrinfo hints;
+    struct addrinfo* addresses = NULL;
+    char service[16];
+    int noDelay = 1;
+
+    Close();
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    sprintf_s(service, sizeof(service), "%u", (unsigned int) port);
+
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+        return FALSE;
+
+    for (struct addrinfo* address = addresses; address != NULL && m_socket == RSP_INVALID_SOCKET; address = address->ai_next)
+    {
+        m_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (m_socket != RSP_INVALID_SOCKET && connect(m_socket, address->ai_addr, (RspSocketLength) address->ai_addrlen) != 0)
+        {
+            Close();
+        }
+    }
+
+    freeaddrinfo(addresses);
+    if (m_socket == RSP_INVALID_SOCKET)
+        return FALSE;
+
+    setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return TRUE;
+}
+
+unsigned short RspSocket::GetPort() const
+{
+    struct sockaddr_in address;
+    RspSocketLength length = sizeof(address);
+
+    if (getsockname(m_socket, reinterpret_cast<struct sockaddr*>(&address), &length) != 0)
+        return 0;
+
+    return ntohs(address.sin_port);
+}
+
+size_t RspSocket::Receive(char* buffer, size_t size)
+{
+    for (;;)
+    {
+        int count = recv(m_socket, buffer, (int) size, 0);
+        if (count > 0)
+            return (size_t) count;
+#ifndef _WIN32
+        if (count < 0 && errno == EINTR)
+            continue;
+#endif
+        return 0;
+    }
+}
+
+BOOL RspSocket::Send(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        int count = send(m_socket, data, (int) length, 0);
+        if (count <= 0)
+        {
+#ifndef _WIN32
+            if (count < 0 && errno == EINTR)
+                continue;
+#endif
+            return FALSE;
+        }
+
+        data += count;
+        length -= count;
+    }
+
+    return TRUE;
+}
+
+BOOL RspSocket::Wait(RspSocket* first, RspSocket* second, DWORD timeout, BOOL& firstReady, BOOL& secondReady)
+{
+    fd_set readable;
+    struct timeval limit;
+    RspSocketHandle highest = 0;
+
+    FD_ZERO(&readable);
+    if (first != NULL && first->IsOpen())
+    {
+        FD_SET(first->m_socket, &readable);
+        highest = first->m_socket;
+    }
+    if (second != NULL && second->IsOpen())
+    {
+        FD_SET(second->m_socket, &readable);
+        if (second->m_socket > highest)
+        {
+            highest = second->m_socket;
+        }
+    }
+
+    limit.tv_sec = timeout / 1000;
+    limit.tv_usec = (timeout % 1000) * 1000;
+
+    int count = select((int) highest + 1, &readable, NULL, NULL, timeout == INFINITE ? NULL : &limit);
+    if (count <= 0)
+        return FALSE;
+
+    firstReady = first != NULL && first->IsOpen() && FD_ISSET(first->m_socket, &readable);
+    secondReady = second != NULL && second->IsOpen() && FD_ISSET(second->m_socket, &readable);
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+RspConnection::RspConnection()
+    : m_noAck(FALSE), m_bytesIn(0), m_bytesOut(0)
+{
+}
+
+BOOL RspConnection::Fill()
+{
+    char buffer[RSP_RECEIVE_BUFFER_SIZE];
+    size_t count = m_socket.Receive(buffer, sizeof(buffer));
+
+    if (count == 0)
+        return FALSE;
+
+    m_input.append(buffer, count);
+    m_bytesIn += count;
+    return TRUE;
+}
+
+RspInputType RspConnection::Next(std::string& payload)
+{
+    size_t position = 0;
+
+    while (position < m_input.size())
+    {
+        char c = m_input[position];
+
+        if (c == '$' || c == '%')
+        {
+            size_t end = m_input.find('#', position + 1);
+            if (end == std::string::npos || end + 2 >= m_input.size())
+                break;
+
+            unsigned long long checksum = 0;
+            size_t digits = end + 1;
+            std::string text(m_input, digits, 2);
+            size_t parsed = 0;
+
+            payload.assign(m_input, position + 1, end - position - 1);
+            m_input.erase(0, end + 3);
+
+            if (!RspCodec::ParseNumber(text, parsed, checksum) || parsed != 2 || checksum != RspCodec::Checksum(payload.data(), payload.size()))
+            {
+                LogPrint(_T("RSP: invalid checksum"));
+                if (!m_noAck && c == '$')
+                {
+                    m_socket.Send("-", 1);
+                }
+                position = 0;
+                continue;
+            }
+
+            if (c == '%')
+                return RspInputNotification;
+
+            if (!m_noAck)
+            {
+                m_socket.Send("+", 1);
+            }
+            return RspInputPacket;
+        }
+
+        position++;
+
+        if (c == RSP_INTERRUPT)
+        {
+            m_input.erase(0, position);
+            return RspInputInterrupt;
+        }
+
+        // peer has rejected the last packet:
+        if (c == '-' && !m_lastPacket.empty())
+        {
+            m_socket.Send(m_lastPacket.data(), m_lastPacket.size());
+        }
+    }
+
+    m_input.erase(0, position);
+    return RspInputNone;
+}
+
+RspInputType RspConnection::Read(std::string& payload, DWORD timeout)
+{
+    unsigned long long deadline = HostGetTimestamp() + timeout * 1000ULL;
+
+    for (;;)
+    {
+        RspInputType type = Next(payload);
+        if (type != RspInputNone)
+            return type;
+
+        unsigned long long now = HostGetTimestamp();
+        BOOL ready;
+        BOOL unused;
+
+        if (timeout != INFINITE && now >= deadline)
+            return RspInputNone;
+
+        if (!RspSocket::Wait(&m_socket, NULL, timeout == INFINITE ? INFINITE : (DWORD) ((deadline - now + 999) / 1000), ready, unused))
+            continue;
+
+        if (ready && !Fill())
+            return RspInputClosed;
+    }
+}
+
+BOOL RspConnection::Send(const std::string& payload)
+{
+    char checksum[4];
+
+    sprintf_s(checksum, sizeof(checksum), "#%02x", (unsigned int) RspCodec::Checksum(payload.data(), payload.size()));
+    m_lastPacket.assign("$");
+    m_lastPacket.append(payload);
+    m_lastPacket.append(checksum);
+    m_bytesOut += m_lastPacket.size();
+
+    return m_socket.Send(m_lastPacket.data(), m_lastPacket.size());
+}
+
+BOOL RspConnection::SendNotification(const std::string& payload)
+{
+    char checksum[4];
+    std::string packet("%");
+
+    sprintf_s(checksum, sizeof(checksum), "#%02x", (unsigned int) RspCodec::Checksum(payload.data(), payload.size()));
+    packet.append(payload);
+    packet.append(checksum);
+    m_bytesOut += packet.size();
+
+    return m_socket.Send(packet.data(), packet.size());
+}
+
+BOOL RspConnection::SendInterrupt()
+{
+    char interrupt = RSP_INTERRUPT;
+
+    m_bytesOut++;
+    return m_socket.Send(&interrupt, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned char RspCodec::Checksum(const char* data, size_t length)
+{
+    unsigned char sum = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        sum = (unsigned char) (sum + (unsigned char) data[i]);
+    }
+
+    return sum;
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+BOOL RspCodec::ParseNumber(const std::string& text, size_t& position, unsigned long long& value)
+{
+    size_t start = position;
+
+    value = 0;
+    while (position < text.size() && HexValue(text[position]) >= 0)
+    {
+        value = (value << 4) | (unsigned long long) HexValue(text[position]);
+        position++;
+    }
+
+    return position > start;
+}
+
+void RspCodec::AppendHex(std::string& output, const char* data, size_t length)
+{
+    size_t start = output.size();
+
+    output.resize(start + 2 * length);
+    for (size_t i = 0; i < length; i++)
+    {
+        output[start + 2 * i] = HexDigits[(unsigned char) data[i] >> 4];
+        output[start + 2 * i + 1] = HexDigits[(unsigned char) data[i] & 0x0F];
+    }
+}
+
+BOOL RspCodec::DecodeHex(const char* text, size_t length, std::string& data)
+{
+    data.clear();
+    if (length % 2 != 0)
+        return FALSE;
+
+    data.resize(length / 2);
+    for (size_t i = 0; i < length / 2; i++)
+    {
+        int high = HexValue(text[2 * i]);
+        int low = HexValue(text[2 * i + 1]);
+
+        if (high < 0 || low < 0)
+            return FALSE;
+
+        data[i] = (char) ((high << 4) | low);
+    }
+
+    return TRUE;
+}
+
+void RspCodec::AppendBinary(std::string& output, const char* data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+
+        if (c == '#' || c == '$' || c == '}' || c == '*')
+        {
+            output += '}';
+            c ^= 0x20;
+        }
+        output += c;
+    }
+}
+
+void RspCodec::Decode(const char* text, size_t length, std::string& data)
+{
+    data.clear();
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == '}' && i + 1 < length)
+        {
+            data += (char) (text[++i] ^ 0x20);
+        }
+        else if (text[i] == '*' && i + 1 < length && !data.empty())
+        {
+            // run-length encoding: the previous character repeated (n - 29) more times:
+            int count = (unsigned char) text[++i] - 29;
+            if (count > 0)
+            {
+                data.append((size_t) count, data[data.size() - 1]);
+            }
+        }
+        else
+        {
+            data += text[i];
+        }
+    }
+}
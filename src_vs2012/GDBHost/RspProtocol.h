@@ -0,0 +1,166 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <string>
+#ifdef _WIN32
+#   include <winsock2.h>
+#endif
+
+
+#define RSP_DEFAULT_PACKET_SIZE     400         // bytes, GDB assumes, when the target doesn't tell
+#define RSP_RECEIVE_BUFFER_SIZE     (64 * 1024)
+#define RSP_INTERRUPT               '\x03'
+
+#ifdef _WIN32
+    typedef SOCKET RspSocketHandle;
+#   define RSP_INVALID_SOCKET       INVALID_SOCKET
+#else
+    typedef int RspSocketHandle;
+#   define RSP_INVALID_SOCKET       (-1)
+#endif
+
+
+/// <summary>
+/// Minimal blocking TCP socket used by the remote serial protocol tools. Listening sockets are bound
+/// to the loopback only, as they are meant for GDB running on the same machine.
+/// </summary>
+class RspSocket
+{
+private:
+    RspSocketHandle m_socket;
+
+    RspSocket(const RspSocket&);
+    RspSocket& operator=(const RspSocket&);
+
+public:
+    RspSocket();
+    ~RspSocket();
+
+    /// <summary>
+    /// Initializes the sockets library of the process (required on Windows only).
+    /// </summary>
+    static BOOL Startup();
+
+    BOOL Listen(unsigned short port);
+    BOOL Accept(RspSocket& client);
+    BOOL Connect(const char* host, unsigned short port);
+    void Close();
+
+    /// <summary>
+    /// Shuts both directions down, which wakes up a thread blocked in Accept() or Receive() on this socket.
+    /// </summary>
+    void Shutdown();
+
+    BOOL IsOpen() const { return m_socket != RSP_INVALID_SOCKET; }
+    RspSocketHandle GetHandle() const { return m_socket; }
+    unsigned short GetPort() const;
+
+    /// <summary>
+    /// Receives available data. Returns number of bytes or 0, when the connection was closed or failed.
+    /// </summary>
+    size_t Receive(char* buffer, size_t size);
+    BOOL Send(const char* data, size_t length);
+
+    /// <summary>
+    /// Waits till any of the sockets has data to read. Returns FALSE on timeout or error.
+    /// </summary>
+    static BOOL Wait(RspSocket* first, RspSocket* second, DWORD timeout, BOOL& firstReady, BOOL& secondReady);
+};
+
+/// <summary>
+/// Kinds of input received over the remote serial protocol connection.
+/// </summary>
+enum RspInputType
+{
+    RspInputNone = 0,               // nothing complete received yet (or timeout)
+    RspInputPacket,                 // $payload#checksum
+    RspInputNotification,           // %payload#checksum
+    RspInputInterrupt,              // Ctrl-C byte sent by GDB
+    RspInputClosed
+};
+
+/// <summary>
+/// Packet layer of the GDB remote serial protocol over a socket. It validates checksums,
+/// sends and handles acknowledgments (unless switched to no-ack mode) and retransmits packets rejected by the peer.
+/// Payloads are passed as they are on the wire, so binary data stays escaped.
+/// </summary>
+class RspConnection
+{
+private:
+    RspSocket m_socket;
+    std::string m_input;
+    std::string m_lastPacket;
+    BOOL m_noAck;
+    unsigned long long m_bytesIn;
+    unsigned long long m_bytesOut;
+
+public:
+    RspConnection();
+
+    RspSocket& GetSocket() { return m_socket; }
+    void SetNoAck(BOOL noAck) { m_noAck = noAck; }
+    BOOL IsNoAck() const { return m_noAck; }
+    unsigned long long GetBytesIn() const { return m_bytesIn; }
+    unsigned long long GetBytesOut() const { return m_bytesOut; }
+
+    /// <summary>
+    /// Receives more data from the socket. Returns FALSE, when the connection was closed.
+    /// </summary>
+    BOOL Fill();
+
+    /// <summary>
+    /// Extracts the next complete input from already received data. Acknowledgments are consumed internally.
+    /// </summary>
+    RspInputType Next(std::string& payload);
+
+    /// <summary>
+    /// Waits for the next complete input at most given number of milliseconds.
+    /// </summary>
+    RspInputType Read(std::string& payload, DWORD timeout);
+
+    BOOL Send(const std::string& payload);
+    BOOL SendNotification(const std::string& payload);
+    BOOL SendInterrupt();
+};
+
+/// <summary>
+/// Encoding helpers of the remote serial protocol.
+/// </summary>
+class RspCodec
+{
+public:
+    static unsigned char Checksum(const char* data, size_t length);
+
+    /// <summary>
+    /// Parses hexadecimal number and moves the position after it. Returns FALSE, if there are no digits.
+    /// </summary>
+    static BOOL ParseNumber(const std::string& text, size_t& position, unsigned long long& value);
+
+    static void AppendHex(std::string& output, const char* data, size_t length);
+    static BOOL DecodeHex(const char* text, size_t length, std::string& data);
+
+    /// <summary>
+    /// Escapes binary data, so it can be sent inside a packet ('#', '$', '}' and '*' are prefixed with '}').
+    /// </summary>
+    static void AppendBinary(std::string& output, const char* data, size_t length);
+
+    /// <summary>
+    /// Removes escaping and expands run-length encoding of received payload.
+    /// </summary>
+    static void Decode(const char* text, size_t length, std::string& data);
+};
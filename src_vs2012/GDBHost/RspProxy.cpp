@@ -0,0 +1,483 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// RspProxy.cpp : GDB remote serial protocol proxy coalescing and caching memory reads.
+//
+
+#include "stdafx.h"
+#include "RspProxy.h"
+#include "HostLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="blockSize">Size of the cached memory blocks (rounded down to power of two).</param>
+RspProxy::RspProxy(size_t blockSize)
+    : m_blockSize(16), m_maxRead((RSP_DEFAULT_PACKET_SIZE - 8) / 2), m_targetBinary(FALSE), m_nonStop(FALSE)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    while (m_blockSize * 2 <= blockSize && m_blockSize * 2 <= RSP_MAX_READ_SIZE)
+    {
+        m_blockSize *= 2;
+    }
+}
+
+/// <summary>
+/// Packets, that don't change the memory of the target.
+/// </summary>
+BOOL RspProxy::IsReadOnly(const std::string& payload)
+{
+    if (payload.empty())
+        return TRUE;
+
+    switch (payload[0])
+    {
+        case 'm':
+        case 'x':
+        case 'g':
+        case 'p':
+        case 'H':
+        case 'T':
+        case '?':
+        case 'Q':
+        case 'Z':   // breakpoints are hidden from memory reads by the target
+        case 'z':
+            return TRUE;
+        case 'q':
+            return payload.compare(0, 5, "qRcmd") != 0;
+        case 'v':
+            return payload == "vCont?" || payload == "vMustReplyEmpty";
+        default:
+            return FALSE;
+    }
+}
+
+void RspProxy::Invalidate()
+{
+    if (!m_blocks.empty())
+    {
+        m_blocks.clear();
+        m_stats.invalidations++;
+    }
+}
+
+BOOL RspProxy::Run(RspSocket& listener, const char* targetHost, unsigned short targetPort)
+{
+    if (!listener.Accept(m_gdb.GetSocket()))
+    {
+        LogPrint(_T("RSP proxy: accept failed"));
+        return FALSE;
+    }
+
+    if (!m_target.GetSocket().Connect(targetHost, targetPort))
+    {
+        LogPrint(_T("RSP proxy: unable to connect to the target"));
+        m_gdb.GetSocket().Close();
+        return FALSE;
+    }
+
+    std::string payload;
+    RspInputType type;
+
+    for (;;)
+    {
+        BOOL gdbReady;
+        BOOL targetReady;
+
+        if (!RspSocket::Wait(&m_gdb.GetSocket(), &m_target.GetSocket(), INFINITE, gdbReady, targetReady))
+            break;
+
+        if ((gdbReady && !m_gdb.Fill()) || (targetReady && !m_target.Fill()))
+            break;
+
+        // requests of the proxy itself can leave already received input in both connections:
+        while ((type = m_gdb.Next(payload)) != RspInputNone)
+        {
+            if (type == RspInputInterrupt)
+            {
+                m_target.SendInterrupt();
+            }
+            else if (type == RspInputPacket)
+            {
+                OnGdbPacket(payload);
+            }
+        }
+
+        while ((type = m_target.Next(payload)) != RspInputNone)
+        {
+            if (type == RspInputPacket)
+            {
+                OnTargetPacket(payload);
+            }
+            else if (type == RspInputNotification)
+            {
+                Invalidate();
+                m_gdb.SendNotification(payload);
+            }
+        }
+    }
+
+    LogPrint(_T("RSP proxy: connection closed"));
+    m_gdb.GetSocket().Close();
+    m_target.GetSocket().Close();
+    return TRUE;
+}
+
+void RspProxy::OnGdbPacket(const std::string& payload)
+{
+    m_stats.packets++;
+
+    if (!payload.empty() && (payload[0] == 'm' || payload[0] == 'x') && ServeRead(payload))
+        return;
+
+    if (payload.compare(0, 8, "QNonStop") == 0)
+    {
+        // other threads keep running, while GDB reads the memory:
+        m_nonStop = payload == "QNonStop:1";
+        Invalidate();
+    }
+
+    if (!IsReadOnly(payload))
+    {
+        Invalidate();
+    }
+
+    m_pending = payload;
+    m_target.Send(payload);
+}
+
+void RspProxy::OnTargetPacket(std::string& payload)
+{
+    if (m_pending.compare(0, 10, "qSupported") == 0)
+    {
+        size_t start = 0;
+
+        while (start < payload.size())
+        {
+            size_t end = payload.find(';', start);
+            if (end == std::string::npos)
+                end = payload.size();
+
+            std::string feature(payload, start, end - start);
+            if (feature.compare(0, 11, "PacketSize=") == 0)
+            {
+                size_t position = 11;
+                unsigned long long size;
+
+                if (RspCodec::ParseNumber(feature, position, size) && size > 8)
+                {
+                    m_maxRead = (size_t) (size - 8) / 2 < RSP_MAX_READ_SIZE ? (size_t) (size - 8) / 2 : RSP_MAX_READ_SIZE;
+                }
+            }
+            else if (feature == "binary-upload+")
+            {
+                m_targetBinary = TRUE;
+            }
+
+            start = end + 1;
+        }
+
+        // replies to 'x' are converted, if the target doesn't support them:
+        if (!m_targetBinary && !payload.empty())
+        {
+            payload.append(";binary-upload+");
+        }
+    }
+    else if (m_pending == "QStartNoAckMode" && payload == "OK")
+    {
+        m_target.SetNoAck(TRUE);
+        m_gdb.Send(payload);
+        m_gdb.SetNoAck(TRUE);
+        m_pending.clear();
+        return;
+    }
+
+    // stop replies:
+    if (!payload.empty() && (payload[0] == 'T' || payload[0] == 'S' || payload[0] == 'W' || payload[0] == 'X'))
+    {
+        Invalidate();
+    }
+
+    m_pending.clear();
+    m_gdb.Send(payload);
+}
+
+/// <summary>
+/// Answers memory read of GDB. Returns FALSE, if the request should be forwarded as it is.
+/// </summary>
+BOOL RspProxy::ServeRead(const std::string& payload)
+{
+    size_t position = 1;
+    unsigned long long address;
+    unsigned long long length;
+
+    if (!RspCodec::ParseNumber(payload, position, address) || position >= payload.size() || payload[position++] != ','
+        || !RspCodec::ParseNumber(payload, position, length) || position != payload.size() || length == 0)
+        return FALSE;
+
+    BOOL binary = payload[0] == 'x';
+    std::string data;
+    std::string error;
+    std::string reply;
+
+    m_stats.reads++;
+
+    if (m_nonStop || length > m_maxRead || !ReadBlocks(address, (size_t) length, data))
+    {
+        m_stats.fallbacks++;
+
+        if (!ReadTarget(address, (size_t) length, data, error))
+        {
+            m_gdb.Send(error.empty() ? std::string("E01") : error);
+            return TRUE;
+        }
+    }
+
+    if (binary)
+    {
+        reply.assign("b");
+        RspCodec::AppendBinary(reply, data.data(), data.size());
+    }
+    else
+    {
+        RspCodec::AppendHex(reply, data.data(), data.size());
+    }
+
+    m_gdb.Send(reply);
+    return TRUE;
+}
+
+/// <summary>
+/// Gets the memory from cached blocks, fetching all missing adjacent blocks by single read, together with
+/// a few blocks following the request (GDB mostly continues with the next frame or instruction).
+/// Returns FALSE, if any of the requested blocks can't be read completely.
+/// </summary>
+BOOL RspProxy::ReadBlocks(unsigned long long address, size_t length, std::string& data)
+{
+    size_t blockSize = m_blockSize;
+    while (blockSize > m_maxRead && blockSize > 1)
+    {
+        blockSize /= 2;
+    }
+
+    unsigned long long mask = ~((unsigned long long) blockSize - 1);
+    unsigned long long end = address + length;
+    unsigned long long first = address & mask;
+    unsigned long long last = (end - 1) & mask;
+    unsigned long long readAhead = last + RSP_READ_AHEAD_BLOCKS * (unsigned long long) blockSize;
+    BOOL hit = TRUE;
+
+    if (end < address)
+        return FALSE;
+    if (readAhead < last)
+        readAhead = last;
+
+    for (unsigned long long block = first; block <= last; )
+    {
+        if (m_blocks.find(block) != m_blocks.end())
+        {
+            block += blockSize;
+            continue;
+        }
+
+        unsigned long long runEnd = block;
+        while (runEnd <= readAhead && runEnd + blockSize - block <= m_maxRead && m_blocks.find(runEnd) == m_blocks.end())
+        {
+            runEnd += blockSize;
+        }
+
+        std::string bytes;
+        std::string error;
+        size_t runLength = (size_t) (runEnd - block);
+
+        if (runLength == 0)
+            return FALSE;
+
+        if (!ReadTarget(block, runLength, bytes, error) || bytes.size() != runLength)
+        {
+            // the blocks read ahead can be outside of the mapped memory:
+            if (runEnd <= last + blockSize)
+                return FALSE;
+
+            runEnd = last + blockSize;
+            runLength = (size_t) (runEnd - block);
+            if (!ReadTarget(block, runLength, bytes, error) || bytes.size() != runLength)
+                return FALSE;
+        }
+
+        m_stats.coalesced += runLength / blockSize - 1;
+        for (size_t offset = 0; offset < runLength; offset += blockSize)
+        {
+            m_blocks[block + offset].assign(bytes, offset, blockSize);
+        }
+
+        hit = FALSE;
+        block = runEnd;
+    }
+
+    if (hit)
+    {
+        m_stats.hits++;
+    }
+
+    data.clear();
+    for (unsigned long long block = first; block <= last; block += blockSize)
+    {
+        const std::string& bytes = m_blocks[block];
+        size_t from = (size_t) ((address > block ? address : block) - block);
+        size_t to = (size_t) ((end < block + blockSize ? end : block + blockSize) - block);
+
+        data.append(bytes, from, to - from);
+    }
+
+    if (m_blocks.size() > RSP_MAX_CACHED_BLOCKS)
+    {
+        Invalidate();
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Reads the memory from the target using the best packet it supports. On failure the error is set to the reply
+/// of the target, that should be passed to GDB, or it's empty, when the connection failed.
+/// </summary>
+BOOL RspProxy::ReadTarget(unsigned long long address, size_t length, std::string& data, std::string& error)
+{
+    char request[64];
+    std::string reply;
+
+    sprintf_s(request, sizeof(request), "%c%llx,%x", m_targetBinary ? 'x' : 'm', address, (unsigned int) length);
+    m_stats.targetReads++;
+    error.clear();
+
+    if (!Request(request, reply))
+        return FALSE;
+
+    if (reply.empty() || (reply[0] == 'E' && (reply.size() == 3 || (reply.size() > 1 && reply[1] == '.'))))
+    {
+        error = reply.empty() ? "E01" : reply;
+        return FALSE;
+    }
+
+    if (m_targetBinary)
+    {
+        if (reply[0] != 'b')
+        {
+            error = "E01";
+            return FALSE;
+        }
+
+        RspCodec::Decode(reply.data() + 1, reply.size() - 1, data);
+        return TRUE;
+    }
+
+    std::string expanded;
+    RspCodec::Decode(reply.data(), reply.size(), expanded);
+    if (!RspCodec::DecodeHex(expanded.data(), expanded.size(), data))
+    {
+        error = "E01";
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Sends request of the proxy itself to the target and waits for its reply.
+/// </summary>
+BOOL RspProxy::Request(const std::string& payload, std::string& reply)
+{
+    if (!m_target.Send(payload))
+        return FALSE;
+
+    for (;;)
+    {
+        RspInputType type = m_target.Read(reply, RSP_REQUEST_TIMEOUT);
+
+        if (type == RspInputPacket)
+            return TRUE;
+
+        if (type == RspInputNotification)
+        {
+            Invalidate();
+            m_gdb.SendNotification(reply);
+            continue;
+        }
+
+        LogPrint(_T("RSP proxy: no reply from the target"));
+        return FALSE;
+    }
+}
+
+void RspProxy::Format(std::string& output) const
+{
+    char text[512];
+
+    sprintf_s(text, sizeof(text), "rsp-proxy={packets=\"%llu\",reads=\"%llu\",hits=\"%llu\",target-reads=\"%llu\",coalesced=\"%llu\",fallbacks=\"%llu\",invalidations=\"%llu\",bytes-to-target=\"%llu\",bytes-from-target=\"%llu\"}",
+              m_stats.packets, m_stats.reads, m_stats.hits, m_stats.targetReads, m_stats.coalesced, m_stats.fallbacks, m_stats.invalidations,
+              m_target.GetBytesOut(), m_target.GetBytesIn());
+    output.append(text);
+}
+
+void RspProxy::Print() const
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunRspProxy(int argc, _TCHAR* argv[])
+{
+    if (argc < 2)
+    {
+        PrintMessage(_T("Usage: --rsp-proxy <listen-port> <target-host>:<target-port> (<block-size>)\r\n"));
+        return 1;
+    }
+
+    // host names are plain ASCII:
+    HostString argument(argv[1]);
+    std::string target(argument.begin(), argument.end());
+    size_t colon = target.rfind(':');
+    std::string host = colon != std::string::npos && colon > 0 ? target.substr(0, colon) : std::string("localhost");
+    unsigned short listenPort = (unsigned short) _ttoi(argv[0]);
+    unsigned short targetPort = (unsigned short) atoi(colon != std::string::npos ? target.c_str() + colon + 1 : target.c_str());
+    RspSocket listener;
+
+    if (!RspSocket::Startup() || !listener.Listen(listenPort))
+    {
+        PrintMessage(_T("Unable to listen on port %d\r\n"), (int) listenPort);
+        return 1;
+    }
+
+    RspProxy proxy(argc >= 3 ? (size_t) _ttoi(argv[2]) : RSP_DEFAULT_BLOCK_SIZE);
+    if (!proxy.Run(listener, host.c_str(), targetPort))
+        return 1;
+
+    proxy.Print();
+    return 0;
+}
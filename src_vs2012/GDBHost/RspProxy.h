@@ -0,0 +1,98 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "RspProtocol.h"
+
+#include <map>
+#include <string>
+
+
+#define RSP_DEFAULT_BLOCK_SIZE      256         // bytes, aligned unit of memory read from the target and cached
+#define RSP_MAX_READ_SIZE           4096        // bytes, max size of single read sent to the target
+#define RSP_MAX_CACHED_BLOCKS       4096
+#define RSP_READ_AHEAD_BLOCKS       3           // missing blocks following the request fetched together with it
+#define RSP_REQUEST_TIMEOUT         10000       // ms, the proxy waits for the reply to its own request
+
+
+/// <summary>
+/// Statistics of the remote serial protocol proxy.
+/// </summary>
+struct RspProxyStats
+{
+    unsigned long long packets;         // received from GDB
+    unsigned long long reads;           // memory reads ('m' and 'x') received from GDB
+    unsigned long long hits;            // reads served completely from the cache
+    unsigned long long targetReads;     // memory reads sent to the target
+    unsigned long long coalesced;       // blocks fetched together with another block in single read
+    unsigned long long fallbacks;       // reads, that couldn't be served by blocks and were passed as they are
+    unsigned long long invalidations;
+};
+
+/// <summary>
+/// Proxy of the GDB remote serial protocol sitting between GDB ('target remote :port') and a gdbserver-like target.
+/// Everything is forwarded unchanged, except memory reads: they are extended to aligned blocks, adjacent missing blocks
+/// are fetched by single read and the blocks are cached till the target resumes, memory or registers are written
+/// or GDB switches to non-stop mode. The proxy advertises binary memory reads ('x' packets) to GDB and uses them
+/// towards the target, when the target supports them (converting between 'm' and 'x' replies as needed).
+/// Each instance serves single connection of GDB.
+/// </summary>
+class RspProxy
+{
+private:
+    RspConnection m_gdb;
+    RspConnection m_target;
+    size_t m_blockSize;
+    size_t m_maxRead;
+    BOOL m_targetBinary;
+    BOOL m_nonStop;
+    std::string m_pending;              // last request forwarded to the target, which reply is still expected
+    std::map<unsigned long long, std::string> m_blocks;
+    RspProxyStats m_stats;
+
+    void OnGdbPacket(const std::string& payload);
+    void OnTargetPacket(std::string& payload);
+    BOOL ServeRead(const std::string& payload);
+    BOOL ReadBlocks(unsigned long long address, size_t length, std::string& data);
+    BOOL ReadTarget(unsigned long long address, size_t length, std::string& data, std::string& error);
+    BOOL Request(const std::string& payload, std::string& reply);
+    void Invalidate();
+    static BOOL IsReadOnly(const std::string& payload);
+
+public:
+    RspProxy(size_t blockSize);
+
+    /// <summary>
+    /// Accepts GDB connection on the listening socket, connects to the target and forwards all packets
+    /// till any side closes the connection.
+    /// </summary>
+    BOOL Run(RspSocket& listener, const char* targetHost, unsigned short targetPort);
+
+    const RspProxyStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: rsp-proxy={packets="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print() const;
+};
+
+/// <summary>
+/// Runs the proxy as a tool:
+///   --rsp-proxy <listen-port> <target-host>:<target-port> (<block-size>)
+/// Arguments start after the '--rsp-proxy' switch.
+/// </summary>
+int RunRspProxy(int argc, _TCHAR* argv[]);
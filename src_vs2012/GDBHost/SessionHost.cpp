@@ -0,0 +1,452 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// SessionHost.cpp : control channel of the multi-session host.
+//
+
+#include "stdafx.h"
+#include "SessionHost.h"
+#include "Log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if defined(_WIN32) && defined(_UNICODE)
+/// <summary>
+/// Converts UTF-8 text received over the control channel into host string.
+/// </summary>
+static HostString ToHostString(const std::string& text)
+{
+    if (text.empty())
+        return HostString();
+
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), NULL, 0);
+    HostString result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), &result[0], length);
+    return result;
+}
+#else
+static const HostString& ToHostString(const std::string& text)
+{
+    return text;
+}
+#endif
+
+/// <summary>
+/// Reads next space-separated argument. Arguments containing spaces can be enclosed in quotes.
+/// </summary>
+static BOOL NextArgument(const std::string& line, size_t& position, std::string& argument)
+{
+    argument.clear();
+
+    while (position < line.size() && line[position] == ' ')
+        position++;
+
+    if (position >= line.size())
+        return FALSE;
+
+    if (line[position] == '"')
+    {
+        size_t end = line.find('"', position + 1);
+        if (end == std::string::npos)
+            end = line.size();
+
+        argument = line.substr(position + 1, end - position - 1);
+        position = end < line.size() ? end + 1 : end;
+        return TRUE;
+    }
+
+    size_t end = line.find(' ', position);
+    if (end == std::string::npos)
+        end = line.size();
+
+    argument = line.substr(position, end - position);
+    position = end;
+    return TRUE;
+}
+
+/// <summary>
+/// Builds GDB command line from the path and the rest of the command, that contains GDB arguments.
+/// </summary>
+static HostString GetGdbCommand(const std::string& gdbPath, const std::string& line, size_t position)
+{
+    std::string gdbCommand = "\"" + gdbPath + "\"";
+
+    // GDB arguments are passed verbatim:
+    if (position < line.size())
+    {
+        gdbCommand.append(line, position, std::string::npos);
+    }
+
+    return ToHostString(gdbCommand);
+}
+
+/// <summary>
+/// Formats time-to-first-prompt statistics.
+/// </summary>
+static void AppendPromptStats(std::string& output, const char* name, const GDBPromptStats& stats)
+{
+    char text[160];
+
+    sprintf_s(text, sizeof(text), ",%s={count=\"%llu\",avg-us=\"%llu\",max-us=\"%llu\"}",
+              name, stats.count, stats.count > 0 ? stats.total / stats.count : 0ULL, stats.max);
+    output.append(text);
+}
+
+/// <summary>
+/// Constructor.
+/// </summary>
+/// <param name="loop">Loop, all sessions are registered in.</param>
+/// <param name="latency">Max time in ms, GDB output can wait inside the relay for the prompt.</param>
+/// <param name="framed">Sends the GDB output as frames with parsed MI records.</param>
+/// <param name="streamChunk">Max bytes of target output forwarded per interval (0 - unlimited).</param>
+/// <param name="poolIdleTimeout">Time in seconds since the last request, after which pre-started GDB instances are closed.</param>
+/// <param name="poolMemoryLimit">Max memory in MB of all pre-started GDB instances together.</param>
+/// <param name="statsInterval">Interval in seconds of dumping the interrupt statistics into the log (0 - never).</param>
+SessionHost::SessionHost(HostLoop* loop, DWORD latency, BOOL framed, size_t streamChunk, DWORD poolIdleTimeout, DWORD poolMemoryLimit, DWORD statsInterval)
+    : m_loop(loop), m_latency(latency), m_framed(framed), m_streamChunk(streamChunk), m_pool(loop, poolIdleTimeout, poolMemoryLimit), m_symbolReuses(0), m_quit(FALSE)
+{
+    m_interruptStats.SetDumpInterval(statsInterval * 1000);
+    m_loop->AddTimer(&m_pool);
+    m_loop->AddTimer(&m_interruptStats);
+}
+
+SessionHost::~SessionHost()
+{
+    TerminateAll();
+    DeleteFinished();
+    m_loop->RemoveTimer(&m_pool);
+    m_loop->RemoveTimer(&m_interruptStats);
+}
+
+/// <summary>
+/// Kills all running GDB instances, including the idle ones.
+/// </summary>
+void SessionHost::TerminateAll()
+{
+    while (!m_sessions.empty())
+    {
+        m_sessions.begin()->second->Terminate();
+    }
+
+    m_pool.Clear();
+}
+
+void SessionHost::DeleteFinished()
+{
+    for (size_t i = 0; i < m_finished.size(); i++)
+    {
+        delete m_finished[i];
+    }
+    m_finished.clear();
+}
+
+/// <summary>
+/// Sends MI-like record on the control channel.
+/// </summary>
+void SessionHost::Send(const std::string& record)
+{
+    char header[32];
+    std::string packet;
+
+    sprintf_s(header, sizeof(header), "#%d %u\r\n", SESSION_CONTROL_CHANNEL, (unsigned int) (record.size() + 2));
+    packet.assign(header);
+    packet.append(record);
+    packet.append("\r\n");
+    HostWritePipe(HostGetStdPipe(HOST_STDOUT), packet.data(), packet.size());
+}
+
+/// <summary>
+/// Formats short MI-like record and sends it on the control channel.
+/// </summary>
+void SessionHost::Reply(const char* format, ...)
+{
+    char text[256];
+    va_list args;
+
+    va_start(args, format);
+    vsprintf_s(text, sizeof(text), format, args);
+    va_end(args);
+
+    Send(text);
+}
+
+GDBSession* SessionHost::Find(int id)
+{
+    std::map<int, GDBSession*>::iterator it = m_sessions.find(id);
+    return it != m_sessions.end() ? it->second : NULL;
+}
+
+/// <summary>
+/// Processes single command received over the control channel.
+/// </summary>
+void SessionHost::Execute(const std::string& line)
+{
+    size_t position = 0;
+    std::string command;
+    std::string id;
+
+    if (!NextArgument(line, position, command))
+        return;
+
+    if (command == "quit")
+    {
+        TerminateAll();
+        m_quit = TRUE;
+        Reply("^exit");
+        return;
+    }
+
+    if (command == "list")
+    {
+        std::string sessions;
+        char item[64];
+
+        for (std::map<int, GDBSession*>::iterator it = m_sessions.begin(); it != m_sessions.end(); ++it)
+        {
+            sprintf_s(item, sizeof(item), "%s{id=\"%d\",running=\"%d\"}", sessions.empty() ? "" : ",", it->first, it->second->IsRunning() ? 1 : 0);
+            sessions.append(item);
+        }
+
+        Send("^done,sessions=[" + sessions + "]");
+        return;
+    }
+
+    if (command == "stats")
+    {
+        const GDBPoolStats& stats = m_pool.GetStats();
+        char text[256];
+
+        sprintf_s(text, sizeof(text), "^done,sessions=\"%u\",pool={idle=\"%u\",hits=\"%llu\",misses=\"%llu\",started=\"%llu\",discarded=\"%llu\",memory=\"%llu\"",
+                  (unsigned int) m_sessions.size(), (unsigned int) m_pool.GetIdleCount(), stats.hits, stats.misses, stats.started, stats.discarded, stats.memoryUsage);
+
+        std::string record(text);
+        AppendPromptStats(record, "hit-first-prompt", stats.hitPrompt);
+        AppendPromptStats(record, "miss-first-prompt", stats.missPrompt);
+
+        sprintf_s(text, sizeof(text), ",recycled={returned=\"%llu\",hits=\"%llu\",symbol-reuses=\"%llu\"}", stats.recycled, stats.warmHits, m_symbolReuses);
+        record.append(text);
+        record.append("},");
+        m_interruptStats.Format(record);
+        Send(record);
+        return;
+    }
+
+    if (command == "pool")
+    {
+        std::string size;
+        std::string gdbPath;
+
+        if (!NextArgument(line, position, size) || !NextArgument(line, position, gdbPath))
+        {
+            Reply("^error,msg=\"Missing arguments\"");
+            return;
+        }
+
+        m_pool.Configure(GetGdbCommand(gdbPath, line, position).c_str(), atoi(size.c_str()));
+        Reply("^done");
+        return;
+    }
+
+    if (!NextArgument(line, position, id) || atoi(id.c_str()) <= SESSION_CONTROL_CHANNEL)
+    {
+        Reply("^error,msg=\"Invalid session ID\"");
+        return;
+    }
+
+    int sessionId = atoi(id.c_str());
+
+    if (command == "start")
+    {
+        std::string ctrlCName;
+        std::string terminateName;
+        std::string gdbPath;
+
+        if (Find(sessionId) != NULL)
+        {
+            Reply("^error,session=\"%d\",msg=\"Session already exists\"", sessionId);
+            return;
+        }
+
+        if (!NextArgument(line, position, ctrlCName) || !NextArgument(line, position, terminateName) || !NextArgument(line, position, gdbPath))
+        {
+            Reply("^error,session=\"%d\",msg=\"Missing arguments\"", sessionId);
+            return;
+        }
+
+        HostString gdbCommand = GetGdbCommand(gdbPath, line, position);
+        GDBSession* session = new GDBSession(sessionId, m_loop, this, m_latency, m_framed, m_streamChunk, &m_interruptStats);
+        GDBPoolEntry* entry = m_pool.Acquire(gdbCommand.c_str());
+        BOOL started;
+
+        // register before starting, as it can fail and notify about finishing:
+        m_sessions[sessionId] = session;
+        if (entry != NULL)
+        {
+            started = session->Adopt(entry, ToHostString(ctrlCName).c_str(), ToHostString(terminateName).c_str());
+            delete entry;
+        }
+        else
+        {
+            started = session->Start(gdbCommand.c_str(), ToHostString(ctrlCName).c_str(), ToHostString(terminateName).c_str());
+        }
+
+        if (!started)
+        {
+            if (!session->IsFinished())
+            {
+                session->Terminate();
+            }
+            if (m_sessions.find(sessionId) != m_sessions.end())
+            {
+                m_sessions.erase(sessionId);
+                m_finished.push_back(session);
+            }
+            Reply("^error,session=\"%d\",msg=\"Failed to start GDB\"", sessionId);
+            return;
+        }
+
+        Reply("^done,session=\"%d\"", sessionId);
+        return;
+    }
+
+    GDBSession* session = Find(sessionId);
+    if (session == NULL)
+    {
+        Reply("^error,session=\"%d\",msg=\"Unknown session\"", sessionId);
+        return;
+    }
+
+    if (command == "send")
+    {
+        while (position < line.size() && line[position] == ' ')
+            position++;
+
+        std::string text = line.substr(position) + "\n";
+        if (!session->Send(text.data(), text.size()))
+        {
+            Reply("^error,session=\"%d\",msg=\"Write failed\"", sessionId);
+        }
+        return;
+    }
+
+    if (command == "interrupt")
+    {
+        if (session->Interrupt())
+        {
+            Reply("^done,session=\"%d\"", sessionId);
+        }
+        else
+        {
+            Reply("^error,session=\"%d\",msg=\"Interrupt failed\"", sessionId);
+        }
+        return;
+    }
+
+    if (command == "terminate")
+    {
+        session->Terminate();
+        Reply("^done,session=\"%d\"", sessionId);
+        return;
+    }
+
+    if (command == "recycle")
+    {
+        // completion is reported by =session-recycled (or =session-exited, if GDB had to be killed):
+        if (session->Recycle())
+        {
+            Reply("^done,session=\"%d\"", sessionId);
+        }
+        else
+        {
+            Reply("^error,session=\"%d\",msg=\"Session can't be recycled\"", sessionId);
+        }
+        return;
+    }
+
+    Reply("^error,msg=\"Unknown command\"");
+}
+
+void SessionHost::OnRead(HostPipe pipe, const char* data, size_t length)
+{
+    size_t start = 0;
+    size_t eol;
+
+    m_input.append(data, length);
+
+    while (!m_quit && (eol = m_input.find('\n', start)) != std::string::npos)
+    {
+        size_t end = eol;
+        if (end > start && m_input[end - 1] == '\r')
+            end--;
+
+        Execute(m_input.substr(start, end - start));
+        start = eol + 1;
+    }
+
+    m_input.erase(0, start);
+}
+
+/// <summary>
+/// IDE closed the control channel, so there is nobody to pass the output to.
+/// </summary>
+void SessionHost::OnClosed(HostPipe pipe)
+{
+    TerminateAll();
+    m_quit = TRUE;
+}
+
+/// <summary>
+/// Wakes up the loop immediately, when there are sessions to delete or the host should quit.
+/// </summary>
+DWORD SessionHost::GetTimeout()
+{
+    return m_finished.empty() && !m_quit ? INFINITE : 0;
+}
+
+BOOL SessionHost::OnTimeout()
+{
+    DeleteFinished();
+    return !m_quit;
+}
+
+void SessionHost::OnSessionFinished(GDBSession* session)
+{
+    std::map<int, GDBSession*>::iterator it = m_sessions.find(session->GetId());
+    if (it == m_sessions.end() || it->second != session)
+        return;
+
+    m_sessions.erase(it);
+    m_finished.push_back(session);
+    m_symbolReuses += session->GetSymbolReuses();
+
+    GDBPoolEntry* entry = session->TakeRecycled();
+    if (entry != NULL)
+    {
+        m_pool.Release(entry);
+        Reply("=session-recycled,session=\"%d\"", session->GetId());
+        return;
+    }
+
+    Reply("=session-exited,session=\"%d\"", session->GetId());
+}
+
+void SessionHost::OnSessionReady(GDBSession* session, unsigned long long elapsed)
+{
+    m_pool.AddPromptTime(session->IsPooled(), elapsed);
+}
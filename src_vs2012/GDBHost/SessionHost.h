@@ -0,0 +1,84 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "GDBPool.h"
+#include "GDBSession.h"
+#include "HostLoop.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+#define SESSION_CONTROL_CHANNEL     0
+
+
+/// <summary>
+/// Multi-session host. It manages many GDB instances inside single process, controlled by line-based
+/// commands sent to the host standard input:
+///   start <id> <ctrl-c-event-name|-> <termination-event-name|-> <path-to-GDB> (<gdb-arguments>)
+///   pool <size> <path-to-GDB> (<gdb-arguments>)
+///   send <id> <MI command>
+///   interrupt <id>
+///   terminate <id>
+///   recycle <id>
+///   list
+///   stats
+///   quit
+/// Replies and notifications are MI-like records sent on channel 0, output of each GDB on channel equal to its session ID.
+/// </summary>
+class SessionHost : public HostReadHandler, public HostTimerHandler, public GDBSessionListener
+{
+private:
+    HostLoop* m_loop;
+    DWORD m_latency;
+    BOOL m_framed;
+    size_t m_streamChunk;
+    GDBPool m_pool;
+    InterruptStats m_interruptStats;
+    std::string m_input;                    // commands received and not processed yet
+    std::map<int, GDBSession*> m_sessions;
+    std::vector<GDBSession*> m_finished;    // sessions waiting to be deleted outside of their own notifications
+    unsigned long long m_symbolReuses;      // symbol loads answered by recycled GDB instances
+    BOOL m_quit;
+
+    void Execute(const std::string& line);
+    void Send(const std::string& record);
+    void Reply(const char* format, ...);
+    GDBSession* Find(int id);
+    void DeleteFinished();
+
+public:
+    SessionHost(HostLoop* loop, DWORD latency, BOOL framed, size_t streamChunk, DWORD poolIdleTimeout, DWORD poolMemoryLimit, DWORD statsInterval);
+    virtual ~SessionHost();
+
+    void TerminateAll();
+    size_t GetSessionCount() const { return m_sessions.size(); }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length);
+    virtual void OnClosed(HostPipe pipe);
+
+    // HostTimerHandler
+    virtual DWORD GetTimeout();
+    virtual BOOL OnTimeout();
+
+    // GDBSessionListener
+    virtual void OnSessionFinished(GDBSession* session);
+    virtual void OnSessionReady(GDBSession* session, unsigned long long elapsed);
+};
@@ -0,0 +1,431 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// ShmTransport.cpp : shared memory transport between the host and the IDE.
+//
+
+#include "stdafx.h"
+#include "ShmTransport.h"
+#include "Log.h"
+
+#include <string.h>
+#ifndef _WIN32
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <stdlib.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+
+static inline unsigned int AlignMessage(size_t length)
+{
+    return (unsigned int) ((length + SHM_MESSAGE_ALIGNMENT - 1) & ~(size_t) (SHM_MESSAGE_ALIGNMENT - 1));
+}
+
+/// <summary>
+/// Builds the name of the region or doorbell out of the base name.
+/// </summary>
+static void GetName(TCHAR* buffer, size_t length, LPCTSTR lpszBaseName, LPCTSTR lpszSuffix)
+{
+    _tcscpy_s(buffer, length, lpszBaseName);
+    _tcscat_s(buffer, length, lpszSuffix);
+}
+
+ShmTransport::ShmTransport(ShmTransportSide side)
+    :
+#ifdef _WIN32
+      m_hMapping(NULL),
+#else
+      m_fd(-1), m_lpszCreatedName(NULL),
+#endif
+      m_side(side), m_header(NULL), m_sendRing(NULL), m_receiveRing(NULL), m_sendData(NULL), m_receiveData(NULL), m_capacity(0), m_listener(NULL),
+      m_output(this, ShmMessageOutput), m_error(this, ShmMessageError), m_sentBytes(0), m_doorbells(0)
+{
+}
+
+ShmTransport::~ShmTransport()
+{
+    Close();
+}
+
+/// <summary>
+/// Opens existing shared memory region or creates a new one with given capacity of each ring.
+/// </summary>
+BOOL ShmTransport::Map(LPCTSTR lpszName, unsigned int capacity)
+{
+    BOOL created = FALSE;
+
+#ifdef _WIN32
+    m_hMapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, lpszName);
+    if (m_hMapping == NULL)
+    {
+        m_hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(ShmHeader) + 2 * capacity, lpszName);
+        if (m_hMapping == NULL)
+        {
+            PrintError(_T("CreateFileMapping"), GetLastError());
+            return FALSE;
+        }
+        created = GetLastError() != ERROR_ALREADY_EXISTS;
+    }
+
+    m_header = static_cast<ShmHeader*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (m_header == NULL)
+    {
+        PrintError(_T("MapViewOfFile"), GetLastError());
+        return FALSE;
+    }
+#else
+    // POSIX shared memory objects have a single leading slash and no other ones:
+    std::string name("/");
+    for (const char* p = lpszName; *p != '\0'; p++)
+    {
+        name += *p == '/' ? '_' : *p;
+    }
+
+    size_t size = sizeof(ShmHeader) + 2 * capacity;
+
+    m_fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (m_fd < 0)
+    {
+        m_fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (m_fd < 0 || ftruncate(m_fd, size) != 0)
+        {
+            PrintError(_T("shm_open"), errno);
+            return FALSE;
+        }
+
+        created = TRUE;
+        m_lpszCreatedName = strdup(name.c_str());
+    }
+    else
+    {
+        struct stat info;
+        if (fstat(m_fd, &info) != 0 || (size_t) info.st_size < sizeof(ShmHeader))
+        {
+            PrintError(_T("fstat"), errno);
+            return FALSE;
+        }
+        size = info.st_size;
+    }
+
+    void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (address == MAP_FAILED)
+    {
+        PrintError(_T("mmap"), errno);
+        return FALSE;
+    }
+    m_header = static_cast<ShmHeader*>(address);
+#endif
+
+    if (created)
+    {
+        memset(m_header, 0, sizeof(ShmHeader));
+        m_header->version = SHM_VERSION;
+        m_header->capacity = capacity;
+
+        // magic is set as the last one, so the other side never sees partially initialized header:
+        HostAtomicStore(reinterpret_cast<HostAtomic*>(&m_header->magic), SHM_MAGIC);
+    }
+
+    if (m_header->magic != SHM_MAGIC || m_header->version != SHM_VERSION
+        || m_header->capacity == 0 || (m_header->capacity & (m_header->capacity - 1)) != 0)
+    {
+        PrintMessage(_T("Error: Invalid shared memory region (%s)\r\n"), lpszName);
+        return FALSE;
+    }
+
+    char* toIde = reinterpret_cast<char*>(m_header + 1);
+    char* toHost = toIde + m_header->capacity;
+
+    m_capacity = m_header->capacity;
+    m_sendRing = m_side == ShmSideHost ? &m_header->toIde : &m_header->toHost;
+    m_receiveRing = m_side == ShmSideHost ? &m_header->toHost : &m_header->toIde;
+    m_sendData = m_side == ShmSideHost ? toIde : toHost;
+    m_receiveData = m_side == ShmSideHost ? toHost : toIde;
+    return TRUE;
+}
+
+void ShmTransport::Unmap()
+{
+#ifdef _WIN32
+    if (m_header != NULL)
+    {
+        UnmapViewOfFile(m_header);
+    }
+    if (m_hMapping != NULL)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+#else
+    if (m_header != NULL)
+    {
+        munmap(m_header, sizeof(ShmHeader) + 2 * m_capacity);
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (m_lpszCreatedName != NULL)
+    {
+        shm_unlink(m_lpszCreatedName);
+        free(m_lpszCreatedName);
+        m_lpszCreatedName = NULL;
+    }
+#endif
+
+    m_header = NULL;
+    m_sendRing = NULL;
+    m_receiveRing = NULL;
+    m_sendData = NULL;
+    m_receiveData = NULL;
+}
+
+/// <summary>
+/// Opens (or creates) the shared memory region and both doorbells.
+/// </summary>
+/// <param name="lpszBaseName">Base name of all the objects; the name of the Ctrl-C event is used for it.</param>
+/// <param name="listener">Receiver of the messages sent by the other side.</param>
+BOOL ShmTransport::Open(LPCTSTR lpszBaseName, ShmTransportListener* listener)
+{
+    TCHAR name[_MAX_PATH];
+
+    if (m_header != NULL || lpszBaseName == NULL)
+        return FALSE;
+
+    m_listener = listener;
+
+    GetName(name, _countof(name), lpszBaseName, SHM_NAME_SUFFIX);
+    if (!Map(name, SHM_DEFAULT_CAPACITY))
+    {
+        Close();
+        return FALSE;
+    }
+
+    GetName(name, _countof(name), lpszBaseName, m_side == ShmSideHost ? SHM_HOST_DOORBELL_SUFFIX : SHM_IDE_DOORBELL_SUFFIX);
+    if (!m_ownDoorbell.Open(name) && !m_ownDoorbell.Create(name))
+    {
+        Close();
+        return FALSE;
+    }
+
+    GetName(name, _countof(name), lpszBaseName, m_side == ShmSideHost ? SHM_IDE_DOORBELL_SUFFIX : SHM_HOST_DOORBELL_SUFFIX);
+    if (!m_peerDoorbell.Open(name) && !m_peerDoorbell.Create(name))
+    {
+        Close();
+        return FALSE;
+    }
+
+    // the loop sleeps on the own doorbell, whenever there is nothing to read; messages sent before it opened must be read first:
+    HostAtomicStore(&m_receiveRing->waiting, 1);
+    if (HostAtomicLoad(&m_receiveRing->tail) != HostAtomicLoad(&m_receiveRing->head))
+    {
+        m_ownDoorbell.Signal();
+    }
+    return TRUE;
+}
+
+void ShmTransport::Close()
+{
+    m_ownDoorbell.Close();
+    m_peerDoorbell.Close();
+    Unmap();
+    m_pending.clear();
+}
+
+/// <summary>
+/// Puts single message into the ring to the other side. Returns FALSE, if there is not enough space.
+/// </summary>
+BOOL ShmTransport::WriteMessage(ShmMessageType type, const char* data, size_t length)
+{
+    ShmRingHeader* ring = m_sendRing;
+    unsigned int total = AlignMessage(sizeof(ShmMessageHeader) + length);
+    unsigned int head = (unsigned int) HostAtomicLoad(&ring->head);
+    unsigned int tail = (unsigned int) HostAtomicLoad(&ring->tail);
+    unsigned int offset = head & (m_capacity - 1);
+    unsigned int contiguous = m_capacity - offset;
+    unsigned int needed = total + (contiguous < total ? contiguous : 0);
+
+    if (needed > m_capacity - (head - tail))
+        return FALSE;
+
+    ShmMessageHeader* header;
+
+    // message can't wrap, so skip the rest of the ring:
+    if (contiguous < total)
+    {
+        header = reinterpret_cast<ShmMessageHeader*>(m_sendData + offset);
+        header->length = contiguous - sizeof(ShmMessageHeader);
+        header->type = ShmMessagePadding;
+        head += contiguous;
+        offset = 0;
+    }
+
+    header = reinterpret_cast<ShmMessageHeader*>(m_sendData + offset);
+    header->length = (unsigned int) length;
+    header->type = type;
+    if (length > 0)
+    {
+        memcpy(header + 1, data, length);
+    }
+
+    // publish and wake the other side, if it's sleeping:
+    HostAtomicStore(&ring->head, (int) (head + total));
+    m_sentBytes += length;
+
+    if (HostAtomicExchange(&ring->waiting, 0) != 0)
+    {
+        m_peerDoorbell.Signal();
+        m_doorbells++;
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Sends a message to the other side. Stream data bigger than the ring is split into several messages.
+/// When the ring is full, the data waits inside this process, till the other side frees some space.
+/// </summary>
+BOOL ShmTransport::Send(ShmMessageType type, const char* data, size_t length)
+{
+    if (m_header == NULL)
+        return FALSE;
+
+    size_t maxChunk = m_capacity / 4;
+
+    do
+    {
+        size_t chunk = length > maxChunk ? maxChunk : length;
+
+        if (!m_pending.empty() || !WriteMessage(type, data, chunk))
+        {
+            ShmMessageHeader header;
+
+            header.length = (unsigned int) chunk;
+            header.type = type;
+            m_pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            m_pending.append(data, chunk);
+            m_pending.append(AlignMessage(sizeof(header) + chunk) - sizeof(header) - chunk, '\0');
+        }
+
+        data += chunk;
+        length -= chunk;
+    }
+    while (length > 0);
+
+    if (!m_pending.empty())
+    {
+        FlushPending();
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Moves as many waiting messages into the ring as possible.
+/// </summary>
+void ShmTransport::FlushPending()
+{
+    size_t offset = 0;
+    BOOL retried = FALSE;
+
+    while (offset < m_pending.size())
+    {
+        const ShmMessageHeader* header = reinterpret_cast<const ShmMessageHeader*>(m_pending.data() + offset);
+
+        if (!WriteMessage((ShmMessageType) header->type, reinterpret_cast<const char*>(header + 1), header->length))
+        {
+            if (retried)
+                break;
+
+            // ask the other side to ring back, once it reads something, and check again, in case it has just done it:
+            HostAtomicStore(&m_sendRing->full, 1);
+            retried = TRUE;
+            continue;
+        }
+
+        offset += AlignMessage(sizeof(ShmMessageHeader) + header->length);
+    }
+
+    m_pending.erase(0, offset);
+}
+
+/// <summary>
+/// Processes all messages received from the other side. Returns FALSE, when the listener wants to stop the loop.
+/// </summary>
+BOOL ShmTransport::ReadMessages()
+{
+    ShmRingHeader* ring = m_receiveRing;
+    unsigned int tail = (unsigned int) HostAtomicLoad(&ring->tail);
+    BOOL result = TRUE;
+
+    while (result)
+    {
+        if (tail == (unsigned int) HostAtomicLoad(&ring->head))
+        {
+            // going to sleep, so ask for the doorbell and check again, in case a message has just been published:
+            HostAtomicStore(&ring->waiting, 1);
+            if (tail == (unsigned int) HostAtomicLoad(&ring->head))
+                break;
+        }
+
+        unsigned int offset = tail & (m_capacity - 1);
+        const ShmMessageHeader* header = reinterpret_cast<const ShmMessageHeader*>(m_receiveData + offset);
+
+        if (sizeof(ShmMessageHeader) + header->length > m_capacity - offset)
+        {
+            PrintMessage(_T("Error: Corrupted message in shared memory\r\n"));
+            return FALSE;
+        }
+
+        if (header->type != ShmMessagePadding && m_listener != NULL)
+        {
+            result = m_listener->OnMessage((ShmMessageType) header->type, reinterpret_cast<const char*>(header + 1), header->length);
+        }
+
+        tail += AlignMessage(sizeof(ShmMessageHeader) + header->length);
+        HostAtomicStore(&ring->tail, (int) tail);
+    }
+
+    // the other side waits for free space:
+    if (HostAtomicExchange(&ring->full, 0) != 0)
+    {
+        m_peerDoorbell.Signal();
+        m_doorbells++;
+    }
+
+    return result;
+}
+
+/// <summary>
+/// The other side rang the doorbell: it either sent new messages or freed some space in the ring it reads.
+/// </summary>
+BOOL ShmTransport::OnSignaled(HostWaitable waitable)
+{
+    m_ownDoorbell.Consume();
+
+    if (m_header == NULL)
+        return TRUE;
+
+    if (!m_pending.empty())
+    {
+        FlushPending();
+    }
+
+    return ReadMessages();
+}
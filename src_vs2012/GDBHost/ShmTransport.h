@@ -0,0 +1,182 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostAtomic.h"
+#include "HostLoop.h"
+#include "MiRelay.h"
+
+#include <string>
+
+
+#define SHM_MAGIC                   0x4D484247      // 'GBHM'
+#define SHM_VERSION                 1
+#define SHM_DEFAULT_CAPACITY        (1024 * 1024)   // bytes of each ring, must be power of 2
+#define SHM_MESSAGE_ALIGNMENT       8
+#define SHM_NAME_SUFFIX             _T("-shm")
+#define SHM_HOST_DOORBELL_SUFFIX    _T("-shm-host")
+#define SHM_IDE_DOORBELL_SUFFIX     _T("-shm-ide")
+
+
+/// <summary>
+/// Side of the transport the instance is running at.
+/// </summary>
+enum ShmTransportSide
+{
+    ShmSideHost = 0,                // consumes the ring to the host and rings the IDE doorbell
+    ShmSideIde                      // consumes the ring to the IDE and rings the host doorbell
+};
+
+/// <summary>
+/// Types of messages passed through the shared memory rings.
+/// </summary>
+enum ShmMessageType
+{
+    ShmMessagePadding = 0,          // skip to the beginning of the ring
+    // host -> IDE:
+    ShmMessageOutput = 1,           // data from GDB standard output
+    ShmMessageError = 2,            // data from GDB standard error
+    ShmMessageExited = 3,           // GDB has exited, no more messages will follow
+    // IDE -> host:
+    ShmMessageCommand = 16,         // data for GDB standard input
+    ShmMessageInterrupt = 17,       // send Ctrl+C to GDB
+    ShmMessageTerminate = 18        // terminate the host and GDB
+};
+
+/// <summary>
+/// Header of each message. It's followed by the payload and padded to SHM_MESSAGE_ALIGNMENT bytes.
+/// Message never wraps around the end of the ring, padding message is placed there instead.
+/// </summary>
+struct ShmMessageHeader
+{
+    unsigned int length;            // of the payload only
+    unsigned int type;              // ShmMessageType
+};
+
+/// <summary>
+/// Control block of single-producer/single-consumer ring. Positions are free-running byte counters,
+/// the offset inside the ring is position modulo capacity. Each field has own cache line.
+/// </summary>
+struct ShmRingHeader
+{
+    HostAtomic head;                // written only by the producer, after the message is complete
+    char reserved1[60];
+    HostAtomic tail;                // written only by the consumer, after the message is processed
+    char reserved2[60];
+    HostAtomic waiting;             // set by the consumer before sleeping on its doorbell; producer rings the doorbell only then
+    char reserved3[60];
+    HostAtomic full;                // set by the producer, when the ring had no space; consumer rings producer's doorbell after reading
+    char reserved4[60];
+};
+
+/// <summary>
+/// Layout of the whole shared memory region. It's followed by the data of the ring to the IDE and then to the host.
+/// </summary>
+struct ShmHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int capacity;          // of each ring
+    unsigned int reserved[13];
+    ShmRingHeader toIde;
+    ShmRingHeader toHost;
+};
+
+/// <summary>
+/// Interface notified about messages sent by the other side.
+/// </summary>
+class ShmTransportListener
+{
+public:
+    virtual ~ShmTransportListener() { }
+
+    /// <summary>
+    /// Called for each message received from the other side. Returning FALSE stops the loop.
+    /// </summary>
+    virtual BOOL OnMessage(ShmMessageType type, const char* data, size_t length) = 0;
+};
+
+/// <summary>
+/// Optional transport between the host and the IDE, that replaces console pipes and named events.
+/// It's a named shared memory region with a ring in each direction and a doorbell event for each side.
+/// The region and both doorbells are opened by name (or created, if the IDE didn't create them):
+///   <base-name>-shm, <base-name>-shm-host (IDE rings the host), <base-name>-shm-ide (host rings the IDE).
+/// The same class serves the IDE side of the benchmarks, it only swaps the rings and the doorbells.
+/// </summary>
+class ShmTransport : public HostWaitHandler
+{
+private:
+    /// <summary>
+    /// Relay sink writing given type of messages.
+    /// </summary>
+    class Channel : public MiRelaySink
+    {
+    private:
+        ShmTransport* m_transport;
+        ShmMessageType m_type;
+
+    public:
+        Channel(ShmTransport* transport, ShmMessageType type) : m_transport(transport), m_type(type) { }
+
+        virtual BOOL Write(const char* data, size_t length) { return m_transport->Send(m_type, data, length); }
+    };
+
+#ifdef _WIN32
+    HANDLE m_hMapping;
+#else
+    int m_fd;
+    TCHAR* m_lpszCreatedName;       // not NULL only, when the region was created by this instance
+#endif
+    ShmTransportSide m_side;
+    ShmHeader* m_header;
+    ShmRingHeader* m_sendRing;
+    ShmRingHeader* m_receiveRing;
+    char* m_sendData;
+    char* m_receiveData;
+    unsigned int m_capacity;
+    HostEvent m_ownDoorbell;        // rung by the other side
+    HostEvent m_peerDoorbell;
+    ShmTransportListener* m_listener;
+    std::string m_pending;          // messages, that didn't fit into the ring yet
+    Channel m_output;
+    Channel m_error;
+    unsigned long long m_sentBytes;
+    unsigned long long m_doorbells;
+
+    BOOL Map(LPCTSTR lpszName, unsigned int capacity);
+    void Unmap();
+    BOOL WriteMessage(ShmMessageType type, const char* data, size_t length);
+    void FlushPending();
+    BOOL ReadMessages();
+
+public:
+    ShmTransport(ShmTransportSide side = ShmSideHost);
+    virtual ~ShmTransport();
+
+    BOOL Open(LPCTSTR lpszBaseName, ShmTransportListener* listener);
+    void Close();
+
+    BOOL Send(ShmMessageType type, const char* data, size_t length);
+    MiRelaySink* GetOutputSink() { return &m_output; }
+    MiRelaySink* GetErrorSink() { return &m_error; }
+    HostWaitable GetWaitable() const { return m_ownDoorbell.GetWaitable(); }
+    unsigned long long GetSentBytes() const { return m_sentBytes; }
+    unsigned long long GetDoorbellCount() const { return m_doorbells; }
+
+    // HostWaitHandler
+    virtual BOOL OnSignaled(HostWaitable waitable);
+};
@@ -0,0 +1,354 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+// StartupProfiler.cpp : timing of the host startup phases.
+//
+
+#include "stdafx.h"
+#include "StartupProfiler.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+static const char* const StartupPhaseNames[StartupPhaseCount] =
+{
+    "arguments",
+    "events",
+    "gdb-check",
+    "gdb-command",
+    "gdb-start",
+    "host-setup",
+    "gdb-prompt",
+    "target",
+    "symbols"
+};
+
+struct StartupCommand
+{
+    const char* name;
+    StartupPhase phase;
+};
+
+// commands of the IDE, which duration is measured:
+static const StartupCommand StartupCommands[] =
+{
+    { "-target-select",         StartupTarget },
+    { "-file-exec-and-symbols", StartupSymbols },
+    { "-file-symbol-file",      StartupSymbols },
+};
+
+
+#if defined(_WIN32) && defined(_UNICODE)
+static std::string FromHostString(LPCTSTR text)
+{
+    int length = WideCharToMultiByte(CP_UTF8, 0, text, -1, NULL, 0, NULL, NULL);
+    if (length <= 1)
+        return std::string();
+
+    std::string result(length - 1, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text, -1, &result[0], length, NULL, NULL);
+    return result;
+}
+#else
+static std::string FromHostString(LPCTSTR text)
+{
+    return std::string(text);
+}
+#endif
+
+
+/// <summary>
+/// Constructor. It should be called as the first thing after the host starts, as it starts the first phase.
+/// </summary>
+StartupProfiler::StartupProfiler()
+    : m_total(0), m_finished(FALSE)
+{
+    m_start = HostGetTimestamp();
+    m_last = m_start;
+    memset(m_durations, 0, sizeof(m_durations));
+    memset(m_measured, 0, sizeof(m_measured));
+    memset(m_commandStart, 0, sizeof(m_commandStart));
+    memset(m_commandPending, 0, sizeof(m_commandPending));
+    for (int i = 0; i < StartupPhaseCount; i++)
+    {
+        m_commandToken[i] = MI_NO_TOKEN;
+    }
+}
+
+const char* StartupProfiler::GetPhaseName(StartupPhase phase)
+{
+    return phase >= 0 && phase < StartupPhaseCount ? StartupPhaseNames[phase] : "unknown";
+}
+
+void StartupProfiler::Mark(StartupPhase phase)
+{
+    unsigned long long now = HostGetTimestamp();
+
+    m_durations[phase] = now - m_last;
+    m_measured[phase] = TRUE;
+    m_last = now;
+}
+
+void StartupProfiler::SetGdbPath(LPCTSTR lpszPath)
+{
+    m_gdbPath = lpszPath != NULL ? FromHostString(lpszPath) : std::string();
+}
+
+void StartupProfiler::RecordCommands(const char* data, size_t length)
+{
+    if (m_finished)
+        return;
+
+    m_input.append(data, length);
+
+    size_t start = 0;
+    size_t eol;
+
+    while ((eol = m_input.find('\n', start)) != std::string::npos)
+    {
+        OnCommand(m_input.data() + start, eol - start);
+        start = eol + 1;
+    }
+
+    m_input.erase(0, start);
+}
+
+/// <summary>
+/// Starts measuring the first command of each watched kind.
+/// </summary>
+void StartupProfiler::OnCommand(const char* line, size_t length)
+{
+    const char* end = line + length;
+    const char* p = line;
+    unsigned int token = MI_NO_TOKEN;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    if (p < end && *p >= '0' && *p <= '9')
+    {
+        token = MiParser::ParseToken(p, end);
+    }
+
+    for (size_t i = 0; i < _countof(StartupCommands); i++)
+    {
+        StartupPhase phase = StartupCommands[i].phase;
+        size_t nameLength = strlen(StartupCommands[i].name);
+
+        if ((size_t) (end - p) >= nameLength && memcmp(p, StartupCommands[i].name, nameLength) == 0)
+        {
+            if (!m_measured[phase] && !m_commandPending[phase])
+            {
+                m_commandStart[phase] = HostGetTimestamp();
+                m_commandToken[phase] = token;
+                m_commandPending[phase] = TRUE;
+            }
+            return;
+        }
+    }
+}
+
+void StartupProfiler::OnRecord(const MiRecord& record)
+{
+    if (m_finished)
+        return;
+
+    if (record.type == MiRecordPrompt && !m_measured[StartupGdbPrompt])
+    {
+        Mark(StartupGdbPrompt);
+        return;
+    }
+
+    if (record.type != MiRecordResult)
+        return;
+
+    for (int i = 0; i < StartupPhaseCount; i++)
+    {
+        if (m_commandPending[i] && m_commandToken[i] == record.token)
+        {
+            m_durations[i] = HostGetTimestamp() - m_commandStart[i];
+            m_measured[i] = TRUE;
+            m_commandPending[i] = FALSE;
+
+            // the session is ready for the user, once the binary is loaded:
+            if (i == StartupSymbols)
+            {
+                Finish();
+            }
+            return;
+        }
+    }
+}
+
+void StartupProfiler::Finish()
+{
+    if (m_finished)
+        return;
+
+    m_finished = TRUE;
+    m_total = HostGetTimestamp() - m_start;
+
+    // standard output might be already carrying MI records, so only the log gets the breakdown now:
+    std::string text;
+
+    Format(text);
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    LogPrint(message.c_str());
+
+    const char* csvPath = getenv(STARTUP_CSV_ENVIRONMENT_VARIABLE);
+    if (csvPath != NULL && csvPath[0] != '\0' && !AppendCsv(csvPath))
+    {
+        LogPrint(_T("StartupProfiler: unable to append to the CSV file"));
+    }
+}
+
+/// <summary>
+/// Appends single row with the UTC time, GDB path (identifying the NDK) and durations of all phases in microseconds.
+/// Phases, that weren't measured, are left empty. The header is written, when the file is new.
+/// </summary>
+BOOL StartupProfiler::AppendCsv(const char* path) const
+{
+    FILE* file = fopen(path, "ab");
+    if (file == NULL)
+        return FALSE;
+
+    std::string row;
+    char text[64];
+
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0)
+    {
+        row.append("date,gdb");
+        for (int i = 0; i < StartupPhaseCount; i++)
+        {
+            std::string column(StartupPhaseNames[i]);
+
+            // identifiers friendly to spreadsheets and scripts:
+            for (size_t j = 0; j < column.size(); j++)
+            {
+                if (column[j] == '-')
+                {
+                    column[j] = '_';
+                }
+            }
+
+            row.append(",");
+            row.append(column);
+            row.append("_us");
+        }
+        row.append(",total_us\r\n");
+    }
+
+    time_t now = time(NULL);
+    struct tm utc;
+#ifdef _WIN32
+    gmtime_s(&utc, &now);
+#else
+    gmtime_r(&now, &utc);
+#endif
+    sprintf_s(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02dZ,\"", utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+    row.append(text);
+
+    for (size_t i = 0; i < m_gdbPath.size(); i++)
+    {
+        if (m_gdbPath[i] == '"')
+        {
+            row.append("\"");
+        }
+        row.append(1, m_gdbPath[i]);
+    }
+    row.append("\"");
+
+    for (int i = 0; i < StartupPhaseCount; i++)
+    {
+        row.append(",");
+        if (m_measured[i])
+        {
+            sprintf_s(text, sizeof(text), "%llu", m_durations[i]);
+            row.append(text);
+        }
+    }
+    sprintf_s(text, sizeof(text), ",%llu\r\n", m_total);
+    row.append(text);
+
+    BOOL result = fwrite(row.data(), 1, row.size(), file) == row.size();
+    fclose(file);
+    return result;
+}
+
+void StartupProfiler::Format(std::string& output) const
+{
+    char text[64];
+
+    output.append("startup={");
+    for (int i = 0; i < StartupPhaseCount; i++)
+    {
+        if (m_measured[i])
+        {
+            sprintf_s(text, sizeof(text), "%s=\"%llu\",", StartupPhaseNames[i], m_durations[i]);
+            output.append(text);
+        }
+    }
+    sprintf_s(text, sizeof(text), "total=\"%llu\"}", m_finished ? m_total : HostGetTimestamp() - m_start);
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the breakdown in milliseconds to console (and log).
+/// </summary>
+void StartupProfiler::Print()
+{
+    std::string text;
+    char item[64];
+    unsigned long long host = 0;
+
+    for (int i = StartupArguments; i <= StartupHostSetup; i++)
+    {
+        host += m_durations[i];
+    }
+
+    sprintf_s(item, sizeof(item), "host %.2f (", host / 1000.0);
+    text.append(item);
+    for (int i = StartupArguments; i <= StartupHostSetup; i++)
+    {
+        sprintf_s(item, sizeof(item), "%s%s %.2f", i > StartupArguments ? ", " : "", StartupPhaseNames[i], m_durations[i] / 1000.0);
+        text.append(item);
+    }
+    text.append(")");
+
+    for (int i = StartupGdbPrompt; i < StartupPhaseCount; i++)
+    {
+        if (m_measured[i])
+        {
+            sprintf_s(item, sizeof(item), ", %s %.2f", StartupPhaseNames[i], m_durations[i] / 1000.0);
+        }
+        else
+        {
+            sprintf_s(item, sizeof(item), ", %s -", StartupPhaseNames[i]);
+        }
+        text.append(item);
+    }
+
+    sprintf_s(item, sizeof(item), ", total %.2f", (m_finished ? m_total : HostGetTimestamp() - m_start) / 1000.0);
+    text.append(item);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
@@ -0,0 +1,132 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostLoop.h"
+#include "MiParser.h"
+
+#include <string>
+
+
+#define STARTUP_CSV_ENVIRONMENT_VARIABLE    "BLACKBERRY_GDBHOST_STARTUP_CSV"
+
+
+/// <summary>
+/// Phases of the host startup, in order they happen.
+/// </summary>
+enum StartupPhase
+{
+    StartupArguments = 0,       // parsing host options
+    StartupEvents,              // opening (or creating) Ctrl-C and termination events
+    StartupGdbCheck,            // checking, that GDB executable exists
+    StartupGdbCommand,          // building GDB command line
+    StartupGdbStart,            // creating GDB process and its pipes
+    StartupHostSetup,           // relays, pipeline, caches and the loop
+    StartupGdbPrompt,           // GDB's own initialization till the first '(gdb)' prompt (relay mode only)
+    StartupTarget,              // '-target-select' command (connecting the device)
+    StartupSymbols,             // '-file-exec-and-symbols' command (loading the binary)
+    StartupPhaseCount
+};
+
+/// <summary>
+/// Measures how long each phase of the launch takes, so regressions can be attributed to the host, GDB or symbol loading.
+/// The host phases are marked explicitly by _tmain(), GDB phases are taken from the commands of the IDE and the records
+/// passing through the output relay. Once symbols are loaded (or the host exits), the breakdown is written into the log
+/// and appended as a single row into the CSV file, whose path is set in STARTUP_CSV_ENVIRONMENT_VARIABLE.
+/// </summary>
+class StartupProfiler : public MiRecordObserver
+{
+private:
+    unsigned long long m_start;
+    unsigned long long m_last;                      // end of the last host phase
+    unsigned long long m_durations[StartupPhaseCount];
+    BOOL m_measured[StartupPhaseCount];
+    unsigned long long m_total;
+    unsigned long long m_commandStart[StartupPhaseCount];
+    unsigned int m_commandToken[StartupPhaseCount];
+    BOOL m_commandPending[StartupPhaseCount];
+    std::string m_input;                            // incomplete command line
+    std::string m_gdbPath;
+    BOOL m_finished;
+
+    void OnCommand(const char* line, size_t length);
+    BOOL AppendCsv(const char* path) const;
+
+public:
+    StartupProfiler();
+
+    static const char* GetPhaseName(StartupPhase phase);
+
+    /// <summary>
+    /// Ends given host phase, which started, when the previous one ended.
+    /// </summary>
+    void Mark(StartupPhase phase);
+
+    void SetGdbPath(LPCTSTR lpszPath);
+
+    /// <summary>
+    /// Watches commands sent by the IDE for the ones loading the target and symbols.
+    /// </summary>
+    void RecordCommands(const char* data, size_t length);
+
+    /// <summary>
+    /// Closes the measurement, logs the breakdown and appends it to the CSV file. Only the first call has any effect.
+    /// </summary>
+    void Finish();
+
+    BOOL IsFinished() const { return m_finished; }
+    BOOL IsMeasured(StartupPhase phase) const { return m_measured[phase]; }
+    unsigned long long GetDuration(StartupPhase phase) const { return m_durations[phase]; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the durations in microseconds: startup={arguments="",events="",...,total=""}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print();
+
+    // MiRecordObserver
+    virtual void OnRecord(const MiRecord& record);
+};
+
+/// <summary>
+/// Passes the commands read from the IDE to the profiler and then to the next handler.
+/// </summary>
+class StartupProfilingReader : public HostReadHandler
+{
+private:
+    StartupProfiler* m_profiler;
+    HostReadHandler* m_next;
+
+public:
+    StartupProfilingReader(StartupProfiler* profiler, HostReadHandler* next)
+        : m_profiler(profiler), m_next(next)
+    {
+    }
+
+    void SetNext(HostReadHandler* next) { m_next = next; }
+
+    // HostReadHandler
+    virtual void OnRead(HostPipe pipe, const char* data, size_t length)
+    {
+        m_profiler->RecordCommands(data, length);
+        m_next->OnRead(pipe, data, length);
+    }
+
+    virtual void OnClosed(HostPipe pipe)
+    {
+        m_next->OnClosed(pipe);
+    }
+};
@@ -0,0 +1,927 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+// SymbolIndex.cpp : on-disk cache of binaries with pre-built GDB symbol index.
+//
+
+#include "stdafx.h"
+#include "SymbolIndex.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifndef _WIN32
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <signal.h>
+#   include <stdlib.h>
+#   include <unistd.h>
+#   include <sys/resource.h>
+#   include <sys/stat.h>
+#   include <sys/wait.h>
+#endif
+
+
+#ifdef _WIN32
+static const TCHAR PathSeparator = '\\';
+#else
+static const TCHAR PathSeparator = '/';
+#endif
+
+#define FNV_OFFSET_BASIS            0xCBF29CE484222325ULL
+#define FNV_PRIME                   0x100000001B3ULL
+#define HASH_BUFFER_SIZE            (1024 * 1024)
+
+enum ElfIndexState
+{
+    ElfNotSupported = 0,            // not a little-endian ELF or without debug info
+    ElfIndexed,                     // already has '.gdb_index' or '.debug_names'
+    ElfNeedsIndex
+};
+
+
+#ifdef _WIN32
+static HostString ToHostPath(const std::string& text)
+{
+    if (text.empty())
+        return HostString();
+
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), NULL, 0);
+    HostString result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), (int) text.size(), &result[0], length);
+    return result;
+}
+
+static std::string FromHostPath(const HostString& path)
+{
+    if (path.empty())
+        return std::string();
+
+    int length = WideCharToMultiByte(CP_UTF8, 0, path.data(), (int) path.size(), NULL, 0, NULL, NULL);
+    std::string result(length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, path.data(), (int) path.size(), &result[0], length, NULL, NULL);
+    return result;
+}
+
+static BOOL PathExists(const HostString& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+static BOOL GetFileStamp(const HostString& path, unsigned long long& size, unsigned long long& time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+        return FALSE;
+
+    size = ((unsigned long long) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    time = ((unsigned long long) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return TRUE;
+}
+
+static void CreateDirectoryPath(const HostString& path)
+{
+    for (size_t i = 3; i <= path.size(); i++)
+    {
+        if (i == path.size() || path[i] == PathSeparator)
+        {
+            CreateDirectory(path.substr(0, i).c_str(), NULL);
+        }
+    }
+}
+
+static void DeleteHostFile(const HostString& path)
+{
+    DeleteFile(path.c_str());
+}
+
+static void DeleteHostDirectory(const HostString& path)
+{
+    RemoveDirectory(path.c_str());
+}
+
+static BOOL RenameHostFile(const HostString& source, const HostString& target)
+{
+    return MoveFileEx(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+static int SeekFile(FILE* file, unsigned long long offset)
+{
+    return _fseeki64(file, (__int64) offset, SEEK_SET);
+}
+#else
+static const std::string& ToHostPath(const std::string& text)
+{
+    return text;
+}
+
+static const HostString& FromHostPath(const HostString& path)
+{
+    return path;
+}
+
+static BOOL PathExists(const HostString& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+static BOOL GetFileStamp(const HostString& path, unsigned long long& size, unsigned long long& time)
+{
+    struct stat info;
+
+    if (stat(path.c_str(), &info) != 0)
+        return FALSE;
+
+    size = (unsigned long long) info.st_size;
+    time = (unsigned long long) info.st_mtime;
+    return TRUE;
+}
+
+static void CreateDirectoryPath(const HostString& path)
+{
+    for (size_t i = 1; i <= path.size(); i++)
+    {
+        if (i == path.size() || path[i] == PathSeparator)
+        {
+            mkdir(path.substr(0, i).c_str(), 0755);
+        }
+    }
+}
+
+static void DeleteHostFile(const HostString& path)
+{
+    unlink(path.c_str());
+}
+
+static void DeleteHostDirectory(const HostString& path)
+{
+    rmdir(path.c_str());
+}
+
+static BOOL RenameHostFile(const HostString& source, const HostString& target)
+{
+    return rename(source.c_str(), target.c_str()) == 0;
+}
+
+static int SeekFile(FILE* file, unsigned long long offset)
+{
+    return fseeko(file, (off_t) offset, SEEK_SET);
+}
+#endif
+
+static unsigned long long ReadLittleEndian(const unsigned char* data, size_t size)
+{
+    unsigned long long result = 0;
+
+    for (size_t i = size; i > 0; i--)
+    {
+        result = (result << 8) | data[i - 1];
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Checks the section names of the ELF binary.
+/// </summary>
+static ElfIndexState GetElfIndexState(const HostString& path)
+{
+    FILE* file = _tfopen(path.c_str(), _T("rb"));
+    if (file == NULL)
+        return ElfNotSupported;
+
+    ElfIndexState result = ElfNotSupported;
+    unsigned char header[64];
+
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) && memcmp(header, "\x7F" "ELF", 4) == 0 && header[5] == 1)
+    {
+        BOOL is64 = header[4] == 2;
+        unsigned long long sectionsOffset = is64 ? ReadLittleEndian(header + 0x28, 8) : ReadLittleEndian(header + 0x20, 4);
+        size_t entrySize = (size_t) ReadLittleEndian(header + (is64 ? 0x3A : 0x2E), 2);
+        size_t count = (size_t) ReadLittleEndian(header + (is64 ? 0x3C : 0x30), 2);
+        size_t namesIndex = (size_t) ReadLittleEndian(header + (is64 ? 0x3E : 0x32), 2);
+        std::vector<unsigned char> sections(entrySize * count);
+
+        if (entrySize >= (size_t) (is64 ? 0x28 : 0x18) && namesIndex < count && !sections.empty()
+            && SeekFile(file, sectionsOffset) == 0 && fread(&sections[0], 1, sections.size(), file) == sections.size())
+        {
+            const unsigned char* namesSection = &sections[namesIndex * entrySize];
+            unsigned long long namesOffset = ReadLittleEndian(namesSection + (is64 ? 0x18 : 0x10), is64 ? 8 : 4);
+            size_t namesSize = (size_t) ReadLittleEndian(namesSection + (is64 ? 0x20 : 0x14), is64 ? 8 : 4);
+            std::vector<char> names(namesSize + 1, '\0');
+
+            if (namesSize > 0 && SeekFile(file, namesOffset) == 0 && fread(&names[0], 1, namesSize, file) == namesSize)
+            {
+                BOOL hasDebugInfo = FALSE;
+                BOOL hasIndex = FALSE;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    size_t nameOffset = (size_t) ReadLittleEndian(&sections[i * entrySize], 4);
+                    if (nameOffset >= namesSize)
+                        continue;
+
+                    const char* name = &names[nameOffset];
+                    hasDebugInfo |= strcmp(name, ".debug_info") == 0;
+                    hasIndex |= strcmp(name, ".gdb_index") == 0 || strcmp(name, ".debug_names") == 0;
+                }
+
+                if (hasDebugInfo)
+                {
+                    result = hasIndex ? ElfIndexed : ElfNeedsIndex;
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+/// <summary>
+/// Parses MI c-string or a plain argument starting at given position and moves the position after it.
+/// </summary>
+static BOOL ParseArgument(const std::string& line, size_t& position, std::string& argument)
+{
+    argument.clear();
+
+    if (position < line.size() && line[position] == '"')
+    {
+        for (position++; position < line.size(); position++)
+        {
+            if (line[position] == '"')
+            {
+                position++;
+                return TRUE;
+            }
+            if (line[position] == '\\' && position + 1 < line.size())
+            {
+                position++;
+            }
+            argument += line[position];
+        }
+
+        return FALSE;
+    }
+
+    while (position < line.size() && line[position] != ' ' && line[position] != '\r' && line[position] != '\n')
+    {
+        argument += line[position++];
+    }
+
+    return !argument.empty();
+}
+
+static std::string QuoteArgument(const std::string& argument)
+{
+    std::string result("\"");
+
+    for (size_t i = 0; i < argument.size(); i++)
+    {
+        if (argument[i] == '"' || argument[i] == '\\')
+        {
+            result += '\\';
+        }
+        result += argument[i];
+    }
+
+    result += '"';
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+SymbolIndexCache::SymbolIndexCache()
+    : m_indexed(0), m_failed(0), m_stopping(FALSE)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+#ifdef _WIN32
+    InitializeCriticalSection(&m_lock);
+    m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_thread = NULL;
+    m_process = NULL;
+#else
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wake, NULL);
+    m_threadStarted = FALSE;
+    m_process = 0;
+#endif
+}
+
+SymbolIndexCache::~SymbolIndexCache()
+{
+    Shutdown();
+#ifdef _WIN32
+    CloseHandle(m_wakeEvent);
+    DeleteCriticalSection(&m_lock);
+#else
+    pthread_cond_destroy(&m_wake);
+    pthread_mutex_destroy(&m_lock);
+#endif
+}
+
+BOOL SymbolIndexCache::Initialize(LPCTSTR lpszGdbPath, LPCTSTR lpszDirectory)
+{
+    if (lpszGdbPath == NULL)
+        return FALSE;
+
+    m_gdbPath = lpszGdbPath;
+
+    if (lpszDirectory != NULL)
+    {
+        m_directory = lpszDirectory;
+    }
+    else
+    {
+#ifdef _WIN32
+        TCHAR path[_MAX_PATH];
+
+        if (GetEnvironmentVariable(_T(SYMBOL_INDEX_ENVIRONMENT_VARIABLE), path, _countof(path)) > 0)
+        {
+            m_directory = path;
+        }
+        else if (GetEnvironmentVariable(_T("LocalAppData"), path, _countof(path)) > 0)
+        {
+            m_directory = path;
+            m_directory += _T("\\BlackBerry\\gdb-index");
+        }
+#else
+        const char* path = getenv(SYMBOL_INDEX_ENVIRONMENT_VARIABLE);
+        const char* home = getenv("HOME");
+
+        if (path != NULL && path[0] != '\0')
+        {
+            m_directory = path;
+        }
+        else
+        {
+            m_directory = home != NULL ? home : "/tmp";
+            m_directory += "/.blackberry-gdb-index";
+        }
+#endif
+    }
+
+    if (m_directory.empty())
+        return FALSE;
+
+    // objcopy of the same toolchain is next to GDB ('ntoarm-gdb' -> 'ntoarm-objcopy'), otherwise take the one from PATH:
+    size_t nameStart = m_gdbPath.find_last_of(_T("\\/"));
+    size_t gdbName = m_gdbPath.rfind(_T("gdb"));
+
+    m_objcopyPath = _T("objcopy");
+    if (gdbName != HostString::npos && (nameStart == HostString::npos || gdbName > nameStart))
+    {
+        HostString objcopy = m_gdbPath;
+
+        objcopy.replace(gdbName, 3, _T("objcopy"));
+        if (PathExists(objcopy))
+        {
+            m_objcopyPath = objcopy;
+        }
+    }
+
+    return TRUE;
+}
+
+/// <summary>
+/// Gets the path of the file, that remembers the content hash of the binary across sessions. It's named after the hash of the binary path.
+/// </summary>
+HostString SymbolIndexCache::GetStampPath(const std::string& source) const
+{
+    unsigned long long hash = FNV_OFFSET_BASIS;
+    TCHAR name[24];
+
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        hash = (hash ^ (unsigned char) source[i]) * FNV_PRIME;
+    }
+
+    _stprintf_s(name, _countof(name), _T("%016llx"), hash);
+    return m_directory + PathSeparator + SYMBOL_INDEX_STAMPS_DIRECTORY + PathSeparator + name;
+}
+
+/// <summary>
+/// Reads the size, modification time and content hash of the binary saved by the previous session.
+/// </summary>
+BOOL SymbolIndexCache::LoadStamp(const HostString& stampPath, const std::string& source, FileStamp& stamp)
+{
+    FILE* file = _tfopen(stampPath.c_str(), _T("rb"));
+    if (file == NULL)
+        return FALSE;
+
+    char line[64];
+    std::string savedSource;
+    char buffer[512];
+    size_t count;
+
+    BOOL result = fgets(line, sizeof(line), file) != NULL && sscanf_s(line, "%llu %llu %llx", &stamp.size, &stamp.time, &stamp.hash) == 3;
+    while (result && (count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        savedSource.append(buffer, count);
+    }
+
+    fclose(file);
+
+    // different paths with the same hash of the name:
+    return result && savedSource == source;
+}
+
+/// <summary>
+/// Saves the size, modification time and content hash of the binary for the next sessions.
+/// </summary>
+void SymbolIndexCache::SaveStamp(const HostString& stampPath, const std::string& source, const FileStamp& stamp)
+{
+    HostString temporary = stampPath + _T(".tmp");
+    FILE* file;
+
+    CreateDirectoryPath(m_directory + PathSeparator + SYMBOL_INDEX_STAMPS_DIRECTORY);
+    file = _tfopen(temporary.c_str(), _T("wb"));
+    if (file == NULL)
+        return;
+
+    BOOL written = fprintf(file, "%llu %llu %016llx\n", stamp.size, stamp.time, stamp.hash) > 0
+                   && fwrite(source.data(), 1, source.size(), file) == source.size();
+
+    if (fclose(file) != 0 || !written || !RenameHostFile(temporary, stampPath))
+    {
+        DeleteHostFile(temporary);
+    }
+}
+
+/// <summary>
+/// Deletes the cache entry made from previous content of the binary, as it can't be used anymore.
+/// </summary>
+void SymbolIndexCache::RemoveEntry(const HostString& source, unsigned long long hash)
+{
+    TCHAR hashText[24];
+    size_t nameStart = source.find_last_of(_T("\\/"));
+
+    _stprintf_s(hashText, _countof(hashText), _T("%016llx"), hash);
+    HostString directory = m_directory + PathSeparator + hashText;
+    HostString target = directory + PathSeparator + (nameStart != HostString::npos ? source.substr(nameStart + 1) : source);
+
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+#else
+    pthread_mutex_lock(&m_lock);
+#endif
+    // the worker might be just creating it:
+    BOOL pending = m_pending.find(directory) != m_pending.end();
+#ifdef _WIN32
+    LeaveCriticalSection(&m_lock);
+#else
+    pthread_mutex_unlock(&m_lock);
+#endif
+
+    if (pending || !PathExists(directory))
+        return;
+
+    // copies still opened by GDB of other sessions can't be deleted on Windows, so they stay till the binary changes again:
+    DeleteHostFile(target);
+    DeleteHostFile(directory + PathSeparator + SYMBOL_INDEX_FAILED_MARKER);
+    DeleteHostDirectory(directory);
+    m_stats.removed++;
+}
+
+/// <summary>
+/// Calculates FNV-1a hash of the whole binary. The result is saved in the cache directory together with the size
+/// and modification time of the binary, so it's calculated again only after the binary changes. It runs on the loop thread,
+/// but it's only done for commands loading symbols, where GDB will spend much more time anyway.
+/// </summary>
+BOOL SymbolIndexCache::GetHash(const HostString& path, unsigned long long& hash)
+{
+    FileStamp stamp;
+
+    if (!GetFileStamp(path, stamp.size, stamp.time))
+        return FALSE;
+
+    std::map<HostString, FileStamp>::const_iterator it = m_hashes.find(path);
+    if (it != m_hashes.end() && it->second.size == stamp.size && it->second.time == stamp.time)
+    {
+        hash = it->second.hash;
+        return TRUE;
+    }
+
+    std::string source = FromHostPath(path);
+    HostString stampPath = GetStampPath(source);
+    FileStamp saved;
+    BOOL hasSaved = LoadStamp(stampPath, source, saved);
+
+    if (hasSaved && saved.size == stamp.size && saved.time == stamp.time)
+    {
+        m_hashes[path] = saved;
+        hash = saved.hash;
+        return TRUE;
+    }
+
+    FILE* file = _tfopen(path.c_str(), _T("rb"));
+    if (file == NULL)
+        return FALSE;
+
+    unsigned long long start = HostGetTimestamp();
+    std::vector<unsigned char> buffer(HASH_BUFFER_SIZE);
+    size_t count;
+
+    stamp.hash = FNV_OFFSET_BASIS;
+    while ((count = fread(&buffer[0], 1, buffer.size(), file)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            stamp.hash = (stamp.hash ^ buffer[i]) * FNV_PRIME;
+        }
+    }
+
+    fclose(file);
+    m_stats.hashTime += HostGetTimestamp() - start;
+
+    // each rebuild of the binary would leave another full copy in the cache:
+    if (hasSaved && saved.hash != stamp.hash)
+    {
+        RemoveEntry(path, saved.hash);
+    }
+
+    SaveStamp(stampPath, source, stamp);
+    m_hashes[path] = stamp;
+    hash = stamp.hash;
+    return TRUE;
+}
+
+BOOL SymbolIndexCache::Rewrite(std::string& command)
+{
+    size_t position = 0;
+
+    while (position < command.size() && command[position] >= '0' && command[position] <= '9')
+    {
+        position++;
+    }
+
+    size_t nameEnd = command.find(' ', position);
+    if (nameEnd == std::string::npos)
+        return FALSE;
+
+    std::string name(command, position, nameEnd - position);
+    if (name != "-file-exec-and-symbols" && name != "-file-symbol-file")
+        return FALSE;
+
+    size_t argumentStart = command.find_first_not_of(' ', nameEnd);
+    size_t argumentEnd = argumentStart;
+    std::string argument;
+
+    if (argumentStart == std::string::npos || !ParseArgument(command, argumentEnd, argument))
+        return FALSE;
+
+    HostString source = ToHostPath(argument);
+    unsigned long long hash;
+
+    if (!GetHash(source, hash))
+        return FALSE;
+
+    TCHAR hashText[24];
+    SymbolIndexJob job;
+    size_t nameStart = source.find_last_of(_T("\\/"));
+
+    _stprintf_s(hashText, _countof(hashText), _T("%016llx"), hash);
+    job.source = source;
+    job.directory = m_directory + PathSeparator + hashText;
+    job.target = job.directory + PathSeparator + (nameStart != HostString::npos ? source.substr(nameStart + 1) : source);
+
+    if (PathExists(job.target))
+    {
+        command.replace(argumentStart, argumentEnd - argumentStart, QuoteArgument(FromHostPath(job.target)));
+        m_stats.hits++;
+        return TRUE;
+    }
+
+    if (PathExists(job.directory + PathSeparator + SYMBOL_INDEX_FAILED_MARKER) || GetElfIndexState(source) != ElfNeedsIndex)
+    {
+        m_stats.skipped++;
+        return FALSE;
+    }
+
+    m_stats.misses++;
+    Enqueue(job);
+    return FALSE;
+}
+
+BOOL SymbolIndexCache::GetArgumentStamp(const std::string& argument, unsigned long long& size, unsigned long long& time)
+{
+    size_t position = 0;
+    std::string path;
+
+    if (!ParseArgument(argument, position, path))
+        return FALSE;
+
+    return GetFileStamp(ToHostPath(path), size, time);
+}
+
+void SymbolIndexCache::Enqueue(const SymbolIndexJob& job)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+#else
+    pthread_mutex_lock(&m_lock);
+#endif
+
+    if (!m_stopping && m_pending.insert(job.directory).second)
+    {
+        m_jobs.push_back(job);
+
+        // the worker is started only, when there is anything to index:
+#ifdef _WIN32
+        if (m_thread == NULL)
+        {
+            m_thread = CreateThread(NULL, 0, WorkerThread, this, 0, NULL);
+        }
+        SetEvent(m_wakeEvent);
+#else
+        if (!m_threadStarted)
+        {
+            m_threadStarted = pthread_create(&m_thread, NULL, WorkerThread, this) == 0;
+        }
+        pthread_cond_signal(&m_wake);
+#endif
+    }
+
+#ifdef _WIN32
+    LeaveCriticalSection(&m_lock);
+#else
+    pthread_mutex_unlock(&m_lock);
+#endif
+}
+
+/// <summary>
+/// Creates the indexed copy of the binary. Runs on the worker thread.
+/// </summary>
+BOOL SymbolIndexCache::Index(const SymbolIndexJob& job)
+{
+    HostString indexFile = job.target + _T(".gdb-index");        // GDB names it after the binary
+    HostString temporary = job.target + _T(".tmp");
+    HostString command;
+
+    CreateDirectoryPath(job.directory);
+
+    command = _T("\"") + m_gdbPath + _T("\" -batch -nx -ex \"save gdb-index ") + job.directory + _T("\" \"") + job.source + _T("\"");
+    BOOL result = RunTool(command) && PathExists(indexFile);
+
+    if (result)
+    {
+        command = _T("\"") + m_objcopyPath + _T("\" --add-section .gdb_index=\"") + indexFile + _T("\" --set-section-flags .gdb_index=readonly \"")
+                + job.source + _T("\" \"") + temporary + _T("\"");
+        result = RunTool(command) && RenameHostFile(temporary, job.target);
+    }
+
+    DeleteHostFile(indexFile);
+    DeleteHostFile(temporary);
+    return result;
+}
+
+/// <summary>
+/// Runs given command line with low priority and no console and waits for it to finish. Returns TRUE, if it succeeded.
+/// </summary>
+BOOL SymbolIndexCache::RunTool(const HostString& commandLine)
+{
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES security = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    HANDLE hNull = CreateFile(_T("NUL"), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &security, OPEN_EXISTING, 0, NULL);
+    STARTUPINFO startupInfo;
+    PROCESS_INFORMATION processInfo;
+    std::vector<TCHAR> command(commandLine.begin(), commandLine.end());
+
+    command.push_back('\0');
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = hNull;
+    startupInfo.hStdOutput = hNull;
+    startupInfo.hStdError = hNull;
+
+    BOOL created = CreateProcess(NULL, &command[0], NULL, NULL, TRUE, CREATE_NO_WINDOW | BELOW_NORMAL_PRIORITY_CLASS, NULL, NULL, &startupInfo, &processInfo);
+    CloseHandle(hNull);
+    if (!created)
+        return FALSE;
+
+    EnterCriticalSection(&m_lock);
+    m_process = processInfo.hProcess;
+    if (m_stopping)
+    {
+        TerminateProcess(processInfo.hProcess, 1);
+    }
+    LeaveCriticalSection(&m_lock);
+
+    DWORD exitCode = 1;
+    WaitForSingleObject(processInfo.hProcess, INFINITE);
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+
+    EnterCriticalSection(&m_lock);
+    m_process = NULL;
+    LeaveCriticalSection(&m_lock);
+
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return exitCode == 0;
+#else
+    pid_t pid = fork();
+    if (pid < 0)
+        return FALSE;
+
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0)
+        {
+            dup2(null, 0);
+            dup2(null, 1);
+            dup2(null, 2);
+        }
+        // own process group, so the whole tree can be killed on shutdown:
+        setpgid(0, 0);
+        setpriority(PRIO_PROCESS, 0, 10);
+        execl("/bin/sh", "sh", "-c", commandLine.c_str(), (char*) NULL);
+        _exit(127);
+    }
+
+    // set also by the parent, so the group exists, even if it's killed before the child gets to run:
+    setpgid(pid, pid);
+
+    pthread_mutex_lock(&m_lock);
+    m_process = pid;
+    if (m_stopping)
+    {
+        kill(-pid, SIGKILL);
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_process = 0;
+    pthread_mutex_unlock(&m_lock);
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+void SymbolIndexCache::RunWorker()
+{
+    for (;;)
+    {
+        SymbolIndexJob job;
+
+#ifdef _WIN32
+        EnterCriticalSection(&m_lock);
+        while (m_jobs.empty() && !m_stopping)
+        {
+            LeaveCriticalSection(&m_lock);
+            WaitForSingleObject(m_wakeEvent, INFINITE);
+            EnterCriticalSection(&m_lock);
+        }
+#else
+        pthread_mutex_lock(&m_lock);
+        while (m_jobs.empty() && !m_stopping)
+        {
+            pthread_cond_wait(&m_wake, &m_lock);
+        }
+#endif
+
+        BOOL stopping = m_stopping;
+        if (!stopping)
+        {
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+#ifdef _WIN32
+        LeaveCriticalSection(&m_lock);
+#else
+        pthread_mutex_unlock(&m_lock);
+#endif
+
+        if (stopping)
+            break;
+
+        unsigned long long start = HostGetTimestamp();
+        BOOL indexed = Index(job);
+        TCHAR message[_MAX_PATH + 64];
+
+        if (indexed)
+        {
+            HostAtomicIncrement(&m_indexed);
+            _stprintf_s(message, _countof(message), _T("SymbolIndex: indexed in %llu ms: %s"), (HostGetTimestamp() - start) / 1000, job.target.c_str());
+            LogPrint(message);
+        }
+        else if (!m_stopping)
+        {
+            // don't try again in the next sessions:
+            FILE* marker = _tfopen((job.directory + PathSeparator + SYMBOL_INDEX_FAILED_MARKER).c_str(), _T("wb"));
+            if (marker != NULL)
+            {
+                fclose(marker);
+            }
+
+            HostAtomicIncrement(&m_failed);
+            _stprintf_s(message, _countof(message), _T("SymbolIndex: indexing failed: %s"), job.source.c_str());
+            LogPrint(message);
+        }
+
+#ifdef _WIN32
+        EnterCriticalSection(&m_lock);
+        m_pending.erase(job.directory);
+        LeaveCriticalSection(&m_lock);
+#else
+        pthread_mutex_lock(&m_lock);
+        m_pending.erase(job.directory);
+        pthread_mutex_unlock(&m_lock);
+#endif
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI SymbolIndexCache::WorkerThread(LPVOID lpParameter)
+{
+    static_cast<SymbolIndexCache*>(lpParameter)->RunWorker();
+    return 0;
+}
+#else
+void* SymbolIndexCache::WorkerThread(void* parameter)
+{
+    static_cast<SymbolIndexCache*>(parameter)->RunWorker();
+    return NULL;
+}
+#endif
+
+void SymbolIndexCache::Shutdown()
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_lock);
+    m_stopping = TRUE;
+    if (m_process != NULL)
+    {
+        TerminateProcess(m_process, 1);
+    }
+    SetEvent(m_wakeEvent);
+    LeaveCriticalSection(&m_lock);
+
+    if (m_thread != NULL)
+    {
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+        m_thread = NULL;
+    }
+#else
+    pthread_mutex_lock(&m_lock);
+    m_stopping = TRUE;
+    if (m_process > 0)
+    {
+        kill(-m_process, SIGKILL);
+    }
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+
+    if (m_threadStarted)
+    {
+        pthread_join(m_thread, NULL);
+        m_threadStarted = FALSE;
+    }
+#endif
+}
+
+void SymbolIndexCache::Format(std::string& output) const
+{
+    char text[256];
+
+    sprintf_s(text, sizeof(text), "symbol-index={hits=\"%llu\",misses=\"%llu\",skipped=\"%llu\",removed=\"%llu\",indexed=\"%d\",failed=\"%d\",hash-time=\"%llu\"}",
+              m_stats.hits, m_stats.misses, m_stats.skipped, m_stats.removed,
+              (int) HostAtomicLoad(const_cast<HostAtomic*>(&m_indexed)), (int) HostAtomicLoad(const_cast<HostAtomic*>(&m_failed)), m_stats.hashTime);
+    output.append(text);
+}
+
+/// <summary>
+/// Prints the statistics to console (and log).
+/// </summary>
+void SymbolIndexCache::Print()
+{
+    std::string text;
+
+    Format(text);
+
+    // the text is plain ASCII:
+    std::basic_string<TCHAR> message(text.begin(), text.end());
+    PrintMessage(_T("%s\r\n"), message.c_str());
+}
@@ -0,0 +1,150 @@
+//* Copyright 2010-2014 Research In Motion Limited.
+//*
+//* Licensed under the Apache License, Version 2.0 (the "License");
+//* you may not use this file except in compliance with the License.
+//* You may obtain a copy of the License at
+//*
+//* http://www.apache.org/licenses/LICENSE-2.0
+//*
+//* Unless required by applicable law or agreed to in writing, software
+//* distributed under the License is distributed on an "AS IS" BASIS,
+//* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//* See the License for the specific language governing permissions and
+//* limitations under the License.
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "HostAtomic.h"
+#include "HostLoop.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#ifndef _WIN32
+#   include <pthread.h>
+#   include <sys/types.h>
+#endif
+
+
+#define SYMBOL_INDEX_ENVIRONMENT_VARIABLE   "BLACKBERRY_GDBHOST_INDEX_CACHE"
+#define SYMBOL_INDEX_FAILED_MARKER          _T("failed")
+#define SYMBOL_INDEX_STAMPS_DIRECTORY       _T("stamps")
+
+
+/// <summary>
+/// Statistics of the symbol index cache.
+/// </summary>
+struct SymbolIndexStats
+{
+    unsigned long long hits;        // commands redirected to already indexed copies
+    unsigned long long misses;      // binaries queued for indexing
+    unsigned long long skipped;     // binaries, which already have an index, are not ELF or failed before
+    unsigned long long removed;     // entries made from previous content of rebuilt binaries
+    unsigned long long hashTime;    // us spent hashing the binaries
+};
+
+/// <summary>
+/// Copy of a binary, that should be extended with '.gdb_index' section.
+/// </summary>
+struct SymbolIndexJob
+{
+    HostString source;
+    HostString directory;           // cache entry directory named after the content hash
+    HostString target;              // indexed copy inside the directory
+};
+
+/// <summary>
+/// On-disk cache of binaries extended with the '.gdb_index' section, so GDB doesn't have to read all the DWARF
+/// data on startup. Entries are keyed by the content hash of the original binary. Commands loading symbols
+/// (-file-exec-and-symbols, -file-symbol-file) are redirected to the indexed copy, if it exists. Otherwise the
+/// original is used and the copy is created in background by the same GDB ('save gdb-index') and its objcopy,
+/// so the next session benefits. Shared libraries loaded by GDB itself from the search path are not covered.
+/// Content hashes are remembered in the 'stamps' subdirectory by the path, size and modification time of the binary,
+/// so it's read again only after it changes, and the entry of its previous content is then deleted.
+/// </summary>
+class SymbolIndexCache
+{
+private:
+    struct FileStamp
+    {
+        unsigned long long size;
+        unsigned long long time;
+        unsigned long long hash;
+    };
+
+    HostString m_directory;
+    HostString m_gdbPath;
+    HostString m_objcopyPath;
+    std::map<HostString, FileStamp> m_hashes;   // binaries hashed during this session
+    SymbolIndexStats m_stats;
+    HostAtomic m_indexed;
+    HostAtomic m_failed;
+
+    // shared with the worker thread:
+    std::deque<SymbolIndexJob> m_jobs;
+    std::set<HostString> m_pending;             // directories of the queued jobs
+    BOOL m_stopping;
+#ifdef _WIN32
+    CRITICAL_SECTION m_lock;
+    HANDLE m_wakeEvent;
+    HANDLE m_thread;
+    HANDLE m_process;                           // tool currently run by the worker
+#else
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_wake;
+    pthread_t m_thread;
+    BOOL m_threadStarted;
+    pid_t m_process;
+#endif
+
+    HostString GetStampPath(const std::string& source) const;
+    BOOL LoadStamp(const HostString& stampPath, const std::string& source, FileStamp& stamp);
+    void SaveStamp(const HostString& stampPath, const std::string& source, const FileStamp& stamp);
+    void RemoveEntry(const HostString& source, unsigned long long hash);
+    BOOL GetHash(const HostString& path, unsigned long long& hash);
+    void Enqueue(const SymbolIndexJob& job);
+    BOOL Index(const SymbolIndexJob& job);
+    BOOL RunTool(const HostString& commandLine);
+    void RunWorker();
+#ifdef _WIN32
+    static DWORD WINAPI WorkerThread(LPVOID lpParameter);
+#else
+    static void* WorkerThread(void* parameter);
+#endif
+
+public:
+    SymbolIndexCache();
+    ~SymbolIndexCache();
+
+    /// <summary>
+    /// Sets up the cache for binaries loaded by given GDB. Directory can be NULL to use the default one.
+    /// </summary>
+    BOOL Initialize(LPCTSTR lpszGdbPath, LPCTSTR lpszDirectory);
+
+    /// <summary>
+    /// Replaces the binary inside the symbol loading command (whole line) by its indexed copy, if there is one.
+    /// Returns TRUE, if the command was changed.
+    /// </summary>
+    BOOL Rewrite(std::string& command);
+
+    /// <summary>
+    /// Gets the size and modification time of the binary passed as MI argument (c-string or plain path).
+    /// </summary>
+    static BOOL GetArgumentStamp(const std::string& argument, unsigned long long& size, unsigned long long& time);
+
+    /// <summary>
+    /// Stops the worker thread, killing the tool it's running, so the host doesn't wait for it.
+    /// </summary>
+    void Shutdown();
+
+    const SymbolIndexStats& GetStats() const { return m_stats; }
+
+    /// <summary>
+    /// Appends MI-like tuple with the statistics: symbol-index={hits="",...}.
+    /// </summary>
+    void Format(std::string& output) const;
+    void Print();
+};
@@ -1,8 +1,28 @@
 #include "stdafx.h"
+#include "Benchmark.h"
+#include "CoreServer.h"
+#include "FakeGdb.h"
 #include "GDBWrapper.h"
+#include "HostLoop.h"
+#include "InterruptStats.h"
+#include "LaunchProfile.h"
+#include "MetricsEndpoint.h"
+#include "MiPipeline.h"
+#include "MiRecorder.h"
+#include "MiRelay.h"
+#include "MiResponseCache.h"
+#include "MiVariables.h"
+#include "RspProxy.h"
+#include "SessionHost.h"
+#include "ShmTransport.h"
+#include "StartupProfiler.h"
+#include "SymbolIndex.h"
 #include "Log.h"
 
 #include <stdlib.h>
+#ifndef _WIN32
+#   include <sys/stat.h>
+#endif
 
 
 /// <summary>
@@ -56,11 +76,250 @@ static LPCTSTR ConcatGdbCommand(int argc, _TCHAR* argv[], LPCTSTR exePath, int a
     return result;
 }
 
+/// <summary>
+/// Prefixes the arguments with the command line of the launch profile. The arguments are released.
+/// </summary>
+static LPCTSTR PrependProfile(const LaunchProfile& profile, LPCTSTR arguments)
+{
+    HostString command = profile.GetCommandLine();
+
+    if (arguments != NULL)
+    {
+        command += arguments;
+        delete[] arguments;
+    }
+
+    TCHAR* result = new TCHAR[command.size() + 1];
+    _tcscpy_s(result, command.size() + 1, command.c_str());
+    return result;
+}
+
 static BOOL FileExists(LPCTSTR lpszPath)
 {
+#ifdef _WIN32
   DWORD attributes = GetFileAttributes(lpszPath);
 
   return (attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY));
+#else
+  struct stat info;
+
+  return stat(lpszPath, &info) == 0 && S_ISREG(info.st_mode);
+#endif
+}
+
+/// <summary>
+/// Handler of the main loop, that reacts on Ctrl-C and termination requests and GDB exit.
+/// The requests come either as named events or as in-band messages of the shared memory transport.
+/// </summary>
+class HostController : public HostWaitHandler, public ShmTransportListener
+{
+private:
+    HostEvent* m_ctrlC;
+    HostEvent* m_terminate;
+    GDBWrapper* m_gdb;
+    InterruptTracker* m_interruptTracker;
+    MiCommandPipeline* m_pipeline;
+    MiRecorder* m_recorder;
+    StartupProfiler* m_startup;
+
+public:
+    HostController(HostEvent* ctrlC, HostEvent* terminate, GDBWrapper* gdb, InterruptTracker* interruptTracker, MiCommandPipeline* pipeline, MiRecorder* recorder, StartupProfiler* startup)
+        : m_ctrlC(ctrlC), m_terminate(terminate), m_gdb(gdb), m_interruptTracker(interruptTracker), m_pipeline(pipeline), m_recorder(recorder), m_startup(startup)
+    {
+    }
+
+    virtual BOOL OnSignaled(HostWaitable waitable)
+    {
+        if (waitable == m_ctrlC->GetWaitable())
+        {
+            m_interruptTracker->OnRequested();
+            LogPrint(_T("WAIT_OBJECT_0 (Ctrl-C)"));
+            m_ctrlC->Consume();
+            m_interruptTracker->OnDelivered(m_gdb->Interrupt());
+            return TRUE;
+        }
+
+        if (waitable == m_terminate->GetWaitable())
+        {
+            LogPrint(_T("WAIT_OBJECT_0 + 1 (Terminate)"));
+            m_terminate->Consume();
+            return FALSE;
+        }
+
+        if (waitable == m_gdb->GetProcessHandle())
+        {
+            if (m_gdb->IsRunning())
+                return TRUE;
+
+            LogPrint(_T("WAIT_OBJECT_0 + 2 (GDB Terminated)"));
+            PrintMessage(_T("GDB process terminated!"));
+            return FALSE;
+        }
+
+        return FALSE;
+    }
+
+    virtual BOOL OnMessage(ShmMessageType type, const char* data, size_t length)
+    {
+        switch (type)
+        {
+            case ShmMessageCommand:
+                m_recorder->RecordCommands(data, length);
+                m_startup->RecordCommands(data, length);
+                if (m_pipeline != NULL)
+                {
+                    m_pipeline->Submit(data, length);
+                }
+                else
+                {
+                    m_gdb->WriteInput(data, length);
+                }
+                return TRUE;
+            case ShmMessageInterrupt:
+                m_interruptTracker->OnRequested();
+                LogPrint(_T("Shared memory: Ctrl-C"));
+                m_interruptTracker->OnDelivered(m_gdb->Interrupt());
+                return TRUE;
+            case ShmMessageTerminate:
+                LogPrint(_T("Shared memory: Terminate"));
+                return FALSE;
+            default:
+                return TRUE;
+        }
+    }
+};
+
+/// <summary>
+/// Finds the core file among GDB arguments ('-c <core>', '-core <core>', '--core <core>' or '--core=<core>')
+/// and moves all the other arguments into the output list. Returns NULL, if there is no core file.
+/// </summary>
+static LPCTSTR ExtractCoreArgument(int argc, _TCHAR* argv[], int argsFrom, std::vector<_TCHAR*>& otherArgs)
+{
+    LPCTSTR result = NULL;
+
+    for (int i = argsFrom; i < argc; i++)
+    {
+        if (result == NULL)
+        {
+            if ((_tcscmp(argv[i], _T("-c")) == 0 || _tcscmp(argv[i], _T("-core")) == 0 || _tcscmp(argv[i], _T("--core")) == 0) && i + 1 < argc)
+            {
+                result = argv[++i];
+                continue;
+            }
+            if (_tcsncmp(argv[i], _T("--core="), 7) == 0)
+            {
+                result = argv[i] + 7;
+                continue;
+            }
+            if (_tcsncmp(argv[i], _T("-core="), 6) == 0)
+            {
+                result = argv[i] + 6;
+                continue;
+            }
+        }
+
+        otherArgs.push_back(argv[i]);
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Parses optional number following the host option at given index, moving the index to its last digit.
+/// </summary>
+static DWORD ParseNumber(LPCTSTR hostOptions, int& i)
+{
+    DWORD result = 0;
+
+    while (hostOptions[i + 1] >= '0' && hostOptions[i + 1] <= '9')
+    {
+        result = result * 10 + (hostOptions[++i] - '0');
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Parses the 'l[<KB>]' host option and turns the logging on.
+/// </summary>
+static void EnableLogging(LPCTSTR hostOptions, int& i)
+{
+    LogEnable(ParseNumber(hostOptions, i) * 1024);
+}
+
+/// <summary>
+/// Parses the 'o[<KB>]' host option and gets the size of target output chunks in bytes.
+/// </summary>
+static size_t ParseStreamChunk(LPCTSTR hostOptions, int& i)
+{
+    DWORD size = ParseNumber(hostOptions, i);
+    return (size > 0 ? size : RELAY_STREAM_DEFAULT_CHUNK) * 1024;
+}
+
+/// <summary>
+/// Runs the multi-session host, that manages many GDB instances controlled over the standard input.
+/// </summary>
+static int RunMultiSessionHost(LPCTSTR hostOptions)
+{
+    DWORD relayLatency = RELAY_DEFAULT_LATENCY;
+    BOOL relayFramed = FALSE;
+    size_t streamChunk = 0;
+    DWORD poolIdleTimeout = POOL_DEFAULT_IDLE_TIMEOUT;
+    DWORD poolMemoryLimit = POOL_DEFAULT_MEMORY_LIMIT;
+    DWORD statsInterval = 0;
+
+    // standard output carries only the multiplexed channels, so any diagnostics go to logs:
+    DisableConsolePrinting();
+
+    if (hostOptions != NULL && hostOptions[0] == '-')
+    {
+        int optionsLength = _tcslen(hostOptions);
+        for (int i = 1; i < optionsLength; i++)
+        {
+            switch(hostOptions[i])
+            {
+            case 'r':
+                if (hostOptions[i + 1] >= '0' && hostOptions[i + 1] <= '9')
+                {
+                    relayLatency = 0;
+                    while (hostOptions[i + 1] >= '0' && hostOptions[i + 1] <= '9')
+                    {
+                        relayLatency = relayLatency * 10 + (hostOptions[++i] - '0');
+                    }
+                }
+                break;
+            case 'f':
+                relayFramed = TRUE;
+                break;
+            case 'l':
+                EnableLogging(hostOptions, i);
+                break;
+            case 'i':
+                poolIdleTimeout = ParseNumber(hostOptions, i);
+                break;
+            case 'h':
+                statsInterval = ParseNumber(hostOptions, i);
+                break;
+            case 'm':
+                poolMemoryLimit = ParseNumber(hostOptions, i);
+                break;
+            case 'o':
+                streamChunk = ParseStreamChunk(hostOptions, i);
+                break;
+            }
+        }
+    }
+
+    HostLoop loop;
+    SessionHost host(&loop, relayLatency, relayFramed, streamChunk, poolIdleTimeout, poolMemoryLimit, statsInterval);
+
+    loop.AddReader(HostGetStdPipe(HOST_STDIN), &host);
+    loop.AddTimer(&host);
+    loop.Run();
+
+    loop.RemoveReader(HostGetStdPipe(HOST_STDIN));
+    host.TerminateAll();
+    return 0;
 }
 
 /// <summary> 
@@ -74,11 +333,73 @@ static BOOL FileExists(LPCTSTR lpszPath)
 /// <returns> 0 </returns>
 int _tmain(int argc, _TCHAR* argv[])
 {
+    StartupProfiler startup;
+
+#ifdef _WIN32
     SetConsoleTitle(_T("BlackBerry GDB Host Application"));
+#endif
 
     LogInitialize();
     LogPrint(_T("Starting"));
 
+    // tool modes:
+    if (argc >= 3 && _tcscmp(argv[1], _T("--bench-mi")) == 0)
+    {
+        return RunParserBenchmark(argv[2], argc >= 4 ? _ttoi(argv[3]) : 10);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-log")) == 0)
+    {
+        return RunLogBenchmark(argc >= 3 ? _ttoi(argv[2]) : 1000000);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-session")) == 0)
+    {
+        return RunSessionBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : 1, argc >= 5 ? argv[4] : NULL);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-stream")) == 0)
+    {
+        return RunStreamBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : 0, argc >= 5 ? _ttoi(argv[4]) : -1);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-shm")) == 0)
+    {
+        return RunShmBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : 0);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-rsp")) == 0)
+    {
+        return RunRspBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : -1, argc >= 5 ? _ttoi(argv[4]) : 0);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-core")) == 0)
+    {
+        return RunCoreBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : 0);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--bench-profile")) == 0)
+    {
+        return RunProfileBenchmark(argc >= 3 ? _ttoi(argv[2]) : 0, argc >= 4 ? _ttoi(argv[3]) : 0);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--fake-core")) == 0)
+    {
+        return RunFakeCore(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--core-server")) == 0)
+    {
+        return RunCoreServer(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--fake-gdb")) == 0)
+    {
+        return RunFakeGdb(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--fake-gdbserver")) == 0)
+    {
+        return RunFakeGdbServer(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--rsp-proxy")) == 0)
+    {
+        return RunRspProxy(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && _tcscmp(argv[1], _T("--multi")) == 0)
+    {
+        return RunMultiSessionHost(argc >= 3 ? argv[2] : NULL);
+    }
+
     if (argc < 4)
     {
         PrintMessage(_T("Copyright (C) 2010-2014 Research in Motion Limited\r\n"));
@@ -90,22 +411,112 @@ int _tmain(int argc, _TCHAR* argv[])
         PrintMessage(_T("  <termination-event-name> - name of the global event, firing it will cause this process to finish\r\n"));
         PrintMessage(_T("  <path-to-GDB.exe>        - path to GDB executable and its arguments\r\n"));
         PrintMessage(_T("  <gdb-arguments>          - additional arguments passed directly to GDB\r\n"));
+        PrintMessage(_T("  @<launch-profile>        - file used instead of <path-to-GDB.exe>, with lines: 'gdb <path>', 'arg <argument>', 'env <name>=<value>',\r\n"));
+        PrintMessage(_T("                             'init <command>' and 'symbols <directory>'; resolved paths and init script are cached by the hash\r\n"));
+        PrintMessage(_T("                             of the profile in ") _T(PROFILE_ENVIRONMENT_VARIABLE) _T(" directory, so identical launches skip probing them\r\n"));
         PrintMessage(_T("  (host-options)           - single parameter starting with '-', which defines custom behavior of the host process itself\r\n"));
+#ifndef _WIN32
+        PrintMessage(_T("On Linux event names are paths to FIFOs (relative ones are placed in $TMPDIR) or numbers of inherited eventfd descriptors.\r\n"));
+#endif
         PrintMessage(_T("Host options:\r\n"));
         PrintMessage(_T("  s                        - [silent] - disable all custom console logs\r\n"));
         PrintMessage(_T("  c                        - skip checking GDB executable existance, before executing\r\n"));
+        PrintMessage(_T("  r[<ms>]                  - [relay] - host owns GDB std streams and forwards whole MI replies to console in large writes,\r\n"));
+        PrintMessage(_T("                             waiting for the '(gdb)' prompt at most <ms> milliseconds (default: %d)\r\n"), RELAY_DEFAULT_LATENCY);
+        PrintMessage(_T("  f                        - [framed] - in relay mode send each MI record as a binary frame with already parsed type and token\r\n"));
+        PrintMessage(_T("  l[<KB>]                  - [log] - enables logging into a file rotated after <KB> kilobytes (default: %d);\r\n"), LOG_DEFAULT_MAX_FILE_SIZE / 1024);
+        PrintMessage(_T("                             it can be also enabled by setting ") _T(LOG_ENVIRONMENT_VARIABLE) _T(" environment variable to the size or 1\r\n"));
+        PrintMessage(_T("  t                        - [transport] - exchange MI data and Ctrl-C/terminate requests with the IDE over shared memory rings\r\n"));
+        PrintMessage(_T("                             named after the Ctrl-C event ('<name>-shm' with '<name>-shm-host' and '<name>-shm-ide' doorbells); implies relay\r\n"));
+        PrintMessage(_T("  h<s>                     - [histograms] - dumps interrupt latency histograms into the log every <s> seconds;\r\n"));
+        PrintMessage(_T("                             '*stopped' records are only visible to the host in relay mode\r\n"));
+        PrintMessage(_T("  p[<count>]               - [pipeline] - forward up to <count> commands (default: %d) without waiting for their results, matched by token;\r\n"), PIPELINE_DEFAULT_WINDOW);
+        PrintMessage(_T("                             -exec-*, -target-*, -gdb-exit and CLI commands are always sent alone;\r\n"));
+        PrintMessage(_T("                             only -exec-interrupt bypasses the commands held by the window or a barrier; implies relay\r\n"));
+        PrintMessage(_T("  q                        - [query cache] - answer repeated idempotent queries without asking GDB, till the target runs,\r\n"));
+        PrintMessage(_T("                             stops or anything else changes; commands are listed in ") _T(CACHE_ENVIRONMENT_VARIABLE) _T(" variable\r\n"));
+        PrintMessage(_T("                             (comma separated, default: -data-list-register-names,-file-list-exec-source-files,-break-list,-thread-info);\r\n"));
+        PrintMessage(_T("                             implies pipeline\r\n"));
+        PrintMessage(_T("  v                        - [variables] - refresh all variable objects once per stop and answer each '-var-update' of the IDE\r\n"));
+        PrintMessage(_T("                             only with the changes it hasn't seen yet; implies pipeline\r\n"));
+        PrintMessage(_T("  o[<KB>]                  - [output] - coalesce target output ('@' records) of the debuggee into chunks of up to <KB> kilobytes\r\n"));
+        PrintMessage(_T("                             (default: %d) sent at most every %d ms, so results don't wait behind it; the excess over %d chunks\r\n"),
+                     RELAY_STREAM_DEFAULT_CHUNK, RELAY_STREAM_INTERVAL, RELAY_STREAM_BACKLOG);
+        PrintMessage(_T("                             is dropped and replaced with a summary; implies relay\r\n"));
+        PrintMessage(_T("  u                        - [startup] - print how long each phase of the startup took (host, GDB till the first prompt,\r\n"));
+        PrintMessage(_T("                             '-target-select' and '-file-exec-and-symbols'); the breakdown is also appended as CSV row\r\n"));
+        PrintMessage(_T("                             into a file, whose path is set in ") _T(STARTUP_CSV_ENVIRONMENT_VARIABLE) _T(" variable\r\n"));
+        PrintMessage(_T("  e[<port>]                - [endpoint] - serve live metrics (stream bytes, MI records per second, commands in flight, interrupt latency,\r\n"));
+        PrintMessage(_T("                             GDB memory and CPU, queue depths) in Prometheus text format over HTTP at http://127.0.0.1:<port>/metrics;\r\n"));
+        PrintMessage(_T("                             any free port is picked (and printed), when not specified\r\n"));
+        PrintMessage(_T("  x                        - [index] - load symbols from copies of binaries with pre-built '.gdb_index', cached by content hash\r\n"));
+        PrintMessage(_T("                             in ") _T(SYMBOL_INDEX_ENVIRONMENT_VARIABLE) _T(" directory; missing ones are built in background for the next session;\r\n"));
+        PrintMessage(_T("                             implies pipeline\r\n"));
+        PrintMessage(_T("  d                        - [dump] - post-mortem debugging; the core file given to GDB ('-c <core>', '--core=<core>') is indexed\r\n"));
+        PrintMessage(_T("                             by the host and served over 'target remote', so GDB reads only the memory it needs; the backtrace\r\n"));
+        PrintMessage(_T("                             of the crashing thread is printed right away, other threads are indexed in background\r\n"));
+        PrintMessage(_T("Tools:\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-mi <transcript> (<iterations>) - measures MI parser throughput over recorded GDB output\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-log (<records>) - measures cost of logging a single record\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-session (<commands>) (<in-flight>) (<host-options>) - measures latency, throughput and memory\r\n"));
+        PrintMessage(_T("                             of the host in relay mode (default options: r) over the synthesized fake GDB\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-stream (<commands>) (<records>) (<cost-us>) - compares latency of commands, while the debuggee floods\r\n"));
+        PrintMessage(_T("                             the output with <records> target stream records per command, each taking the IDE <cost-us> to show,\r\n"));
+        PrintMessage(_T("                             with and without throttling\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-shm (<commands>) (<in-flight>) - compares latency and throughput of commands sent over the console\r\n"));
+        PrintMessage(_T("                             pipes and over the shared memory transport, driving the host as the IDE side of the rings\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --fake-gdb replay <recording> (<speed-percent>) - GDB stand-in replaying recorded session\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --fake-gdb synth <threads> <frames> <variables> (<delay-us>) (<records>) - GDB stand-in with synthesized replies,\r\n"));
+        PrintMessage(_T("                             preceded by <records> lines of target output each\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --fake-gdbserver <port> (<delay-us>) (<binary: 0|1>) - gdbserver stand-in delaying each reply\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-rsp (<steps>) (<delay-us>) (<block-size>) - compares stepping over slow link with and without the RSP proxy\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --fake-core <path> <threads> (<megabytes>) (<format: qnx|linux>) - writes synthetic core file of ARM QNX\r\n"));
+        PrintMessage(_T("                             or x86-64 Linux process with given number of threads and size of dumped memory\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-core (<threads>) (<megabytes>) - compares time to the first backtrace of the crashing thread, when\r\n"));
+        PrintMessage(_T("                             the synthetic core is read whole and when it's indexed over a mapping\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --bench-profile (<launches>) (<paths>) - compares time of loading launch profile with <paths> symbol\r\n"));
+        PrintMessage(_T("                             directories, when it's resolved each time and when it's taken from the cache\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --core-server <core> (<port>) - serves the core file to single 'target remote :<port>' connection of GDB\r\n"));
+        PrintMessage(_T("Remote serial protocol proxy:\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --rsp-proxy <listen-port> <target-host>:<target-port> (<block-size>) - serves single 'target remote :<listen-port>'\r\n"));
+        PrintMessage(_T("                             connection of GDB, reads memory of the target in aligned blocks (default: %d bytes) cached till it resumes\r\n"), RSP_DEFAULT_BLOCK_SIZE);
+        PrintMessage(_T("Recording:\r\n"));
+        PrintMessage(_T("  In relay mode both directions of the session are recorded into a file, whose path is set in ") _T(RECORDER_ENVIRONMENT_VARIABLE) _T(" variable\r\n"));
+        PrintMessage(_T("Multi-session mode:\r\n"));
+        PrintMessage(_T("  BlackBerry.GDBHost.exe --multi (host-options) - runs many GDB instances controlled by commands read from standard input:\r\n"));
+        PrintMessage(_T("    start <id> <ctrl-c-event-name|-> <termination-event-name|-> <path-to-GDB.exe> (<gdb-arguments>)*\r\n"));
+        PrintMessage(_T("    pool <size> <path-to-GDB.exe> (<gdb-arguments>)* - keeps <size> pre-started GDB instances for sessions with the same command\r\n"));
+        PrintMessage(_T("    send <id> <command>, interrupt <id>, terminate <id>, list, stats, quit\r\n"));
+        PrintMessage(_T("    recycle <id> - resets GDB (detaches, deletes breakpoints and variable objects, restores changed settings) and keeps it with its symbols for the next session\r\n"));
+        PrintMessage(_T("  Multi-session host options: r<ms>, f, l<KB>, h<s>, o<KB> (as above), i<s> - idle timeout of the GDB pool (default: %d), m<MB> - memory limit of the GDB pool (default: %d)\r\n"),
+                     POOL_DEFAULT_IDLE_TIMEOUT, POOL_DEFAULT_MEMORY_LIMIT);
+        PrintMessage(_T("  Each output write is prefixed with '#<id> <length>' line; id 0 carries replies to the commands.\r\n"));
         PrintMessage(_T("\r\n\r\n"));
         return 0;
     }
 
-    HANDLE handleCtrlC;
-    HANDLE handleTerminate;
+    HostEvent eventCtrlC;
+    HostEvent eventTerminate;
     LPCTSTR hostOptions = argv[3];          // it's not a mistake, the hostOptions and gdbExecutablePath should point to the same 'opitional' parameter
     LPCTSTR gdbExecutablePath = argv[3];
     LPCTSTR eventNameCtrlC = argv[1];
     LPCTSTR eventNameTerminate = argv[2];
     int gdbArgsStartFrom = 4;
     BOOL checkGdbExistence = TRUE;
+    BOOL relayStreams = FALSE;
+    BOOL relayFramed = FALSE;
+    BOOL sharedMemory = FALSE;
+    DWORD relayLatency = RELAY_DEFAULT_LATENCY;
+    DWORD statsInterval = 0;
+    DWORD pipelineWindow = 0;
+    BOOL cacheReplies = FALSE;
+    BOOL indexSymbols = FALSE;
+    BOOL trackVariables = FALSE;
+    size_t streamChunk = 0;
+    BOOL printStartup = FALSE;
+    BOOL serveMetrics = FALSE;
+    DWORD metricsPort = 0;
+    BOOL postMortem = FALSE;
 
     // check, if we passed some optional arguments for the host...
     if (hostOptions[0] == '-')
@@ -125,40 +536,173 @@ int _tmain(int argc, _TCHAR* argv[])
             case 'c':
                 checkGdbExistence = FALSE;
                 break;
+            case 'r':
+                relayStreams = TRUE;
+                if (hostOptions[i + 1] >= '0' && hostOptions[i + 1] <= '9')
+                {
+                    relayLatency = 0;
+                    while (hostOptions[i + 1] >= '0' && hostOptions[i + 1] <= '9')
+                    {
+                        relayLatency = relayLatency * 10 + (hostOptions[++i] - '0');
+                    }
+                }
+                break;
+            case 'f':
+                relayFramed = TRUE;
+                break;
+            case 'l':
+                EnableLogging(hostOptions, i);
+                break;
+            case 'h':
+                statsInterval = ParseNumber(hostOptions, i);
+                break;
+            case 't':
+                sharedMemory = TRUE;
+                relayStreams = TRUE;
+                break;
+            case 'p':
+                pipelineWindow = ParseNumber(hostOptions, i);
+                if (pipelineWindow == 0)
+                {
+                    pipelineWindow = PIPELINE_DEFAULT_WINDOW;
+                }
+                relayStreams = TRUE;
+                break;
+            case 'q':
+                cacheReplies = TRUE;
+                relayStreams = TRUE;
+                break;
+            case 'x':
+                indexSymbols = TRUE;
+                relayStreams = TRUE;
+                break;
+            case 'v':
+                trackVariables = TRUE;
+                relayStreams = TRUE;
+                break;
+            case 'o':
+                streamChunk = ParseStreamChunk(hostOptions, i);
+                relayStreams = TRUE;
+                break;
+            case 'u':
+                printStartup = TRUE;
+                break;
+            case 'e':
+                serveMetrics = TRUE;
+                metricsPort = ParseNumber(hostOptions, i);
+                break;
+            case 'd':
+                postMortem = TRUE;
+                break;
             }
         }
+
+        if ((cacheReplies || indexSymbols || trackVariables) && pipelineWindow == 0)
+        {
+            pipelineWindow = PIPELINE_DEFAULT_WINDOW;
+        }
     }
 
-    handleCtrlC     = OpenEventW(EVENT_ALL_ACCESS, TRUE, eventNameCtrlC); // Ctrl-C signal
-    handleTerminate = OpenEventW(EVENT_ALL_ACCESS, TRUE, eventNameTerminate); // Signal to terminate the wrapper process
+    const char* startupCsvPath = getenv(STARTUP_CSV_ENVIRONMENT_VARIABLE);
+    BOOL profileStartup = printStartup || (startupCsvPath != NULL && startupCsvPath[0] != '\0');
+
+    startup.Mark(StartupArguments);
 
     // If opening failed, create by itself events with the same names:
-    if (handleCtrlC == NULL)
+    if (!eventCtrlC.Open(eventNameCtrlC)) // Ctrl-C signal
     {
         PrintMessage(_T("Error: Unable to open Ctrl+C event (%s), creating new one\r\n"), eventNameCtrlC);
-        handleCtrlC = CreateEvent(NULL, FALSE, FALSE, eventNameCtrlC);
+        eventCtrlC.Create(eventNameCtrlC);
     }
-    if (handleTerminate == NULL)
+    if (!eventTerminate.Open(eventNameTerminate)) // Signal to terminate the wrapper process
     {
         PrintMessage(_T("Error: Unable to open termination event (%s), creating new one\r\n"), eventNameTerminate);
-        handleTerminate = CreateEvent(NULL, FALSE, FALSE, eventNameTerminate);
+        eventTerminate.Create(eventNameTerminate);
     }
+    startup.Mark(StartupEvents);
 
     // Print status
     PrintMessage(_T("STARTUP INFO:\r\n"));
     PrintMessage(_T("  Args: %s %s %s %s\r\n"), argv[0], argv[1], argv[2], argv[3], argc >= 5 ? argv[4] : _T(""), argc >= 6 ? argv[5] : _T(""));
-    PrintMessage(_T("  Ctrl-C handler: name: \"%s\", handle: 0x%p\r\n"), eventNameCtrlC, handleCtrlC);
-    PrintMessage(_T("  Terminate handler: name: \"%s\", handle: 0x%p\r\n"), eventNameTerminate, handleTerminate);
+    PrintMessage(_T("  Ctrl-C handler: name: \"%s\", handle: ") WAITABLE_FORMAT _T("\r\n"), eventNameCtrlC, eventCtrlC.GetWaitable());
+    PrintMessage(_T("  Terminate handler: name: \"%s\", handle: ") WAITABLE_FORMAT _T("\r\n"), eventNameTerminate, eventTerminate.GetWaitable());
+
+    LaunchProfile profile;
+    BOOL useProfile = gdbExecutablePath != NULL && gdbExecutablePath[0] == PROFILE_PREFIX;
+
+    if (useProfile)
+    {
+        // paths of the profile are probed only, when it's not found in the cache:
+        if (!profile.Load(gdbExecutablePath + 1, NULL))
+        {
+            PrintMessage(_T("Error: Unable to load launch profile (%s)\r\n"), gdbExecutablePath + 1);
+            return 1;
+        }
+
+        const LaunchProfileStats& profileStats = profile.GetStats();
+        PrintMessage(_T("  Profile: %s (%s in %llu us, %u paths probed, %u missing symbol directories skipped)\r\n"), gdbExecutablePath + 1,
+                     profileStats.cached ? _T("cached") : _T("resolved"), profileStats.loadTime, profileStats.probes, profileStats.skipped);
 
-    if (gdbExecutablePath == NULL || gdbExecutablePath[0] == '\0' || (checkGdbExistence && !FileExists(gdbExecutablePath)))
+        profile.ApplyEnvironment();
+        gdbExecutablePath = profile.GetGdbPath();
+    }
+    else if (gdbExecutablePath == NULL || gdbExecutablePath[0] == '\0' || (checkGdbExistence && !FileExists(gdbExecutablePath)))
     {
         PrintMessage(_T("Error: Unable to find GDB executable (%s)\r\n"), gdbExecutablePath != NULL ? gdbExecutablePath : _T("-missing path-"));
         return 1;
     }
+    startup.Mark(StartupGdbCheck);
+
+    // In post-mortem mode the core file is served to GDB as a remote target, so it doesn't have to load it whole:
+    CoreIndex coreIndex;
+    CoreServer coreServer(&coreIndex);
+    std::vector<_TCHAR*> gdbArgs;
+    static TCHAR exArgument[] = _T("-ex");
+    static TCHAR trustArgument[] = _T("set trust-readonly-sections on");
+    TCHAR targetArgument[64];
+
+    if (postMortem)
+    {
+        LPCTSTR corePath = ExtractCoreArgument(argc, argv, gdbArgsStartFrom, gdbArgs);
+
+        if (corePath == NULL || !coreIndex.Open(corePath))
+        {
+            PrintMessage(_T("Error: Unable to open core file (%s), loading it by GDB\r\n"), corePath != NULL ? corePath : _T("-missing path-"));
+            coreIndex.Close();
+            postMortem = FALSE;
+        }
+        else if (!coreServer.Listen(0) || !coreServer.Start())
+        {
+            PrintMessage(_T("Error: Unable to serve core file (%s), loading it by GDB\r\n"), corePath);
+            coreServer.Stop();
+            coreIndex.Close();
+            postMortem = FALSE;
+        }
+        else
+        {
+            _stprintf_s(targetArgument, _countof(targetArgument), _T("target remote 127.0.0.1:%u"), (unsigned int) coreServer.GetPort());
+            gdbArgs.push_back(exArgument);
+            gdbArgs.push_back(trustArgument);
+            gdbArgs.push_back(exArgument);
+            gdbArgs.push_back(targetArgument);
+
+            PrintMessage(_T("  Core: %s served on 127.0.0.1:%u\r\n"), corePath, (unsigned int) coreServer.GetPort());
+            coreIndex.PrintCrashedThread();
+        }
+    }
 
     // Initialize GDB
-    LPCTSTR gdbCommand = ConcatGdbCommand(argc, argv, gdbExecutablePath, gdbArgsStartFrom);
-    GDBWrapper* gdb = new GDBWrapper(gdbCommand, handleCtrlC, handleTerminate);
+    LPCTSTR gdbCommand = postMortem
+        ? ConcatGdbCommand((int) gdbArgs.size(), gdbArgs.empty() ? NULL : &gdbArgs[0], useProfile ? NULL : gdbExecutablePath, 0)
+        : ConcatGdbCommand(argc, argv, useProfile ? NULL : gdbExecutablePath, gdbArgsStartFrom);
+    if (useProfile)
+    {
+        gdbCommand = PrependProfile(profile, gdbCommand);
+    }
+    GDBWrapper* gdb = new GDBWrapper(gdbCommand);
+
+    startup.SetGdbPath(gdbExecutablePath);
+    startup.Mark(StartupGdbCommand);
 
     PrintMessage(_T("  GDB command: %s\r\n"), gdbCommand);
     PrintMessage(_T("\r\n\r\n"));
@@ -166,48 +710,251 @@ int _tmain(int argc, _TCHAR* argv[])
     delete[] gdbCommand;
 
     // Start GDB
-    if (!gdb->StartProcess())
+    if (!gdb->StartProcess(relayStreams ? GDB_START_OWN_PIPES : 0))
     {
         PrintMessage(_T("Error: Failed to start the GDB process (%s)\r\n"), gdbExecutablePath);
+        if (useProfile)
+        {
+            profile.Invalidate();
+        }
         return 2;
     }
+    startup.Mark(StartupGdbStart);
+
+    MiRelay outputRelay(HostGetStdPipe(HOST_STDOUT), relayLatency);
+    MiRelay errorRelay(HostGetStdPipe(HOST_STDERR), relayLatency);
+    MiInputForwarder inputForwarder(gdb);
+    MiCommandPipeline pipeline(gdb, pipelineWindow);
+    MiResponseCache cache;
+    MiVarTracker variables(&outputRelay);
+    SymbolIndexCache symbolIndex;
+    MiRecorder recorder;
+    MiRecordingReader recordingReader(&recorder, pipelineWindow > 0 ? static_cast<HostReadHandler*>(&pipeline) : &inputForwarder);
+    InterruptStats interruptStats;
+    InterruptTracker interruptTracker(&interruptStats);
+    MetricsEndpoint metrics;
 
-    HANDLE handles[] = { handleCtrlC, handleTerminate, gdb->GetProcessHandle() };
-    BOOL exitProc = FALSE;
+    ShmTransport transport;
 
-    // Main loop
-    while (!exitProc)
+    outputRelay.SetFramed(relayFramed);
+    outputRelay.SetStreamChunk(streamChunk);
+    outputRelay.AddObserver(&interruptTracker);
+    if (profileStartup)
+    {
+        outputRelay.AddObserver(&startup);
+    }
+    if (relayStreams)
     {
-        // Wait for a CTRL-C event indicating GDB should be interrupted
-        LogPrint(_T("WaitForMultipleObjects"));
-        DWORD event = WaitForMultipleObjects(_countof(handles), handles, false, INFINITE);
-        switch (event)
+        const char* recordingPath = getenv(RECORDER_ENVIRONMENT_VARIABLE);
+        if (recordingPath != NULL && recordingPath[0] != '\0')
         {
-            case WAIT_OBJECT_0:
-                LogPrint(_T("WAIT_OBJECT_0 (Ctrl-C)"));
-                GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0);
-                break;
-            case WAIT_OBJECT_0 + 1:
-                LogPrint(_T("WAIT_OBJECT_0 + 1 (Terminate)"));
-                exitProc = TRUE;
-                break;
-            case WAIT_OBJECT_0 + 2:
-                LogPrint(_T("WAIT_OBJECT_0 + 2 (GDB Terminated)"));
-                PrintMessage(_T("GDB process terminated!"));
-                exitProc = TRUE;
-                break;
-            case WAIT_FAILED:
-                PrintError(_T("WaitForSingleObject WAIT_FAILED"), GetLastError());
-                exitProc = TRUE;
-                break;
-            default:
-                exitProc = TRUE;
-            break;
+            if (recorder.Open(recordingPath))
+            {
+                outputRelay.AddObserver(&recorder);
+            }
+            else
+            {
+                PrintMessage(_T("Error: Unable to create session recording\r\n"));
+            }
         }
     }
+    if (trackVariables)
+    {
+        // the state must be updated, before the pipeline sends the requests waiting for it:
+        outputRelay.AddObserver(&variables);
+        pipeline.SetVariables(&variables, &outputRelay);
+    }
+    if (pipelineWindow > 0)
+    {
+        outputRelay.AddObserver(&pipeline);
+    }
+    if (cacheReplies)
+    {
+        const char* cachedCommands = getenv(CACHE_ENVIRONMENT_VARIABLE);
+        if (cachedCommands != NULL)
+        {
+            cache.SetCommands(cachedCommands);
+        }
+
+        outputRelay.AddObserver(&cache);
+        pipeline.SetCache(&cache, &outputRelay);
+    }
+    if (indexSymbols)
+    {
+        if (symbolIndex.Initialize(gdbExecutablePath, NULL))
+        {
+            pipeline.SetSymbolIndex(&symbolIndex);
+        }
+        else
+        {
+            PrintMessage(_T("Error: Unable to find directory for symbol index cache\r\n"));
+            indexSymbols = FALSE;
+        }
+    }
+    interruptStats.SetDumpInterval(statsInterval * 1000);
+    if (serveMetrics)
+    {
+        metrics.SetGdb(gdb);
+        metrics.SetInterrupts(&interruptStats);
+        if (relayStreams)
+        {
+            metrics.SetRelays(&outputRelay, &errorRelay, pipelineWindow > 0 ? &pipeline.GetStats() : &inputForwarder.GetStats());
+        }
+        if (pipelineWindow > 0)
+        {
+            metrics.SetPipeline(&pipeline);
+        }
+
+        if (metricsPort <= 0xFFFF && metrics.Open((unsigned short) metricsPort))
+        {
+            PrintMessage(_T("Metrics: 127.0.0.1:%u\r\n"), (unsigned int) metrics.GetPort());
+        }
+        else
+        {
+            PrintMessage(_T("Error: Unable to open metrics endpoint (port: %u)\r\n"), (unsigned int) metricsPort);
+            serveMetrics = FALSE;
+        }
+    }
+
+    {
+        StartupProfilingReader startupReader(&startup, NULL);
+        HostController controller(&eventCtrlC, &eventTerminate, gdb, &interruptTracker, pipelineWindow > 0 ? &pipeline : NULL, &recorder, &startup);
+        HostLoop loop;
+
+        if (sharedMemory)
+        {
+            if (!transport.Open(eventNameCtrlC, &controller))
+            {
+                PrintMessage(_T("Error: Unable to open shared memory transport (%s%s)\r\n"), eventNameCtrlC, SHM_NAME_SUFFIX);
+                gdb->Shutdown();
+                delete gdb;
+                return 3;
+            }
+
+            outputRelay.SetSink(transport.GetOutputSink());
+            errorRelay.SetSink(transport.GetErrorSink());
+            loop.Add(transport.GetWaitable(), &transport);
+        }
+
+        loop.Add(eventCtrlC.GetWaitable(), &controller);
+        loop.Add(eventTerminate.GetWaitable(), &controller);
+        loop.Add(gdb->GetProcessHandle(), &controller);
+        loop.AddTimer(&interruptStats);
+        if (serveMetrics)
+        {
+            loop.Add(metrics.GetWaitable(), &metrics);
+            loop.AddTimer(&metrics);
+        }
+
+        if (relayStreams)
+        {
+            loop.AddReader(gdb->GetOutputPipe(), &outputRelay);
+            loop.AddReader(gdb->GetErrorPipe(), &errorRelay);
+            if (!sharedMemory)
+            {
+                HostReadHandler* commandReader;
+
+                if (recorder.IsOpen())
+                {
+                    commandReader = &recordingReader;
+                }
+                else if (pipelineWindow > 0)
+                {
+                    commandReader = &pipeline;
+                }
+                else
+                {
+                    commandReader = &inputForwarder;
+                }
+
+                startupReader.SetNext(commandReader);
+                loop.AddReader(HostGetStdPipe(HOST_STDIN), profileStartup ? &startupReader : commandReader);
+            }
+            loop.AddTimer(&outputRelay);
+            loop.AddTimer(&errorRelay);
+        }
+
+        startup.Mark(StartupHostSetup);
+
+        // Main loop - wait for a Ctrl-C event indicating GDB should be interrupted, termination request or GDB exit
+        loop.Run();
+    }
+
+    startup.Finish();
+    if (printStartup)
+    {
+        PrintMessage(_T("\r\nStartup (ms): "));
+        startup.Print();
+    }
+
+    if (relayStreams)
+    {
+        outputRelay.FlushAll();
+        errorRelay.FlushAll();
+
+        if (sharedMemory)
+        {
+            transport.Send(ShmMessageExited, NULL, 0);
+            PrintMessage(_T("\r\nShared memory: %llu bytes sent, %llu doorbells rung\r\n"), transport.GetSentBytes(), transport.GetDoorbellCount());
+        }
+
+        const MiRelayStats& output = outputRelay.GetStats();
+        const MiRelayStats& input = pipelineWindow > 0 ? pipeline.GetStats() : inputForwarder.GetStats();
+        PrintMessage(_T("\r\nRelay: %llu records (%llu bytes) received in %llu reads and forwarded in %llu writes, %llu bytes of commands sent\r\n"),
+                     output.records, output.bytes, output.reads, output.writes, input.bytes);
+
+        if (streamChunk > 0)
+        {
+            const MiStreamStats& stream = outputRelay.GetStreamStats();
+            PrintMessage(_T("Target output: %llu records coalesced into %llu chunks (%llu bytes), %llu bytes dropped\r\n"),
+                         stream.records, stream.chunks, stream.bytes, stream.dropped);
+        }
+        if (pipelineWindow > 0)
+        {
+            PrintMessage(_T("Pipeline (us): "));
+            pipeline.Print();
+        }
+        if (cacheReplies)
+        {
+            PrintMessage(_T("Responses: "));
+            cache.Print();
+        }
+        if (trackVariables)
+        {
+            PrintMessage(_T("Variables: "));
+            variables.Print();
+        }
+        if (indexSymbols)
+        {
+            symbolIndex.Shutdown();
+            PrintMessage(_T("Symbols: "));
+            symbolIndex.Print();
+        }
+        if (recorder.IsOpen())
+        {
+            PrintMessage(_T("Recording: %llu lines (%llu bytes)\r\n"), recorder.GetLineCount(), recorder.GetByteCount());
+            recorder.Close();
+        }
+    }
+
+    if (interruptStats.requests > 0)
+    {
+        PrintMessage(_T("\r\nInterrupt latency (us): "));
+        interruptStats.Print();
+    }
 
     // Clean-up
     gdb->Shutdown();
+    delete gdb;
+
+    if (postMortem)
+    {
+        coreServer.Stop();
+        coreIndex.WaitComplete();
+        PrintMessage(_T("\r\nCore: "));
+        coreIndex.Print();
+        coreServer.Print();
+    }
     PrintMessage(_T("Finished"));
     return 0;
 }
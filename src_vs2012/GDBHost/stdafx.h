@@ -19,9 +19,17 @@
 
 #pragma once
 
+#ifdef _WIN32
+
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 
 #include <windows.h>
 #include <tchar.h>
+
+#else
+
+#include "PosixCompat.h"
+
+#endif
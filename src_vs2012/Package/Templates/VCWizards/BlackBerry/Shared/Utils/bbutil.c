@@ -21,7 +21,12 @@
 #include <sys/keycodes.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <math.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "$Name$.h"
 
@@ -39,6 +44,41 @@
 
 #include "png.h"
 
+//Atlas pages of a font, before the least recently used one is cleared for new glyphs
+#define BBUTIL_FONT_PAGES 4
+
+//Lines of text, that fit under each other into an atlas page
+#define BBUTIL_FONT_PAGE_LINES 12
+
+//Empty pixels between glyphs inside the atlas, so linear filtering doesn't pick up their neighbours
+#define BBUTIL_GLYPH_PADDING 1
+
+//Distance in font pixels, at which the signed distance field of a glyph is saturated
+#define BBUTIL_SDF_SPREAD 4
+
+//Glyphs of distance field fonts are rasterized this many times larger than the font size
+#define BBUTIL_SDF_UPSCALE 4
+
+//Marks free slots of the font cache
+#define BBUTIL_NO_GLYPH 0xFFFFFFFF
+
+//Signature and version of the font cache files, the version has to change with the layout of glyph_t or the atlas
+#define BBUTIL_FONT_CACHE_MAGIC 0x43464242
+#define BBUTIL_FONT_CACHE_VERSION 1
+
+//Font pages collected by single text batch, before it has to be drawn early to make room for another one
+#define BBUTIL_TEXT_BATCH_RUNS 8
+
+//Glyphs per draw call of the text batch, all their vertices must be addressable by 16-bit indices
+#define BBUTIL_TEXT_BATCH_QUADS 4096
+
+#ifdef USING_GL11
+//OpenGL ES 1.1 doesn't know GL_STREAM_DRAW, dynamic buffers are the closest match
+#define BBUTIL_STREAM_DRAW GL_DYNAMIC_DRAW
+#else
+#define BBUTIL_STREAM_DRAW GL_STREAM_DRAW
+#endif
+
 EGLDisplay egl_disp;
 EGLSurface egl_surf;
 
@@ -51,6 +91,9 @@ static screen_display_t screen_disp;
 static int nbuffers = 2;
 static int initialized = 0;
 
+//Directory of the font cache files, empty when the cache is disabled
+static char font_cache_dir[PATH_MAX] = "";
+
 #ifdef USING_GL20
 static GLuint text_rendering_program;
 static int text_program_initialized = 0;
@@ -58,24 +101,128 @@ static GLint positionLoc;
 static GLint texcoordLoc;
 static GLint textureLoc;
 static GLint colorLoc;
+static GLint transformLoc;
+static GLint smoothingLoc;
 #endif
 
+//Rasterized glyph inside the font cache
+typedef struct
+{
+    unsigned int code;          //Unicode code point, BBUTIL_NO_GLYPH for free slots of the cache
+    int page;                   //atlas page with the bitmap, -1 for blank glyphs (i.e. spaces)
+    float advance;
+    float width;
+    float height;
+    float offset_x;
+    float offset_y;
+    float tex_x1;
+    float tex_x2;
+    float tex_y1;
+    float tex_y2;
+} glyph_t;
+
+//Horizontal segment of the top edge of the glyphs packed into an atlas page
+typedef struct
+{
+    int x;
+    int y;
+    int width;
+} skyline_node_t;
+
+//Single texture of the font atlas
+typedef struct
+{
+    GLuint texture;
+    GLubyte* pixels;            //copy of the texture with luminance and alpha of each pixel
+    skyline_node_t* skyline;
+    int skyline_nodes;
+    int dirty_y1;               //rows changed since the last upload of the texture
+    int dirty_y2;
+    unsigned int last_used;     //font clock, when any of the glyphs was used for the last time
+} atlas_page_t;
+
 struct font_t
 {
-    unsigned int font_texture;
+    FT_Library library;
+    FT_Face face;               //opened only when a glyph is missing in the font cache file
+    int face_error;
+    char* path;
     float pt;
-    float advance[128];
-    float width[128];
-    float height[128];
-    float tex_x1[128];
-    float tex_x2[128];
-    float tex_y1[128];
-    float tex_y2[128];
-    float offset_x[128];
-    float offset_y[128];
+    int dpi;
+    int page_size;
+    atlas_page_t pages[BBUTIL_FONT_PAGES];
+    int page_count;
+    glyph_t* glyphs;            //open addressing hash table of rasterized glyphs
+    int glyph_capacity;
+    int glyph_count;
+    unsigned int clock;         //advanced for each laid out string
+    unsigned int generation;    //advanced each time any glyphs are evicted
+    int sdf;                    //glyphs are signed distance fields, instead of bitmaps
+    int cache_dirty;            //glyphs were added since the font cache file was written
     int initialized;
 };
 
+//Header of the font cache file, followed by the font path padded to 4 bytes, the glyphs and the atlas pages,
+//each with the number of skyline nodes, page_size nodes and the pixels
+typedef struct
+{
+    unsigned int magic;
+    unsigned int version;
+    long long file_size;        //size and modification time of the font file the cache was made from
+    long long file_time;
+    int point_size;
+    int dpi;
+    int sdf;
+    int page_size;
+    int page_count;
+    int glyph_count;
+    int path_length;
+} font_cache_header_t;
+
+//Single corner of a glyph quad inside the text batch
+typedef struct
+{
+    GLfloat x, y;
+    GLfloat s, t;
+    GLubyte color[4];
+} text_vertex_t;
+
+//Glyph quads of the text batch, that are drawn from the same atlas page of a font
+typedef struct
+{
+    font_t* font;
+    int page;
+    float scale;
+    text_vertex_t* vertices;
+    int quads;
+    int capacity;
+} text_run_t;
+
+static text_run_t text_runs[BBUTIL_TEXT_BATCH_RUNS];
+static GLuint text_vertex_buffer = 0;
+static GLuint text_index_buffer = 0;
+static int text_batch_started = 0;
+
+//Quads of the last laid out string, shared by all the ways of text rendering
+static text_vertex_t* text_scratch = NULL;
+static text_vertex_t* text_sorted = NULL;
+static int* text_scratch_pages = NULL;
+static int text_scratch_capacity = 0;
+
+struct text_layout_t
+{
+    font_t* font;
+    char* text;
+    unsigned int generation;
+    GLuint vertex_buffer;
+    int page_first[BBUTIL_FONT_PAGES];
+    int page_quads[BBUTIL_FONT_PAGES];
+    int quads;
+};
+
+static void bbutil_text_batch_flush();
+static void bbutil_text_batch_release();
+
 static void bbutil_egl_perror(const char *msg)
 {
     static const char *errmsg[] = {
@@ -285,6 +432,8 @@ int bbutil_init_egl(screen_context_t ctx)
 
 void bbutil_terminate()
 {
+    bbutil_text_batch_release();
+
     //Typical EGL cleanup
     if (egl_disp != EGL_NO_DISPLAY) {
         eglMakeCurrent(egl_disp, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
@@ -324,438 +473,1928 @@ static inline int nextp2(int x)
     return val;
 }
 
-font_t* bbutil_load_font(const char* path, int point_size, int dpi)
+/**
+ * Decodes the code point at the beginning of the UTF-8 string and moves the string behind it.
+ * Invalid or truncated sequences are decoded as U+FFFD (replacement character).
+ */
+static unsigned int bbutil_utf8_next(const char** text)
 {
-    FT_Library library;
-    FT_Face face;
-    int c;
-    int i, j;
-    font_t* font;
-
-    if (!initialized) {
-        fprintf(stderr, "EGL has not been initialized\n");
-        return NULL;
-    }
-
-    if (!path){
-        fprintf(stderr, "Invalid path to font file\n");
-        return NULL;
+    const unsigned char* s = (const unsigned char*) *text;
+    unsigned int code;
+    int i, extra;
+
+    if (s[0] < 0x80) {
+        *text += 1;
+        return s[0];
+    } else if ((s[0] & 0xE0) == 0xC0) {
+        code = s[0] & 0x1F;
+        extra = 1;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        code = s[0] & 0x0F;
+        extra = 2;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        code = s[0] & 0x07;
+        extra = 3;
+    } else {
+        *text += 1;
+        return 0xFFFD;
     }
 
-    if(FT_Init_FreeType(&library)) {
-        fprintf(stderr, "Error loading Freetype library\n");
-        return NULL;
-    }
-    if (FT_New_Face(library, path,0,&face)) {
-        fprintf(stderr, "Error loading font %s\n", path);
-        return NULL;
-    }
+    for(i = 1; i <= extra; ++i) {
+        //Also stops at the terminating zero of a truncated sequence
+        if ((s[i] & 0xC0) != 0x80) {
+            *text += i;
+            return 0xFFFD;
+        }
 
-    if(FT_Set_Char_Size ( face, point_size * 64, point_size * 64, dpi, dpi)) {
-        fprintf(stderr, "Error initializing character parameters\n");
-        return NULL;
+        code = (code << 6) | (s[i] & 0x3F);
     }
 
-    font = (font_t*) malloc(sizeof(font_t));
+    *text += extra + 1;
 
-    if (!font) {
-        fprintf(stderr, "Unable to allocate memory for font structure\n");
-        return NULL;
+    //Reject overlong encodings, surrogates and values out of the Unicode range
+    if ((extra == 1 && code < 0x80) || (extra == 2 && code < 0x800) || (extra == 3 && code < 0x10000)
+            || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) {
+        return 0xFFFD;
     }
 
-    font->initialized = 0;
-    font->pt = point_size;
+    return code;
+}
 
-    glGenTextures(1, &(font->font_texture));
+/**
+ * Returns index of the slot of the font cache with the glyph or the free slot, where it should be inserted.
+ */
+static int bbutil_glyph_slot(const glyph_t* glyphs, int capacity, unsigned int code)
+{
+    unsigned int mask = capacity - 1;
+    unsigned int i = (code * 2654435761u) & mask;
 
-    //Let each glyph reside in 32x32 section of the font texture
-    int segment_size_x = 0, segment_size_y = 0;
-    int num_segments_x = 16;
-    int num_segments_y = 8;
+    while (glyphs[i].code != BBUTIL_NO_GLYPH && glyphs[i].code != code) {
+        i = (i + 1) & mask;
+    }
 
-    FT_GlyphSlot slot;
-    FT_Bitmap bmp;
-    int glyph_width, glyph_height;
+    return i;
+}
 
-    //First calculate the max width and height of a character in a passed font
-    for(c = 0; c < 128; c++) {
-        if(FT_Load_Char(face, c, FT_LOAD_RENDER)) {
-            fprintf(stderr, "FT_Load_Char failed\n");
-            free(font);
-            return NULL;
-        }
+/**
+ * Moves all glyphs of the font cache into a new table of given capacity,
+ * dropping the ones from the evicted atlas page (if not negative).
+ */
+static int bbutil_font_rehash(font_t* font, int capacity, int evicted_page)
+{
+    glyph_t* glyphs = (glyph_t*) malloc(sizeof(glyph_t) * capacity);
+    int i, count = 0;
 
-        slot = face->glyph;
-        bmp = slot->bitmap;
+    if (!glyphs) {
+        fprintf(stderr, "Unable to allocate memory for font cache\n");
+        return EXIT_FAILURE;
+    }
 
-        glyph_width = bmp.width;
-        glyph_height = bmp.rows;
+    for(i = 0; i < capacity; ++i) {
+        glyphs[i].code = BBUTIL_NO_GLYPH;
+    }
 
-        if (glyph_width > segment_size_x) {
-            segment_size_x = glyph_width;
+    for(i = 0; i < font->glyph_capacity; ++i) {
+        if (font->glyphs[i].code == BBUTIL_NO_GLYPH) {
+            continue;
         }
 
-        if (glyph_height > segment_size_y) {
-            segment_size_y = glyph_height;
+        if (evicted_page >= 0 && font->glyphs[i].page == evicted_page) {
+            continue;
         }
+
+        glyphs[bbutil_glyph_slot(glyphs, capacity, font->glyphs[i].code)] = font->glyphs[i];
+        count++;
     }
 
-    int font_tex_width = nextp2(num_segments_x * segment_size_x);
-    int font_tex_height = nextp2(num_segments_y * segment_size_y);
+    free(font->glyphs);
+    font->glyphs = glyphs;
+    font->glyph_capacity = capacity;
+    font->glyph_count = count;
+    return EXIT_SUCCESS;
+}
+
+static void bbutil_atlas_clear(atlas_page_t* page, int size)
+{
+    memset(page->pixels, 0, 2 * size * size);
+
+    page->skyline[0].x = 0;
+    page->skyline[0].y = 0;
+    page->skyline[0].width = size;
+    page->skyline_nodes = 1;
+
+    page->dirty_y1 = 0;
+    page->dirty_y2 = size;
+}
 
-    int bitmap_offset_x = 0, bitmap_offset_y = 0;
+/**
+ * Adds an empty atlas page to the font or the one with given pixels, which are uploaded directly.
+ */
+static int bbutil_atlas_add_page(font_t* font, const GLubyte* pixels)
+{
+    atlas_page_t* page = &font->pages[font->page_count];
+    int size = font->page_size;
 
-    GLubyte* font_texture_data = (GLubyte*) calloc(2 * font_tex_width * font_tex_height, sizeof(GLubyte));
+    page->pixels = (GLubyte*) malloc(2 * size * size);
+    //Inserted node can briefly overlap all the others, before they are shrunk
+    page->skyline = (skyline_node_t*) calloc(size + 1, sizeof(skyline_node_t));
 
-    if (!font_texture_data) {
+    if (!page->pixels || !page->skyline) {
         fprintf(stderr, "Failed to allocate memory for font texture\n");
-        free(font);
-        return NULL;
+        free(page->pixels);
+        free(page->skyline);
+        memset(page, 0, sizeof(atlas_page_t));
+        return EXIT_FAILURE;
     }
 
-    // Fill font texture bitmap with individual bmp data and record appropriate size, texture coordinates and offsets for every glyph
-    for(c = 0; c < 128; c++) {
-        if(FT_Load_Char(face, c, FT_LOAD_RENDER)) {
-            fprintf(stderr, "FT_Load_Char failed\n");
-            free(font);
-            return NULL;
-        }
+    if (pixels) {
+        memcpy(page->pixels, pixels, 2 * size * size);
+    } else {
+        bbutil_atlas_clear(page, size);
+    }
+
+    glGenTextures(1, &page->texture);
+    glBindTexture(GL_TEXTURE_2D, page->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        slot = face->glyph;
-        bmp = slot->bitmap;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, size, size, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, pixels ? pixels : page->pixels);
+    page->dirty_y1 = size;
+    page->dirty_y2 = 0;
 
-        glyph_width = bmp.width;
-        glyph_height = bmp.rows;
+    page->last_used = font->clock;
+    font->page_count++;
+    return EXIT_SUCCESS;
+}
 
-        div_t temp = div(c, num_segments_x);
+/**
+ * Returns the lowest position, where the rectangle can be placed onto the skyline starting at given node, or -1.
+ */
+static int bbutil_skyline_fit(const atlas_page_t* page, int size, int index, int width, int height)
+{
+    int y = 0;
+    int width_left = width;
 
-        bitmap_offset_x = segment_size_x * temp.rem;
-        bitmap_offset_y = segment_size_y * temp.quot;
+    if (page->skyline[index].x + width > size) {
+        return -1;
+    }
 
-        for (j = 0; j < glyph_height; j++) {
-            for (i = 0; i < glyph_width; i++) {
-                font_texture_data[2 * ((bitmap_offset_x + i) + (j + bitmap_offset_y) * font_tex_width) + 0] =
-                font_texture_data[2 * ((bitmap_offset_x + i) + (j + bitmap_offset_y) * font_tex_width) + 1] =
-                    (i >= bmp.width || j >= bmp.rows)? 0 : bmp.buffer[i + bmp.width * j];
-            }
+    while (width_left > 0) {
+        if (page->skyline[index].y > y) {
+            y = page->skyline[index].y;
         }
 
-        font->advance[c] = (float)(slot->advance.x >> 6);
-        font->tex_x1[c] = (float)bitmap_offset_x / (float) font_tex_width;
-        font->tex_x2[c] = (float)(bitmap_offset_x + bmp.width) / (float)font_tex_width;
-        font->tex_y1[c] = (float)bitmap_offset_y / (float) font_tex_height;
-        font->tex_y2[c] = (float)(bitmap_offset_y + bmp.rows) / (float)font_tex_height;
-        font->width[c] = bmp.width;
-        font->height[c] = bmp.rows;
-        font->offset_x[c] = (float)slot->bitmap_left;
-        font->offset_y[c] =  (float)((slot->metrics.horiBearingY-face->glyph->metrics.height) >> 6);
+        if (y + height > size) {
+            return -1;
+        }
+
+        width_left -= page->skyline[index].width;
+        index++;
     }
 
-    glBindTexture(GL_TEXTURE_2D, font->font_texture);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+    return y;
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, font_tex_width, font_tex_height, 0, GL_LUMINANCE_ALPHA , GL_UNSIGNED_BYTE, font_texture_data);
+/**
+ * Finds the place for the rectangle, that keeps its top edge lowest, and raises the skyline over it.
+ */
+static int bbutil_skyline_insert(atlas_page_t* page, int size, int width, int height, int* x, int* y)
+{
+    skyline_node_t* nodes = page->skyline;
+    int best = -1, best_top = size + 1, best_width = size + 1;
+    int i, top, shrink;
+
+    for(i = 0; i < page->skyline_nodes; ++i) {
+        top = bbutil_skyline_fit(page, size, i, width, height);
+
+        if (top >= 0 && (top + height < best_top || (top + height == best_top && nodes[i].width < best_width))) {
+            best = i;
+            best_top = top + height;
+            best_width = nodes[i].width;
+            *x = nodes[i].x;
+            *y = top;
+        }
+    }
 
-    free(font_texture_data);
+    if (best < 0) {
+        return EXIT_FAILURE;
+    }
 
-    FT_Done_Face(face);
-    FT_Done_FreeType(library);
+    memmove(&nodes[best + 1], &nodes[best], sizeof(skyline_node_t) * (page->skyline_nodes - best));
+    nodes[best].x = *x;
+    nodes[best].y = *y + height;
+    nodes[best].width = width;
+    page->skyline_nodes++;
 
-    font->initialized = 1;
-    return font;
-}
+    //Cut the nodes covered by the new one
+    for(i = best + 1; i < page->skyline_nodes; ++i) {
+        shrink = nodes[i - 1].x + nodes[i - 1].width - nodes[i].x;
+        if (shrink <= 0) {
+            break;
+        }
 
-void bbutil_render_text(font_t* font, const char* msg, float x, float y, float r, float g, float b, float a)
-{
-    int i, c;
-    GLfloat *vertices;
-    GLfloat *texture_coords;
-    GLushort* indices;
+        nodes[i].x += shrink;
+        nodes[i].width -= shrink;
 
-    float pen_x = 0.0f;
+        if (nodes[i].width > 0) {
+            break;
+        }
 
-    if (!font) {
-        fprintf(stderr, "Font must not be null\n");
-        return;
+        memmove(&nodes[i], &nodes[i + 1], sizeof(skyline_node_t) * (page->skyline_nodes - i - 1));
+        page->skyline_nodes--;
+        i--;
     }
 
-    if (!font->initialized) {
-        fprintf(stderr, "Font has not been loaded\n");
-        return;
+    //Join the neighbours of the same height
+    for(i = 0; i < page->skyline_nodes - 1; ++i) {
+        if (nodes[i].y == nodes[i + 1].y) {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2], sizeof(skyline_node_t) * (page->skyline_nodes - i - 2));
+            page->skyline_nodes--;
+            i--;
+        }
     }
 
-    if (!msg) {
-        return;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Clears the atlas page and drops all its glyphs from the font cache.
+ */
+static int bbutil_atlas_evict_page(font_t* font, int index)
+{
+    //Quads already collected by the text batch still need the old content of the page
+    if (text_batch_started) {
+        bbutil_text_batch_flush();
+    }
+
+    if (EXIT_SUCCESS != bbutil_font_rehash(font, font->glyph_capacity, index)) {
+        return EXIT_FAILURE;
     }
 
-    const int msg_len = strlen(msg);
+    bbutil_atlas_clear(&font->pages[index], font->page_size);
 
-    vertices = (GLfloat*) malloc(sizeof(GLfloat) * 8 * msg_len);
-    texture_coords = (GLfloat*) malloc(sizeof(GLfloat) * 8 * msg_len);
+    //Let text layouts know, they have to be laid out again
+    font->generation++;
+    return EXIT_SUCCESS;
+}
 
-    indices = (GLushort*) malloc(sizeof(GLushort) * 6 * msg_len);
+/**
+ * Reserves the rectangle inside the font atlas and returns index of its page or -1.
+ * When all the pages are full, the least recently used one is cleared, unless it's needed by the current string.
+ */
+static int bbutil_atlas_place(font_t* font, int width, int height, int* x, int* y)
+{
+    int i, oldest = -1;
 
-    for(i = 0; i < msg_len; ++i) {
-        c = msg[i];
+    if (width > font->page_size || height > font->page_size) {
+        return -1;
+    }
 
-        vertices[8 * i + 0] = x + pen_x + font->offset_x[c];
-        vertices[8 * i + 1] = y + font->offset_y[c];
-        vertices[8 * i + 2] = vertices[8 * i + 0] + font->width[c];
-        vertices[8 * i + 3] = vertices[8 * i + 1];
-        vertices[8 * i + 4] = vertices[8 * i + 0];
-        vertices[8 * i + 5] = vertices[8 * i + 1] + font->height[c];
-        vertices[8 * i + 6] = vertices[8 * i + 2];
-        vertices[8 * i + 7] = vertices[8 * i + 5];
+    for(i = 0; i < font->page_count; ++i) {
+        if (EXIT_SUCCESS == bbutil_skyline_insert(&font->pages[i], font->page_size, width, height, x, y)) {
+            return i;
+        }
+    }
 
-        texture_coords[8 * i + 0] = font->tex_x1[c];
-        texture_coords[8 * i + 1] = font->tex_y2[c];
-        texture_coords[8 * i + 2] = font->tex_x2[c];
-        texture_coords[8 * i + 3] = font->tex_y2[c];
-        texture_coords[8 * i + 4] = font->tex_x1[c];
-        texture_coords[8 * i + 5] = font->tex_y1[c];
-        texture_coords[8 * i + 6] = font->tex_x2[c];
-        texture_coords[8 * i + 7] = font->tex_y1[c];
+    if (font->page_count < BBUTIL_FONT_PAGES) {
+        if (EXIT_SUCCESS != bbutil_atlas_add_page(font, NULL)) {
+            return -1;
+        }
+        oldest = font->page_count - 1;
+    } else {
+        for(i = 0; i < font->page_count; ++i) {
+            if (font->pages[i].last_used != font->clock
+                    && (oldest < 0 || font->pages[i].last_used < font->pages[oldest].last_used)) {
+                oldest = i;
+            }
+        }
 
-        indices[i * 6 + 0] = 4 * i + 0;
-        indices[i * 6 + 1] = 4 * i + 1;
-        indices[i * 6 + 2] = 4 * i + 2;
-        indices[i * 6 + 3] = 4 * i + 2;
-        indices[i * 6 + 4] = 4 * i + 1;
-        indices[i * 6 + 5] = 4 * i + 3;
+        if (oldest < 0) {
+            return -1;
+        }
 
-        //Assume we are only working with typewriter fonts
-        pen_x += font->advance[c];
+        if (EXIT_SUCCESS != bbutil_atlas_evict_page(font, oldest)) {
+            return -1;
+        }
     }
-#ifdef USING_GL11
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
 
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    if (EXIT_SUCCESS != bbutil_skyline_insert(&font->pages[oldest], font->page_size, width, height, x, y)) {
+        return -1;
+    }
 
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    return oldest;
+}
 
-    glColor4f(r, g, b, a);
+//Vector from a pixel to the nearest pixel of the other set in the distance transform
+typedef struct
+{
+    int dx;
+    int dy;
+} sdf_point_t;
 
-    glVertexPointer(2, GL_FLOAT, 0, vertices);
-    glTexCoordPointer(2, GL_FLOAT, 0, texture_coords);
-    glBindTexture(GL_TEXTURE_2D, font->font_texture);
+static void bbutil_sdf_compare(sdf_point_t* grid, int width, int x, int y, int offset_x, int offset_y)
+{
+    sdf_point_t* point = &grid[x + y * width];
+    sdf_point_t other = grid[(x + offset_x) + (y + offset_y) * width];
 
-    glDrawElements(GL_TRIANGLES, 6 * msg_len, GL_UNSIGNED_SHORT, indices);
+    other.dx += offset_x;
+    other.dy += offset_y;
 
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_BLEND);
-#elif defined USING_GL20
-    if (!text_program_initialized) {
-        GLint status;
-
-        // Create shaders if this hasn't been done already
-        const char* v_source =
-                "precision mediump float;"
-                "attribute vec2 a_position;"
-                "attribute vec2 a_texcoord;"
-                "varying vec2 v_texcoord;"
-                "void main()"
-                "{"
-                "   gl_Position = vec4(a_position, 0.0, 1.0);"
-                "    v_texcoord = a_texcoord;"
-                "}";
-
-        const char* f_source =
-                "precision lowp float;"
-                "varying vec2 v_texcoord;"
-                "uniform sampler2D u_font_texture;"
-                "uniform vec4 u_col;"
-                "void main()"
-                "{"
-                "    vec4 temp = texture2D(u_font_texture, v_texcoord);"
-                "    gl_FragColor = u_col * temp;"
-                "}";
-
-        // Compile the vertex shader
-        GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-
-        if (!vs) {
-            fprintf(stderr, "Failed to create vertex shader: %d\n", glGetError());
-            return;
-        } else {
-            glShaderSource(vs, 1, &v_source, 0);
-            glCompileShader(vs);
-            glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
-            if (GL_FALSE == status) {
-                GLchar log[256];
-                glGetShaderInfoLog(vs, 256, NULL, log);
+    if (other.dx * other.dx + other.dy * other.dy < point->dx * point->dx + point->dy * point->dy) {
+        *point = other;
+    }
+}
 
-                fprintf(stderr, "Failed to compile vertex shader: %s\n", log);
+/**
+ * 8-point sequential Euclidean distance transform, two passes over the grid propagate the nearest points.
+ */
+static void bbutil_sdf_transform(sdf_point_t* grid, int width, int height)
+{
+    int x, y;
 
-                glDeleteShader(vs);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            if (x > 0) {
+                bbutil_sdf_compare(grid, width, x, y, -1, 0);
+            }
+            if (y > 0) {
+                bbutil_sdf_compare(grid, width, x, y, 0, -1);
+                if (x > 0) {
+                    bbutil_sdf_compare(grid, width, x, y, -1, -1);
+                }
+                if (x < width - 1) {
+                    bbutil_sdf_compare(grid, width, x, y, 1, -1);
+                }
             }
         }
+        for (x = width - 2; x >= 0; x--) {
+            bbutil_sdf_compare(grid, width, x, y, 1, 0);
+        }
+    }
 
-        // Compile the fragment shader
-        GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-
-        if (!fs) {
-            fprintf(stderr, "Failed to create fragment shader: %d\n", glGetError());
-            return;
-        } else {
-            glShaderSource(fs, 1, &f_source, 0);
-            glCompileShader(fs);
-            glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
-            if (GL_FALSE == status) {
-                GLchar log[256];
-                glGetShaderInfoLog(fs, 256, NULL, log);
+    for (y = height - 1; y >= 0; y--) {
+        for (x = width - 1; x >= 0; x--) {
+            if (x < width - 1) {
+                bbutil_sdf_compare(grid, width, x, y, 1, 0);
+            }
+            if (y < height - 1) {
+                bbutil_sdf_compare(grid, width, x, y, 0, 1);
+                if (x > 0) {
+                    bbutil_sdf_compare(grid, width, x, y, -1, 1);
+                }
+                if (x < width - 1) {
+                    bbutil_sdf_compare(grid, width, x, y, 1, 1);
+                }
+            }
+        }
+        for (x = 1; x < width; x++) {
+            bbutil_sdf_compare(grid, width, x, y, -1, 0);
+        }
+    }
+}
 
-                fprintf(stderr, "Failed to compile fragment shader: %s\n", log);
+/**
+ * Converts the glyph bitmap rasterized BBUTIL_SDF_UPSCALE times larger than the font size into a signed distance field
+ * of the font size with BBUTIL_SDF_SPREAD pixels of border around. The edge of the glyph maps to 128, inside is brighter.
+ * Returns the field, that has to be freed, and its size or NULL on error.
+ */
+static GLubyte* bbutil_sdf_generate(const FT_Bitmap* bmp, int* width, int* height)
+{
+    const int border = BBUTIL_SDF_SPREAD * BBUTIL_SDF_UPSCALE;
+    const int far = 0x4000;
+    int field_width = (bmp->width + BBUTIL_SDF_UPSCALE - 1) / BBUTIL_SDF_UPSCALE + 2 * BBUTIL_SDF_SPREAD;
+    int field_height = (bmp->rows + BBUTIL_SDF_UPSCALE - 1) / BBUTIL_SDF_UPSCALE + 2 * BBUTIL_SDF_SPREAD;
+    int grid_width = field_width * BBUTIL_SDF_UPSCALE;
+    int grid_height = field_height * BBUTIL_SDF_UPSCALE;
+    sdf_point_t* to_inside = (sdf_point_t*) malloc(sizeof(sdf_point_t) * grid_width * grid_height);
+    sdf_point_t* to_outside = (sdf_point_t*) malloc(sizeof(sdf_point_t) * grid_width * grid_height);
+    GLubyte* field = (GLubyte*) malloc(field_width * field_height);
+    int x, y, i, inside;
+    float distance, value;
+
+    if (!to_inside || !to_outside || !field) {
+        fprintf(stderr, "Unable to allocate memory for distance field\n");
+        free(to_inside);
+        free(to_outside);
+        free(field);
+        return NULL;
+    }
 
-                glDeleteShader(vs);
-                glDeleteShader(fs);
+    for (y = 0; y < grid_height; y++) {
+        for (x = 0; x < grid_width; x++) {
+            i = x + y * grid_width;
+            inside = x >= border && x < border + bmp->width && y >= border && y < border + bmp->rows
+                    && bmp->buffer[(x - border) + (y - border) * bmp->pitch] >= 128;
 
-                return;
-            }
+            to_inside[i].dx = to_inside[i].dy = inside ? 0 : far;
+            to_outside[i].dx = to_outside[i].dy = inside ? far : 0;
         }
+    }
 
-        // Create and link the program
-        text_rendering_program = glCreateProgram();
-        if (text_rendering_program)
-        {
-            glAttachShader(text_rendering_program, vs);
-            glAttachShader(text_rendering_program, fs);
-            glLinkProgram(text_rendering_program);
-
-            glGetProgramiv(text_rendering_program, GL_LINK_STATUS, &status);
-            if (status == GL_FALSE)    {
-                GLchar log[256];
-                glGetProgramInfoLog(fs, 256, NULL, log);
+    bbutil_sdf_transform(to_inside, grid_width, grid_height);
+    bbutil_sdf_transform(to_outside, grid_width, grid_height);
 
-                fprintf(stderr, "Failed to link text rendering shader program: %s\n", log);
+    //Sample the distances at the centers of the field pixels, positive outside of the glyph
+    for (y = 0; y < field_height; y++) {
+        for (x = 0; x < field_width; x++) {
+            i = (x * BBUTIL_SDF_UPSCALE + BBUTIL_SDF_UPSCALE / 2) + (y * BBUTIL_SDF_UPSCALE + BBUTIL_SDF_UPSCALE / 2) * grid_width;
 
-                glDeleteProgram(text_rendering_program);
-                text_rendering_program = 0;
+            distance = sqrtf((float)(to_inside[i].dx * to_inside[i].dx + to_inside[i].dy * to_inside[i].dy))
+                     - sqrtf((float)(to_outside[i].dx * to_outside[i].dx + to_outside[i].dy * to_outside[i].dy));
+            value = 0.5f - distance / (2.0f * BBUTIL_SDF_SPREAD * BBUTIL_SDF_UPSCALE);
 
-                return;
+            if (value < 0.0f) {
+                value = 0.0f;
+            }
+            if (value > 1.0f) {
+                value = 1.0f;
             }
-        } else {
-            fprintf(stderr, "Failed to create a shader program\n");
 
-            glDeleteShader(vs);
-            glDeleteShader(fs);
-            return;
+            field[x + y * field_width] = (GLubyte) (value * 255.0f + 0.5f);
         }
+    }
 
-        // We don't need the shaders anymore - the program is enough
-        glDeleteShader(fs);
-        glDeleteShader(vs);
+    free(to_inside);
+    free(to_outside);
 
-        glUseProgram(text_rendering_program);
+    *width = field_width;
+    *height = field_height;
+    return field;
+}
 
-        // Store the locations of the shader variables we need later
-        positionLoc = glGetAttribLocation(text_rendering_program, "a_position");
-        texcoordLoc = glGetAttribLocation(text_rendering_program, "a_texcoord");
-        textureLoc = glGetUniformLocation(text_rendering_program, "u_font_texture");
-        colorLoc = glGetUniformLocation(text_rendering_program, "u_col");
+/**
+ * Opens the font face, unless it's open already. Fonts loaded from the font cache file open it
+ * only when a glyph missing in the file is used.
+ */
+static int bbutil_font_open_face(font_t* font)
+{
+    //Distance fields are generated from glyphs rasterized larger than the font size
+    int char_size = font->sdf ? (int)font->pt * 64 * BBUTIL_SDF_UPSCALE : (int)font->pt * 64;
 
-        text_program_initialized = 1;
+    if (font->face) {
+        return EXIT_SUCCESS;
     }
 
-    glEnable(GL_BLEND);
+    //Don't report the same failure for each missing glyph
+    if (font->face_error) {
+        return EXIT_FAILURE;
+    }
 
-    //Map text coordinates from (0...surface width, 0...surface height) to (-1...1, -1...1)
-    //this make our vertex shader very simple and also works irrespective of orientation changes
-    EGLint surface_width, surface_height;
+    font->face_error = 1;
 
-    eglQuerySurface(egl_disp, egl_surf, EGL_WIDTH, &surface_width);
-    eglQuerySurface(egl_disp, egl_surf, EGL_HEIGHT, &surface_height);
+    if(FT_Init_FreeType(&font->library)) {
+        fprintf(stderr, "Error loading Freetype library\n");
+        font->library = NULL;
+        return EXIT_FAILURE;
+    }
+    if (FT_New_Face(font->library, font->path, 0, &font->face)) {
+        fprintf(stderr, "Error loading font %s\n", font->path);
+        font->face = NULL;
+        return EXIT_FAILURE;
+    }
 
-    for(i = 0; i < 4 * msg_len; ++i) {
-        vertices[2 * i + 0] = 2 * vertices[2 * i + 0] / surface_width - 1.0f;
-        vertices[2 * i + 1] = 2 * vertices[2 * i + 1] / surface_height - 1.0f;
+    if(FT_Set_Char_Size ( font->face, char_size, char_size, font->dpi, font->dpi)) {
+        fprintf(stderr, "Error initializing character parameters\n");
+        FT_Done_Face(font->face);
+        font->face = NULL;
+        return EXIT_FAILURE;
     }
 
-    //Render text
-    glUseProgram(text_rendering_program);
+    font->face_error = 0;
+    return EXIT_SUCCESS;
+}
 
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+/**
+ * Returns the glyph from the font cache, rasterizing it on its first use.
+ * Returned pointer is valid only until the next call, as the cache can be rebuilt.
+ */
+static const glyph_t* bbutil_font_glyph(font_t* font, unsigned int code)
+{
+    FT_GlyphSlot slot;
+    FT_Bitmap bmp;
+    atlas_page_t* page;
+    glyph_t glyph;
+    GLubyte* field = NULL;
+    int i, j, x, y, index, pad_y;
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    index = bbutil_glyph_slot(font->glyphs, font->glyph_capacity, code);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, font->font_texture);
-    glUniform1i(textureLoc, 0);
+    if (font->glyphs[index].code == code) {
+        if (font->glyphs[index].page >= 0) {
+            font->pages[font->glyphs[index].page].last_used = font->clock;
+        }
 
-    glUniform4f(colorLoc, r, g, b, a);
+        return &font->glyphs[index];
+    }
 
-    glEnableVertexAttribArray(positionLoc);
-    glVertexAttribPointer(positionLoc, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+    if (EXIT_SUCCESS != bbutil_font_open_face(font)) {
+        return NULL;
+    }
 
-    glEnableVertexAttribArray(texcoordLoc);
-    glVertexAttribPointer(texcoordLoc, 2, GL_FLOAT, GL_FALSE, 0, texture_coords);
+    if(FT_Load_Char(font->face, code, FT_LOAD_RENDER)) {
+        fprintf(stderr, "FT_Load_Char failed\n");
+        return NULL;
+    }
 
-       //Draw the string
-    glDrawElements(GL_TRIANGLES, 6 * msg_len, GL_UNSIGNED_SHORT, indices);
+    slot = font->face->glyph;
+    bmp = slot->bitmap;
+
+    memset(&glyph, 0, sizeof(glyph_t));
+    glyph.code = code;
+    glyph.page = -1;
+    glyph.advance = (float)(slot->advance.x >> 6);
+    glyph.width = bmp.width;
+    glyph.height = bmp.rows;
+    glyph.offset_x = (float)slot->bitmap_left;
+    glyph.offset_y = (float)((slot->metrics.horiBearingY - slot->metrics.height) >> 6);
+
+    if (font->sdf && bmp.width > 0 && bmp.rows > 0) {
+        field = bbutil_sdf_generate(&bmp, &i, &j);
+        if (!field) {
+            return NULL;
+        }
 
-    glDisableVertexAttribArray(positionLoc);
-    glDisableVertexAttribArray(texcoordLoc);
-#else
-    fprintf(stderr, "bbutil should be compiled with either USING_GL11 or USING_GL20 -D flags\n");
-#endif
+        //Metrics are scaled back to the font size and moved by the border of the field
+        pad_y = j * BBUTIL_SDF_UPSCALE - bmp.rows - BBUTIL_SDF_SPREAD * BBUTIL_SDF_UPSCALE;
+        glyph.advance /= BBUTIL_SDF_UPSCALE;
+        glyph.offset_x = glyph.offset_x / BBUTIL_SDF_UPSCALE - BBUTIL_SDF_SPREAD;
+        glyph.offset_y = (float)(((slot->metrics.horiBearingY - slot->metrics.height) >> 6) - pad_y) / BBUTIL_SDF_UPSCALE;
+
+        bmp.width = i;
+        bmp.rows = j;
+        bmp.pitch = i;
+        bmp.buffer = field;
+        glyph.width = bmp.width;
+        glyph.height = bmp.rows;
+    }
+
+    if (bmp.width > 0 && bmp.rows > 0) {
+        glyph.page = bbutil_atlas_place(font, bmp.width + BBUTIL_GLYPH_PADDING, bmp.rows + BBUTIL_GLYPH_PADDING, &x, &y);
+
+        if (glyph.page < 0) {
+            free(field);
+            return NULL;
+        }
+
+        page = &font->pages[glyph.page];
+
+        //Distance fields are only in the alpha channel, so they can be alpha tested
+        for (j = 0; j < bmp.rows; j++) {
+            for (i = 0; i < bmp.width; i++) {
+                page->pixels[2 * ((x + i) + (y + j) * font->page_size) + 0] = field ? 255 : bmp.buffer[i + bmp.pitch * j];
+                page->pixels[2 * ((x + i) + (y + j) * font->page_size) + 1] = bmp.buffer[i + bmp.pitch * j];
+            }
+        }
+
+        free(field);
+
+        if (y < page->dirty_y1) {
+            page->dirty_y1 = y;
+        }
+        if (y + bmp.rows > page->dirty_y2) {
+            page->dirty_y2 = y + bmp.rows;
+        }
+
+        page->last_used = font->clock;
+
+        glyph.tex_x1 = (float)x / (float)font->page_size;
+        glyph.tex_x2 = (float)(x + bmp.width) / (float)font->page_size;
+        glyph.tex_y1 = (float)y / (float)font->page_size;
+        glyph.tex_y2 = (float)(y + bmp.rows) / (float)font->page_size;
+    }
+
+    //Keep the cache at most half full, so the probing stays short
+    if (2 * (font->glyph_count + 1) > font->glyph_capacity
+            && EXIT_SUCCESS != bbutil_font_rehash(font, 2 * font->glyph_capacity, -1)) {
+        return NULL;
+    }
+
+    index = bbutil_glyph_slot(font->glyphs, font->glyph_capacity, code);
+    font->glyphs[index] = glyph;
+    font->glyph_count++;
+    font->cache_dirty = 1;
+
+    return &font->glyphs[index];
+}
+
+/**
+ * Uploads rows of the atlas pages changed by newly rasterized glyphs.
+ */
+static void bbutil_font_upload(font_t* font)
+{
+    atlas_page_t* page;
+    int i;
+
+    for(i = 0; i < font->page_count; ++i) {
+        page = &font->pages[i];
+
+        if (page->dirty_y1 >= page->dirty_y2) {
+            continue;
+        }
+
+        //Whole rows are continuous in memory, so they don't need any unpacking
+        glBindTexture(GL_TEXTURE_2D, page->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, page->dirty_y1, font->page_size, page->dirty_y2 - page->dirty_y1,
+                        GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, page->pixels + 2 * font->page_size * page->dirty_y1);
+
+        page->dirty_y1 = font->page_size;
+        page->dirty_y2 = 0;
+    }
+}
+
+/**
+ * Returns the path of the font cache file, which name is made of a hash of the font path and the font parameters.
+ */
+static int bbutil_font_cache_path(const font_t* font, char* cache_path)
+{
+    //FNV-1a hash of the font path
+    unsigned int hash = 2166136261u;
+    const char* c;
+    int length;
+
+    for(c = font->path; *c; ++c) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+
+    length = snprintf(cache_path, PATH_MAX, "%s/font-%08x-%d-%d%s.cache", font_cache_dir, hash, (int)font->pt, font->dpi, font->sdf ? "-sdf" : "");
+
+    if (length < 0 || length >= PATH_MAX) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Returns non-zero, when the mapped cache file was made from the current version of the font file with the same parameters.
+ */
+static int bbutil_font_cache_valid(const font_t* font, const struct stat* font_stat, const void* mapping, size_t size)
+{
+    const font_cache_header_t* header = (const font_cache_header_t*) mapping;
+    const glyph_t* glyphs;
+    const skyline_node_t* skyline;
+    const char* page;
+    size_t path_size, page_size, expected;
+    GLint max_texture_size;
+    int i, j, nodes, right;
+
+    if (size < sizeof(font_cache_header_t)
+            || header->magic != BBUTIL_FONT_CACHE_MAGIC || header->version != BBUTIL_FONT_CACHE_VERSION
+            || header->file_size != (long long)font_stat->st_size || header->file_time != (long long)font_stat->st_mtime
+            || header->point_size != (int)font->pt || header->dpi != font->dpi || header->sdf != font->sdf
+            || header->path_length != (int)strlen(font->path)) {
+        return 0;
+    }
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    if (header->page_size < 64 || header->page_size > max_texture_size
+            || header->page_count < 0 || header->page_count > BBUTIL_FONT_PAGES || header->glyph_count < 0) {
+        return 0;
+    }
+
+    path_size = (header->path_length + 3) & ~3;
+    page_size = sizeof(int) + sizeof(skyline_node_t) * header->page_size + 2 * header->page_size * header->page_size;
+    expected = sizeof(font_cache_header_t) + path_size + sizeof(glyph_t) * header->glyph_count + page_size * header->page_count;
+
+    if (size != expected || memcmp((const char*) mapping + sizeof(font_cache_header_t), font->path, header->path_length)) {
+        return 0;
+    }
+
+    glyphs = (const glyph_t*) ((const char*) mapping + sizeof(font_cache_header_t) + path_size);
+    for(i = 0; i < header->glyph_count; ++i) {
+        if (glyphs[i].code == BBUTIL_NO_GLYPH || glyphs[i].page < -1 || glyphs[i].page >= header->page_count) {
+            return 0;
+        }
+
+        //Texture rectangle must lie inside the page (negated comparisons reject NaNs too)
+        if (glyphs[i].page >= 0
+                && !(glyphs[i].tex_x1 >= 0.0f && glyphs[i].tex_x1 <= glyphs[i].tex_x2 && glyphs[i].tex_x2 <= 1.0f
+                     && glyphs[i].tex_y1 >= 0.0f && glyphs[i].tex_y1 <= glyphs[i].tex_y2 && glyphs[i].tex_y2 <= 1.0f)) {
+            return 0;
+        }
+    }
+
+    page = (const char*) (glyphs + header->glyph_count);
+    for(i = 0; i < header->page_count; ++i) {
+        nodes = *(const int*) (page + page_size * i);
+        if (nodes < 1 || nodes > header->page_size) {
+            return 0;
+        }
+
+        //Skyline nodes must cover the page width left to right without gaps or overlaps
+        skyline = (const skyline_node_t*) (page + page_size * i + sizeof(int));
+        right = 0;
+        for(j = 0; j < nodes; ++j) {
+            if (skyline[j].x != right || skyline[j].width <= 0 || skyline[j].width > header->page_size - right
+                    || skyline[j].y < 0 || skyline[j].y > header->page_size) {
+                return 0;
+            }
+            right += skyline[j].width;
+        }
+
+        if (right != header->page_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Fills the font from its cache file, so neither FreeType nor any rasterization is needed.
+ * The file is mapped into memory and atlas pages are uploaded straight from it.
+ * Returns EXIT_FAILURE only on errors, loaded is set to zero, when there is no valid cache file.
+ */
+static int bbutil_font_load_cache(font_t* font, const struct stat* font_stat, int* loaded)
+{
+    char cache_path[PATH_MAX];
+    struct stat cache_stat;
+    const font_cache_header_t* header;
+    const glyph_t* glyphs;
+    const char* data;
+    void* mapping;
+    int fd, i, capacity;
+
+    *loaded = 0;
+
+    if (!font_cache_dir[0] || EXIT_SUCCESS != bbutil_font_cache_path(font, cache_path)) {
+        return EXIT_SUCCESS;
+    }
+
+    fd = open(cache_path, O_RDONLY);
+    if (fd < 0) {
+        return EXIT_SUCCESS;
+    }
+
+    if (fstat(fd, &cache_stat) || cache_stat.st_size <= 0) {
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    mapping = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return EXIT_SUCCESS;
+    }
+
+    //Stale cache files are ignored and replaced, once the font is rasterized again
+    if (!bbutil_font_cache_valid(font, font_stat, mapping, cache_stat.st_size)) {
+        munmap(mapping, cache_stat.st_size);
+        return EXIT_SUCCESS;
+    }
+
+    header = (const font_cache_header_t*) mapping;
+    font->page_size = header->page_size;
+
+    //Keep the cache at most half full, as when the glyphs are added one by one
+    capacity = font->glyph_capacity;
+    while (2 * (header->glyph_count + 1) > capacity) {
+        capacity *= 2;
+    }
+
+    if (EXIT_SUCCESS != bbutil_font_rehash(font, capacity, -1)) {
+        munmap(mapping, cache_stat.st_size);
+        return EXIT_FAILURE;
+    }
+
+    glyphs = (const glyph_t*) ((const char*) mapping + sizeof(font_cache_header_t) + ((header->path_length + 3) & ~3));
+    for(i = 0; i < header->glyph_count; ++i) {
+        font->glyphs[bbutil_glyph_slot(font->glyphs, font->glyph_capacity, glyphs[i].code)] = glyphs[i];
+    }
+    font->glyph_count = header->glyph_count;
+
+    data = (const char*) (glyphs + header->glyph_count);
+    for(i = 0; i < header->page_count; ++i) {
+        if (EXIT_SUCCESS != bbutil_atlas_add_page(font, (const GLubyte*) data + sizeof(int) + sizeof(skyline_node_t) * font->page_size)) {
+            munmap(mapping, cache_stat.st_size);
+            return EXIT_FAILURE;
+        }
+
+        font->pages[i].skyline_nodes = *(const int*) data;
+        memcpy(font->pages[i].skyline, data + sizeof(int), sizeof(skyline_node_t) * font->page_size);
+        data += sizeof(int) + sizeof(skyline_node_t) * font->page_size + 2 * font->page_size * font->page_size;
+    }
+
+    munmap(mapping, cache_stat.st_size);
+
+    *loaded = 1;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Writes the glyphs and the atlas pages of the font into its cache file, if the font cache is enabled.
+ * The file is written under a temporary name first, so a concurrent or interrupted write can't leave a broken cache.
+ */
+static void bbutil_font_save_cache(font_t* font)
+{
+    static const char padding[4] = { 0, 0, 0, 0 };
+    char cache_path[PATH_MAX];
+    char temp_path[PATH_MAX + 4];
+    struct stat font_stat;
+    font_cache_header_t header;
+    atlas_page_t* page;
+    FILE* file;
+    int i, written;
+
+    if (!font_cache_dir[0] || EXIT_SUCCESS != bbutil_font_cache_path(font, cache_path) || stat(font->path, &font_stat)) {
+        return;
+    }
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+
+    file = fopen(temp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Unable to create font cache file %s\n", temp_path);
+        return;
+    }
+
+    memset(&header, 0, sizeof(font_cache_header_t));
+    header.magic = BBUTIL_FONT_CACHE_MAGIC;
+    header.version = BBUTIL_FONT_CACHE_VERSION;
+    header.file_size = font_stat.st_size;
+    header.file_time = font_stat.st_mtime;
+    header.point_size = (int)font->pt;
+    header.dpi = font->dpi;
+    header.sdf = font->sdf;
+    header.page_size = font->page_size;
+    header.page_count = font->page_count;
+    header.glyph_count = font->glyph_count;
+    header.path_length = strlen(font->path);
+
+    written = fwrite(&header, sizeof(font_cache_header_t), 1, file) == 1
+            && fwrite(font->path, 1, header.path_length, file) == header.path_length
+            && fwrite(padding, 1, ((header.path_length + 3) & ~3) - header.path_length, file) == ((header.path_length + 3) & ~3) - header.path_length;
+
+    for(i = 0; written && i < font->glyph_capacity; ++i) {
+        if (font->glyphs[i].code != BBUTIL_NO_GLYPH) {
+            written = fwrite(&font->glyphs[i], sizeof(glyph_t), 1, file) == 1;
+        }
+    }
+
+    for(i = 0; written && i < font->page_count; ++i) {
+        page = &font->pages[i];
+        written = fwrite(&page->skyline_nodes, sizeof(int), 1, file) == 1
+                && fwrite(page->skyline, sizeof(skyline_node_t), font->page_size, file) == font->page_size
+                && fwrite(page->pixels, 2 * font->page_size, font->page_size, file) == font->page_size;
+    }
+
+    if (fclose(file) || !written || rename(temp_path, cache_path)) {
+        fprintf(stderr, "Unable to write font cache file %s\n", cache_path);
+        unlink(temp_path);
+        return;
+    }
+
+    font->cache_dirty = 0;
+}
+
+static font_t* bbutil_create_font(const char* path, int point_size, int dpi, int sdf)
+{
+    struct stat font_stat;
+    GLint max_texture_size;
+    int c, i, loaded;
+    font_t* font;
+
+    if (!initialized) {
+        fprintf(stderr, "EGL has not been initialized\n");
+        return NULL;
+    }
+
+    if (!path){
+        fprintf(stderr, "Invalid path to font file\n");
+        return NULL;
+    }
+
+    //Size and modification time of the font file tell, whether its cache file is still valid
+    if (stat(path, &font_stat)) {
+        fprintf(stderr, "Error loading font %s\n", path);
+        return NULL;
+    }
+
+    font = (font_t*) calloc(1, sizeof(font_t));
+
+    if (!font) {
+        fprintf(stderr, "Unable to allocate memory for font structure\n");
+        return NULL;
+    }
+
+    font->path = strdup(path);
+    font->pt = point_size;
+    font->dpi = dpi;
+    font->sdf = sdf;
+
+    font->glyph_capacity = 256;
+    font->glyphs = (glyph_t*) malloc(sizeof(glyph_t) * font->glyph_capacity);
+
+    if (!font->path || !font->glyphs) {
+        fprintf(stderr, "Unable to allocate memory for font cache\n");
+        bbutil_destroy_font(font);
+        return NULL;
+    }
+
+    for(i = 0; i < font->glyph_capacity; ++i) {
+        font->glyphs[i].code = BBUTIL_NO_GLYPH;
+    }
+
+    if (EXIT_SUCCESS != bbutil_font_load_cache(font, &font_stat, &loaded)) {
+        bbutil_destroy_font(font);
+        return NULL;
+    }
+
+    //Glyphs from the cache file are ready, the face is opened later, if any other glyph is needed
+    if (loaded) {
+        font->initialized = 1;
+        return font;
+    }
+
+    //Face stays open, as glyphs are rasterized when they are used for the first time
+    if (EXIT_SUCCESS != bbutil_font_open_face(font)) {
+        bbutil_destroy_font(font);
+        return NULL;
+    }
+
+    //Let each page hold at least the printable ASCII characters
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    if (sdf) {
+        font->page_size = nextp2(BBUTIL_FONT_PAGE_LINES * ((font->face->size->metrics.height >> 6) / BBUTIL_SDF_UPSCALE + 2 * BBUTIL_SDF_SPREAD));
+    } else {
+        font->page_size = nextp2(BBUTIL_FONT_PAGE_LINES * (font->face->size->metrics.height >> 6));
+    }
+    if (font->page_size < 64) {
+        font->page_size = 64;
+    }
+    if (font->page_size > max_texture_size) {
+        font->page_size = max_texture_size;
+    }
+
+    //Printable ASCII characters are needed almost always, all the others are added on their first use
+    for(c = 32; c < 127; c++) {
+        if (!bbutil_font_glyph(font, c)) {
+            bbutil_destroy_font(font);
+            return NULL;
+        }
+    }
+
+    bbutil_font_upload(font);
+    bbutil_font_save_cache(font);
+
+    font->initialized = 1;
+    return font;
+}
+
+font_t* bbutil_load_font(const char* path, int point_size, int dpi)
+{
+    return bbutil_create_font(path, point_size, dpi, 0);
+}
+
+font_t* bbutil_load_sdf_font(const char* path, int point_size, int dpi)
+{
+    return bbutil_create_font(path, point_size, dpi, 1);
+}
+
+int bbutil_set_font_cache(const char* directory)
+{
+    if (!directory) {
+        font_cache_dir[0] = '\0';
+        return EXIT_SUCCESS;
+    }
+
+    if (strlen(directory) >= sizeof(font_cache_dir)) {
+        fprintf(stderr, "Invalid path to font cache directory\n");
+        return EXIT_FAILURE;
+    }
+
+    strcpy(font_cache_dir, directory);
+    return EXIT_SUCCESS;
+}
+
+#ifdef USING_GL20
+/**
+ * Compiles the shader program shared by bbutil_render_text() and the text batch.
+ * The color is a vertex attribute, so the batch can give each string its own one.
+ */
+static int bbutil_init_text_program()
+{
+    GLint status;
+
+    // Create shaders if this hasn't been done already
+    const char* v_source =
+            "precision mediump float;"
+            "attribute vec2 a_position;"
+            "attribute vec2 a_texcoord;"
+            "attribute vec4 a_color;"
+            "uniform vec4 u_transform;"
+            "varying vec2 v_texcoord;"
+            "varying vec4 v_color;"
+            "void main()"
+            "{"
+            "   gl_Position = vec4(a_position * u_transform.xy + u_transform.zw, 0.0, 1.0);"
+            "    v_texcoord = a_texcoord;"
+            "    v_color = a_color;"
+            "}";
+
+    const char* f_source =
+            "precision lowp float;"
+            "varying vec2 v_texcoord;"
+            "varying vec4 v_color;"
+            "uniform sampler2D u_font_texture;"
+            "uniform float u_smoothing;"
+            "void main()"
+            "{"
+            "    vec4 temp = texture2D(u_font_texture, v_texcoord);"
+            "    if (u_smoothing > 0.0) {"
+            "        temp.a = smoothstep(0.5 - u_smoothing, 0.5 + u_smoothing, temp.a);"
+            "    }"
+            "    gl_FragColor = v_color * temp.a;"
+            "}";
+
+    // Compile the vertex shader
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+
+    if (!vs) {
+        fprintf(stderr, "Failed to create vertex shader: %d\n", glGetError());
+        return EXIT_FAILURE;
+    } else {
+        glShaderSource(vs, 1, &v_source, 0);
+        glCompileShader(vs);
+        glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
+        if (GL_FALSE == status) {
+            GLchar log[256];
+            glGetShaderInfoLog(vs, 256, NULL, log);
+
+            fprintf(stderr, "Failed to compile vertex shader: %s\n", log);
+
+            glDeleteShader(vs);
+        }
+    }
+
+    // Compile the fragment shader
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+
+    if (!fs) {
+        fprintf(stderr, "Failed to create fragment shader: %d\n", glGetError());
+        return EXIT_FAILURE;
+    } else {
+        glShaderSource(fs, 1, &f_source, 0);
+        glCompileShader(fs);
+        glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
+        if (GL_FALSE == status) {
+            GLchar log[256];
+            glGetShaderInfoLog(fs, 256, NULL, log);
+
+            fprintf(stderr, "Failed to compile fragment shader: %s\n", log);
+
+            glDeleteShader(vs);
+            glDeleteShader(fs);
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Create and link the program
+    text_rendering_program = glCreateProgram();
+    if (text_rendering_program)
+    {
+        glAttachShader(text_rendering_program, vs);
+        glAttachShader(text_rendering_program, fs);
+        glLinkProgram(text_rendering_program);
+
+        glGetProgramiv(text_rendering_program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE)    {
+            GLchar log[256];
+            glGetProgramInfoLog(text_rendering_program, 256, NULL, log);
+
+            fprintf(stderr, "Failed to link text rendering shader program: %s\n", log);
+
+            glDeleteProgram(text_rendering_program);
+            text_rendering_program = 0;
+
+            return EXIT_FAILURE;
+        }
+    } else {
+        fprintf(stderr, "Failed to create a shader program\n");
+
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return EXIT_FAILURE;
+    }
+
+    // We don't need the shaders anymore - the program is enough
+    glDeleteShader(fs);
+    glDeleteShader(vs);
+
+    glUseProgram(text_rendering_program);
+
+    // Store the locations of the shader variables we need later
+    positionLoc = glGetAttribLocation(text_rendering_program, "a_position");
+    texcoordLoc = glGetAttribLocation(text_rendering_program, "a_texcoord");
+    textureLoc = glGetUniformLocation(text_rendering_program, "u_font_texture");
+    colorLoc = glGetAttribLocation(text_rendering_program, "a_color");
+    transformLoc = glGetUniformLocation(text_rendering_program, "u_transform");
+    smoothingLoc = glGetUniformLocation(text_rendering_program, "u_smoothing");
+
+    text_program_initialized = 1;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Maps text coordinates from (0...surface width, 0...surface height) to (-1...1, -1...1) inside the vertex shader,
+ * after moving them by (x, y) and scaling them, so the vertices never have to be touched on CPU.
+ * This also works irrespective of orientation changes.
+ */
+static void bbutil_set_text_transform(float x, float y, float scale)
+{
+    EGLint surface_width, surface_height;
+
+    eglQuerySurface(egl_disp, egl_surf, EGL_WIDTH, &surface_width);
+    eglQuerySurface(egl_disp, egl_surf, EGL_HEIGHT, &surface_height);
+
+    glUniform4f(transformLoc, 2.0f * scale / surface_width, 2.0f * scale / surface_height,
+                2.0f * x / surface_width - 1.0f, 2.0f * y / surface_height - 1.0f);
+}
+#endif
+
+
+/**
+ * Creates the index buffer shared by all the ways of text rendering, together with the vertex buffer used for streaming.
+ */
+static int bbutil_text_init_buffers()
+{
+    GLushort* indices;
+    int i;
+
+    if (text_index_buffer) {
+        return EXIT_SUCCESS;
+    }
+
+    indices = (GLushort*) malloc(sizeof(GLushort) * 6 * BBUTIL_TEXT_BATCH_QUADS);
+    if (!indices) {
+        fprintf(stderr, "Unable to allocate memory for text indices\n");
+        return EXIT_FAILURE;
+    }
+
+    //Indices of the quads never change, so they are uploaded only once
+    for(i = 0; i < BBUTIL_TEXT_BATCH_QUADS; ++i) {
+        indices[i * 6 + 0] = 4 * i + 0;
+        indices[i * 6 + 1] = 4 * i + 1;
+        indices[i * 6 + 2] = 4 * i + 2;
+        indices[i * 6 + 3] = 4 * i + 2;
+        indices[i * 6 + 4] = 4 * i + 1;
+        indices[i * 6 + 5] = 4 * i + 3;
+    }
+
+    glGenBuffers(1, &text_index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, text_index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * 6 * BBUTIL_TEXT_BATCH_QUADS, indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &text_vertex_buffer);
 
-    free(vertices);
-    free(texture_coords);
     free(indices);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Sets up the state for drawing of text quads from the currently bound vertex buffer.
+ * Text is moved by (x, y) and scaled, if transformed is set, otherwise it's drawn at the coordinates of the quads.
+ * Quads either have their own color or all of them are drawn by the passed one.
+ */
+static int bbutil_text_begin_draw(int transformed, float x, float y, float scale, int color_array, float r, float g, float b, float a)
+{
+#ifdef USING_GL20
+    if (!text_program_initialized && EXIT_SUCCESS != bbutil_init_text_program()) {
+        return EXIT_FAILURE;
+    }
+#endif
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, text_index_buffer);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+#ifdef USING_GL11
+    if (transformed) {
+        glPushMatrix();
+        glTranslatef(x, y, 0.0f);
+        glScalef(scale, scale, 1.0f);
+    }
+
+    glEnable(GL_TEXTURE_2D);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    glVertexPointer(2, GL_FLOAT, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, x));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, s));
+
+    if (color_array) {
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, color));
+    } else {
+        glColor4f(r, g, b, a);
+    }
+#elif defined USING_GL20
+    glUseProgram(text_rendering_program);
+
+    if (transformed) {
+        bbutil_set_text_transform(x, y, scale);
+    } else {
+        bbutil_set_text_transform(0.0f, 0.0f, 1.0f);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(textureLoc, 0);
+
+    glEnableVertexAttribArray(positionLoc);
+    glVertexAttribPointer(positionLoc, 2, GL_FLOAT, GL_FALSE, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, x));
+
+    glEnableVertexAttribArray(texcoordLoc);
+    glVertexAttribPointer(texcoordLoc, 2, GL_FLOAT, GL_FALSE, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, s));
+
+    if (color_array) {
+        glEnableVertexAttribArray(colorLoc);
+        glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(text_vertex_t), (const GLvoid*) offsetof(text_vertex_t, color));
+    } else {
+        //Without the color array, the same color is used for all the vertices
+        glDisableVertexAttribArray(colorLoc);
+        glVertexAttrib4f(colorLoc, r, g, b, a);
+    }
+#else
+    fprintf(stderr, "bbutil should be compiled with either USING_GL11 or USING_GL20 -D flags\n");
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+static void bbutil_text_end_draw(int transformed, int color_array)
+{
+#ifdef USING_GL11
+    if (color_array) {
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        //Current color is undefined after drawing with the color array
+        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
+    glDisable(GL_ALPHA_TEST);
+
+    if (transformed) {
+        glPopMatrix();
+    }
+#elif defined USING_GL20
+    glDisableVertexAttribArray(positionLoc);
+    glDisableVertexAttribArray(texcoordLoc);
+    if (color_array) {
+        glDisableVertexAttribArray(colorLoc);
+    }
+#endif
+
+    //Leave client-side arrays of the application working
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/**
+ * Draws the quads of the currently bound vertex buffer starting at the first one with the texture of the atlas page.
+ * Scale is the size of font pixels on the screen, it's needed to keep edges of distance field fonts sharp.
+ */
+static void bbutil_text_draw_quads(font_t* font, int page, int first, int quads, float scale)
+{
+#ifdef USING_GL11
+    //Distance fields can't be blended without shaders, but alpha testing keeps their edges sharp at any scale
+    if (font->sdf) {
+        glDisable(GL_BLEND);
+        glEnable(GL_ALPHA_TEST);
+        glAlphaFunc(GL_GEQUAL, 0.5f);
+    } else {
+        glEnable(GL_BLEND);
+        glDisable(GL_ALPHA_TEST);
+    }
+#elif defined USING_GL20
+    //Edges of distance fields are smoothed over a single pixel of the screen
+    glUniform1f(smoothingLoc, font->sdf ? 0.25f / (BBUTIL_SDF_SPREAD * scale) : 0.0f);
+#endif
+
+    glBindTexture(GL_TEXTURE_2D, font->pages[page].texture);
+    glDrawElements(GL_TRIANGLES, 6 * quads, GL_UNSIGNED_SHORT, (const GLvoid*) (sizeof(GLushort) * 6 * first));
+}
+
+/**
+ * Fills position and texture coordinates of the 4 vertices of a scaled glyph quad, which origin is at (x, y).
+ */
+static void bbutil_text_glyph_quad(const glyph_t* glyph, float x, float y, float scale, text_vertex_t* v)
+{
+    float x1 = x + scale * glyph->offset_x;
+    float y1 = y + scale * glyph->offset_y;
+    float x2 = x1 + scale * glyph->width;
+    float y2 = y1 + scale * glyph->height;
+
+    v[0].x = x1;
+    v[0].y = y1;
+    v[0].s = glyph->tex_x1;
+    v[0].t = glyph->tex_y2;
+
+    v[1].x = x2;
+    v[1].y = y1;
+    v[1].s = glyph->tex_x2;
+    v[1].t = glyph->tex_y2;
+
+    v[2].x = x1;
+    v[2].y = y2;
+    v[2].s = glyph->tex_x1;
+    v[2].t = glyph->tex_y1;
+
+    v[3].x = x2;
+    v[3].y = y2;
+    v[3].s = glyph->tex_x2;
+    v[3].t = glyph->tex_y1;
+}
+
+/**
+ * Lays the scaled UTF-8 message out into the glyph quads of text_scratch, rasterizing the glyphs missing in the font cache.
+ * Returns the number of quads; the atlas page of each of them is in text_scratch_pages.
+ */
+static int bbutil_text_quads(font_t* font, const char* msg, float x, float y, float scale)
+{
+    const glyph_t* glyph;
+    float pen_x = x;
+    int quads = 0, missing = 0;
+    int max_quads = strlen(msg);
+
+    if (max_quads > BBUTIL_TEXT_BATCH_QUADS) {
+        fprintf(stderr, "Text is limited to %d glyphs\n", BBUTIL_TEXT_BATCH_QUADS);
+        max_quads = BBUTIL_TEXT_BATCH_QUADS;
+    }
+
+    //There is never more glyphs than bytes of the message
+    if (max_quads > text_scratch_capacity) {
+        text_vertex_t* scratch = (text_vertex_t*) realloc(text_scratch, sizeof(text_vertex_t) * 4 * max_quads);
+        text_vertex_t* sorted = scratch ? (text_vertex_t*) realloc(text_sorted, sizeof(text_vertex_t) * 4 * max_quads) : NULL;
+        int* pages = sorted ? (int*) realloc(text_scratch_pages, sizeof(int) * max_quads) : NULL;
+
+        if (scratch) {
+            text_scratch = scratch;
+        }
+        if (sorted) {
+            text_sorted = sorted;
+        }
+        if (!pages) {
+            fprintf(stderr, "Unable to allocate memory for text\n");
+            return 0;
+        }
+
+        text_scratch_pages = pages;
+        text_scratch_capacity = max_quads;
+    }
+
+    //Glyphs of the current string are never evicted to make room for each other
+    font->clock++;
+
+    while (*msg && quads < max_quads) {
+        glyph = bbutil_font_glyph(font, bbutil_utf8_next(&msg));
+
+        if (!glyph) {
+            missing++;
+            continue;
+        }
+
+        //Blank glyphs (i.e. spaces) only move the pen
+        if (glyph->page >= 0) {
+            bbutil_text_glyph_quad(glyph, pen_x, y, scale, text_scratch + 4 * quads);
+            text_scratch_pages[quads] = glyph->page;
+            quads++;
+        }
+
+        pen_x += scale * glyph->advance;
+    }
+
+    if (missing) {
+        fprintf(stderr, "Unable to render %d glyphs, font texture is too small for the text\n", missing);
+    }
+
+    bbutil_font_upload(font);
+    return quads;
+}
+
+/**
+ * Copies the quads of text_scratch into text_sorted grouped by their atlas pages,
+ * so quads of each page can be drawn by single call.
+ */
+static void bbutil_text_sort_quads(int quads, int* page_first, int* page_quads)
+{
+    int i, next[BBUTIL_FONT_PAGES];
+
+    memset(page_quads, 0, sizeof(int) * BBUTIL_FONT_PAGES);
+
+    for(i = 0; i < quads; ++i) {
+        page_quads[text_scratch_pages[i]]++;
+    }
+
+    for(i = 0; i < BBUTIL_FONT_PAGES; ++i) {
+        page_first[i] = i ? page_first[i - 1] + page_quads[i - 1] : 0;
+        next[i] = page_first[i];
+    }
+
+    for(i = 0; i < quads; ++i) {
+        memcpy(text_sorted + 4 * next[text_scratch_pages[i]]++, text_scratch + 4 * i, sizeof(text_vertex_t) * 4);
+    }
+}
+
+void bbutil_render_text(font_t* font, const char* msg, float x, float y, float r, float g, float b, float a)
+{
+    bbutil_render_text_scaled(font, msg, x, y, 1.0f, r, g, b, a);
+}
+
+void bbutil_render_text_scaled(font_t* font, const char* msg, float x, float y, float scale, float r, float g, float b, float a)
+{
+    int i, quads;
+    int page_first[BBUTIL_FONT_PAGES], page_quads[BBUTIL_FONT_PAGES];
+
+    if (!font) {
+        fprintf(stderr, "Font must not be null\n");
+        return;
+    }
+
+    if (!font->initialized) {
+        fprintf(stderr, "Font has not been loaded\n");
+        return;
+    }
+
+    if (!msg) {
+        return;
+    }
+
+    if (EXIT_SUCCESS != bbutil_text_init_buffers()) {
+        return;
+    }
+
+    quads = bbutil_text_quads(font, msg, x, y, scale);
+    if (!quads) {
+        return;
+    }
+
+    bbutil_text_sort_quads(quads, page_first, page_quads);
+
+    //Specifying the store again orphans the one still used by the previous draw, so the driver doesn't wait for it
+    glBindBuffer(GL_ARRAY_BUFFER, text_vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(text_vertex_t) * 4 * quads, NULL, BBUTIL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(text_vertex_t) * 4 * quads, text_sorted);
+
+    if (EXIT_SUCCESS != bbutil_text_begin_draw(0, 0.0f, 0.0f, 1.0f, 0, r, g, b, a)) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    for(i = 0; i < font->page_count; ++i) {
+        if (page_quads[i]) {
+            bbutil_text_draw_quads(font, i, page_first[i], page_quads[i], scale);
+        }
+    }
+
+    bbutil_text_end_draw(0, 0);
+}
+
+static void bbutil_text_batch_release()
+{
+    int i;
+
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        free(text_runs[i].vertices);
+        memset(&text_runs[i], 0, sizeof(text_run_t));
+    }
+
+    free(text_scratch);
+    free(text_sorted);
+    free(text_scratch_pages);
+    text_scratch = NULL;
+    text_sorted = NULL;
+    text_scratch_pages = NULL;
+    text_scratch_capacity = 0;
+
+    //Buffers exist only, if there was a context to create them in
+    if (text_vertex_buffer) {
+        glDeleteBuffers(1, &text_vertex_buffer);
+        text_vertex_buffer = 0;
+    }
+    if (text_index_buffer) {
+        glDeleteBuffers(1, &text_index_buffer);
+        text_index_buffer = 0;
+    }
+
+    text_batch_started = 0;
+}
+
+/**
+ * Draws all the collected quads, single draw call per atlas page of each font, and empties the runs.
+ */
+static void bbutil_text_batch_flush()
+{
+    int i, pending = 0;
+
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        pending += text_runs[i].quads;
+    }
+
+    if (!pending) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, text_vertex_buffer);
+
+    if (EXIT_SUCCESS != bbutil_text_begin_draw(0, 0.0f, 0.0f, 1.0f, 1, 1.0f, 1.0f, 1.0f, 1.0f)) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        text_run_t* run = &text_runs[i];
+        GLsizeiptr size = sizeof(text_vertex_t) * 4 * run->quads;
+
+        if (!run->quads) {
+            continue;
+        }
+
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, BBUTIL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, run->vertices);
+
+        bbutil_text_draw_quads(run->font, run->page, 0, run->quads, run->scale);
+
+        run->quads = 0;
+    }
+
+    bbutil_text_end_draw(0, 1);
+}
+
+/**
+ * Finds the run collecting quads of given atlas page of the font at the scale or takes a free one.
+ */
+static text_run_t* bbutil_text_batch_find_run(font_t* font, int page, float scale)
+{
+    int i, free_run = -1;
+
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        if (text_runs[i].font == font && text_runs[i].page == page && text_runs[i].scale == scale) {
+            return &text_runs[i];
+        }
+
+        if (free_run < 0 && (!text_runs[i].font || !text_runs[i].quads)) {
+            free_run = i;
+        }
+    }
+
+    if (free_run < 0) {
+        //All the runs are taken by other fonts, so draw them to make room
+        bbutil_text_batch_flush();
+        free_run = 0;
+    }
+
+    text_runs[free_run].font = font;
+    text_runs[free_run].page = page;
+    text_runs[free_run].scale = scale;
+    return &text_runs[free_run];
+}
+
+static int bbutil_text_batch_grow(text_run_t* run)
+{
+    int capacity = run->capacity ? 2 * run->capacity : 64;
+    text_vertex_t* vertices;
+
+    if (capacity > BBUTIL_TEXT_BATCH_QUADS) {
+        capacity = BBUTIL_TEXT_BATCH_QUADS;
+    }
+
+    vertices = (text_vertex_t*) realloc(run->vertices, sizeof(text_vertex_t) * 4 * capacity);
+    if (!vertices) {
+        fprintf(stderr, "Unable to allocate memory for text batch\n");
+        return EXIT_FAILURE;
+    }
+
+    run->vertices = vertices;
+    run->capacity = capacity;
+    return EXIT_SUCCESS;
+}
+
+static GLubyte bbutil_color_component(float value)
+{
+    if (value <= 0.0f) {
+        return 0;
+    }
+    if (value >= 1.0f) {
+        return 255;
+    }
+    return (GLubyte) (value * 255.0f + 0.5f);
+}
+
+void bbutil_text_batch_begin()
+{
+    int i;
+
+    if (!initialized) {
+        fprintf(stderr, "EGL has not been initialized\n");
+        return;
+    }
+
+#ifdef USING_GL20
+    if (!text_program_initialized && EXIT_SUCCESS != bbutil_init_text_program()) {
+        return;
+    }
+#endif
+
+    if (EXIT_SUCCESS != bbutil_text_init_buffers()) {
+        return;
+    }
+
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        text_runs[i].quads = 0;
+    }
+
+    text_batch_started = 1;
+}
+
+void bbutil_text_batch_add(font_t* font, const char* msg, float x, float y, float r, float g, float b, float a)
+{
+    bbutil_text_batch_add_scaled(font, msg, x, y, 1.0f, r, g, b, a);
+}
+
+void bbutil_text_batch_add_scaled(font_t* font, const char* msg, float x, float y, float scale, float r, float g, float b, float a)
+{
+    text_run_t* run = NULL;
+    text_vertex_t* v;
+    GLubyte color[4];
+    int i, quads;
+
+    if (!text_batch_started) {
+        fprintf(stderr, "Text batch has not been started\n");
+        return;
+    }
+
+    if (!font) {
+        fprintf(stderr, "Font must not be null\n");
+        return;
+    }
+
+    if (!font->initialized) {
+        fprintf(stderr, "Font has not been loaded\n");
+        return;
+    }
+
+    if (!msg) {
+        return;
+    }
+
+    color[0] = bbutil_color_component(r);
+    color[1] = bbutil_color_component(g);
+    color[2] = bbutil_color_component(b);
+    color[3] = bbutil_color_component(a);
+
+    quads = bbutil_text_quads(font, msg, x, y, scale);
+
+    for(i = 0; i < quads; ++i) {
+        if (!run || run->page != text_scratch_pages[i] || run->font != font || run->scale != scale) {
+            run = bbutil_text_batch_find_run(font, text_scratch_pages[i], scale);
+        }
+
+        if (run->quads == BBUTIL_TEXT_BATCH_QUADS) {
+            bbutil_text_batch_flush();
+        }
+
+        if (run->quads == run->capacity && EXIT_SUCCESS != bbutil_text_batch_grow(run)) {
+            return;
+        }
+
+        v = run->vertices + 4 * run->quads;
+        memcpy(v, text_scratch + 4 * i, sizeof(text_vertex_t) * 4);
+
+        memcpy(v[0].color, color, sizeof(color));
+        memcpy(v[1].color, color, sizeof(color));
+        memcpy(v[2].color, color, sizeof(color));
+        memcpy(v[3].color, color, sizeof(color));
+
+        run->quads++;
+    }
+}
+
+void bbutil_text_batch_end()
+{
+    if (!text_batch_started) {
+        return;
+    }
+
+    bbutil_text_batch_flush();
+    text_batch_started = 0;
+}
+
+text_layout_t* bbutil_create_text_layout(font_t* font, const char* msg)
+{
+    text_layout_t* layout = (text_layout_t*) calloc(1, sizeof(text_layout_t));
+
+    if (!layout) {
+        fprintf(stderr, "Unable to allocate memory for text layout\n");
+        return NULL;
+    }
+
+    if (EXIT_SUCCESS != bbutil_update_text_layout(layout, font, msg)) {
+        bbutil_destroy_text_layout(layout);
+        return NULL;
+    }
+
+    return layout;
+}
+
+int bbutil_update_text_layout(text_layout_t* layout, font_t* font, const char* msg)
+{
+    char* text;
+
+    if (!layout) {
+        fprintf(stderr, "Text layout must not be null\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!font) {
+        fprintf(stderr, "Font must not be null\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!font->initialized) {
+        fprintf(stderr, "Font has not been loaded\n");
+        return EXIT_FAILURE;
+    }
+
+    if (EXIT_SUCCESS != bbutil_text_init_buffers()) {
+        return EXIT_FAILURE;
+    }
+
+    //Keep the message, as the layout has to be built again, when the font evicts any of its glyphs
+    if (msg != layout->text) {
+        text = strdup(msg ? msg : "");
+        if (!text) {
+            fprintf(stderr, "Unable to allocate memory for text layout\n");
+            return EXIT_FAILURE;
+        }
+
+        free(layout->text);
+        layout->text = text;
+    }
+
+    //Glyphs are laid out relative to the origin, position is given when the layout is rendered
+    layout->font = font;
+    layout->quads = bbutil_text_quads(font, layout->text, 0.0f, 0.0f, 1.0f);
+    layout->generation = font->generation;
+
+    if (!layout->quads) {
+        return EXIT_SUCCESS;
+    }
+
+    bbutil_text_sort_quads(layout->quads, layout->page_first, layout->page_quads);
+
+    if (!layout->vertex_buffer) {
+        glGenBuffers(1, &layout->vertex_buffer);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, layout->vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(text_vertex_t) * 4 * layout->quads, text_sorted, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return EXIT_SUCCESS;
+}
+
+void bbutil_render_text_layout(text_layout_t* layout, float x, float y, float scale, float r, float g, float b, float a)
+{
+    int i;
+
+    if (!layout) {
+        fprintf(stderr, "Text layout must not be null\n");
+        return;
+    }
+
+    if (layout->font->generation != layout->generation
+            && EXIT_SUCCESS != bbutil_update_text_layout(layout, layout->font, layout->text)) {
+        return;
+    }
+
+    if (!layout->quads) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, layout->vertex_buffer);
+
+    if (EXIT_SUCCESS != bbutil_text_begin_draw(1, x, y, scale, 0, r, g, b, a)) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    for(i = 0; i < layout->font->page_count; ++i) {
+        if (layout->page_quads[i]) {
+            bbutil_text_draw_quads(layout->font, i, layout->page_first[i], layout->page_quads[i], scale);
+        }
+    }
+
+    bbutil_text_end_draw(1, 0);
+}
+
+void bbutil_destroy_text_layout(text_layout_t* layout)
+{
+    if (!layout) {
+        return;
+    }
+
+    if (layout->vertex_buffer) {
+        glDeleteBuffers(1, &layout->vertex_buffer);
+    }
+
+    free(layout->text);
+    free(layout);
 }
 
 void bbutil_destroy_font(font_t* font)
 {
+    int i;
+
     if (!font)
     {
         return;
     }
 
-    glDeleteTextures(1, &(font->font_texture));
+    //Glyphs added while the font was used are stored for the next start of the application
+    if (font->initialized && font->cache_dirty) {
+        bbutil_font_save_cache(font);
+    }
+
+    //Glyphs of the font still waiting in the text batch can't be drawn anymore
+    for(i = 0; i < BBUTIL_TEXT_BATCH_RUNS; ++i) {
+        if (text_runs[i].font == font) {
+            text_runs[i].font = NULL;
+            text_runs[i].quads = 0;
+        }
+    }
+
+    for(i = 0; i < font->page_count; ++i) {
+        glDeleteTextures(1, &(font->pages[i].texture));
+        free(font->pages[i].pixels);
+        free(font->pages[i].skyline);
+    }
+
+    free(font->glyphs);
+    free(font->path);
+
+    if (font->face) {
+        FT_Done_Face(font->face);
+    }
+    if (font->library) {
+        FT_Done_FreeType(font->library);
+    }
 
     free(font);
 }
 
 void bbutil_measure_text(font_t* font, const char* msg, float* width, float* height)
 {
-    int i, c;
+    const glyph_t* glyph;
+
+    if (width)
+    {
+        *width = 0.0f;
+    }
+
+    if (height)
+    {
+        *height = 0.0f;
+    }
 
-    if (!msg)
+    if (!font || !msg)
     {
         return;
     }
 
-    const int msg_len  =strlen(msg);
+    font->clock++;
 
-    if (width)
+    while (*msg)
     {
-        //Width of a text rectangle is a sum advances for every glyph in a string
-        *width = 0.0f;
+        glyph = bbutil_font_glyph(font, bbutil_utf8_next(&msg));
 
-        for(i = 0; i < msg_len; ++i)
+        if (!glyph)
         {
-            c = msg[i];
-            *width += font->advance[c];
+            continue;
         }
-    }
 
-    if (height)
-    {
-        //Height of a text rectangle is a high of a tallest glyph in a string
-        *height = 0.0f;
-
-        for(i = 0; i < msg_len; ++i)
+        //Width of a text rectangle is a sum advances for every glyph in a string
+        if (width)
         {
-            c = msg[i];
+            *width += glyph->advance;
+        }
 
-            if (*height < font->height[c])
-            {
-                *height = font->height[c];
-            }
+        //Height of a text rectangle is a high of a tallest glyph in a string, without the border of distance fields
+        if (height && *height < glyph->height - (font->sdf ? 2 * BBUTIL_SDF_SPREAD : 0))
+        {
+            *height = glyph->height - (font->sdf ? 2 * BBUTIL_SDF_SPREAD : 0);
         }
     }
 }